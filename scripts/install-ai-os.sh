@@ -28,6 +28,10 @@ sudo touch /var/log/ai-os/ai-shell.log
 sudo chown $(logname):$(logname) /var/log/ai-os/ai-shell.log
 sudo chmod 664 /var/log/ai-os/ai-shell.log
 
+# Members of the ai-os group may read the daemon's shared answer cache
+sudo groupadd -f ai-os
+sudo usermod -aG ai-os $(logname)
+
 # Detect Linux distribution and version
 DISTRO_ID=$(grep '^ID=' /etc/os-release | cut -d= -f2 | tr -d '"')
 DISTRO_VERSION=$(grep '^VERSION_ID=' /etc/os-release | cut -d= -f2 | tr -d '"')
@@ -95,6 +99,7 @@ install_dependencies() {
             libdbus-1-dev \
             libjson-c-dev \
             libcurl4-openssl-dev \
+            bash-builtins \
             cmake \
             git \
             wget \
@@ -233,6 +238,9 @@ install_components() {
     # Install shell integration
     make install-shell-integration || { error "Failed to install shell integration"; exit 1; }
     
+    # Install bash builtin (optional, shell integration falls back to ai-client)
+    make install-builtin || warn "Bash builtin not installed, using ai-client co-process"
+    
     log "Components installed successfully"
 }
 
@@ -0,0 +1,82 @@
+/*
+ * AI-OS Shared Read-Only Cache
+ * File: userspace/ai_os_cache.h
+ *
+ * Layout of the file the daemon maps at AI_OS_CACHE_PATH and republishes
+ * answers into (daemon/shared_cache.c). Clients map it read-only and look
+ * there before opening the socket (client/ai_client.c).
+ *
+ * Every record carries its own sequence counter: the daemon makes it odd
+ * before touching the record and even again afterwards, so a reader that
+ * sees the same even value before and after copying knows the copy is
+ * whole. Readers never write to the file and never block the daemon.
+ *
+ * Interpret keys are the requests as users typed them, so the file is not
+ * world-readable: it is mode 0640 and group AI_OS_CACHE_GROUP, or 0600
+ * (root only) when that group does not exist. Members of the group see
+ * one another's recent requests; everyone else is answered over the
+ * socket as if there were no cache.
+ */
+
+#ifndef AI_OS_CACHE_H
+#define AI_OS_CACHE_H
+
+#include <time.h>
+#include <sys/types.h>
+
+#define AI_OS_CACHE_PATH "/var/run/ai-os.cache"
+#define AI_OS_CACHE_GROUP "ai-os"
+#define AI_OS_CACHE_MAGIC 0x434f4941u     /* "AIOC" */
+#define AI_OS_CACHE_VERSION 1
+
+#define AI_OS_CACHE_ENTRIES 512           /* power of two */
+#define AI_OS_CACHE_PROBE 4               /* slots searched per key */
+#define AI_OS_CACHE_KEY_SIZE 256
+#define AI_OS_CACHE_VALUE_SIZE 1024
+#define AI_OS_CACHE_STATUS_SIZE 2048
+
+#define AI_OS_CACHE_STATUS_TTL 5          /* seconds; refreshed every 2 */
+#define AI_OS_CACHE_ENTRY_TTL 300
+
+/* What an entry answers */
+enum {
+    AI_OS_CACHE_EMPTY = 0,
+    AI_OS_CACHE_INTERPRET,                /* value: shell command */
+    AI_OS_CACHE_CLASSIFY                  /* value: "command" or "chat" */
+};
+
+typedef struct {
+    unsigned int seq;                     /* odd while being rewritten */
+    unsigned int kind;
+    unsigned int hash;
+    int result_code;                      /* as returned by interpret */
+    time_t expires;
+    char key[AI_OS_CACHE_KEY_SIZE];
+    char value[AI_OS_CACHE_VALUE_SIZE];
+} ai_os_cache_entry_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int entry_count;
+    unsigned int entry_size;              /* catches layout mismatches */
+    pid_t daemon_pid;
+    unsigned int status_seq;
+    time_t status_updated;                /* 0 once the daemon has exited */
+    char status[AI_OS_CACHE_STATUS_SIZE]; /* reply to the status action */
+    ai_os_cache_entry_t entries[AI_OS_CACHE_ENTRIES];
+} ai_os_cache_t;
+
+/* FNV-1a over the kind and key; both sides must agree on slot placement */
+static inline unsigned int ai_os_cache_hash(unsigned int kind, const char *key) {
+    unsigned int h = 2166136261u ^ kind;
+
+    h *= 16777619u;
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+
+#endif /* AI_OS_CACHE_H */
@@ -3,6 +3,15 @@
 
 #include <time.h>
 #include <sys/types.h>
+#include <linux/netlink.h>
+
+/* Hot-path helpers that are file-local in the daemon; objects built with
+ * -DAI_OS_BENCH (`make bench`) export them to userspace/bench/microbench.c */
+#ifdef AI_OS_BENCH
+#define AI_OS_BENCH_VISIBLE
+#else
+#define AI_OS_BENCH_VISIBLE static
+#endif
 
 /* Process context structure */
 typedef struct {
@@ -61,6 +70,19 @@ typedef struct {
     char error_message[256];
 } ai_os_response_t;
 
+/* Kernel bridge wire protocol (netlink, or socketpair under the emulator) */
+#define NETLINK_AI_OS 31
+#define AI_OS_MSG_INTERPRET 1
+#define AI_OS_MSG_RESPONSE 2
+
+struct ai_netlink_msg {
+    struct nlmsghdr nlh;
+    int msg_type;
+    int request_id;
+    pid_t pid;
+    char data[1024];
+};
+
 typedef struct {
     int socket_fd;
     pid_t client_pid;
@@ -69,6 +91,7 @@ typedef struct {
     ai_context_t context;
     int active;
     time_t last_activity;
+    unsigned long session_id;
 } ai_client_t;
 
 /* Function declarations */
@@ -79,10 +102,58 @@ int ai_execute_command(const char *command, char *output, size_t output_size);
 int ai_get_status(char *status_info, size_t info_size);
 int ai_set_model(const char *model_name);
 int ai_get_context(char *context_info, size_t info_size);
+int ai_speculate_command(const char *natural_command);
+int ai_get_metrics(char *metrics_text, size_t text_size);
+int ai_trace_export(const char *format, char *path, size_t path_size);
+void ai_client_set_trace(int enabled);
+int ai_client_last_trace_id(char *trace_id, size_t size);
+
+/* Trace ids are 32 lowercase hex digits (16 random bytes) */
+#define AI_OS_TRACE_ID_LEN 32
+
+/* Reentrant client API: one daemon connection per handle (ai_client.c) */
+typedef struct ai_handle ai_handle_t;
+typedef void (*ai_completion_cb)(ai_handle_t *handle, int error, const char *response, void *user_data);
+
+ai_handle_t *ai_handle_open(const char *socket_path);
+void ai_handle_close(ai_handle_t *handle);
+int ai_handle_connect(ai_handle_t *handle);
+void ai_handle_disconnect(ai_handle_t *handle);
+int ai_handle_submit(ai_handle_t *handle, const char *action, const char *text, int timeout_ms,
+                     ai_completion_cb cb, void *user_data);
+int ai_handle_call(ai_handle_t *handle, const char *action, const char *text,
+                   char *response, size_t response_size, int timeout_ms);
+int ai_handle_interpret(ai_handle_t *handle, const char *natural_command,
+                        char *shell_command, size_t command_size, int timeout_ms);
+int ai_handle_fd(ai_handle_t *handle);
+short ai_handle_events(ai_handle_t *handle);
+int ai_handle_timeout(ai_handle_t *handle);
+int ai_handle_process(ai_handle_t *handle);
+void ai_handle_set_trace(ai_handle_t *handle, int enabled);
+void ai_handle_set_batch(ai_handle_t *handle, int enabled);
+int ai_handle_last_trace_id(ai_handle_t *handle, char *trace_id, size_t size);
+
+/* Ollama's own accounting of one generate call, from its reply */
+struct ollama_timings {
+    long long total_ns;             /* total_duration */
+    long long load_ns;              /* load_duration: loading the model */
+    long long prompt_eval_count;    /* prompt tokens evaluated */
+    long long prompt_eval_ns;
+    long long eval_count;           /* tokens generated */
+    long long eval_ns;
+};
 
 int ollama_client_init(const char *model_name, const char *api_url);
 int ollama_interpret_command(const char *natural_command, const char *context, 
                             char *shell_command, size_t command_size);
+int ollama_interpret_preemptible(const char *natural_command, const char *context,
+                                 char *shell_command, size_t command_size,
+                                 int (*cancelled)(void *arg), void *arg);
+int ollama_chat_preemptible(const char *message, const char *context, char *reply, size_t reply_size,
+                            int (*cancelled)(void *arg), void *arg);
+int ollama_interpret_speculative(const char *natural_command, const char *context,
+                                 char *shell_command, size_t command_size,
+                                 int (*cancelled)(void *arg), void *arg);
 int ollama_check_status(void);
 int ollama_list_models(char *models_list, size_t list_size);
 int ollama_set_model(const char *model_name);
@@ -96,9 +167,250 @@ int ai_context_add_command(ai_context_t *ctx, const char *command);
 int ai_context_needs_refresh(ai_context_t *ctx);
 void ai_context_free(ai_context_t *ctx);
 
+int speculation_init(void);
+void speculation_cleanup(void);
+int speculation_submit(uid_t uid, const char *session, const char *command, const char *context);
+int speculation_take(const char *session, const char *command, const char *context,
+                     char *out, size_t out_size, int *code);
+void speculation_end_session(const char *session);
+
+int shared_cache_init(int (*status_fn)(char *buf, size_t size));
+void shared_cache_cleanup(void);
+void shared_cache_publish_status(const char *status_json);
+void shared_cache_refresh_status(void);
+void shared_cache_put(unsigned int kind, const char *key, const char *value, int result_code);
+void shared_cache_invalidate(unsigned int kind);
+
+/* Per-request arena (arena.c): a request's scratch memory, bump-allocated
+ * per thread and dropped at once by arena_reset() */
+struct arena_stats {
+    unsigned long allocs;           /* arena_alloc calls */
+    unsigned long long bytes;       /* bytes asked for */
+    unsigned long heap_allocs;      /* spilled past the block: one malloc and one free each */
+    unsigned long long heap_bytes;
+};
+
+void *arena_alloc(size_t size);
+void *arena_resize(void *ptr, size_t old_size, size_t new_size);
+void arena_reset(struct arena_stats *stats);
+
+/* Request stages timed by metrics.c */
+enum metrics_stage {
+    METRICS_STAGE_CONTEXT,      /* refreshing the client's context */
+    METRICS_STAGE_SPECULATION,  /* taking (or waiting on) a speculation */
+    METRICS_STAGE_QUEUE,        /* waiting for the user's turn at the backend */
+    METRICS_STAGE_PROMPT,       /* building the Ollama request */
+    METRICS_STAGE_MUTEX_WAIT,   /* waiting for the shared CURL handle */
+    METRICS_STAGE_HTTP,         /* the HTTP exchange, retries included */
+    METRICS_STAGE_PARSE,        /* decoding Ollama's reply */
+    METRICS_STAGE_EXECUTE,      /* running the command */
+    METRICS_STAGE_SERIALIZE,    /* building the reply JSON */
+    METRICS_STAGES
+};
+
+int metrics_init(const char *socket_path);
+void metrics_cleanup(void);
+long long metrics_now_ns(void);
+void metrics_observe_stage(enum metrics_stage stage, long long elapsed_ns);
+void metrics_observe_deadline(int stage);
+const char *metrics_stage_name(int stage);
+void metrics_observe_request(const char *action, const char *status, long long elapsed_ns);
+void metrics_observe_backend(const char *model, int result, long long elapsed_ns);
+void metrics_observe_ollama(const char *model, const struct ollama_timings *timings);
+void metrics_observe_memory(const struct arena_stats *stats);
+void metrics_observe_output(int outcome);
+void metrics_observe_admission(int lane, int result);
+void metrics_observe_preemption(int lane);
+void metrics_request_started(void);
+void metrics_request_finished(void);
+long long metrics_in_flight(void);
+int metrics_render(char *buf, size_t size);
+
+/* Request tracing (trace.c): spans of requests carrying a "trace_id" */
+#define AI_OS_TRACE_DIR "/var/log/ai-os/traces"
+
+int trace_valid_id(const char *trace_id);
+int trace_begin(const char *trace_id);
+void trace_stage(const char *name, long long elapsed_ns);
+void trace_ollama(const char *model, const struct ollama_timings *timings, long long end_ns);
+void trace_end(const char *action, const char *status, long long start_ns);
+int trace_export(const char *format, char *path, size_t path_size);
+
+/* Traffic capture and replay backend (capture.c) */
+int capture_init(const char *path, const char *model);
+int capture_active(void);
+void capture_request(unsigned long conn, long long arrival_ns, const char *action, const char *text,
+                     const char *status, long long elapsed_ns);
+void capture_backend(const char *model, const char *prompt, int result, const char *reply, long long elapsed_ns);
+void capture_cleanup(void);
+int replay_backend_init(const char *path, double speed);
+int replay_backend_active(void);
+int replay_backend_answer(const char *model, const char *prompt, char *reply, size_t reply_size,
+                          int (*cancelled)(void *arg), void *arg);
+
+/* Configuration (config.c): config.json and models.json as one immutable
+ * snapshot, swapped whole on SIGHUP or when a file changes */
+#define AI_OS_CONFIG_DIR "/etc/ai-os"
+#define AI_OS_CONFIG_FILE AI_OS_CONFIG_DIR "/config.json"
+#define AI_OS_MODELS_FILE AI_OS_CONFIG_DIR "/models.json"
+#define AI_OS_CONFIG_MAX_MODELS 16
+#define AI_OS_POLICY_MAX_RULES 32
+#define AI_OS_POLICY_MAX_FLAGS 4
+#define AI_OS_POLICY_MAX_ARGS 12
+#define AI_OS_CONFIG_MAX_USERS 32
+
+/* Safety policy verdicts, least to most severe */
+enum safety_verdict {
+    SAFETY_ALLOW,
+    SAFETY_CONFIRM,                 /* never run without the user saying so */
+    SAFETY_BLOCK
+};
+
+/* One safety policy rule; every field given must match. Alternatives are
+ * separated by '|', patterns are fnmatch(3) globs with FNM_PATHNAME */
+typedef struct {
+    char command[96];               /* program names or globs; empty: any */
+    char flags[AI_OS_POLICY_MAX_FLAGS][32];     /* each present: "-r|-R|--recursive" */
+    char args[AI_OS_POLICY_MAX_ARGS][48];       /* an operand matches one */
+    char piped_from[32];            /* fed by one of these programs */
+    char reason[64];
+    int redirects;                  /* args match output redirection targets instead */
+    int privileged;                 /* only under sudo, doas, su or pkexec */
+    int action;                     /* SAFETY_BLOCK or SAFETY_CONFIRM */
+} ai_os_policy_rule_t;
+
+typedef struct {
+    char name[64];
+    int enabled;
+    int priority;                   /* -1: keep the built-in priority */
+} ai_os_model_setting_t;
+
+/* A user's share of the inference backend (fair_queue.c) */
+typedef struct {
+    uid_t uid;
+    double weight;                  /* backend time against other users' */
+    double rate;                    /* model requests per second; 0: unlimited */
+    double burst;                   /* requests at once above the rate; 0: the rate, at least 1 */
+} ai_os_user_setting_t;
+
+typedef struct {
+    unsigned long generation;       /* 0: built-in defaults, nothing loaded */
+    char model[64];
+    int safety_mode;
+    int confirmation_required;
+    int log_level;                  /* -1: not set */
+    char metrics_socket[108];       /* restart-only from here ... */
+    char capture_file[256];
+    char replay_backend[256];
+    double replay_speed;            /* ... to here */
+    char distro_id[64];             /* empty: read /etc/os-release */
+    char distro_version[64];
+    char distro_name[128];
+    int model_count;
+    ai_os_model_setting_t models[AI_OS_CONFIG_MAX_MODELS];
+    int policy_count;               /* "safety_policy", on top of the built-in rules */
+    ai_os_policy_rule_t policy[AI_OS_POLICY_MAX_RULES];
+    ai_os_user_setting_t user_default;  /* "fair_queue": users not listed */
+    int queue_timeout_ms;           /* longest wait for the backend */
+    int max_concurrency;            /* most generate calls at once, however fast */
+    int interpret_deadline_ms;      /* "deadlines": budget when the client sets none, 0 for none */
+    int chat_deadline_ms;
+    int execute_deadline_ms;
+    int user_count;
+    ai_os_user_setting_t users[AI_OS_CONFIG_MAX_USERS];
+} ai_os_settings_t;
+
+int config_init(void);
+void config_cleanup(void);
+const ai_os_settings_t *config_get(void);
+int config_reload(void);
+void config_request_reload(void);
+void config_on_reload(void (*fn)(const ai_os_settings_t *prev, const ai_os_settings_t *next));
+
+/* Safety policy (safety_policy.c): a shell command against the rules */
+int safety_policy_check(const char *command, char *reason, size_t reason_size);
+
+/* Shell syntax (shell_syntax.c): model output cut down to a command that parses */
+enum shell_output {
+    SHELL_OUTPUT_VALID,             /* a command as it came */
+    SHELL_OUTPUT_REPAIRED,          /* fences, prompts or prose stripped */
+    SHELL_OUTPUT_REASKED,           /* only the constrained second generation parsed */
+    SHELL_OUTPUT_REJECTED,          /* nothing in it parses */
+    SHELL_OUTPUTS
+};
+
+int shell_syntax_check(const char *command, char *reason, size_t reason_size);
+int shell_output_clean(char *text, char *reason, size_t reason_size);
+
+/* Fair queueing (fair_queue.c): each user's turn at the inference backend */
+enum fair_queue_result {
+    FAIR_QUEUE_GRANTED,
+    FAIR_QUEUE_RATE_LIMITED,        /* over the user's rate: come back later */
+    FAIR_QUEUE_TIMEOUT,             /* no turn within the longest wait */
+    FAIR_QUEUE_RESULTS
+};
+
+/* Request classes, served in this order */
+enum fair_queue_lane {
+    FAIR_QUEUE_INTERACTIVE,         /* interpret: a shell is waiting */
+    FAIR_QUEUE_CHAT,
+    FAIR_QUEUE_BACKGROUND,          /* batch and speculation: idle capacity only */
+    FAIR_QUEUE_LANES
+};
+
+typedef struct fair_queue_ticket {
+    struct fair_queue_ticket *next; /* holders of the backend, fair_queue.c's */
+    int flow;
+    int lane;
+    int preempted;                  /* a higher lane wants the backend */
+    int requeues;
+    long long start_ns;
+    double weight;
+    double charged;                 /* virtual time charged up front */
+} fair_queue_ticket_t;
+
+int fair_queue_acquire(uid_t uid, int lane, fair_queue_ticket_t *ticket, long *retry_ms);
+int fair_queue_try_acquire(uid_t uid, int lane, int charge, fair_queue_ticket_t *ticket);
+int fair_queue_requeue(fair_queue_ticket_t *ticket);
+int fair_queue_preempted(void *ticket);
+void fair_queue_release(fair_queue_ticket_t *ticket);
+int fair_queue_waiting(int lane);
+
+/* The adaptive limit on concurrent generate calls (fair_queue.c) */
+typedef struct {
+    double limit;
+    int inflight;
+    double baseline_ns;             /* per generated token, with nothing else running */
+    double latency_ns;              /* per generated token, recently */
+    double gradient;                /* baseline allowance over latency, 0.5 to 1 */
+} fair_queue_limiter_t;
+
+void fair_queue_observe(long long elapsed_ns, long long tokens);
+void fair_queue_limiter(fair_queue_limiter_t *stats);
+
+/* Request deadlines (deadline.c), per thread; times are metrics_now_ns() */
+void deadline_begin(long long deadline_ns);
+void deadline_end(void);
+long long deadline_from_epoch_ms(long long epoch_ms);
+long long deadline_budget_ns(long long default_ns);
+void deadline_exceeded(int stage);
+int deadline_check(int stage);
+const char *deadline_expired_stage(void);
+void deadline_timespec(struct timespec *ts, long long budget_ns);
+
+/* Flight recorder (flight_recorder.c): last requests in shared memory */
+int flight_init(void);
+void flight_cleanup(void);
+void flight_begin(unsigned long long request_no, const char *action, const char *model,
+                  pid_t client_pid, size_t request_bytes, const char *trace_id);
+void flight_stage(enum metrics_stage stage, long long elapsed_ns);
+void flight_end(const char *status, size_t response_bytes, const struct arena_stats *memory);
+
 int kernel_bridge_init(void);
 int kernel_bridge_start(void);
+int kernel_bridge_start_attached(int fd);
 void kernel_bridge_stop(void);
 void kernel_bridge_cleanup(void);
+void kernel_bridge_cleanup_enhanced(void);
 
 #endif /* AI_OS_COMMON_H */ 
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*
+ * AI-OS Flight Recorder
+ * File: userspace/ai_os_flight.h
+ *
+ * Layout of the shared-memory ring at AI_OS_FLIGHT_PATH in which the daemon
+ * keeps the last AI_OS_FLIGHT_RECORDS requests (daemon/flight_recorder.c).
+ * The segment lives in tmpfs, not in the daemon, so it outlasts a crash:
+ * `ai-client debug flight-recorder` maps it read-only and prints it without
+ * talking to the daemon (client/client_debug.c). A daemon that starts up
+ * first moves the previous segment to AI_OS_FLIGHT_PREV_PATH.
+ *
+ * A record is filled in as its request progresses, so a request that hung
+ * or died with the daemon shows up as in progress with the stages it got
+ * through. Records use the same per-record sequence counter as the shared
+ * cache (ai_os_cache.h): odd while the daemon is writing, and a reader
+ * retries until it sees the same even value before and after its copy.
+ */
+
+#ifndef AI_OS_FLIGHT_H
+#define AI_OS_FLIGHT_H
+
+#include <sys/types.h>
+
+#define AI_OS_FLIGHT_PATH "/dev/shm/ai-os-flight"
+#define AI_OS_FLIGHT_PREV_PATH "/dev/shm/ai-os-flight.prev"
+#define AI_OS_FLIGHT_MAGIC 0x52464941u    /* "AIFR" */
+#define AI_OS_FLIGHT_VERSION 3
+
+#define AI_OS_FLIGHT_RECORDS 256          /* power of two */
+#define AI_OS_FLIGHT_STAGES 9             /* enum metrics_stage, in order */
+
+/* Record states */
+enum {
+    AI_OS_FLIGHT_EMPTY = 0,
+    AI_OS_FLIGHT_ACTIVE,                  /* request still being served */
+    AI_OS_FLIGHT_DONE
+};
+
+typedef struct {
+    unsigned int seq;                     /* odd while being rewritten */
+    unsigned int state;
+    unsigned long long request_no;        /* the daemon's, from 1; slot is request_no % RECORDS */
+    long long start_unix_ns;              /* wall clock at arrival */
+    long long updated_ns;                 /* monotonic, last change */
+    long long total_ns;                   /* set when done */
+    long long stage_ns[AI_OS_FLIGHT_STAGES];
+    pid_t client_pid;
+    unsigned int queue_depth;             /* other requests in flight at arrival */
+    unsigned int request_bytes;
+    unsigned int response_bytes;
+    unsigned int arena_bytes;             /* scratch memory from the per-request arena */
+    unsigned int heap_allocs;             /* of that, allocations that spilled to malloc */
+    char action[16];
+    char status[16];
+    char model[64];
+    char trace_id[33];
+} ai_os_flight_record_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int record_count;
+    unsigned int record_size;             /* catches layout mismatches */
+    pid_t daemon_pid;
+    long long started_unix_ns;
+    long long monotonic_base_ns;          /* monotonic clock at started_unix_ns */
+    unsigned long long next_request;      /* highest request_no recorded */
+    ai_os_flight_record_t records[AI_OS_FLIGHT_RECORDS];
+} ai_os_flight_t;
+
+#endif /* AI_OS_FLIGHT_H */
@@ -0,0 +1,620 @@
+/*
+ * AI-OS Streaming JSON
+ * File: userspace/ai_os_json.c
+ *
+ * Pull tokenizer and buffer-backed writer; see ai_os_json.h. The reader
+ * keeps one bit per open container and what it expects next, and checks
+ * the grammar as it goes, so a document that reaches AI_OS_JSON_END was
+ * well formed. Strings are validated when scanned but unescaped only on
+ * request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ai_os_json.h"
+
+/* What the reader accepts next */
+enum {
+    EXPECT_VALUE,
+    EXPECT_FIRST_VALUE,         /* a value or ']' */
+    EXPECT_KEY,
+    EXPECT_FIRST_KEY,           /* a key or '}' */
+    EXPECT_SEPARATOR,           /* ',' or the closing bracket */
+    EXPECT_DONE
+};
+
+/* ---- reader ---- */
+
+void ai_os_json_reader_init(ai_os_json_reader_t *r, const char *buf, size_t len) {
+    memset(r, 0, sizeof(*r));
+    r->pos = buf;
+    r->end = buf + len;
+    r->expect = EXPECT_VALUE;
+}
+
+static void skip_space(ai_os_json_reader_t *r) {
+    while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\n' || *r->pos == '\r')) {
+        r->pos++;
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* A string starting at the quote under pos; leaves its body in text */
+static int scan_string(ai_os_json_reader_t *r) {
+    const char *p = r->pos + 1;
+
+    while (p < r->end) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"') {
+            r->text = r->pos + 1;
+            r->text_len = (size_t)(p - r->text);
+            r->pos = p + 1;
+            return 0;
+        }
+        if (c < 0x20) {
+            return AI_OS_JSON_ERROR;
+        }
+        if (c == '\\') {
+            if (++p >= r->end) return AI_OS_JSON_PARTIAL;
+            if (*p == 'u') {
+                for (int i = 1; i <= 4; i++) {
+                    if (p + i >= r->end) return AI_OS_JSON_PARTIAL;
+                    if (hex_value(p[i]) < 0) return AI_OS_JSON_ERROR;
+                }
+                p += 4;
+            } else if (!strchr("\"\\/bfnrt", *p) || *p == '\0') {
+                return AI_OS_JSON_ERROR;
+            }
+        }
+        p++;
+    }
+    return AI_OS_JSON_PARTIAL;
+}
+
+static int is_digit(const char *p, const char *end) {
+    return p < end && *p >= '0' && *p <= '9';
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static int scan_number(ai_os_json_reader_t *r) {
+    const char *p = r->pos;
+
+    if (*p == '-') p++;
+    if (!is_digit(p, r->end)) {
+        return p >= r->end ? AI_OS_JSON_PARTIAL : AI_OS_JSON_ERROR;
+    }
+    if (*p == '0') {
+        p++;
+    } else {
+        while (is_digit(p, r->end)) p++;
+    }
+    if (p < r->end && *p == '.') {
+        p++;
+        if (!is_digit(p, r->end)) return p >= r->end ? AI_OS_JSON_PARTIAL : AI_OS_JSON_ERROR;
+        while (is_digit(p, r->end)) p++;
+    }
+    if (p < r->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < r->end && (*p == '+' || *p == '-')) p++;
+        if (!is_digit(p, r->end)) return p >= r->end ? AI_OS_JSON_PARTIAL : AI_OS_JSON_ERROR;
+        while (is_digit(p, r->end)) p++;
+    }
+    /* Only a top-level number may run to the end of the input */
+    if (p >= r->end && r->depth > 0) {
+        return AI_OS_JSON_PARTIAL;
+    }
+    r->text = r->pos;
+    r->text_len = (size_t)(p - r->pos);
+    r->pos = p;
+    return 0;
+}
+
+static int scan_literal(ai_os_json_reader_t *r, const char *word, int token) {
+    size_t len = strlen(word);
+    size_t have = (size_t)(r->end - r->pos);
+
+    if (have < len) {
+        return memcmp(r->pos, word, have) == 0 ? AI_OS_JSON_PARTIAL : AI_OS_JSON_ERROR;
+    }
+    if (memcmp(r->pos, word, len) != 0) {
+        return AI_OS_JSON_ERROR;
+    }
+    r->pos += len;
+    return token;
+}
+
+static void value_done(ai_os_json_reader_t *r) {
+    r->expect = r->depth == 0 ? EXPECT_DONE : EXPECT_SEPARATOR;
+}
+
+static int open_container(ai_os_json_reader_t *r, int object) {
+    if (r->depth >= AI_OS_JSON_MAX_DEPTH) {
+        return AI_OS_JSON_ERROR;
+    }
+    unsigned long long bit = 1ULL << r->depth;
+    r->objects = object ? r->objects | bit : r->objects & ~bit;
+    r->depth++;
+    r->pos++;
+    r->expect = object ? EXPECT_FIRST_KEY : EXPECT_FIRST_VALUE;
+    return object ? AI_OS_JSON_OBJECT_BEGIN : AI_OS_JSON_ARRAY_BEGIN;
+}
+
+static int in_object(const ai_os_json_reader_t *r) {
+    return r->depth > 0 && (r->objects >> (r->depth - 1) & 1);
+}
+
+static int close_container(ai_os_json_reader_t *r, char c) {
+    if (r->depth == 0 || (c == '}') != in_object(r)) {
+        return AI_OS_JSON_ERROR;
+    }
+    r->depth--;
+    r->pos++;
+    value_done(r);
+    return c == '}' ? AI_OS_JSON_OBJECT_END : AI_OS_JSON_ARRAY_END;
+}
+
+static int read_value(ai_os_json_reader_t *r) {
+    int result;
+
+    switch (*r->pos) {
+        case '{':
+            return open_container(r, 1);
+        case '[':
+            return open_container(r, 0);
+        case '"':
+            if ((result = scan_string(r)) != 0) return result;
+            value_done(r);
+            return AI_OS_JSON_STRING;
+        case 't':
+            result = scan_literal(r, "true", AI_OS_JSON_TRUE);
+            break;
+        case 'f':
+            result = scan_literal(r, "false", AI_OS_JSON_FALSE);
+            break;
+        case 'n':
+            result = scan_literal(r, "null", AI_OS_JSON_NULL);
+            break;
+        default:
+            if ((result = scan_number(r)) != 0) return result;
+            value_done(r);
+            return AI_OS_JSON_NUMBER;
+    }
+    if (result > 0) {
+        value_done(r);
+    }
+    return result;
+}
+
+/* The next token. After AI_OS_JSON_PARTIAL the reader is stuck mid-token:
+ * start over on the whole document once more input has arrived. */
+int ai_os_json_next(ai_os_json_reader_t *r) {
+    for (;;) {
+        skip_space(r);
+        if (r->expect == EXPECT_DONE) {
+            return AI_OS_JSON_END;
+        }
+        if (r->pos >= r->end) {
+            return AI_OS_JSON_PARTIAL;
+        }
+        r->start = r->pos;
+        char c = *r->pos;
+
+        switch (r->expect) {
+            case EXPECT_SEPARATOR:
+                if (c == ',') {
+                    r->pos++;
+                    r->expect = in_object(r) ? EXPECT_KEY : EXPECT_VALUE;
+                    continue;
+                }
+                return close_container(r, c);
+
+            case EXPECT_FIRST_KEY:
+                if (c == '}') {
+                    return close_container(r, c);
+                }
+                /* fall through */
+            case EXPECT_KEY: {
+                if (c != '"') {
+                    return AI_OS_JSON_ERROR;
+                }
+                int result = scan_string(r);
+                if (result != 0) return result;
+                skip_space(r);
+                if (r->pos >= r->end) return AI_OS_JSON_PARTIAL;
+                if (*r->pos != ':') return AI_OS_JSON_ERROR;
+                r->pos++;
+                r->expect = EXPECT_VALUE;
+                return AI_OS_JSON_KEY;
+            }
+
+            case EXPECT_FIRST_VALUE:
+                if (c == ']') {
+                    return close_container(r, c);
+                }
+                /* fall through */
+            default:
+                return read_value(r);
+        }
+    }
+}
+
+/* Skip the rest of the value whose first token was TOKEN; returns its last
+ * token, or AI_OS_JSON_ERROR / AI_OS_JSON_PARTIAL */
+int ai_os_json_skip(ai_os_json_reader_t *r, int token) {
+    if (token <= 0 || token == AI_OS_JSON_END || token == AI_OS_JSON_KEY ||
+        token == AI_OS_JSON_OBJECT_END || token == AI_OS_JSON_ARRAY_END) {
+        return token <= 0 ? token : AI_OS_JSON_ERROR;
+    }
+    if (token != AI_OS_JSON_OBJECT_BEGIN && token != AI_OS_JSON_ARRAY_BEGIN) {
+        return token;
+    }
+    int depth = r->depth - 1;
+    while (r->depth > depth) {
+        token = ai_os_json_next(r);
+        if (token <= 0) {
+            return token;
+        }
+    }
+    return token;
+}
+
+/* The complete text of the value whose first token was TOKEN, skipping
+ * past it; for echoing a field back without looking inside */
+int ai_os_json_raw_value(ai_os_json_reader_t *r, int token, const char **raw, size_t *raw_len) {
+    const char *from = r->start;
+    int last = ai_os_json_skip(r, token);
+    if (last <= 0) {
+        return last == 0 ? AI_OS_JSON_PARTIAL : AI_OS_JSON_ERROR;
+    }
+    *raw = from;
+    *raw_len = (size_t)(r->pos - from);
+    return 0;
+}
+
+/* Append code point CP to DST as UTF-8; returns the bytes it takes */
+static size_t put_utf8(char *dst, size_t room, size_t n, unsigned int cp) {
+    char bytes[4];
+    size_t len;
+
+    if (cp < 0x80) {
+        bytes[0] = (char)cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = (char)(0xc0 | cp >> 6);
+        bytes[1] = (char)(0x80 | (cp & 0x3f));
+        len = 2;
+    } else if (cp < 0x10000) {
+        bytes[0] = (char)(0xe0 | cp >> 12);
+        bytes[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+        bytes[2] = (char)(0x80 | (cp & 0x3f));
+        len = 3;
+    } else {
+        bytes[0] = (char)(0xf0 | cp >> 18);
+        bytes[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+        bytes[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+        bytes[3] = (char)(0x80 | (cp & 0x3f));
+        len = 4;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (n + i < room) dst[n + i] = bytes[i];
+    }
+    return len;
+}
+
+static unsigned int hex4(const char *p) {
+    return (unsigned int)(hex_value(p[0]) << 12 | hex_value(p[1]) << 8 | hex_value(p[2]) << 4 | hex_value(p[3]));
+}
+
+/* Unescape the last key or string into DST, truncating to SIZE - 1 bytes;
+ * returns the full unescaped length, like snprintf */
+size_t ai_os_json_get_string(const ai_os_json_reader_t *r, char *dst, size_t size) {
+    size_t room = size > 0 ? size - 1 : 0;
+    size_t n = 0;
+    const char *p = r->text, *end = r->text + r->text_len;
+
+    while (p < end) {
+        const char *escape = memchr(p, '\\', (size_t)(end - p));
+        size_t plain = (size_t)((escape ? escape : end) - p);
+        if (n < room) memcpy(dst + n, p, plain < room - n ? plain : room - n);
+        n += plain;
+        if (!escape) break;
+
+        p = escape + 1;
+        char c = *p++;
+        switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                unsigned int cp = hex4(p);
+                p += 4;
+                if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    unsigned int low = hex4(p + 2);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                }
+                if (cp >= 0xd800 && cp < 0xe000) {
+                    cp = 0xfffd;        /* unpaired surrogate */
+                }
+                n += put_utf8(dst, room, n, cp);
+                continue;
+            }
+            default: break;             /* " \ / stand for themselves */
+        }
+        if (n < room) dst[n] = c;
+        n++;
+    }
+    if (size > 0) {
+        dst[n < room ? n : room] = '\0';
+    }
+    return n;
+}
+
+int ai_os_json_key_is(const ai_os_json_reader_t *r, const char *key) {
+    size_t len = strlen(key);
+    if (r->text_len == len && memcmp(r->text, key, len) == 0) {
+        return 1;
+    }
+    /* Escaped spelling of the same name */
+    if (r->text_len > len && memchr(r->text, '\\', r->text_len)) {
+        char name[128];
+        return len < sizeof(name) && ai_os_json_get_string(r, name, sizeof(name)) == len &&
+               memcmp(name, key, len) == 0;
+    }
+    return 0;
+}
+
+/* The value whose first token was TOKEN as text: strings unescaped, other
+ * scalars and containers as written. 1 if it is null (DST untouched). */
+int ai_os_json_get_text(ai_os_json_reader_t *r, int token, char *dst, size_t size) {
+    const char *raw;
+    size_t len;
+
+    if (token == AI_OS_JSON_STRING) {
+        ai_os_json_get_string(r, dst, size);
+        return 0;
+    }
+    if (token == AI_OS_JSON_NULL) {
+        return 1;
+    }
+    if (size == 0 || ai_os_json_raw_value(r, token, &raw, &len) != 0) {
+        return AI_OS_JSON_ERROR;
+    }
+    if (len >= size) len = size - 1;
+    memcpy(dst, raw, len);
+    dst[len] = '\0';
+    return 0;
+}
+
+long long ai_os_json_get_int64(const ai_os_json_reader_t *r) {
+    char number[64];
+    size_t len = r->text_len < sizeof(number) - 1 ? r->text_len : sizeof(number) - 1;
+    memcpy(number, r->text, len);
+    number[len] = '\0';
+    if (strpbrk(number, ".eE")) {
+        return (long long)strtod(number, NULL);
+    }
+    return strtoll(number, NULL, 10);
+}
+
+double ai_os_json_get_double(const ai_os_json_reader_t *r) {
+    char number[64];
+    size_t len = r->text_len < sizeof(number) - 1 ? r->text_len : sizeof(number) - 1;
+    memcpy(number, r->text, len);
+    number[len] = '\0';
+    return strtod(number, NULL);
+}
+
+/* 1 if BUF holds exactly one document (plus whitespace), 0 if it could
+ * still become one, -1 if it cannot */
+int ai_os_json_complete(const char *buf, size_t len) {
+    ai_os_json_reader_t r;
+    int token;
+
+    ai_os_json_reader_init(&r, buf, len);
+    while ((token = ai_os_json_next(&r)) > 0 && token != AI_OS_JSON_END) {
+    }
+    if (token != AI_OS_JSON_END) {
+        return token == AI_OS_JSON_PARTIAL ? 0 : -1;
+    }
+    skip_space(&r);
+    return r.pos == r.end ? 1 : -1;
+}
+
+/* ---- writer ---- */
+
+void ai_os_json_writer_init(ai_os_json_writer_t *w, char *buf, size_t size) {
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->comma = 0;
+    w->overflow = size == 0;
+    if (size > 0) buf[0] = '\0';
+}
+
+/* Terminate the text; its length, or -1 if it did not fit */
+int ai_os_json_writer_finish(ai_os_json_writer_t *w) {
+    if (w->overflow) {
+        if (w->size > 0) w->buf[0] = '\0';
+        return -1;
+    }
+    w->buf[w->len] = '\0';
+    return (int)w->len;
+}
+
+/* One byte is always kept back for the terminator */
+static void put(ai_os_json_writer_t *w, const char *s, size_t len) {
+    if (w->overflow || len >= w->size - w->len) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+}
+
+static void put_char(ai_os_json_writer_t *w, char c) {
+    if (w->overflow || w->len + 1 >= w->size) {
+        w->overflow = 1;
+        return;
+    }
+    w->buf[w->len++] = c;
+}
+
+/* Separator before a key or an array element */
+static void before_value(ai_os_json_writer_t *w) {
+    if (w->comma) {
+        put_char(w, ',');
+    }
+    w->comma = 1;
+}
+
+static void put_escaped(ai_os_json_writer_t *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    put_char(w, '"');
+    for (const char *p = s; p < s + len; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put(w, run, (size_t)(p - run));
+        run = p + 1;
+        switch (c) {
+            case '"':  put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            default: {
+                char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                put(w, u, sizeof(u));
+            }
+        }
+    }
+    put(w, run, (size_t)(s + len - run));
+    put_char(w, '"');
+}
+
+void ai_os_json_begin_object(ai_os_json_writer_t *w) {
+    before_value(w);
+    put_char(w, '{');
+    w->comma = 0;
+}
+
+void ai_os_json_end_object(ai_os_json_writer_t *w) {
+    put_char(w, '}');
+    w->comma = 1;
+}
+
+void ai_os_json_begin_array(ai_os_json_writer_t *w) {
+    before_value(w);
+    put_char(w, '[');
+    w->comma = 0;
+}
+
+void ai_os_json_end_array(ai_os_json_writer_t *w) {
+    put_char(w, ']');
+    w->comma = 1;
+}
+
+void ai_os_json_key(ai_os_json_writer_t *w, const char *key) {
+    before_value(w);
+    put_escaped(w, key, strlen(key));
+    put_char(w, ':');
+    w->comma = 0;
+}
+
+void ai_os_json_string_len(ai_os_json_writer_t *w, const char *s, size_t len) {
+    before_value(w);
+    put_escaped(w, s, len);
+}
+
+void ai_os_json_string(ai_os_json_writer_t *w, const char *s) {
+    if (!s) {
+        ai_os_json_null(w);
+        return;
+    }
+    ai_os_json_string_len(w, s, strlen(s));
+}
+
+void ai_os_json_int(ai_os_json_writer_t *w, long long n) {
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%lld", n);
+    before_value(w);
+    put(w, number, (size_t)len);
+}
+
+/* Shortest of %.15g and %.17g that reads back the same; JSON has no NaN */
+void ai_os_json_double(ai_os_json_writer_t *w, double d) {
+    char number[32];
+    if (!isfinite(d)) {
+        ai_os_json_null(w);
+        return;
+    }
+    int len = snprintf(number, sizeof(number), "%.15g", d);
+    if (strtod(number, NULL) != d) {
+        len = snprintf(number, sizeof(number), "%.17g", d);
+    }
+    /* Keep it a double for readers that care */
+    if (!strpbrk(number, ".eEn")) {
+        number[len++] = '.';
+        number[len++] = '0';
+        number[len] = '\0';
+    }
+    before_value(w);
+    put(w, number, (size_t)len);
+}
+
+void ai_os_json_bool(ai_os_json_writer_t *w, int b) {
+    before_value(w);
+    put(w, b ? "true" : "false", b ? 4 : 5);
+}
+
+void ai_os_json_null(ai_os_json_writer_t *w) {
+    before_value(w);
+    put(w, "null", 4);
+}
+
+/* JSON produced elsewhere, copied as is */
+void ai_os_json_raw(ai_os_json_writer_t *w, const char *json, size_t len) {
+    before_value(w);
+    put(w, json, len);
+}
+
+void ai_os_json_field_string(ai_os_json_writer_t *w, const char *key, const char *s) {
+    ai_os_json_key(w, key);
+    ai_os_json_string(w, s);
+}
+
+void ai_os_json_field_int(ai_os_json_writer_t *w, const char *key, long long n) {
+    ai_os_json_key(w, key);
+    ai_os_json_int(w, n);
+}
+
+void ai_os_json_field_double(ai_os_json_writer_t *w, const char *key, double d) {
+    ai_os_json_key(w, key);
+    ai_os_json_double(w, d);
+}
+
+void ai_os_json_field_bool(ai_os_json_writer_t *w, const char *key, int b) {
+    ai_os_json_key(w, key);
+    ai_os_json_bool(w, b);
+}
+
+void ai_os_json_field_raw(ai_os_json_writer_t *w, const char *key, const char *json, size_t len) {
+    ai_os_json_key(w, key);
+    ai_os_json_raw(w, json, len);
+}
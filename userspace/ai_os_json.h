@@ -0,0 +1,104 @@
+/*
+ * AI-OS Streaming JSON
+ * File: userspace/ai_os_json.h
+ *
+ * A pull tokenizer and a buffer-backed writer for the hot protocol paths
+ * (ai_os_json.c): daemon requests and replies, Ollama generate bodies and
+ * their answers. Neither allocates. The reader walks the caller's bytes
+ * once and hands back tokens; strings are unescaped only when asked for,
+ * into the caller's buffer. The writer emits straight into the caller's
+ * buffer and remembers overflow instead of truncating mid-document.
+ *
+ *     ai_os_json_reader_t r;
+ *     ai_os_json_reader_init(&r, line, len);
+ *     if (ai_os_json_next(&r) != AI_OS_JSON_OBJECT_BEGIN) ...
+ *     while ((token = ai_os_json_next(&r)) == AI_OS_JSON_KEY) {
+ *         int is_action = ai_os_json_key_is(&r, "action");
+ *         token = ai_os_json_next(&r);
+ *         if (is_action) ai_os_json_get_text(&r, token, action, sizeof(action));
+ *         else ai_os_json_skip(&r, token);
+ *     }
+ *
+ * Input that stops inside a document reads as AI_OS_JSON_PARTIAL rather
+ * than an error, so a connection or NDJSON stream can wait for more bytes
+ * and parse the line again. json-c stays where a DOM is convenient, such
+ * as the config file.
+ */
+
+#ifndef AI_OS_JSON_H
+#define AI_OS_JSON_H
+
+#include <stddef.h>
+
+#define AI_OS_JSON_MAX_DEPTH 64
+
+/* Tokens returned by ai_os_json_next() */
+enum ai_os_json_token {
+    AI_OS_JSON_ERROR = -1,      /* not JSON, or nested too deep */
+    AI_OS_JSON_PARTIAL = 0,     /* input ended inside the document */
+    AI_OS_JSON_OBJECT_BEGIN,
+    AI_OS_JSON_OBJECT_END,
+    AI_OS_JSON_ARRAY_BEGIN,
+    AI_OS_JSON_ARRAY_END,
+    AI_OS_JSON_KEY,
+    AI_OS_JSON_STRING,
+    AI_OS_JSON_NUMBER,
+    AI_OS_JSON_TRUE,
+    AI_OS_JSON_FALSE,
+    AI_OS_JSON_NULL,
+    AI_OS_JSON_END              /* the document is complete */
+};
+
+typedef struct {
+    const char *pos;
+    const char *end;
+    const char *start;          /* first byte of the last token (a string's quote) */
+    const char *text;           /* last key, string or number; strings still escaped */
+    size_t text_len;
+    unsigned long long objects; /* bit per open container: 1 = object */
+    int depth;
+    int expect;
+} ai_os_json_reader_t;
+
+void ai_os_json_reader_init(ai_os_json_reader_t *r, const char *buf, size_t len);
+int ai_os_json_next(ai_os_json_reader_t *r);
+int ai_os_json_skip(ai_os_json_reader_t *r, int token);
+int ai_os_json_raw_value(ai_os_json_reader_t *r, int token, const char **raw, size_t *raw_len);
+int ai_os_json_key_is(const ai_os_json_reader_t *r, const char *key);
+size_t ai_os_json_get_string(const ai_os_json_reader_t *r, char *dst, size_t size);
+int ai_os_json_get_text(ai_os_json_reader_t *r, int token, char *dst, size_t size);
+long long ai_os_json_get_int64(const ai_os_json_reader_t *r);
+double ai_os_json_get_double(const ai_os_json_reader_t *r);
+int ai_os_json_complete(const char *buf, size_t len);
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    int comma;                  /* a value precedes at this level */
+    int overflow;
+} ai_os_json_writer_t;
+
+void ai_os_json_writer_init(ai_os_json_writer_t *w, char *buf, size_t size);
+int ai_os_json_writer_finish(ai_os_json_writer_t *w);
+void ai_os_json_begin_object(ai_os_json_writer_t *w);
+void ai_os_json_end_object(ai_os_json_writer_t *w);
+void ai_os_json_begin_array(ai_os_json_writer_t *w);
+void ai_os_json_end_array(ai_os_json_writer_t *w);
+void ai_os_json_key(ai_os_json_writer_t *w, const char *key);
+void ai_os_json_string(ai_os_json_writer_t *w, const char *s);
+void ai_os_json_string_len(ai_os_json_writer_t *w, const char *s, size_t len);
+void ai_os_json_int(ai_os_json_writer_t *w, long long n);
+void ai_os_json_double(ai_os_json_writer_t *w, double d);
+void ai_os_json_bool(ai_os_json_writer_t *w, int b);
+void ai_os_json_null(ai_os_json_writer_t *w);
+void ai_os_json_raw(ai_os_json_writer_t *w, const char *json, size_t len);
+
+/* "key": value in one call */
+void ai_os_json_field_string(ai_os_json_writer_t *w, const char *key, const char *s);
+void ai_os_json_field_int(ai_os_json_writer_t *w, const char *key, long long n);
+void ai_os_json_field_double(ai_os_json_writer_t *w, const char *key, double d);
+void ai_os_json_field_bool(ai_os_json_writer_t *w, const char *key, int b);
+void ai_os_json_field_raw(ai_os_json_writer_t *w, const char *key, const char *json, size_t len);
+
+#endif /* AI_OS_JSON_H */
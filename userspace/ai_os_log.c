@@ -0,0 +1,406 @@
+/*
+ * AI-OS Logging
+ * File: userspace/ai_os_log.c
+ *
+ * Every thread that logs gets its own single-producer ring of fixed-size
+ * records. Logging a line is a level check, a vsnprintf into the next free
+ * record and a release store; no lock, no syscall, no file I/O on the
+ * caller's thread. A background writer drains all rings, writes the lines
+ * to their sinks in batches with one fflush per sink per pass, rotates a
+ * sink to <path>.old once the bytes it has written pass AI_OS_LOG_MAX_SIZE
+ * (tracked in memory, not by stat() per line) and mirrors to syslog where
+ * asked. When a ring is full the line is dropped and counted, and the
+ * writer notes the loss in the log, so a stalled disk never stalls a
+ * request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include "ai_os_log.h"
+
+#define LOG_RING_RECORDS 128            /* power of two */
+#define LOG_RECORD_TEXT 480
+#define LOG_WRITER_IDLE_MS 100
+#define LOG_FLUSH_WAIT_MS 1000
+
+typedef struct {
+    ai_os_log_sink_t *sink;
+    time_t when;
+    unsigned short level;
+    unsigned short len;
+    char text[LOG_RECORD_TEXT];
+} log_record_t;
+
+typedef struct log_ring {
+    unsigned int head;                  /* next slot to fill; producer only */
+    unsigned int tail;                  /* next slot to drain; writer only */
+    unsigned long long dropped;         /* not yet reported by the writer */
+    int dead;                           /* owning thread has exited */
+    struct log_ring *next;
+    log_record_t records[LOG_RING_RECORDS];
+} log_ring_t;
+
+int ai_os_log_threshold = AI_OS_LOG_INFO;
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+static const int level_priorities[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
+
+static struct {
+    log_ring_t *rings;                  /* pushed by producers, pruned by the writer */
+    ai_os_log_sink_t *sinks;            /* opened sinks; writer only */
+    pthread_mutex_t drain_mutex;        /* one consumer at a time */
+    pthread_mutex_t start_mutex;
+    pthread_key_t ring_key;
+    pthread_once_t key_once;
+    sem_t wake;
+    int sleeping;
+    pid_t writer_pid;                   /* process the writer thread runs in */
+    unsigned long long dropped_total;
+} log_state = {
+    .drain_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .start_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .key_once = PTHREAD_ONCE_INIT,
+};
+
+static __thread log_ring_t *thread_ring;
+
+int ai_os_log_level_from_name(const char *name) {
+    if (!name) return -1;
+    for (int i = 0; i < 4; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) return i;
+    }
+    if (strcasecmp(name, "warning") == 0) return AI_OS_LOG_WARN;
+    return -1;
+}
+
+void ai_os_log_set_level(int level) {
+    if (level >= AI_OS_LOG_DEBUG && level <= AI_OS_LOG_ERROR) {
+        __atomic_store_n(&ai_os_log_threshold, level, __ATOMIC_RELAXED);
+    }
+}
+
+unsigned long long ai_os_log_dropped(void) {
+    return __atomic_load_n(&log_state.dropped_total, __ATOMIC_RELAXED);
+}
+
+/* ---- writer side (drain_mutex held) ---- */
+
+static void sink_open(ai_os_log_sink_t *sink) {
+    struct stat st;
+
+    sink->file = fopen(sink->path, "a");
+    if (!sink->file) {
+        sink->file = stderr;
+        sink->size = 0;
+        return;
+    }
+    sink->size = fstat(fileno(sink->file), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+static void sink_rotate(ai_os_log_sink_t *sink) {
+    char rotated[512];
+
+    fclose(sink->file);
+    snprintf(rotated, sizeof(rotated), "%s.old", sink->path);
+    rename(sink->path, rotated);
+    sink_open(sink);
+}
+
+static void sink_write(ai_os_log_sink_t *sink, const log_record_t *rec) {
+    char prefix[64] = "";
+    size_t prefix_len = 0;
+    int newline = rec->len == 0 || rec->text[rec->len - 1] != '\n';
+
+    if (!sink->registered) {
+        sink->registered = 1;
+        sink->next = log_state.sinks;
+        log_state.sinks = sink;
+    }
+    if (!sink->file) {
+        sink_open(sink);
+    }
+    if (sink->file != stderr && sink->size >= AI_OS_LOG_MAX_SIZE) {
+        sink_rotate(sink);
+    }
+
+    if (sink->flags & AI_OS_LOG_TIMESTAMP) {
+        struct tm tm;
+        char stamp[32];
+        localtime_r(&rec->when, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        prefix_len = (size_t)snprintf(prefix, sizeof(prefix), "[%s] %s: ", stamp, level_names[rec->level]);
+        fwrite(prefix, 1, prefix_len, sink->file);
+    }
+    fwrite(rec->text, 1, rec->len, sink->file);
+    if (newline) {
+        fputc('\n', sink->file);
+    }
+    sink->size += prefix_len + rec->len + (size_t)newline;
+
+    if (sink->flags & AI_OS_LOG_SYSLOG) {
+        syslog(level_priorities[rec->level], "%.*s", (int)rec->len, rec->text);
+    }
+}
+
+static void report_dropped(ai_os_log_sink_t *sink, unsigned long long count) {
+    log_record_t rec;
+
+    rec.sink = sink;
+    rec.when = time(NULL);
+    rec.level = AI_OS_LOG_WARN;
+    rec.len = (unsigned short)snprintf(rec.text, sizeof(rec.text),
+                                       "[AI-OS Log] %llu lines dropped, log ring full\n", count);
+    sink_write(sink, &rec);
+}
+
+/* Write out everything queued so far; returns the number of lines */
+static int drain_locked(void) {
+    log_ring_t *prev = NULL;
+    log_ring_t *ring = __atomic_load_n(&log_state.rings, __ATOMIC_ACQUIRE);
+    int written = 0;
+
+    while (ring) {
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (ring->tail != head) {
+            log_record_t *rec = &ring->records[ring->tail & (LOG_RING_RECORDS - 1)];
+            unsigned long long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+            if (dropped) {
+                report_dropped(rec->sink, dropped);
+            }
+            sink_write(rec->sink, rec);
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+            written++;
+        }
+
+        /* Producers only ever push at the list head, so any other ring
+         * whose thread is gone can be unlinked without a CAS */
+        log_ring_t *next = ring->next;
+        if (prev && __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+            ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            prev->next = next;
+            free(ring);
+        } else {
+            prev = ring;
+        }
+        ring = next;
+    }
+
+    if (written) {
+        for (ai_os_log_sink_t *sink = log_state.sinks; sink; sink = sink->next) {
+            if (sink->file) fflush(sink->file);
+        }
+    }
+    return written;
+}
+
+/* Caller holds drain_mutex, which keeps the writer from freeing rings */
+static int rings_pending(void) {
+    for (log_ring_t *ring = __atomic_load_n(&log_state.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        if (ring->tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) return 1;
+    }
+    return 0;
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&log_state.drain_mutex);
+        int written = drain_locked();
+        pthread_mutex_unlock(&log_state.drain_mutex);
+        if (written) {
+            continue;
+        }
+
+        /* Announce the nap before the last look, so a producer that
+         * publishes after the look sees the flag and posts */
+        __atomic_store_n(&log_state.sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&log_state.drain_mutex);
+        int pending = rings_pending();
+        pthread_mutex_unlock(&log_state.drain_mutex);
+        if (!pending) {
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_nsec += LOG_WRITER_IDLE_MS * 1000000L;
+            if (wake.tv_nsec >= 1000000000L) {
+                wake.tv_sec++;
+                wake.tv_nsec -= 1000000000L;
+            }
+            while (sem_timedwait(&log_state.wake, &wake) != 0 && errno == EINTR) {
+            }
+        }
+        __atomic_store_n(&log_state.sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+/* ---- process lifecycle ---- */
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&log_state.drain_mutex);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&log_state.drain_mutex);
+}
+
+/* The writer does not survive fork; the child starts its own on first use
+ * and reopens its sinks, so it never writes through the parent's FILEs.
+ * Lines queued before the fork are the parent's to write. */
+static void fork_child(void) {
+    for (log_ring_t *ring = log_state.rings; ring; ring = ring->next) {
+        ring->tail = ring->head;
+        ring->dropped = 0;
+        if (ring != thread_ring) ring->dead = 1;
+    }
+    for (ai_os_log_sink_t *sink = log_state.sinks; sink; sink = sink->next) {
+        sink->file = NULL;
+        sink->registered = 0;
+    }
+    log_state.sinks = NULL;
+    log_state.writer_pid = 0;
+    pthread_mutex_unlock(&log_state.drain_mutex);
+}
+
+static void ring_release(void *ring) {
+    __atomic_store_n(&((log_ring_t *)ring)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void at_exit(void) {
+    ai_os_log_flush();
+}
+
+static void key_init(void) {
+    const char *level = getenv("AI_OS_LOG_LEVEL");
+
+    ai_os_log_set_level(ai_os_log_level_from_name(level));
+    pthread_key_create(&log_state.ring_key, ring_release);
+    sem_init(&log_state.wake, 0, 0);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    atexit(at_exit);
+}
+
+static void start_writer(void) {
+    pthread_mutex_lock(&log_state.start_mutex);
+    if (log_state.writer_pid != getpid()) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, writer_thread, NULL) == 0) {
+            __atomic_store_n(&log_state.writer_pid, getpid(), __ATOMIC_RELEASE);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&log_state.start_mutex);
+}
+
+static log_ring_t *get_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    log_ring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->next = __atomic_load_n(&log_state.rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&log_state.rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    pthread_setspecific(log_state.ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/* ---- producer side ---- */
+
+void ai_os_logv(ai_os_log_sink_t *sink, int level, const char *fmt, va_list args) {
+    if (level < __atomic_load_n(&ai_os_log_threshold, __ATOMIC_RELAXED) || !sink) {
+        return;
+    }
+    if (level > AI_OS_LOG_ERROR) {
+        level = AI_OS_LOG_ERROR;
+    }
+
+    pthread_once(&log_state.key_once, key_init);
+    if (__atomic_load_n(&log_state.writer_pid, __ATOMIC_ACQUIRE) != getpid()) {
+        start_writer();
+    }
+
+    log_ring_t *ring = get_ring();
+    if (!ring) {
+        __atomic_add_fetch(&log_state.dropped_total, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    unsigned int head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_RECORDS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&log_state.dropped_total, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_record_t *rec = &ring->records[head & (LOG_RING_RECORDS - 1)];
+    int len = vsnprintf(rec->text, sizeof(rec->text), fmt, args);
+    if (len < 0) {
+        len = 0;
+    } else if ((size_t)len >= sizeof(rec->text)) {
+        len = sizeof(rec->text) - 1;    /* truncated; keep the line break */
+        rec->text[len - 1] = '\n';
+    }
+    rec->sink = sink;
+    rec->when = time(NULL);
+    rec->level = (unsigned short)level;
+    rec->len = (unsigned short)len;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&log_state.sleeping, __ATOMIC_SEQ_CST)) {
+        sem_post(&log_state.wake);
+    }
+}
+
+void ai_os_log(ai_os_log_sink_t *sink, int level, const char *fmt, ...) {
+    va_list args;
+
+    if (level < __atomic_load_n(&ai_os_log_threshold, __ATOMIC_RELAXED)) {
+        return;
+    }
+    va_start(args, fmt);
+    ai_os_logv(sink, level, fmt, args);
+    va_end(args);
+}
+
+/* Write out every line queued before the call, e.g. before exiting. Runs
+ * the drain on the calling thread, so it also works with no writer. */
+void ai_os_log_flush(void) {
+    struct timespec start, now;
+
+    if (!__atomic_load_n(&log_state.rings, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        pthread_mutex_lock(&log_state.drain_mutex);
+        drain_locked();
+        int pending = rings_pending();
+        pthread_mutex_unlock(&log_state.drain_mutex);
+        if (!pending) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > LOG_FLUSH_WAIT_MS) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * AI-OS Logging
+ * File: userspace/ai_os_log.h
+ *
+ * One logging subsystem for every component (ai_os_log.c). A component
+ * declares a static sink for its log file and logs through it:
+ *
+ *     static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/x.log", 0);
+ *     ai_os_log(&log_sink, AI_OS_LOG_INFO, "started %d workers\n", n);
+ *
+ * The calling thread only checks the level and formats into its own ring
+ * buffer; a background writer does the file I/O, rotation and syslog.
+ */
+
+#ifndef AI_OS_LOG_H
+#define AI_OS_LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#define AI_OS_LOG_DEBUG 0
+#define AI_OS_LOG_INFO  1
+#define AI_OS_LOG_WARN  2
+#define AI_OS_LOG_ERROR 3
+
+/* Sink flags */
+#define AI_OS_LOG_TIMESTAMP 0x1     /* prefix "[date time] LEVEL: " */
+#define AI_OS_LOG_SYSLOG    0x2     /* mirror each line to syslog */
+
+#define AI_OS_LOG_MAX_SIZE (1024 * 1024)   /* rotate to <path>.old beyond this */
+
+typedef struct ai_os_log_sink {
+    const char *path;
+    unsigned int flags;
+    /* Owned by the writer thread */
+    FILE *file;
+    size_t size;
+    int registered;
+    struct ai_os_log_sink *next;
+} ai_os_log_sink_t;
+
+#define AI_OS_LOG_SINK(path, flags) { (path), (flags), NULL, 0, 0, NULL }
+
+/* Lines below this level are dropped before they are formatted. Starts
+ * at AI_OS_LOG_LEVEL from the environment (debug, info, warn, error). */
+extern int ai_os_log_threshold;
+
+void ai_os_log(ai_os_log_sink_t *sink, int level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void ai_os_logv(ai_os_log_sink_t *sink, int level, const char *fmt, va_list args);
+int ai_os_log_level_from_name(const char *name);
+void ai_os_log_set_level(int level);
+void ai_os_log_flush(void);
+unsigned long long ai_os_log_dropped(void);
+
+#endif /* AI_OS_LOG_H */
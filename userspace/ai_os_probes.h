@@ -0,0 +1,60 @@
+/*
+ * AI-OS Static Probes
+ * File: userspace/ai_os_probes.h
+ *
+ * USDT probes (provider "ai_os") on the daemon's request path, for bpftrace,
+ * perf and SystemTap against a running release build:
+ *
+ *     bpftrace -e 'usdt:/usr/local/bin/ai-os-daemon:ai_os:inference_done
+ *                  { @[str(arg1)] = hist(arg3); }'
+ *
+ * Each probe site compiles to a single nop plus a note in .note.stapsdt
+ * recording where its arguments live; nothing runs until a tracer attaches.
+ * The arguments are still computed, so keep them to values already at hand.
+ *
+ * The probes come from <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel,
+ * header only). Without it, or with -DAI_OS_NO_PROBES, they compile away.
+ *
+ * Probe                 Arguments
+ * client_accept         session_id, socket fd
+ * request_start         request_no, session_id, request bytes
+ * request_parse         request_no, action, request bytes
+ * context_refresh_start request_no
+ * context_refresh_done  request_no, elapsed ns
+ * cache_lookup          request_no, command, hit (speculation cache)
+ * inference_start       request_no, model, command bytes
+ * inference_done        request_no, model, result, elapsed ns, reply bytes
+ * exec_start            request_no, command
+ * exec_done             request_no, exit code, output bytes
+ * request_done          request_no, action, status, response bytes
+ * response_send         request_no, bytes sent (-1 on error)
+ */
+
+#ifndef AI_OS_PROBES_H
+#define AI_OS_PROBES_H
+
+#if !defined(AI_OS_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AI_OS_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef AI_OS_HAVE_PROBES
+#define AI_OS_PROBE1(name, a1) DTRACE_PROBE1(ai_os, name, a1)
+#define AI_OS_PROBE2(name, a1, a2) DTRACE_PROBE2(ai_os, name, a1, a2)
+#define AI_OS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(ai_os, name, a1, a2, a3)
+#define AI_OS_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(ai_os, name, a1, a2, a3, a4)
+#define AI_OS_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(ai_os, name, a1, a2, a3, a4, a5)
+#else
+/* sizeof keeps probe-only variables used without evaluating anything */
+#define AI_OS_PROBE1(name, a1) do { (void)sizeof(a1); } while (0)
+#define AI_OS_PROBE2(name, a1, a2) do { (void)sizeof(a1); (void)sizeof(a2); } while (0)
+#define AI_OS_PROBE3(name, a1, a2, a3) do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); } while (0)
+#define AI_OS_PROBE4(name, a1, a2, a3, a4) \
+    do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); (void)sizeof(a4); } while (0)
+#define AI_OS_PROBE5(name, a1, a2, a3, a4, a5) \
+    do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); (void)sizeof(a4); (void)sizeof(a5); } while (0)
+#endif
+
+#endif /* AI_OS_PROBES_H */
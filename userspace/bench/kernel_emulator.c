@@ -0,0 +1,327 @@
+/*
+ * Kernel Module Emulator for AI-OS
+ * File: userspace/bench/kernel_emulator.c
+ *
+ * Userspace stand-in for ai_os.ko. Speaks the kernel bridge wire protocol
+ * (struct ai_netlink_msg) over a SOCK_SEQPACKET socketpair, so the real
+ * kernel_bridge.c can be driven without root or a loaded module. Requests
+ * are injected at a configurable rate and the bridge's throughput and
+ * per-request latency are reported.
+ *
+ * The interpretation backend is replaced by a mock with a fixed service
+ * time, so the numbers measure the bridge itself and not Ollama.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "../ai_os_common.h"
+
+#define EMU_DEFAULT_REQUESTS 2000
+#define EMU_DEFAULT_COMMAND "list files in current directory"
+#define EMU_RECV_TIMEOUT_SEC 10
+
+/* Emulator configuration */
+typedef struct {
+    int requests;            /* Total requests to inject */
+    double rate;             /* Requests per second, 0 = as fast as possible */
+    int window;              /* Max outstanding requests, 0 = unbounded */
+    long service_us;         /* Mock backend service time */
+    int fail_every;          /* Mock backend fails every Nth request, 0 = never */
+    int verbose;             /* Keep bridge logging on stderr */
+    const char *command;     /* Natural language payload */
+} emu_config_t;
+
+/* Emulator state shared by the injector and collector threads */
+static struct {
+    emu_config_t cfg;
+    int fd;                          /* Kernel side of the socketpair */
+    struct timespec *sent_at;        /* Indexed by request_id - 1 */
+    double *latency_us;              /* Indexed by completion order */
+    int completed;
+    int failed;
+    int outstanding;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} g_emu = {
+    .fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static double elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+/* Mock interpretation backend linked in place of ollama_client.c */
+int ollama_interpret_command(const char *natural_command, const char *context,
+                             char *shell_command, size_t command_size) {
+    static int calls = 0;
+    (void)context;
+
+    if (g_emu.cfg.service_us > 0) {
+        usleep(g_emu.cfg.service_us);
+    }
+
+    calls++;
+    if (g_emu.cfg.fail_every > 0 && calls % g_emu.cfg.fail_every == 0) {
+        return -1;
+    }
+
+    snprintf(shell_command, command_size, "echo '%s'", natural_command);
+    return 0;
+}
+
+/* Send one AI_OS_MSG_INTERPRET message, as ai_os.ko would */
+static int emu_send_request(int request_id) {
+    struct ai_netlink_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(msg) - sizeof(struct nlmsghdr));
+    msg.nlh.nlmsg_pid = 0; /* Kernel */
+    msg.msg_type = AI_OS_MSG_INTERPRET;
+    msg.request_id = request_id;
+    msg.pid = getpid();
+    strncpy(msg.data, g_emu.cfg.command, sizeof(msg.data) - 1);
+
+    if (send(g_emu.fd, &msg, msg.nlh.nlmsg_len, 0) < 0) {
+        fprintf(stdout, "Kernel Emulator: Failed to send request %d: %s\n", request_id, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Injector thread: open-loop schedule at cfg.rate, bounded by cfg.window */
+static void *emu_injector_thread(void *arg) {
+    struct timespec start, next;
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < g_emu.cfg.requests; i++) {
+        if (g_emu.cfg.rate > 0) {
+            double offset = i / g_emu.cfg.rate;
+            next = start;
+            next.tv_sec += (time_t)offset;
+            next.tv_nsec += (long)((offset - (time_t)offset) * 1e9);
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        pthread_mutex_lock(&g_emu.mutex);
+        while (g_emu.cfg.window > 0 && g_emu.outstanding >= g_emu.cfg.window) {
+            pthread_cond_wait(&g_emu.cond, &g_emu.mutex);
+        }
+        g_emu.outstanding++;
+        pthread_mutex_unlock(&g_emu.mutex);
+
+        /* Latency is measured from the scheduled time, so a stalled bridge
+         * cannot hide its queueing delay (no coordinated omission) */
+        if (g_emu.cfg.rate > 0) {
+            g_emu.sent_at[i] = next;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &g_emu.sent_at[i]);
+        }
+
+        if (emu_send_request(i + 1) != 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Collector: read AI_OS_MSG_RESPONSE messages until all requests complete */
+static int emu_collect_responses(void) {
+    struct ai_netlink_msg msg;
+    struct timeval tv = { EMU_RECV_TIMEOUT_SEC, 0 };
+
+    setsockopt(g_emu.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while (g_emu.completed < g_emu.cfg.requests) {
+        ssize_t len = recv(g_emu.fd, &msg, sizeof(msg), 0);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stdout, "Kernel Emulator: Receive failed after %d responses: %s\n",
+                    g_emu.completed, strerror(errno));
+            return -1;
+        }
+        if ((size_t)len < NLMSG_LENGTH(0) || msg.msg_type != AI_OS_MSG_RESPONSE) {
+            continue;
+        }
+        if (msg.request_id < 1 || msg.request_id > g_emu.cfg.requests) {
+            fprintf(stdout, "Kernel Emulator: Unexpected request id %d\n", msg.request_id);
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock(&g_emu.mutex);
+        g_emu.latency_us[g_emu.completed++] = elapsed_us(&g_emu.sent_at[msg.request_id - 1], &now);
+        /* Same failure convention as ai_netlink_receive() in ai_os.ko */
+        if (strstr(msg.data, "ERROR:") || strstr(msg.data, "UNSAFE:")) {
+            g_emu.failed++;
+        }
+        g_emu.outstanding--;
+        pthread_cond_signal(&g_emu.cond);
+        pthread_mutex_unlock(&g_emu.mutex);
+    }
+
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) return 0.0;
+    int idx = (int)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void print_report(double wall_us) {
+    int n = g_emu.completed;
+    double sum = 0.0;
+
+    qsort(g_emu.latency_us, n, sizeof(double), compare_double);
+    for (int i = 0; i < n; i++) sum += g_emu.latency_us[i];
+
+    printf("Kernel bridge benchmark\n");
+    printf("  requests:     %d sent, %d completed, %d failed\n",
+           g_emu.cfg.requests, n, g_emu.failed);
+    printf("  offered rate: %s", g_emu.cfg.rate > 0 ? "" : "unthrottled\n");
+    if (g_emu.cfg.rate > 0) printf("%.0f req/s\n", g_emu.cfg.rate);
+    printf("  window:       %d\n", g_emu.cfg.window);
+    printf("  service time: %ld us (mock backend)\n", g_emu.cfg.service_us);
+    printf("  throughput:   %.0f req/s\n", wall_us > 0 ? n / (wall_us / 1e6) : 0.0);
+    printf("  latency (us): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           n ? sum / n : 0.0,
+           percentile(g_emu.latency_us, n, 50),
+           percentile(g_emu.latency_us, n, 90),
+           percentile(g_emu.latency_us, n, 99),
+           percentile(g_emu.latency_us, n, 99.9),
+           n ? g_emu.latency_us[n - 1] : 0.0);
+}
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n\n", program_name);
+    printf("Drive kernel_bridge.c through an emulated ai_os.ko and report\n");
+    printf("throughput and latency. Needs no root and no kernel module.\n\n");
+    printf("Options:\n");
+    printf("  -n, --requests N     Requests to inject (default %d)\n", EMU_DEFAULT_REQUESTS);
+    printf("  -r, --rate R         Offered load in req/s, 0 = unthrottled (default 0)\n");
+    printf("  -w, --window W       Max outstanding requests, 0 = unbounded (default 64)\n");
+    printf("  -s, --service-us US  Mock backend service time (default 0)\n");
+    printf("  -f, --fail-every N   Mock backend fails every Nth request (default 0)\n");
+    printf("  -c, --command TEXT   Natural language payload\n");
+    printf("  -v, --verbose        Show bridge log output on stderr\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    int sv[2];
+    pthread_t injector;
+    struct timespec start, end;
+
+    g_emu.cfg.requests = EMU_DEFAULT_REQUESTS;
+    g_emu.cfg.rate = 0;
+    g_emu.cfg.window = 64;
+    g_emu.cfg.service_us = 0;
+    g_emu.cfg.fail_every = 0;
+    g_emu.cfg.verbose = 0;
+    g_emu.cfg.command = EMU_DEFAULT_COMMAND;
+
+    static struct option long_options[] = {
+        {"requests", required_argument, 0, 'n'},
+        {"rate", required_argument, 0, 'r'},
+        {"window", required_argument, 0, 'w'},
+        {"service-us", required_argument, 0, 's'},
+        {"fail-every", required_argument, 0, 'f'},
+        {"command", required_argument, 0, 'c'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:r:w:s:f:c:vh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': g_emu.cfg.requests = atoi(optarg); break;
+            case 'r': g_emu.cfg.rate = atof(optarg); break;
+            case 'w': g_emu.cfg.window = atoi(optarg); break;
+            case 's': g_emu.cfg.service_us = atol(optarg); break;
+            case 'f': g_emu.cfg.fail_every = atoi(optarg); break;
+            case 'c': g_emu.cfg.command = optarg; break;
+            case 'v': g_emu.cfg.verbose = 1; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    if (g_emu.cfg.requests <= 0) {
+        fprintf(stdout, "Kernel Emulator: --requests must be positive\n");
+        return 1;
+    }
+
+    g_emu.sent_at = calloc(g_emu.cfg.requests, sizeof(*g_emu.sent_at));
+    g_emu.latency_us = calloc(g_emu.cfg.requests, sizeof(*g_emu.latency_us));
+    if (!g_emu.sent_at || !g_emu.latency_us) {
+        fprintf(stdout, "Kernel Emulator: Out of memory\n");
+        return 1;
+    }
+
+    /* Bridge logging falls back to stderr without /var/log/ai-os; keep the
+     * report readable unless asked otherwise */
+    if (!g_emu.cfg.verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        fprintf(stdout, "Kernel Emulator: socketpair failed: %s\n", strerror(errno));
+        return 1;
+    }
+    g_emu.fd = sv[0];
+
+    if (kernel_bridge_start_attached(sv[1]) != 0) {
+        fprintf(stdout, "Kernel Emulator: Failed to start kernel bridge\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pthread_create(&injector, NULL, emu_injector_thread, NULL) != 0) {
+        fprintf(stdout, "Kernel Emulator: Failed to create injector thread\n");
+        kernel_bridge_cleanup_enhanced();
+        return 1;
+    }
+
+    int result = emu_collect_responses();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_join(injector, NULL);
+    kernel_bridge_cleanup_enhanced();
+    close(g_emu.fd);
+
+    print_report(elapsed_us(&start, &end));
+
+    free(g_emu.sent_at);
+    free(g_emu.latency_us);
+    return result == 0 ? 0 : 1;
+}
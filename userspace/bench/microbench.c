@@ -0,0 +1,701 @@
+/*
+ * Daemon Microbenchmarks for AI-OS
+ * File: userspace/bench/microbench.c
+ *
+ * Times the daemon's per-request CPU work in isolation: request dispatch
+ * through handle_client_request, classify matching, task classification
+ * and model selection, context creation, refresh and serialization,
+ * feedback lookup, construction of the Ollama generate body, the safety
+ * policy check and the shell syntax check of model output. Nothing here
+ * talks to Ollama or opens a socket.
+ *
+ * Each case is calibrated to a fixed sample length, warmed up, then timed
+ * over a number of samples; the report gives the median cost per call
+ * and its spread. Samples can be saved as a baseline and a later build
+ * compared against it: a case is flagged when its median moved by more
+ * than the threshold and a Mann-Whitney U test says the shift is not
+ * noise. `make bench` and `make bench-baseline` drive this.
+ *
+ * malloc, calloc and realloc are interposed here (and passed on to glibc)
+ * so each case also reports the heap allocations one call makes, json-c's
+ * and libc's included; the request pipeline's target is zero.
+ *
+ * Before timing, the safety policy is checked against a table of
+ * commands with known verdicts, so the safety cases measure the paths
+ * they are named for.
+ *
+ * The file-local functions under test are exported by building their
+ * sources with -DAI_OS_BENCH (AI_OS_BENCH_VISIBLE in ai_os_common.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+#include <json-c/json.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+
+#define BENCH_DEFAULT_SAMPLES 20
+#define BENCH_DEFAULT_WARMUP_MS 100
+#define BENCH_DEFAULT_SAMPLE_MS 10
+#define BENCH_DEFAULT_THRESHOLD 10.0    /* percent change of the median */
+#define BENCH_ALPHA 0.01                /* significance for the U test */
+#define BENCH_MAX_ITERS 100000000L
+#define BENCH_FEEDBACK_ENTRIES 999      /* learning_system.c keeps 1000 */
+#define BENCH_BASELINE_VERSION 1
+#define BENCH_RESPONSE_SIZE (64 * 1024)  /* the daemon's MAX_RESPONSE_LEN */
+
+/* ai_daemon.c, model_manager.c and ollama_client.c with -DAI_OS_BENCH */
+int handle_client_request(ai_client_t *client, const char *request, char *response, size_t response_size);
+const char *classify_input(const char *command);
+const char *classify_task_type(const char *command);
+struct ai_model_config *select_best_model(const char *task_type);
+int build_generate_body(char *buf, size_t size, char *system, size_t system_size,
+                        const char *prompt, const char *context);
+
+/* learning_system.c */
+void learning_system_set_file(const char *path);
+void learning_system_load_feedback(void);
+int learning_system_suggest(const char *natural, char *suggested, size_t size);
+
+/* One benchmark case */
+typedef struct {
+    const char *name;
+    const char *description;
+    void (*run)(void);
+} bench_case_t;
+
+/* Timing results of one case */
+typedef struct {
+    double *samples;        /* ns per call, one per sample */
+    int count;
+    long iters;             /* calls per sample */
+    double median;
+    double mad;             /* median absolute deviation */
+    double min;
+    double heap_allocs;     /* malloc/calloc/realloc per call */
+} bench_result_t;
+
+/* Benchmark configuration */
+typedef struct {
+    int samples;
+    long long warmup_ns;
+    long long sample_ns;
+    double threshold;
+    const char *filter;
+    const char *save_path;
+    const char *compare_path;
+    int verbose;
+} bench_config_t;
+
+static bench_config_t g_cfg;
+
+/* State the cases run against */
+static struct {
+    ai_client_t client;
+    ai_context_t context;
+    char response[BENCH_RESPONSE_SIZE];
+    char system_prompt[4096];
+    char suggestion[512];
+    char oldest_feedback[64];
+} g_bench;
+
+/* Keeps results observable so calls are not optimized away */
+static volatile unsigned long g_sink;
+
+/* ---- heap accounting ---- */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Counted only on the measuring thread, only while armed */
+static __thread int g_heap_armed;
+static __thread unsigned long g_heap_allocs;
+
+void *malloc(size_t size) {
+    g_heap_allocs += g_heap_armed;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    g_heap_allocs += g_heap_armed;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    g_heap_allocs += g_heap_armed;
+    return __libc_realloc(ptr, size);
+}
+
+/* ---- cases ---- */
+
+static void run_request(const char *request) {
+    handle_client_request(&g_bench.client, request, g_bench.response, sizeof(g_bench.response));
+    g_sink += (unsigned char)g_bench.response[0];
+}
+
+static void bench_dispatch_classify(void) {
+    run_request("{\"action\":\"classify\",\"command\":\"list files in current directory\",\"id\":7}");
+}
+
+static void bench_dispatch_context(void) {
+    run_request("{\"action\":\"get_context\",\"id\":7}");
+}
+
+static void bench_dispatch_unknown(void) {
+    run_request("{\"action\":\"noop\",\"command\":\"list files in current directory\",\"id\":7}");
+}
+
+static void bench_classify_command(void) {
+    g_sink += (unsigned long)classify_input("compress the logs folder into a tarball");
+}
+
+static void bench_classify_chat(void) {
+    /* No command word matches, so every list is scanned */
+    g_sink += (unsigned long)classify_input("what is the weather like today");
+}
+
+static void bench_task_type(void) {
+    g_sink += (unsigned long)classify_task_type("compile the project and push it to github");
+}
+
+static void bench_select_model(void) {
+    g_sink += (unsigned long)select_best_model("dev_ops");
+}
+
+static void bench_context_create(void) {
+    ai_context_t ctx;
+    ai_context_create(&ctx, getpid());
+    g_sink += (unsigned char)ctx.username[0];
+}
+
+static void bench_context_update(void) {
+    ai_context_update(&g_bench.context);
+    g_sink += (unsigned char)g_bench.context.hostname[0];
+}
+
+static void bench_context_json(void) {
+    g_sink += (unsigned long)ai_context_to_json(&g_bench.context);
+    arena_reset(NULL);
+}
+
+static void bench_feedback_hit(void) {
+    /* Lookups walk newest first: the oldest entry is the slowest hit */
+    g_sink += learning_system_suggest(g_bench.oldest_feedback, g_bench.suggestion, sizeof(g_bench.suggestion));
+}
+
+static void bench_feedback_miss(void) {
+    g_sink += learning_system_suggest("never seen before", g_bench.suggestion, sizeof(g_bench.suggestion));
+}
+
+static void bench_generate_body(void) {
+    g_sink += (unsigned long)build_generate_body(g_bench.response, sizeof(g_bench.response),
+                                                 g_bench.system_prompt, sizeof(g_bench.system_prompt),
+                                                 "show disk usage of my home directory",
+                                                 ai_context_to_summary(&g_bench.context));
+}
+
+static void bench_safety_allow(void) {
+    g_sink += safety_policy_check("find . -name '*.log' -mtime +7 -print0 | xargs -0 gzip -9 && "
+                                  "ls -la \"$HOME/logs\" > /tmp/ai-os-bench.txt 2>&1 < /etc/passwd", NULL, 0);
+}
+
+static void bench_safety_block(void) {
+    g_sink += safety_policy_check("sudo -u root bash -c 'cd /tmp && r\"\"m -fr --one-file-system //'", NULL, 0);
+}
+
+static void bench_syntax_check(void) {
+    g_sink += shell_syntax_check("for f in $(find . -name '*.log' -mtime +7); do\n"
+                                 "    if [ -s \"$f\" ]; then gzip -9 \"$f\" && echo \"done: ${f##*/}\"; fi\n"
+                                 "done 2>/dev/null | tee /tmp/ai-os-bench.txt", NULL, 0);
+}
+
+static void bench_syntax_repair(void) {
+    char reply[] = "Here is the command you asked for:\n\n```bash\n$ ls -la --sort=size | head -n 20\n```\n\n"
+                   "This lists the twenty largest files.";
+    g_sink += shell_output_clean(reply, NULL, 0);
+}
+
+static const bench_case_t bench_cases[] = {
+    {"dispatch_classify", "handle_client_request, classify action", bench_dispatch_classify},
+    {"dispatch_get_context", "handle_client_request, get_context action", bench_dispatch_context},
+    {"dispatch_unknown", "handle_client_request, unknown action", bench_dispatch_unknown},
+    {"classify_command", "classify matching, command word found", bench_classify_command},
+    {"classify_chat", "classify matching, falls through to chat words", bench_classify_chat},
+    {"classify_task_type", "model_manager classify_task_type", bench_task_type},
+    {"select_best_model", "model_manager select_best_model", bench_select_model},
+    {"context_create", "ai_context_create (runs ps, ss and df)", bench_context_create},
+    {"context_update", "ai_context_update", bench_context_update},
+    {"context_to_json", "ai_context_to_json", bench_context_json},
+    {"feedback_hit", "learning_system_suggest, oldest of a full table", bench_feedback_hit},
+    {"feedback_miss", "learning_system_suggest, no match in a full table", bench_feedback_miss},
+    {"generate_body", "Ollama generate request with system prompt", bench_generate_body},
+    {"safety_allow", "safety_policy_check, pipeline that passes", bench_safety_allow},
+    {"safety_block", "safety_policy_check, rm -rf / behind sudo bash -c", bench_safety_block},
+    {"syntax_check", "shell_syntax_check, loop over a command substitution", bench_syntax_check},
+    {"syntax_repair", "shell_output_clean, fenced reply with prose around it", bench_syntax_repair},
+};
+
+#define BENCH_CASES ((int)(sizeof(bench_cases) / sizeof(bench_cases[0])))
+
+/* Verdicts the safety cases stand for: a policy that got these wrong would
+ * be timed on the wrong path, so they are checked before anything runs */
+static const struct {
+    const char *command;
+    int verdict;
+} safety_verdicts[] = {
+    {"grep root < /etc/passwd", SAFETY_ALLOW},
+    {"wc -l </etc/group", SAFETY_ALLOW},
+    {"sort 0</etc/passwd", SAFETY_ALLOW},
+    {"exec 3</etc/passwd", SAFETY_ALLOW},
+    {"cat <<EOF > /tmp/x\nroot\nEOF", SAFETY_ALLOW},
+    {"echo x > /etc/passwd", SAFETY_BLOCK},
+    {"echo x >> /etc/group", SAFETY_BLOCK},
+    {"echo x >| /etc/shadow", SAFETY_BLOCK},
+    {"ls &> /dev/sda", SAFETY_BLOCK},
+    {"exec 3<> /etc/passwd", SAFETY_BLOCK},
+    {"$(echo rm) -rf /", SAFETY_CONFIRM},
+    {"`echo rm` -rf /", SAFETY_CONFIRM},
+    {"/bin/r? -rf /", SAFETY_CONFIRM},
+    {"[ -f /etc/passwd ] && echo yes", SAFETY_ALLOW},
+    {"echo / | xargs rm -rf", SAFETY_CONFIRM},
+    {"echo -rf / | xargs rm", SAFETY_CONFIRM},
+    {"find . -name '*.o' | xargs gzip", SAFETY_ALLOW},
+    {"xargs rm -rf / < list", SAFETY_BLOCK},
+    {"busybox rm -rf /", SAFETY_BLOCK},
+    {"sudo -u root bash -c 'cd /tmp && r\"\"m -fr --one-file-system //'", SAFETY_BLOCK},
+    {"find / -exec rm -rf {} \\;", SAFETY_BLOCK},
+    {"find / -type d -exec rm -rf {} +", SAFETY_BLOCK},
+    {"find -L /tmp / -name core -execdir rm -rf '{}' ';'", SAFETY_BLOCK},
+    {"find . -name '*.o' -exec rm {} +", SAFETY_ALLOW},
+    {"find build -name '*.o' -exec rm -f {} +", SAFETY_ALLOW},
+    {"rm -rf \"$(pwd)\"", SAFETY_CONFIRM},
+    {"for d in /*; do rm -rf $d; done", SAFETY_CONFIRM},
+    {"rm $opts /", SAFETY_CONFIRM},
+    {"rm -rf $HOME", SAFETY_BLOCK},
+    {"rm -rf /opt/*", SAFETY_CONFIRM},
+    {"rm -rf build *.o", SAFETY_ALLOW},
+    {"echo x > \"$target\"", SAFETY_CONFIRM},
+    {"echo $HOME > out.txt", SAFETY_ALLOW},
+    {"kill -- -1", SAFETY_BLOCK},
+    {"kill -9 -1", SAFETY_BLOCK},
+    {"kill %1", SAFETY_ALLOW},
+};
+
+static int check_safety_verdicts(void) {
+    static const char *const names[] = {"allow", "confirm", "block"};
+    int wrong = 0;
+    for (size_t i = 0; i < sizeof(safety_verdicts) / sizeof(safety_verdicts[0]); i++) {
+        char reason[128];
+        int verdict = safety_policy_check(safety_verdicts[i].command, reason, sizeof(reason));
+        if (verdict != safety_verdicts[i].verdict) {
+            fprintf(stdout, "Microbench: safety policy says %s for '%s', expected %s (%s)\n",
+                    names[verdict], safety_verdicts[i].command, names[safety_verdicts[i].verdict],
+                    reason[0] ? reason : "no rule");
+            wrong++;
+        }
+    }
+    return wrong;
+}
+
+/* A full feedback table in a private temporary file */
+static int setup_feedback(void) {
+    char path[] = "/tmp/ai-os-bench-feedback.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stdout, "Microbench: mkstemp failed: %s\n", strerror(errno));
+        return -1;
+    }
+    close(fd);
+
+    json_object *root = json_object_new_array();
+    for (int i = 0; i < BENCH_FEEDBACK_ENTRIES; i++) {
+        char natural[64], interpreted[64];
+        snprintf(natural, sizeof(natural), "show the contents of folder %d", i);
+        snprintf(interpreted, sizeof(interpreted), "ls -la folder%d", i);
+
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "natural_command", json_object_new_string(natural));
+        json_object_object_add(entry, "interpreted_command", json_object_new_string(interpreted));
+        json_object_object_add(entry, "accepted", json_object_new_boolean(1));
+        json_object_object_add(entry, "model_used", json_object_new_string("bench"));
+        json_object_object_add(entry, "timestamp", json_object_new_int64(1700000000LL + i));
+        json_object_array_add(root, entry);
+    }
+    int written = json_object_to_file(path, root);
+    json_object_put(root);
+
+    if (written == 0) {
+        learning_system_set_file(path);
+        learning_system_load_feedback();
+    }
+    unlink(path);
+    snprintf(g_bench.oldest_feedback, sizeof(g_bench.oldest_feedback), "show the contents of folder 0");
+    return written == 0 ? 0 : -1;
+}
+
+/* ---- timing ---- */
+
+static long long time_iters(const bench_case_t *c, long iters) {
+    long long start = metrics_now_ns();
+    for (long i = 0; i < iters; i++) {
+        c->run();
+    }
+    return metrics_now_ns() - start;
+}
+
+/* Calls per sample so one sample lasts about the configured sample time */
+static long calibrate(const bench_case_t *c) {
+    long iters = 1;
+    for (;;) {
+        long long elapsed = time_iters(c, iters);
+        if (elapsed >= g_cfg.sample_ns || iters >= BENCH_MAX_ITERS) {
+            return iters;
+        }
+        long next = elapsed > 0 ? (long)(iters * 1.2 * g_cfg.sample_ns / elapsed) : iters * 10;
+        if (next <= iters) next = iters * 2;
+        if (next > iters * 10) next = iters * 10;
+        iters = next;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median_of(double *sorted, int n) {
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+static void summarize(bench_result_t *r) {
+    double *sorted = malloc(sizeof(double) * r->count);
+    if (!sorted) {
+        return;
+    }
+    memcpy(sorted, r->samples, sizeof(double) * r->count);
+    qsort(sorted, r->count, sizeof(double), compare_double);
+    r->min = sorted[0];
+    r->median = median_of(sorted, r->count);
+    for (int i = 0; i < r->count; i++) {
+        sorted[i] = fabs(sorted[i] - r->median);
+    }
+    qsort(sorted, r->count, sizeof(double), compare_double);
+    r->mad = median_of(sorted, r->count);
+    free(sorted);
+}
+
+static int run_case(const bench_case_t *c, bench_result_t *r) {
+    r->samples = calloc(g_cfg.samples, sizeof(double));
+    if (!r->samples) {
+        return -1;
+    }
+    r->iters = calibrate(c);
+
+    long long warm_until = metrics_now_ns() + g_cfg.warmup_ns;
+    while (metrics_now_ns() < warm_until) {
+        time_iters(c, r->iters);
+    }
+
+    for (int i = 0; i < g_cfg.samples; i++) {
+        r->samples[i] = (double)time_iters(c, r->iters) / r->iters;
+    }
+    r->count = g_cfg.samples;
+
+    /* Warm by now, so one-time setup (arena blocks, log rings) is not counted */
+    g_heap_allocs = 0;
+    g_heap_armed = 1;
+    time_iters(c, r->iters);
+    g_heap_armed = 0;
+    r->heap_allocs = (double)g_heap_allocs / r->iters;
+    summarize(r);
+    return 0;
+}
+
+/* Two-sided Mann-Whitney U test with the normal approximation and tie
+ * correction; the p-value that A and B come from the same distribution */
+typedef struct {
+    double value;
+    int group;
+} ranked_t;
+
+static int compare_ranked(const void *a, const void *b) {
+    return compare_double(&((const ranked_t *)a)->value, &((const ranked_t *)b)->value);
+}
+
+static double mann_whitney_p(const double *a, int na, const double *b, int nb) {
+    int n = na + nb;
+    ranked_t *all = malloc(sizeof(ranked_t) * n);
+    if (!all || na < 2 || nb < 2) {
+        free(all);
+        return 1.0;
+    }
+    for (int i = 0; i < na; i++) all[i] = (ranked_t){a[i], 0};
+    for (int i = 0; i < nb; i++) all[na + i] = (ranked_t){b[i], 1};
+    qsort(all, n, sizeof(ranked_t), compare_ranked);
+
+    double rank_sum_a = 0, ties = 0;
+    for (int i = 0; i < n;) {
+        int j = i;
+        while (j < n && all[j].value == all[i].value) j++;
+        double rank = (i + 1 + j) / 2.0;     /* midrank of positions i..j-1 */
+        double t = j - i;
+        ties += t * t * t - t;
+        for (int k = i; k < j; k++) {
+            if (all[k].group == 0) rank_sum_a += rank;
+        }
+        i = j;
+    }
+    free(all);
+
+    double u = rank_sum_a - na * (na + 1) / 2.0;
+    double mean = na * nb / 2.0;
+    double var = na * nb / 12.0 * ((n + 1) - ties / ((double)n * (n - 1)));
+    if (var <= 0) {
+        return 1.0;
+    }
+    double z = (fabs(u - mean) - 0.5) / sqrt(var);
+    return z > 0 ? erfc(z / sqrt(2.0)) : 1.0;
+}
+
+/* ---- baseline ---- */
+
+static int save_baseline(const char *path, const bench_result_t *results, const int *selected) {
+    json_object *root = json_object_new_object();
+    json_object *cases = json_object_new_object();
+    json_object_object_add(root, "version", json_object_new_int(BENCH_BASELINE_VERSION));
+    json_object_object_add(root, "created", json_object_new_int64((long long)time(NULL)));
+    for (int i = 0; i < BENCH_CASES; i++) {
+        if (!selected[i]) continue;
+        json_object *entry = json_object_new_object();
+        json_object *samples = json_object_new_array();
+        for (int s = 0; s < results[i].count; s++) {
+            json_object_array_add(samples, json_object_new_double(results[i].samples[s]));
+        }
+        json_object_object_add(entry, "iters", json_object_new_int64(results[i].iters));
+        json_object_object_add(entry, "samples_ns", samples);
+        json_object_object_add(cases, bench_cases[i].name, entry);
+    }
+    json_object_object_add(root, "cases", cases);
+
+    int result = json_object_to_file(path, root);
+    json_object_put(root);
+    if (result != 0) {
+        fprintf(stdout, "Microbench: cannot write baseline %s\n", path);
+        return -1;
+    }
+    printf("Baseline saved to %s\n", path);
+    return 0;
+}
+
+/* Samples of NAME in the baseline; returns their count, 0 if absent */
+static int baseline_samples(json_object *cases, const char *name, double **samples) {
+    json_object *entry, *array;
+    if (!cases || !json_object_object_get_ex(cases, name, &entry) ||
+        !json_object_object_get_ex(entry, "samples_ns", &array)) {
+        return 0;
+    }
+    int n = json_object_array_length(array);
+    *samples = n > 0 ? malloc(sizeof(double) * n) : NULL;
+    if (!*samples) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        (*samples)[i] = json_object_get_double(json_object_array_get_idx(array, i));
+    }
+    return n;
+}
+
+static json_object *load_baseline(const char *path) {
+    if (access(path, R_OK) != 0) {
+        printf("No baseline at %s; run `make bench-baseline` to record one\n\n", path);
+        return NULL;
+    }
+    json_object *root = json_object_from_file(path);
+    json_object *version, *cases;
+    if (!root || !json_object_object_get_ex(root, "version", &version) ||
+        json_object_get_int(version) != BENCH_BASELINE_VERSION ||
+        !json_object_object_get_ex(root, "cases", &cases)) {
+        printf("Baseline %s is not usable; ignoring it\n\n", path);
+        if (root) json_object_put(root);
+        return NULL;
+    }
+    return root;
+}
+
+/* ---- report ---- */
+
+static void print_header(int comparing) {
+    printf("%-22s %12s %8s %12s %10s %7s", "case", "median(ns)", "mad", "min(ns)", "calls", "allocs");
+    if (comparing) {
+        printf(" %12s %8s %8s  %s", "base(ns)", "change", "p", "verdict");
+    }
+    printf("\n");
+}
+
+/* Prints one row; returns 1 for a regression */
+static int print_row(const bench_case_t *c, const bench_result_t *r, json_object *cases) {
+    printf("%-22s %12.1f %7.1f%% %12.1f %10ld %7.1f", c->name, r->median,
+           r->median > 0 ? 100.0 * r->mad / r->median : 0.0, r->min, r->iters, r->heap_allocs);
+    if (!cases) {
+        printf("\n");
+        return 0;
+    }
+
+    double *base = NULL;
+    int n = baseline_samples(cases, c->name, &base);
+    if (n == 0) {
+        printf(" %12s %8s %8s  %s\n", "-", "-", "-", "new");
+        return 0;
+    }
+
+    bench_result_t b = { .samples = base, .count = n };
+    summarize(&b);
+    double change = b.median > 0 ? 100.0 * (r->median - b.median) / b.median : 0.0;
+    double p = mann_whitney_p(r->samples, r->count, base, n);
+    int significant = p < BENCH_ALPHA && fabs(change) > g_cfg.threshold;
+    const char *verdict = !significant ? "same" : change > 0 ? "SLOWER" : "faster";
+
+    printf(" %12.1f %+7.1f%% %8.4f  %s\n", b.median, change, p, verdict);
+    free(base);
+    return significant && change > 0;
+}
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n\n", program_name);
+    printf("Time the daemon's request hot paths without Ollama or a socket,\n");
+    printf("optionally against a saved baseline.\n\n");
+    printf("Options:\n");
+    printf("  -n, --samples N       Timed samples per case (default %d)\n", BENCH_DEFAULT_SAMPLES);
+    printf("  -w, --warmup MS       Warmup per case (default %d ms)\n", BENCH_DEFAULT_WARMUP_MS);
+    printf("  -t, --sample-ms MS    Target length of one sample (default %d ms)\n", BENCH_DEFAULT_SAMPLE_MS);
+    printf("  -f, --filter TEXT     Only cases whose name contains TEXT\n");
+    printf("  -s, --save PATH       Save the samples as a baseline\n");
+    printf("  -c, --compare PATH    Compare with the baseline at PATH\n");
+    printf("  -T, --threshold PCT   Median change that counts as a regression (default %.0f%%)\n",
+           BENCH_DEFAULT_THRESHOLD);
+    printf("  -l, --list            List the cases\n");
+    printf("  -v, --verbose         Show daemon log output on stderr\n");
+    printf("  -h, --help            Show this help message\n\n");
+    printf("Exits 2 when a case is significantly slower than the baseline.\n");
+}
+
+int main(int argc, char *argv[]) {
+    int list = 0;
+
+    g_cfg.samples = BENCH_DEFAULT_SAMPLES;
+    g_cfg.warmup_ns = BENCH_DEFAULT_WARMUP_MS * 1000000LL;
+    g_cfg.sample_ns = BENCH_DEFAULT_SAMPLE_MS * 1000000LL;
+    g_cfg.threshold = BENCH_DEFAULT_THRESHOLD;
+
+    static struct option long_options[] = {
+        {"samples", required_argument, 0, 'n'},
+        {"warmup", required_argument, 0, 'w'},
+        {"sample-ms", required_argument, 0, 't'},
+        {"filter", required_argument, 0, 'f'},
+        {"save", required_argument, 0, 's'},
+        {"compare", required_argument, 0, 'c'},
+        {"threshold", required_argument, 0, 'T'},
+        {"list", no_argument, 0, 'l'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:w:t:f:s:c:T:lvh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': g_cfg.samples = atoi(optarg); break;
+            case 'w': g_cfg.warmup_ns = atol(optarg) * 1000000LL; break;
+            case 't': g_cfg.sample_ns = atol(optarg) * 1000000LL; break;
+            case 'f': g_cfg.filter = optarg; break;
+            case 's': g_cfg.save_path = optarg; break;
+            case 'c': g_cfg.compare_path = optarg; break;
+            case 'T': g_cfg.threshold = atof(optarg); break;
+            case 'l': list = 1; break;
+            case 'v': g_cfg.verbose = 1; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    if (list) {
+        for (int i = 0; i < BENCH_CASES; i++) {
+            printf("%-22s %s\n", bench_cases[i].name, bench_cases[i].description);
+        }
+        return 0;
+    }
+    if (g_cfg.samples < 2 || g_cfg.sample_ns <= 0) {
+        fprintf(stdout, "Microbench: --samples must be at least 2 and --sample-ms positive\n");
+        return 1;
+    }
+
+    /* Daemon logging falls back to stderr without /var/log/ai-os, and
+     * writing it is not what is being measured */
+    ai_os_log_set_level(AI_OS_LOG_WARN);
+    if (!g_cfg.verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+    }
+
+    if (check_safety_verdicts() != 0) {
+        return 1;
+    }
+
+    ai_context_create(&g_bench.context, getpid());
+    ai_context_create(&g_bench.client.context, getpid());
+    g_bench.client.client_pid = getpid();
+    if (setup_feedback() != 0) {
+        fprintf(stdout, "Microbench: feedback cases will measure an empty table\n");
+    }
+
+    json_object *baseline = g_cfg.compare_path ? load_baseline(g_cfg.compare_path) : NULL;
+    json_object *baseline_cases = NULL;
+    if (baseline) {
+        json_object_object_get_ex(baseline, "cases", &baseline_cases);
+    }
+
+    bench_result_t results[BENCH_CASES];
+    int selected[BENCH_CASES];
+    int regressions = 0;
+    memset(results, 0, sizeof(results));
+
+    printf("AI-OS daemon microbenchmarks: %d samples of ~%lld ms per case, %lld ms warmup\n",
+           g_cfg.samples, g_cfg.sample_ns / 1000000, g_cfg.warmup_ns / 1000000);
+    print_header(baseline_cases != NULL);
+    for (int i = 0; i < BENCH_CASES; i++) {
+        selected[i] = !g_cfg.filter || strstr(bench_cases[i].name, g_cfg.filter) != NULL;
+        if (!selected[i]) continue;
+        if (run_case(&bench_cases[i], &results[i]) != 0) {
+            fprintf(stdout, "Microbench: out of memory\n");
+            return 1;
+        }
+        regressions += print_row(&bench_cases[i], &results[i], baseline_cases);
+        fflush(stdout);
+    }
+
+    if (baseline_cases) {
+        printf("\n%d regression(s) beyond %.1f%% at p < %.2f\n", regressions, g_cfg.threshold, BENCH_ALPHA);
+    }
+    if (baseline) {
+        json_object_put(baseline);
+    }
+
+    int result = regressions ? 2 : 0;
+    if (g_cfg.save_path && save_baseline(g_cfg.save_path, results, selected) != 0) {
+        result = 1;
+    }
+    for (int i = 0; i < BENCH_CASES; i++) {
+        free(results[i].samples);
+    }
+    return result;
+}
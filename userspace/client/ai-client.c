@@ -8,11 +8,13 @@
  #include <string.h>
  #include <unistd.h>
  #include <getopt.h>
- #include <sys/stat.h>
  #include <stdarg.h>
  #include <time.h>
  #include <pthread.h>
+ #include <signal.h>
+ #include <errno.h>
  #include <json-c/json.h>
+ #include "../ai_os_log.h"
 
  /* Include our client library functions */
  extern int ai_client_connect(void);
@@ -23,35 +25,28 @@
  extern int ai_set_model(const char *model_name);
  extern int ai_get_context(char *context_info, size_t info_size);
  extern int ai_classify_input(const char *input, char *classification, size_t classification_size);
+ extern int ai_speculate_command(const char *natural_command);
+ extern int ai_get_metrics(char *metrics_text, size_t text_size);
+ extern int ai_trace_export(const char *format, char *path, size_t path_size);
+ extern void ai_client_set_trace(int enabled);
+ extern int ai_client_last_trace_id(char *trace_id, size_t size);
+ extern int bench_main(int argc, char **argv);
+ extern int debug_main(int argc, char **argv);
+ extern int replay_main(int argc, char **argv);
+ extern int batch_mode(const char *action, FILE *in, int delimiter, int max_inflight, int json_output);
  
  #define MAX_COMMAND_SIZE 4096
  #define MAX_OUTPUT_SIZE 8192
+ #define MAX_METRICS_SIZE (64 * 1024)
+ #define BATCH_DEFAULT_INFLIGHT 32
  
  #define AI_CLIENT_CLI_LOG_FILE "/var/log/ai-os/ai_client_cli.log"
- #define AI_CLIENT_CLI_LOG_MAX_SIZE (1024 * 1024) // 1MB
- static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
- static FILE *log_file = NULL;
- static void ai_client_cli_rotate_log() {
-     struct stat st;
-     if (stat(AI_CLIENT_CLI_LOG_FILE, &st) == 0 && st.st_size > AI_CLIENT_CLI_LOG_MAX_SIZE) {
-         char rotated[512];
-         snprintf(rotated, sizeof(rotated), "%s.old", AI_CLIENT_CLI_LOG_FILE);
-         rename(AI_CLIENT_CLI_LOG_FILE, rotated);
-     }
- }
+ static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK(AI_CLIENT_CLI_LOG_FILE, 0);
  static void ai_client_cli_log(const char *fmt, ...) {
-     pthread_mutex_lock(&log_mutex);
-     ai_client_cli_rotate_log();
-     if (!log_file) {
-         log_file = fopen(AI_CLIENT_CLI_LOG_FILE, "a");
-         if (!log_file) log_file = stderr;
-     }
      va_list args;
      va_start(args, fmt);
-     vfprintf(log_file, fmt, args);
-     fflush(log_file);
+     ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
      va_end(args);
-     pthread_mutex_unlock(&log_mutex);
  }
  
  /* Print usage information */
@@ -63,22 +58,162 @@
      printf("  execute <command>    Execute shell command through daemon\n");
      printf("  status              Show daemon and AI status\n");
      printf("  context             Show current context information\n");
+     printf("  metrics             Show daemon metrics (Prometheus text format)\n");
+     printf("  trace-export [FMT]  Write the daemon's request traces to a file,\n");
+     printf("                      FMT chrome (Perfetto, default) or otlp\n");
      printf("  model <name>        Set AI model\n");
      printf("  models              List available models\n");
      printf("  interactive         Start interactive mode\n");
+     printf("  bench [OPTIONS]     Load-test the daemon (bench -h for options)\n");
+     printf("  replay [OPTIONS] FILE\n");
+     printf("                      Re-drive a daemon traffic capture (replay -h for options)\n");
+     printf("  debug flight-recorder [-p] [-j]\n");
+     printf("                      Dump the daemon's recent requests from shared memory\n");
      printf("  help                Show this help message\n\n");
      printf("Options:\n");
      printf("  -h, --help          Show help message\n");
      printf("  -v, --verbose       Verbose output\n");
      printf("  -q, --quiet         Quiet mode (minimal output)\n");
      printf("  -j, --json          Output in JSON format\n");
-     printf("  -e, --execute       Auto-execute interpreted commands\n\n");
+     printf("  -e, --execute       Auto-execute interpreted commands\n");
+     printf("  -T, --trace         Trace the request; prints its trace id on stderr\n");
+     printf("  -S, --serve         Co-process mode: serve framed requests on stdin\n");
+     printf("  -b, --batch         Run ACTION (default interpret) on every line of\n");
+     printf("                      FILE or stdin: %s --batch [ACTION] [FILE]\n", program_name);
+     printf("  -0, --null          Batch records are NUL-delimited, in and out\n");
+     printf("  -P, --max-inflight N  Batch requests outstanding at once (default %d)\n\n", BATCH_DEFAULT_INFLIGHT);
      printf("Examples:\n");
      printf("  %s interpret \"git push and add all files\"\n", program_name);
      printf("  %s execute \"ls -la\"\n", program_name);
      printf("  %s status\n", program_name);
+     printf("  %s -T interpret \"show disk usage\" && %s trace-export\n", program_name, program_name);
      printf("  %s model phi3:mini\n", program_name);
      printf("  %s interactive\n", program_name);
+     printf("  %s bench -c 8 -d 30 -m classify=80,status=20 -j\n", program_name);
+     printf("  %s --batch -j interpret runbook.txt > commands.ndjson\n", program_name);
+     printf("  coproc AI { %s --serve; }\n", program_name);
+ }
+ 
+ /* Send chat request and extract the reply text */
+ static int chat_request(const char *input, char *reply, size_t reply_size) {
+     char chat_response[1024];
+     int chat_result = ai_interpret_command(input, chat_response, sizeof(chat_response));
+     
+     if (chat_result != 0) {
+         return chat_result;
+     }
+     
+     /* Parse JSON response to extract chat_response */
+     json_object *response_obj = json_tokener_parse(chat_response);
+     const char *text = chat_response;
+     json_object *chat_response_obj;
+     if (response_obj && json_object_object_get_ex(response_obj, "chat_response", &chat_response_obj)) {
+         text = json_object_get_string(chat_response_obj);
+     }
+     snprintf(reply, reply_size, "%s", text);
+     if (response_obj) json_object_put(response_obj);
+     return 0;
+ }
+ 
+ /* Join arguments with single spaces, truncating at SIZE - 1 bytes */
+ static void join_args(char *buf, size_t size, char **args, int count) {
+     size_t len = 0;
+     
+     buf[0] = '\0';
+     for (int i = 0; i < count && len < size - 1; i++) {
+         int n = snprintf(buf + len, size - len, "%s%s", i ? " " : "", args[i]);
+         if (n < 0) break;
+         len += (size_t)n;
+     }
+ }
+ 
+ /* Map an interpret result to the CLI exit code convention */
+ static int interpret_exit_code(int interpret_result) {
+     switch (interpret_result) {
+         case 0:  return 0;
+         case -2: return 2;
+         case -3: return 3;
+         default: return 1;
+     }
+ }
+ 
+ /*
+  * Co-process mode. Keeps one daemon connection for the lifetime of the
+  * process so shell integrations avoid a fork+exec+connect per prompt.
+  *
+  * Request frame (one line):   <id> TAB <action> TAB <text> LF
+  * Response frame:             <id> TAB <code> TAB <payload> NUL
+  *
+  * <code> follows the CLI exit codes (0 ok, 1 error, 2 unsafe, 3 unclear;
+  * execute returns the command's exit code). NUL termination lets bash
+  * read multi-line payloads with `read -r -d ''`; the echoed <id> lets the
+  * reader discard replies left over from an interrupted request.
+  */
+ static void serve_reply(const char *id, int code, const char *payload) {
+     fprintf(stdout, "%s\t%d\t%s", id, code, payload ? payload : "");
+     fputc('\0', stdout);
+     fflush(stdout);
+ }
+ 
+ int serve_mode(void) {
+     char *line = NULL;
+     size_t line_cap = 0;
+     ssize_t len;
+     char output[MAX_OUTPUT_SIZE];
+     
+     /* Ctrl-C in the parent shell must not drop the persistent connection */
+     signal(SIGINT, SIG_IGN);
+     
+     while ((len = getline(&line, &line_cap, stdin)) != -1) {
+         if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+         if (len == 0) continue;
+         
+         char *id = line;
+         char *action = strchr(id, '\t');
+         if (!action) {
+             serve_reply(id, 1, "malformed request");
+             continue;
+         }
+         *action++ = '\0';
+         char *text = strchr(action, '\t');
+         if (text) {
+             *text++ = '\0';
+         } else {
+             text = "";
+         }
+         
+         output[0] = '\0';
+         
+         if (strcmp(action, "interpret") == 0) {
+             int code = interpret_exit_code(ai_interpret_command(text, output, sizeof(output)));
+             serve_reply(id, code, code == 0 ? output : "");
+         } else if (strcmp(action, "speculate") == 0) {
+             serve_reply(id, ai_speculate_command(text) == 0 ? 0 : 1, "");
+         } else if (strcmp(action, "classify") == 0) {
+             int code = ai_classify_input(text, output, sizeof(output)) == 0 ? 0 : 1;
+             serve_reply(id, code, output);
+         } else if (strcmp(action, "chat") == 0) {
+             int code = chat_request(text, output, sizeof(output)) == 0 ? 0 : 1;
+             serve_reply(id, code, output);
+         } else if (strcmp(action, "execute") == 0) {
+             int exec_result = ai_execute_command(text, output, sizeof(output));
+             serve_reply(id, exec_result, output);
+         } else if (strcmp(action, "status") == 0) {
+             int code = ai_get_status(output, sizeof(output)) == 0 ? 0 : 1;
+             serve_reply(id, code, output);
+         } else if (strcmp(action, "context") == 0) {
+             int code = ai_get_context(output, sizeof(output)) == 0 ? 0 : 1;
+             serve_reply(id, code, output);
+         } else if (strcmp(action, "model") == 0) {
+             serve_reply(id, ai_set_model(text) == 0 ? 0 : 1, "");
+         } else {
+             ai_client_cli_log("Error: Unknown action in serve mode: %s\n", action);
+             serve_reply(id, 1, "unknown action");
+         }
+     }
+     
+     free(line);
+     return 0;
  }
  
  /* Interactive mode */
@@ -224,6 +359,27 @@
      int quiet = 0;
      int json_output = 0;
      int auto_execute = 0;
+     int trace = 0;
+     int serve = 0;
+     int batch = 0;
+     int delimiter = '\n';
+     int max_inflight = BATCH_DEFAULT_INFLIGHT;
+     
+     /* bench, replay and debug take their own options: hand them everything from the word on */
+     for (int i = 1; i < argc; i++) {
+         if (argv[i][0] != '-') {
+             if (strcmp(argv[i], "bench") == 0) {
+                 return bench_main(argc - i, argv + i);
+             }
+             if (strcmp(argv[i], "replay") == 0) {
+                 return replay_main(argc - i, argv + i);
+             }
+             if (strcmp(argv[i], "debug") == 0) {
+                 return debug_main(argc - i, argv + i);
+             }
+             break;
+         }
+     }
      
      /* Parse command line options */
      static struct option long_options[] = {
@@ -232,13 +388,18 @@
          {"quiet", no_argument, 0, 'q'},
          {"json", no_argument, 0, 'j'},
          {"execute", no_argument, 0, 'e'},
+         {"trace", no_argument, 0, 'T'},
+         {"serve", no_argument, 0, 'S'},
+         {"batch", no_argument, 0, 'b'},
+         {"null", no_argument, 0, '0'},
+         {"max-inflight", required_argument, 0, 'P'},
          {0, 0, 0, 0}
      };
      
      int option_index = 0;
      int c;
      
-     while ((c = getopt_long(argc, argv, "hvqje", long_options, &option_index)) != -1) {
+     while ((c = getopt_long(argc, argv, "hvqjeTSb0P:", long_options, &option_index)) != -1) {
          switch (c) {
              case 'h':
                  print_usage(argv[0]);
@@ -255,6 +416,21 @@
              case 'e':
                  auto_execute = 1;
                  break;
+             case 'T':
+                 trace = 1;
+                 break;
+             case 'S':
+                 serve = 1;
+                 break;
+             case 'b':
+                 batch = 1;
+                 break;
+             case '0':
+                 delimiter = '\0';
+                 break;
+             case 'P':
+                 max_inflight = atoi(optarg);
+                 break;
              case '?':
                  return 1;
              default:
@@ -262,6 +438,29 @@
          }
      }
      
+     /* Co-process mode: the library reconnects on demand, so a daemon that
+      * is down now (or restarts later) does not end the co-process */
+     if (serve) {
+         ai_client_connect();
+         int serve_result = serve_mode();
+         ai_client_disconnect();
+         return serve_result;
+     }
+     
+     /* Batch mode: [ACTION] [FILE], stdin when FILE is absent or "-" */
+     if (batch) {
+         const char *batch_action = optind < argc ? argv[optind] : "interpret";
+         const char *path = optind + 1 < argc ? argv[optind + 1] : "-";
+         FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+         if (!in) {
+             fprintf(stderr, "%s: %s: %s\n", argv[0], path, strerror(errno));
+             return 1;
+         }
+         int batch_result = batch_mode(batch_action, in, delimiter, max_inflight, json_output);
+         if (in != stdin) fclose(in);
+         return batch_result;
+     }
+     
      /* Check if we have a command */
      if (optind >= argc) {
          if (!quiet) {
@@ -280,6 +479,10 @@
          return 1;
      }
      
+     if (trace) {
+         ai_client_set_trace(1);
+     }
+     
      char command[MAX_COMMAND_SIZE];
      char output[MAX_OUTPUT_SIZE];
      int result = 0;
@@ -294,11 +497,7 @@
          }
          
          /* Join all remaining arguments as the command */
-         command[0] = '\0';
-         for (int i = optind + 1; i < argc; i++) {
-             if (i > optind + 1) strcat(command, " ");
-             strcat(command, argv[i]);
-         }
+         join_args(command, sizeof(command), argv + optind + 1, argc - optind - 1);
          
          int interpret_result = ai_interpret_command(command, output, sizeof(output));
          
@@ -333,11 +532,7 @@
          }
          
          /* Join all remaining arguments as the command */
-         command[0] = '\0';
-         for (int i = optind + 1; i < argc; i++) {
-             if (i > optind + 1) strcat(command, " ");
-             strcat(command, argv[i]);
-         }
+         join_args(command, sizeof(command), argv + optind + 1, argc - optind - 1);
          
          int exec_result = ai_execute_command(command, output, sizeof(output));
          
@@ -371,6 +566,31 @@
              result = 1;
          }
          
+     } else if (strcmp(action, "metrics") == 0) {
+         char *metrics_text = malloc(MAX_METRICS_SIZE);
+         if (metrics_text && ai_get_metrics(metrics_text, MAX_METRICS_SIZE) == 0) {
+             fputs(metrics_text, stdout);
+         } else {
+             if (!quiet) ai_client_cli_log("Error: Failed to get metrics\n");
+             result = 1;
+         }
+         free(metrics_text);
+         
+     } else if (strcmp(action, "trace-export") == 0) {
+         const char *format = optind + 1 < argc ? argv[optind + 1] : "chrome";
+         output[0] = '\0';
+         int spans = ai_trace_export(format, output, sizeof(output));
+         if (spans >= 0) {
+             if (json_output) {
+                 printf("{\"path\":\"%s\",\"spans\":%d}\n", output, spans);
+             } else {
+                 printf("%s (%d spans)\n", output, spans);
+             }
+         } else {
+             if (!quiet) ai_client_cli_log("Error: Failed to export trace: %s\n", output);
+             result = 1;
+         }
+         
      } else if (strcmp(action, "model") == 0) {
          if (optind + 1 >= argc) {
              ai_client_cli_log("Error: No model name specified\n");
@@ -394,11 +614,7 @@
          }
          
          /* Join all remaining arguments as the input */
-         command[0] = '\0';
-         for (int i = optind + 1; i < argc; i++) {
-             if (i > optind + 1) strcat(command, " ");
-             strcat(command, argv[i]);
-         }
+         join_args(command, sizeof(command), argv + optind + 1, argc - optind - 1);
          
          /* Send classify request to daemon */
          char classification[256];
@@ -419,30 +635,11 @@
          }
          
          /* Join all remaining arguments as the input */
-         command[0] = '\0';
-         for (int i = optind + 1; i < argc; i++) {
-             if (i > optind + 1) strcat(command, " ");
-             strcat(command, argv[i]);
-         }
+         join_args(command, sizeof(command), argv + optind + 1, argc - optind - 1);
          
          /* Send chat request to daemon */
-         char chat_response[1024];
-         int chat_result = ai_interpret_command(command, chat_response, sizeof(chat_response));
-         
-         if (chat_result == 0) {
-             /* Parse JSON response to extract chat_response */
-             json_object *response_obj = json_tokener_parse(chat_response);
-             if (response_obj) {
-                 json_object *chat_response_obj;
-                 if (json_object_object_get_ex(response_obj, "chat_response", &chat_response_obj)) {
-                     printf("%s\n", json_object_get_string(chat_response_obj));
-                 } else {
-                     printf("%s\n", chat_response);
-                 }
-                 json_object_put(response_obj);
-             } else {
-                 printf("%s\n", chat_response);
-             }
+         if (chat_request(command, output, sizeof(output)) == 0) {
+             printf("%s\n", output);
          } else {
              if (!quiet) ai_client_cli_log("Error: Failed to get chat response\n");
              result = 1;
@@ -456,11 +653,7 @@
          
      } else {
          /* Try to interpret as natural language command */
-         command[0] = '\0';
-         for (int i = optind; i < argc; i++) {
-             if (i > optind) strcat(command, " ");
-             strcat(command, argv[i]);
-         }
+         join_args(command, sizeof(command), argv + optind, argc - optind);
          
          if (verbose && !quiet) {
              printf("Interpreting: %s\n", command);
@@ -537,10 +730,11 @@
      }
      
      /* Cleanup */
+     if (trace && !quiet && ai_client_last_trace_id(command, sizeof(command)) == 0) {
+         fprintf(stderr, "trace_id: %s\n", command);
+     }
+     
      ai_client_disconnect();
-     pthread_mutex_lock(&log_mutex);
-     if (log_file && log_file != stderr) fclose(log_file);
-     log_file = NULL;
-     pthread_mutex_unlock(&log_mutex);
+     ai_os_log_flush();
      return result;
  }
\ No newline at end of file
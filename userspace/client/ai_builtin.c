@@ -0,0 +1,305 @@
+/*
+ * AI-OS Bash Loadable Builtin
+ * File: userspace/client/ai_builtin.c
+ *
+ * Linked with ai_client.c into ai_os.so and loaded with
+ *
+ *     enable -f ai_os.so ai
+ *
+ * The builtin runs inside the shell process and keeps the client library's
+ * daemon connection open between prompts, so interpreting a line costs no
+ * fork, no exec and no pipe round trip. Results are returned in shell
+ * variables instead of on stdout.
+ *
+ * Build needs the bash loadable headers (Debian/Ubuntu: bash-builtins).
+ */
+
+#include <config.h>
+#if defined (HAVE_UNISTD_H)
+#  include <unistd.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "builtins.h"
+#include "shell.h"
+#include "findcmd.h"
+#include "bashgetopt.h"
+#include "common.h"
+#if defined (ALIAS)
+#  include "alias.h"
+#endif
+
+#define AI_BUILTIN_DEFAULT_VAR "AI_OS_REPLY"
+#define AI_BUILTIN_OUTPUT_SIZE 8192
+#define AI_BUILTIN_IDLE_MS 250      /* typing pause before speculating */
+#define AI_BUILTIN_MIN_WORDS 3
+
+/* Readline is linked into bash, which exports it to loadables */
+extern char *rl_line_buffer;
+extern int (*rl_event_hook)(void);
+
+/* Client library (ai_client.c) */
+extern int ai_client_connect(void);
+extern void ai_client_disconnect(void);
+extern int ai_interpret_command(const char *natural_command, char *shell_command, size_t command_size);
+extern int ai_get_status(char *status_info, size_t info_size);
+extern int ai_classify_input(const char *input, char *classification, size_t classification_size);
+extern int ai_speculate_command(const char *natural_command);
+
+/* Same exit code convention as ai-client and its --serve mode */
+static int interpret_exit_code(int interpret_result) {
+    switch (interpret_result) {
+        case 0:  return 0;
+        case -2: return 2;
+        case -3: return 3;
+        default: return 1;
+    }
+}
+
+/*
+ * `ai watch on`: readline calls rl_event_hook about ten times a second
+ * while it waits for a key. Once the line has been left alone for
+ * AI_BUILTIN_IDLE_MS and reads like a request rather than a command line,
+ * it is handed to the daemon for speculative interpretation on this
+ * connection, which is the one the eventual `interpret` arrives on.
+ */
+static struct {
+    int enabled;
+    int pending;                          /* daemon holds a speculation */
+    int (*saved_hook)(void);
+    char line[AI_BUILTIN_OUTPUT_SIZE];    /* buffer as of the last change */
+    char sent[AI_BUILTIN_OUTPUT_SIZE];    /* last buffer acted upon */
+    struct timespec changed;
+} watch;
+
+static long ms_since(const struct timespec *then) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+/* At least AI_BUILTIN_MIN_WORDS words and the first is not runnable */
+static int looks_like_request(const char *line) {
+    char first[256];
+    const char *p = line;
+    size_t len = 0;
+    int words = 0;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        words++;
+        while (*p && *p != ' ' && *p != '\t') {
+            if (words == 1 && len < sizeof(first) - 1) first[len++] = *p;
+            p++;
+        }
+    }
+    first[len] = '\0';
+    if (words < AI_BUILTIN_MIN_WORDS) return 0;
+
+    if (find_shell_builtin(first) || find_function(first)) return 0;
+#if defined (ALIAS)
+    if (find_alias(first)) return 0;
+#endif
+    char *path = find_user_command(first);
+    if (path) {
+        free(path);
+        return 0;
+    }
+    return 1;
+}
+
+static int watch_event_hook(void) {
+    if (watch.saved_hook) {
+        watch.saved_hook();
+    }
+    if (!rl_line_buffer) {
+        return 0;
+    }
+
+    if (strncmp(watch.line, rl_line_buffer, sizeof(watch.line) - 1) != 0) {
+        strncpy(watch.line, rl_line_buffer, sizeof(watch.line) - 1);
+        watch.line[sizeof(watch.line) - 1] = '\0';
+        clock_gettime(CLOCK_MONOTONIC, &watch.changed);
+        return 0;
+    }
+    if (strcmp(watch.line, watch.sent) == 0 || ms_since(&watch.changed) < AI_BUILTIN_IDLE_MS) {
+        return 0;
+    }
+
+    strcpy(watch.sent, watch.line);
+    if (looks_like_request(watch.line)) {
+        watch.pending = ai_speculate_command(watch.line) == 0;
+    } else if (watch.pending) {
+        /* Line cleared or turned into a command: drop the stale guess */
+        ai_speculate_command("");
+        watch.pending = 0;
+    }
+    return 0;
+}
+
+static int set_watch(int enable) {
+    if (enable && !watch.enabled) {
+        watch.saved_hook = rl_event_hook;
+        watch.line[0] = watch.sent[0] = '\0';
+        rl_event_hook = watch_event_hook;
+        watch.enabled = 1;
+    } else if (!enable && watch.enabled) {
+        if (rl_event_hook == watch_event_hook) {
+            rl_event_hook = watch.saved_hook;
+        }
+        watch.enabled = 0;
+    }
+    return 0;
+}
+
+/* Replace the readline buffer, for use from `bind -x` key bindings */
+static void set_readline_buffer(const char *line) {
+    char point[32];
+
+    snprintf(point, sizeof(point), "%zu", strlen(line));
+    bind_variable("READLINE_LINE", (char *)line, 0);
+    bind_variable("READLINE_POINT", point, 0);
+}
+
+static int ai_builtin(WORD_LIST *list) {
+    char *var_name = AI_BUILTIN_DEFAULT_VAR;
+    char output[AI_BUILTIN_OUTPUT_SIZE];
+    char *text = NULL;
+    const char *action;
+    int opt, code;
+
+    reset_internal_getopt();
+    while ((opt = internal_getopt(list, "v:")) != -1) {
+        switch (opt) {
+            case 'v':
+                var_name = list_optarg;
+                break;
+            CASE_HELPOPT;
+            default:
+                builtin_usage();
+                return EX_USAGE;
+        }
+    }
+    list = loptend;
+
+    if (!list) {
+        builtin_usage();
+        return EX_USAGE;
+    }
+    if (!legal_identifier(var_name)) {
+        builtin_error("`%s': not a valid identifier", var_name);
+        return EXECUTION_FAILURE;
+    }
+
+    action = list->word->word;
+    if (list->next) {
+        text = string_list(list->next);
+    }
+    output[0] = '\0';
+
+    if (strcmp(action, "interpret") == 0) {
+        if (!text) {
+            builtin_usage();
+            return EX_USAGE;
+        }
+        code = interpret_exit_code(ai_interpret_command(text, output, sizeof(output)));
+    } else if (strcmp(action, "speculate") == 0) {
+        /* Queue the text, or the readline buffer, for background
+         * interpretation; returns without waiting for the model */
+        const char *input = text ? text : get_string_value("READLINE_LINE");
+        code = ai_speculate_command(input ? input : "") == 0 ? 0 : 1;
+    } else if (strcmp(action, "watch") == 0) {
+        if (text && strcmp(text, "off") == 0) {
+            code = set_watch(0);
+        } else if (!text || strcmp(text, "on") == 0) {
+            code = set_watch(1);
+        } else {
+            builtin_usage();
+            FREE(text);
+            return EX_USAGE;
+        }
+        snprintf(output, sizeof(output), "%s", watch.enabled ? "on" : "off");
+    } else if (strcmp(action, "classify") == 0) {
+        if (!text) {
+            builtin_usage();
+            return EX_USAGE;
+        }
+        code = ai_classify_input(text, output, sizeof(output)) == 0 ? 0 : 1;
+    } else if (strcmp(action, "complete") == 0) {
+        /* Interpret the text, or the current readline buffer when called
+         * from a `bind -x` binding, and replace the buffer with the result */
+        const char *input = text;
+        int from_readline = 0;
+        if (!input) {
+            input = get_string_value("READLINE_LINE");
+            from_readline = 1;
+        }
+        if (!input || !*input) {
+            FREE(text);
+            return EXECUTION_FAILURE;
+        }
+        code = interpret_exit_code(ai_interpret_command(input, output, sizeof(output)));
+        if (code == 0 && from_readline) {
+            set_readline_buffer(output);
+        }
+    } else if (strcmp(action, "status") == 0) {
+        code = ai_get_status(output, sizeof(output)) == 0 ? 0 : 1;
+    } else {
+        builtin_error("%s: unknown action", action);
+        FREE(text);
+        return EX_USAGE;
+    }
+
+    FREE(text);
+    bind_variable(var_name, code == 0 ? output : "", 0);
+    return code;
+}
+
+/* Called by `enable -f`; connect eagerly, the library reconnects on demand */
+int ai_builtin_load(char *name) {
+    (void)name;
+    ai_client_connect();
+    return 1;
+}
+
+/* Called by `enable -d` */
+void ai_builtin_unload(char *name) {
+    (void)name;
+    set_watch(0);
+    ai_client_disconnect();
+}
+
+static char *ai_doc[] = {
+    "Talk to the AI-OS daemon without leaving the shell.",
+    "",
+    "Actions:",
+    "  interpret TEXT   Translate natural language into a shell command",
+    "  classify TEXT    Classify TEXT as `command' or `chat'",
+    "  complete [TEXT]  Interpret TEXT, or the readline buffer when run from",
+    "                   `bind -x', and replace the buffer with the result",
+    "  speculate [TEXT] Start interpreting TEXT, or the readline buffer, in",
+    "                   the background so a later interpret is answered at once",
+    "  watch [on|off]   Speculate automatically on the line being edited",
+    "                   once typing pauses",
+    "  status           Daemon status as JSON",
+    "",
+    "The result is stored in AI_OS_REPLY, or in VAR with -v VAR.",
+    "",
+    "Exit Status:",
+    "0 on success, 2 if the command is unsafe, 3 if it is unclear,",
+    "1 on any other failure.",
+    (char *)NULL
+};
+
+struct builtin ai_struct = {
+    "ai",
+    ai_builtin,
+    BUILTIN_ENABLED,
+    ai_doc,
+    "ai [-v var] interpret|classify|complete|speculate|watch|status [text ...]",
+    0
+};
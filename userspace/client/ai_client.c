@@ -1,6 +1,29 @@
 /*
  * AI-OS Client Library
  * File: userspace/client/ai_client.c
+ *
+ * Connections belong to handles (ai_handle_t). A handle may be shared by
+ * any number of threads: requests are pipelined on its socket as one JSON
+ * object per line, and replies, which the daemon sends back in order and
+ * tagged with the request id, are matched to their callers. Blocking calls
+ * take a deadline. Event loops instead poll ai_handle_fd() for
+ * ai_handle_events() (at most ai_handle_timeout() ms) and then call
+ * ai_handle_process(), which delivers completion callbacks. A handle
+ * reconnects on its own, backing off while the daemon is unreachable.
+ *
+ * The classic ai_* functions below use a process-wide default handle.
+ * Status, classification and interpretation first look in the read-only
+ * cache the daemon publishes (ai_os_cache.h) and only go to the socket on
+ * a miss; AI_OS_CACHE=0 in the environment turns that off.
+ *
+ * A handle with tracing on (ai_handle_set_trace(), or AI_OS_TRACE=1 in the
+ * environment for every handle) tags each request with a fresh trace id;
+ * the daemon then records the request's stages under that id for
+ * trace_export. Traced requests never answer from the cache.
+ *
+ * A batch handle (ai_handle_set_batch()) marks its requests
+ * "priority": "batch", which the daemon serves only from capacity no
+ * interactive request wants.
  */
 
  #include <stdio.h>
@@ -12,141 +35,644 @@
  #include <json-c/json.h>
  #include <errno.h>
  #include <sys/stat.h>
+ #include <sys/mman.h>
+ #include <fcntl.h>
  #include <stdarg.h>
+ #include <pthread.h>
+ #include <poll.h>
+ #include <time.h>
+ #include <sys/random.h>
  #include "../ai_os_common.h"
+ #include "../ai_os_cache.h"
+ #include "../ai_os_log.h"
  
  #define AI_SOCKET_PATH "/var/run/ai-os.sock"
  #define MAX_RESPONSE_SIZE 8192
+ #define MAX_REQUEST_SIZE 8192
+ #define AI_CLIENT_MAX_LINE (64 * 1024)     /* longest reply we will buffer */
+ #define AI_CLIENT_BACKOFF_MIN_MS 100
+ #define AI_CLIENT_BACKOFF_MAX_MS 5000
+ #define AI_CLIENT_POLL_SLICE_MS 100        /* re-check deadlines at least this often */
+ #define AI_CLIENT_CACHE_RETRIES 8          /* seqlock reads racing the daemon */
  
  #define AI_CLIENT_LOG_FILE "/var/log/ai-os/ai_client.log"
  
  /* Logging utility */
- static FILE *log_file = NULL;
+ static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK(AI_CLIENT_LOG_FILE, 0);
  static void ai_client_log(const char *fmt, ...) {
      va_list args;
-     if (!log_file) {
-         log_file = fopen(AI_CLIENT_LOG_FILE, "a");
-         if (!log_file) log_file = stderr;
-     }
      va_start(args, fmt);
-     vfprintf(log_file, fmt, args);
-     fflush(log_file);
+     ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
      va_end(args);
  }
  
- // TODO: Add reconnection and exponential backoff logic for transient failures
- // TODO: Add timeouts for send/recv to avoid indefinite blocking
- // TODO: Add mutex protection for g_client if used from multiple threads
+ /* One request waiting for its reply */
+ typedef struct ai_pending {
+     unsigned long id;
+     ai_completion_cb cb;
+     void *user_data;
+     long long deadline;         /* monotonic ms, 0 = none */
+     int abandoned;              /* timed out: drop the reply when it arrives */
+     struct ai_pending *next;
+ } ai_pending_t;
  
- /* Client connection structure */
+ struct ai_handle {
+     pthread_mutex_t mutex;      /* recursive, so callbacks may submit */
+     pthread_cond_t cond;        /* replies delivered */
+     int polling;                /* a blocking caller is driving the socket */
+     char socket_path[108];
+     int fd;
+     unsigned int epoch;         /* bumped whenever the socket is dropped */
+     unsigned long next_id;
+     char *out;                  /* framed requests not yet written */
+     size_t out_len, out_cap;
+     char *in;                   /* reply bytes not yet dispatched */
+     size_t in_len, in_cap;
+     ai_pending_t *head, *tail;  /* in send order, which is reply order */
+     long long next_connect;     /* backoff: no attempt before this */
+     int backoff_ms;
+     int trace;                  /* tag requests with a trace id */
+     int batch;                  /* "priority": "batch" on every request */
+     char last_trace_id[AI_OS_TRACE_ID_LEN + 1];
+ };
  
- // Replace ai_client_t with ai_client_state_t for the local client connection struct
- // Define the local struct:
-typedef struct {
-    int socket_fd;
-    int connected;
-} ai_client_state_t;
-
-// Update the global client instance
-static ai_client_state_t g_client = {-1, 0};
+ /* Set by AI_OS_TRACE=1 or ai_client_set_trace(); new handles inherit it */
+ static int g_trace = -1;
  
- /* Connect to AI daemon */
- int ai_client_connect(void) {
+ static long long epoch_ms(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_REALTIME, &ts);
+     return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+ }
+ 
+ static long long now_ms(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+ }
+ 
+ static int buffer_reserve(char **buf, size_t *cap, size_t need) {
+     if (need <= *cap) return 0;
+     size_t new_cap = *cap ? *cap : 1024;
+     while (new_cap < need) new_cap *= 2;
+     char *grown = realloc(*buf, new_cap);
+     if (!grown) return -1;
+     *buf = grown;
+     *cap = new_cap;
+     return 0;
+ }
+ 
+ /* Append S to BUF as the body of a JSON string */
+ static int append_escaped(char *buf, size_t size, size_t *len, const char *s) {
+     for (; *s; s++) {
+         unsigned char c = (unsigned char)*s;
+         char piece[8];
+         
+         switch (c) {
+             case '"':  strcpy(piece, "\\\""); break;
+             case '\\': strcpy(piece, "\\\\"); break;
+             case '\n': strcpy(piece, "\\n"); break;
+             case '\r': strcpy(piece, "\\r"); break;
+             case '\t': strcpy(piece, "\\t"); break;
+             default:
+                 if (c < 0x20) {
+                     snprintf(piece, sizeof(piece), "\\u%04x", c);
+                 } else {
+                     piece[0] = (char)c;
+                     piece[1] = '\0';
+                 }
+         }
+         
+         size_t piece_len = strlen(piece);
+         if (*len + piece_len >= size) return -1;
+         memcpy(buf + *len, piece, piece_len);
+         *len += piece_len;
+     }
+     buf[*len] = '\0';
+     return 0;
+ }
+ 
+ /* 32 random lowercase hex digits, as W3C trace context and OTLP expect */
+ static void new_trace_id(char *out) {
+     unsigned char bytes[AI_OS_TRACE_ID_LEN / 2];
+     
+     if (getrandom(bytes, sizeof(bytes), GRND_NONBLOCK) != (ssize_t)sizeof(bytes)) {
+         struct timespec ts;
+         clock_gettime(CLOCK_REALTIME, &ts);
+         unsigned long long x = ((unsigned long long)ts.tv_sec << 30) ^ (unsigned long long)ts.tv_nsec ^
+                                ((unsigned long long)getpid() << 48);
+         for (size_t i = 0; i < sizeof(bytes); i++) {
+             x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+             bytes[i] = (unsigned char)x;
+         }
+     }
+     bytes[0] |= 1;              /* never all zeros */
+     for (size_t i = 0; i < sizeof(bytes); i++) {
+         snprintf(out + 2 * i, 3, "%02x", bytes[i]);
+     }
+ }
+ 
+ /* {"id":N,"action":"...","command":"..."}\n -- set_model carries "model",
+  * a traced request "trace_id", a batch one "priority", one with a
+  * deadline "deadline" (wall-clock ms, so the daemon stops when we do) */
+ static int build_request(char *buf, size_t size, unsigned long id, const char *action, const char *text,
+                          const char *trace_id, int batch, long long deadline) {
+     size_t len = (size_t)snprintf(buf, size, "{\"id\":%lu,\"action\":\"", id);
+     if (len >= size || append_escaped(buf, size, &len, action) != 0) return -1;
+     if (text) {
+         const char *field = strcmp(action, "set_model") == 0 ? "\",\"model\":\"" : "\",\"command\":\"";
+         len += (size_t)snprintf(buf + len, size - len, "%s", field);
+         if (len >= size || append_escaped(buf, size, &len, text) != 0) return -1;
+     }
+     if (trace_id) {
+         len += (size_t)snprintf(buf + len, size - len, "\",\"trace_id\":\"%s", trace_id);
+         if (len >= size) return -1;
+     }
+     if (batch) {
+         len += (size_t)snprintf(buf + len, size - len, "\",\"priority\":\"batch");
+         if (len >= size) return -1;
+     }
+     if (deadline) {
+         len += (size_t)snprintf(buf + len, size - len, "\",\"deadline\":\"%lld", deadline);
+         if (len >= size) return -1;
+     }
+     len += (size_t)snprintf(buf + len, size - len, "\"}\n");
+     return len >= size ? -1 : (int)len;
+ }
+ 
+ /* Drop the connection and fail everything in flight with ERROR. Caller
+  * holds the mutex; callbacks may run and may submit again. */
+ static void fail_all_locked(ai_handle_t *h, int error) {
+     ai_pending_t *list = h->head;
+     
+     if (h->fd >= 0) {
+         close(h->fd);
+         h->fd = -1;
+     }
+     h->epoch++;
+     h->head = h->tail = NULL;
+     h->out_len = 0;
+     h->in_len = 0;
+     
+     while (list) {
+         ai_pending_t *next = list->next;
+         if (!list->abandoned) {
+             list->cb(h, error, NULL, list->user_data);
+         }
+         free(list);
+         list = next;
+     }
+     pthread_cond_broadcast(&h->cond);
+ }
+ 
+ /* Connect unless backing off. Caller holds the mutex. */
+ static int connect_locked(ai_handle_t *h) {
      struct sockaddr_un addr;
+     long long now = now_ms();
      
-     if (g_client.connected) {
-         return 0; /* Already connected */
+     if (h->fd >= 0) return 0;
+     if (now < h->next_connect) {
+         errno = EAGAIN;
+         return -1;
      }
      
-     /* Create socket */
-     g_client.socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-     if (g_client.socket_fd < 0) {
+     int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+     if (fd < 0) {
          ai_client_log("AI-Client: Failed to create socket: %s\n", strerror(errno));
          return -1;
      }
      
-     /* Connect to daemon */
      memset(&addr, 0, sizeof(addr));
      addr.sun_family = AF_UNIX;
-     strncpy(addr.sun_path, AI_SOCKET_PATH, sizeof(addr.sun_path) - 1);
-     
-     if (connect(g_client.socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-         ai_client_log("AI-Client: Failed to connect to daemon: %s\n", strerror(errno));
-         close(g_client.socket_fd);
-         g_client.socket_fd = -1;
+     strncpy(addr.sun_path, h->socket_path, sizeof(addr.sun_path) - 1);
+     
+     if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+         int saved = errno;
+         ai_client_log("AI-Client: Failed to connect to daemon: %s (retry in %d ms)\n",
+                       strerror(saved), h->backoff_ms);
+         close(fd);
+         h->next_connect = now + h->backoff_ms;
+         h->backoff_ms *= 2;
+         if (h->backoff_ms > AI_CLIENT_BACKOFF_MAX_MS) h->backoff_ms = AI_CLIENT_BACKOFF_MAX_MS;
+         errno = saved;
          return -1;
      }
      
-     g_client.connected = 1;
+     h->fd = fd;
+     h->next_connect = 0;
+     h->backoff_ms = AI_CLIENT_BACKOFF_MIN_MS;
      return 0;
  }
  
- /* Disconnect from AI daemon */
- void ai_client_disconnect(void) {
-     if (g_client.connected && g_client.socket_fd >= 0) {
-         if (close(g_client.socket_fd) != 0) {
-             ai_client_log("AI-Client: Failed to close socket: %s\n", strerror(errno));
+ /* Write as much queued output as the socket takes */
+ static int flush_locked(ai_handle_t *h) {
+     while (h->fd >= 0 && h->out_len > 0) {
+         ssize_t n = send(h->fd, h->out, h->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+         if (n < 0) {
+             if (errno == EINTR) continue;
+             if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+             ai_client_log("AI-Client: Failed to send request: %s\n", strerror(errno));
+             fail_all_locked(h, errno);
+             return -1;
          }
-         g_client.socket_fd = -1;
-         g_client.connected = 0;
+         memmove(h->out, h->out + n, h->out_len - (size_t)n);
+         h->out_len -= (size_t)n;
      }
+     return 0;
  }
  
- /* Send request and receive response */
- static int send_request(const char *request, char *response, size_t response_size) {
-     if (!g_client.connected) {
-         if (ai_client_connect() != 0) {
+ /* Reply id, if the daemon put one first: { "id": N, ... } */
+ static int reply_id(const char *line, unsigned long *id) {
+     const char *p = line;
+     while (*p == ' ' || *p == '{') p++;
+     if (strncmp(p, "\"id\"", 4) != 0) return -1;
+     p += 4;
+     while (*p == ' ' || *p == ':') p++;
+     char *end;
+     *id = strtoul(p, &end, 10);
+     return end == p ? -1 : 0;
+ }
+ 
+ /* Hand one reply line to the oldest pending request */
+ static int dispatch_reply_locked(ai_handle_t *h, const char *line) {
+     ai_pending_t *pending = h->head;
+     unsigned long id;
+     
+     if (!pending) {
+         ai_client_log("AI-Client: Unexpected reply from daemon\n");
+         return 0;
+     }
+     if (reply_id(line, &id) == 0 && id != pending->id) {
+         ai_client_log("AI-Client: Reply for request %lu while waiting for %lu\n", id, pending->id);
+         fail_all_locked(h, EPROTO);
+         return -1;
+     }
+     
+     h->head = pending->next;
+     if (!h->head) h->tail = NULL;
+     if (!pending->abandoned) {
+         pending->cb(h, 0, line, pending->user_data);
+     }
+     free(pending);
+     return 0;
+ }
+ 
+ /* Read what is available and dispatch complete lines */
+ static int read_locked(ai_handle_t *h) {
+     unsigned int epoch = h->epoch;
+     
+     while (h->fd >= 0) {
+         if (buffer_reserve(&h->in, &h->in_cap, h->in_len + 4096 + 1) != 0) {
+             fail_all_locked(h, ENOMEM);
+             return -1;
+         }
+         ssize_t n = recv(h->fd, h->in + h->in_len, h->in_cap - h->in_len - 1, MSG_DONTWAIT);
+         if (n < 0) {
+             if (errno == EINTR) continue;
+             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+             ai_client_log("AI-Client: Failed to receive response: %s\n", strerror(errno));
+             fail_all_locked(h, errno);
+             return -1;
+         }
+         if (n == 0) {
+             if (h->head) ai_client_log("AI-Client: Daemon closed the connection\n");
+             fail_all_locked(h, ECONNRESET);
+             return -1;
+         }
+         h->in_len += (size_t)n;
+         if (h->in_len > AI_CLIENT_MAX_LINE && !memchr(h->in, '\n', h->in_len)) {
+             fail_all_locked(h, EMSGSIZE);
              return -1;
          }
      }
      
-     /* Send request */
-     ssize_t bytes_sent = send(g_client.socket_fd, request, strlen(request), 0);
-     if (bytes_sent < 0) {
-         ai_client_log("AI-Client: Failed to send request: %s\n", strerror(errno));
-         ai_client_disconnect();
-         return -1;
+     size_t start = 0;
+     char *nl;
+     while (h->epoch == epoch && (nl = memchr(h->in + start, '\n', h->in_len - start))) {
+         *nl = '\0';
+         size_t next = (size_t)(nl - h->in) + 1;
+         if (nl > h->in + start && dispatch_reply_locked(h, h->in + start) != 0) {
+             return -1;
+         }
+         start = next;
      }
-     
-     /* Receive response */
-     ssize_t bytes_received = recv(g_client.socket_fd, response, response_size - 1, 0);
-     if (bytes_received < 0) {
-         ai_client_log("AI-Client: Failed to receive response: %s\n", strerror(errno));
-         ai_client_disconnect();
-         return -1;
+     if (h->epoch == epoch && start > 0) {
+         memmove(h->in, h->in + start, h->in_len - start);
+         h->in_len -= start;
+     }
+     return 0;
+ }
+ 
+ /* Time out overdue requests; their replies are discarded on arrival */
+ static void expire_locked(ai_handle_t *h) {
+     long long now = now_ms();
+     unsigned int epoch = h->epoch;
+     
+     for (ai_pending_t *p = h->head; p && h->epoch == epoch; p = p->next) {
+         if (!p->abandoned && p->deadline && p->deadline <= now) {
+             p->abandoned = 1;
+             p->cb(h, ETIMEDOUT, NULL, p->user_data);
+         }
+     }
+ }
+ 
+ /* Requests queued while disconnected: connect, or fail the ones that
+  * have no deadline to wait out the backoff with */
+ static void reconnect_locked(ai_handle_t *h) {
+     if (h->fd >= 0 || !h->head || connect_locked(h) == 0) return;
+     
+     int error = errno == EAGAIN ? ECONNREFUSED : errno;
+     unsigned int epoch = h->epoch;
+     for (ai_pending_t *p = h->head; p && h->epoch == epoch; p = p->next) {
+         if (!p->abandoned && !p->deadline) {
+             p->abandoned = 1;
+             p->cb(h, error, NULL, p->user_data);
+         }
      }
      
-     response[bytes_received] = '\0';
+     /* Nothing left worth sending */
+     int live = 0;
+     for (ai_pending_t *p = h->head; p; p = p->next) live |= !p->abandoned;
+     if (!live && h->epoch == epoch) fail_all_locked(h, ECONNREFUSED);
+ }
+ 
+ static int process_locked(ai_handle_t *h) {
+     reconnect_locked(h);
+     if (h->fd >= 0 && flush_locked(h) == 0) {
+         read_locked(h);
+     }
+     expire_locked(h);
+     pthread_cond_broadcast(&h->cond);
      return 0;
  }
  
- /* Interpret natural language command */
- int ai_interpret_command(const char *natural_command, char *shell_command, size_t command_size) {
-     if (!natural_command || !shell_command || command_size == 0) {
+ ai_handle_t *ai_handle_open(const char *socket_path) {
+     pthread_mutexattr_t attr;
+     ai_handle_t *h = calloc(1, sizeof(*h));
+     if (!h) return NULL;
+     
+     pthread_mutexattr_init(&attr);
+     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+     pthread_mutex_init(&h->mutex, &attr);
+     pthread_mutexattr_destroy(&attr);
+     pthread_cond_init(&h->cond, NULL);
+     
+     strncpy(h->socket_path, socket_path ? socket_path : AI_SOCKET_PATH, sizeof(h->socket_path) - 1);
+     h->fd = -1;
+     h->next_id = 1;
+     h->backoff_ms = AI_CLIENT_BACKOFF_MIN_MS;
+     if (g_trace < 0) {
+         const char *env = getenv("AI_OS_TRACE");
+         g_trace = env && *env && strcmp(env, "0") != 0;
+     }
+     h->trace = g_trace;
+     return h;
+ }
+ 
+ /* Tag this handle's requests with trace ids from now on (or stop) */
+ void ai_handle_set_trace(ai_handle_t *h, int enabled) {
+     if (!h) return;
+     pthread_mutex_lock(&h->mutex);
+     h->trace = enabled != 0;
+     pthread_mutex_unlock(&h->mutex);
+ }
+ 
+ /* Send this handle's requests as batch work from now on (or stop) */
+ void ai_handle_set_batch(ai_handle_t *h, int enabled) {
+     if (!h) return;
+     pthread_mutex_lock(&h->mutex);
+     h->batch = enabled != 0;
+     pthread_mutex_unlock(&h->mutex);
+ }
+ 
+ /* Trace id of the handle's most recent traced request; -1 if none */
+ int ai_handle_last_trace_id(ai_handle_t *h, char *trace_id, size_t size) {
+     if (!h || !trace_id || size <= AI_OS_TRACE_ID_LEN) return -1;
+     pthread_mutex_lock(&h->mutex);
+     int result = h->last_trace_id[0] ? 0 : -1;
+     memcpy(trace_id, h->last_trace_id, AI_OS_TRACE_ID_LEN + 1);
+     pthread_mutex_unlock(&h->mutex);
+     return result;
+ }
+ 
+ /* Fails whatever is still in flight with ECANCELED */
+ void ai_handle_close(ai_handle_t *h) {
+     if (!h) return;
+     pthread_mutex_lock(&h->mutex);
+     fail_all_locked(h, ECANCELED);
+     pthread_mutex_unlock(&h->mutex);
+     
+     pthread_cond_destroy(&h->cond);
+     pthread_mutex_destroy(&h->mutex);
+     free(h->out);
+     free(h->in);
+     free(h);
+ }
+ 
+ /* Connect now, ignoring any backoff in effect */
+ int ai_handle_connect(ai_handle_t *h) {
+     if (!h) return -1;
+     pthread_mutex_lock(&h->mutex);
+     h->next_connect = 0;
+     int result = connect_locked(h);
+     pthread_mutex_unlock(&h->mutex);
+     return result;
+ }
+ 
+ void ai_handle_disconnect(ai_handle_t *h) {
+     if (!h) return;
+     pthread_mutex_lock(&h->mutex);
+     fail_all_locked(h, ECONNABORTED);
+     pthread_mutex_unlock(&h->mutex);
+ }
+ 
+ /*
+  * Queue ACTION (with TEXT as its command, or model for set_model) and
+  * return without waiting. CB runs exactly once, from whichever thread
+  * calls ai_handle_process() or blocks in ai_handle_call(), with the handle
+  * locked: it may submit more requests but must not block. ERROR is 0 and
+  * RESPONSE the reply JSON on success; otherwise RESPONSE is NULL and ERROR
+  * an errno value (ETIMEDOUT once TIMEOUT_MS passes, < 0 for no deadline).
+  * A request without a deadline fails at once if the daemon cannot be
+  * reached; one with a deadline waits out the reconnect backoff.
+  */
+ int ai_handle_submit(ai_handle_t *h, const char *action, const char *text, int timeout_ms,
+                      ai_completion_cb cb, void *user_data) {
+     char line[MAX_REQUEST_SIZE];
+     
+     if (!h || !action || !cb) {
+         errno = EINVAL;
          return -1;
      }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("interpret");
-     json_object *command = json_object_new_string(natural_command);
+     pthread_mutex_lock(&h->mutex);
      
-     json_object_object_add(request, "action", action);
-     json_object_object_add(request, "command", command);
+     /* A daemon restart while idle shows up as EOF: reconnect up front
+      * rather than queue behind a dead socket */
+     if (h->fd >= 0 && !h->head) {
+         char c;
+         ssize_t n = recv(h->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+         if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+             fail_all_locked(h, ECONNRESET);
+         }
+     }
      
-     const char *request_str = json_object_to_json_string(request);
+     if (h->fd < 0 && connect_locked(h) != 0 && timeout_ms < 0) {
+         if (errno == EAGAIN) errno = ECONNREFUSED;
+         pthread_mutex_unlock(&h->mutex);
+         return -1;
+     }
      
-     /* Send request */
-     char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
+     if (h->trace) {
+         new_trace_id(h->last_trace_id);
+     }
+     int len = build_request(line, sizeof(line), h->next_id, action, text, h->trace ? h->last_trace_id : NULL,
+                             h->batch, timeout_ms >= 0 ? epoch_ms() + timeout_ms : 0);
+     ai_pending_t *pending = calloc(1, sizeof(*pending));
+     if (len < 0 || !pending || buffer_reserve(&h->out, &h->out_cap, h->out_len + (size_t)len) != 0) {
+         free(pending);
+         pthread_mutex_unlock(&h->mutex);
+         errno = len < 0 ? EMSGSIZE : ENOMEM;
+         return -1;
+     }
      
-     json_object_put(request);
+     memcpy(h->out + h->out_len, line, (size_t)len);
+     h->out_len += (size_t)len;
+     pending->id = h->next_id++;
+     pending->cb = cb;
+     pending->user_data = user_data;
+     pending->deadline = timeout_ms >= 0 ? now_ms() + timeout_ms : 0;
+     if (h->tail) h->tail->next = pending; else h->head = pending;
+     h->tail = pending;
+     
+     flush_locked(h);
+     pthread_mutex_unlock(&h->mutex);
+     return 0;
+ }
+ 
+ /* Descriptor to poll; changes after a reconnect, -1 while disconnected */
+ int ai_handle_fd(ai_handle_t *h) {
+     pthread_mutex_lock(&h->mutex);
+     int fd = h->fd;
+     pthread_mutex_unlock(&h->mutex);
+     return fd;
+ }
+ 
+ short ai_handle_events(ai_handle_t *h) {
+     short events = 0;
+     pthread_mutex_lock(&h->mutex);
+     if (h->fd >= 0) {
+         if (h->head) events |= POLLIN;
+         if (h->out_len) events |= POLLOUT;
+     }
+     pthread_mutex_unlock(&h->mutex);
+     return events;
+ }
+ 
+ /* Milliseconds until ai_handle_process() has timer work, -1 if none */
+ static int timeout_locked(ai_handle_t *h) {
+     long long next = 0, now = now_ms();
      
-     if (result != 0) {
+     for (ai_pending_t *p = h->head; p; p = p->next) {
+         if (!p->abandoned && p->deadline && (!next || p->deadline < next)) next = p->deadline;
+     }
+     if (h->fd < 0 && h->head && (!next || h->next_connect < next)) next = h->next_connect;
+     if (!next && h->fd < 0 && h->head) next = now;
+     
+     if (!next) return -1;
+     return next <= now ? 0 : (int)(next - now);
+ }
+ 
+ int ai_handle_timeout(ai_handle_t *h) {
+     pthread_mutex_lock(&h->mutex);
+     int timeout = timeout_locked(h);
+     pthread_mutex_unlock(&h->mutex);
+     return timeout;
+ }
+ 
+ /* Drive I/O, reconnects and deadlines; never blocks */
+ int ai_handle_process(ai_handle_t *h) {
+     pthread_mutex_lock(&h->mutex);
+     int result = process_locked(h);
+     pthread_mutex_unlock(&h->mutex);
+     return result;
+ }
+ 
+ struct sync_call {
+     int done;
+     int error;
+     char *response;
+     size_t response_size;
+ };
+ 
+ static void sync_complete(ai_handle_t *h, int error, const char *response, void *user_data) {
+     struct sync_call *call = user_data;
+     (void)h;
+     call->error = error;
+     if (response) {
+         strncpy(call->response, response, call->response_size - 1);
+         call->response[call->response_size - 1] = '\0';
+     }
+     call->done = 1;
+ }
+ 
+ /*
+  * Blocking request. Returns 0 with the reply JSON in RESPONSE, or -1 with
+  * errno set. Concurrent callers share the socket: one of them polls it and
+  * the others sleep until their reply has been dispatched. Must not be
+  * called from a completion callback.
+  */
+ int ai_handle_call(ai_handle_t *h, const char *action, const char *text,
+                    char *response, size_t response_size, int timeout_ms) {
+     struct sync_call call = { 0, 0, response, response_size };
+     
+     if (!response || response_size == 0) {
+         errno = EINVAL;
+         return -1;
+     }
+     response[0] = '\0';
+     if (ai_handle_submit(h, action, text, timeout_ms, sync_complete, &call) != 0) {
          return -1;
      }
      
-     /* Parse response */
+     pthread_mutex_lock(&h->mutex);
+     while (!call.done) {
+         if (h->polling) {
+             struct timespec wake;
+             clock_gettime(CLOCK_REALTIME, &wake);
+             wake.tv_nsec += AI_CLIENT_POLL_SLICE_MS * 1000000L;
+             if (wake.tv_nsec >= 1000000000L) {
+                 wake.tv_sec++;
+                 wake.tv_nsec -= 1000000000L;
+             }
+             pthread_cond_timedwait(&h->cond, &h->mutex, &wake);
+             continue;
+         }
+         
+         struct pollfd pfd = { h->fd, POLLIN, 0 };
+         if (h->out_len) pfd.events |= POLLOUT;
+         int wait = timeout_locked(h);
+         if (wait < 0 || wait > AI_CLIENT_POLL_SLICE_MS) wait = AI_CLIENT_POLL_SLICE_MS;
+         
+         h->polling = 1;
+         pthread_mutex_unlock(&h->mutex);
+         poll(&pfd, pfd.fd >= 0 ? 1 : 0, wait);
+         pthread_mutex_lock(&h->mutex);
+         h->polling = 0;
+         
+         process_locked(h);
+     }
+     pthread_mutex_unlock(&h->mutex);
+     
+     if (call.error) {
+         errno = call.error;
+         return -1;
+     }
+     return 0;
+ }
+ 
+ /* Map an interpret reply onto 0 / -1 / -2 (unsafe) / -3 (unclear) */
+ static int parse_interpret_response(const char *response, char *shell_command, size_t command_size) {
      json_object *response_obj = json_tokener_parse(response);
      if (!response_obj) {
          ai_client_log("AI-Client: Invalid JSON response\n");
@@ -180,27 +706,239 @@ static ai_client_state_t g_client = {-1, 0};
      return -1;
  }
  
- /* Execute command through daemon */
- int ai_execute_command(const char *command, char *output, size_t output_size) {
-     if (!command || !output || output_size == 0) {
+ int ai_handle_interpret(ai_handle_t *h, const char *natural_command,
+                         char *shell_command, size_t command_size, int timeout_ms) {
+     char response[MAX_RESPONSE_SIZE];
+     
+     if (!natural_command || !shell_command || command_size == 0) {
          return -1;
      }
+     if (ai_handle_call(h, "interpret", natural_command, response, sizeof(response), timeout_ms) != 0) {
+         return -1;
+     }
+     return parse_interpret_response(response, shell_command, command_size);
+ }
+ 
+ /* Daemon-published cache. Mapped on first use and re-checked at most
+  * once a second, remapping when a restarted daemon has replaced the file.
+  * Reads hold the mutex so a remap never pulls the mapping from under one. */
+ static struct {
+     pthread_mutex_t mutex;
+     const ai_os_cache_t *map;
+     dev_t dev;
+     ino_t ino;
+     time_t checked;
+ } g_cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+ 
+ /* Caller holds g_cache.mutex */
+ static void cache_unmap(void) {
+     if (g_cache.map) {
+         munmap((void *)g_cache.map, sizeof(ai_os_cache_t));
+         g_cache.map = NULL;
+     }
+ }
+ 
+ /* Caller holds g_cache.mutex */
+ static const ai_os_cache_t *cache_get(void) {
+     const char *env = getenv("AI_OS_CACHE");
+     if ((env && strcmp(env, "0") == 0) || g_trace > 0) {
+         return NULL;
+     }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("execute");
-     json_object *cmd = json_object_new_string(command);
+     time_t now = time(NULL);
+     if (g_cache.map && now == g_cache.checked) {
+         return g_cache.map;
+     }
+     g_cache.checked = now;
      
-     json_object_object_add(request, "action", action);
-     json_object_object_add(request, "command", cmd);
+     struct stat st;
+     if (stat(AI_OS_CACHE_PATH, &st) != 0) {
+         cache_unmap();
+         return NULL;
+     }
+     if (g_cache.map && st.st_dev == g_cache.dev && st.st_ino == g_cache.ino) {
+         return g_cache.map;
+     }
+     
+     cache_unmap();
+     if ((size_t)st.st_size < sizeof(ai_os_cache_t)) {
+         return NULL;
+     }
+     int fd = open(AI_OS_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+     if (fd < 0) {
+         return NULL;
+     }
+     void *map = mmap(NULL, sizeof(ai_os_cache_t), PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+     if (map == MAP_FAILED) {
+         return NULL;
+     }
+     
+     const ai_os_cache_t *cache = map;
+     if (cache->magic != AI_OS_CACHE_MAGIC || cache->version != AI_OS_CACHE_VERSION ||
+         cache->entry_count != AI_OS_CACHE_ENTRIES || cache->entry_size != sizeof(ai_os_cache_entry_t)) {
+         munmap(map, sizeof(ai_os_cache_t));
+         return NULL;
+     }
+     g_cache.map = cache;
+     g_cache.dev = st.st_dev;
+     g_cache.ino = st.st_ino;
+     return cache;
+ }
+ 
+ /* Seqlock read: copy SIZE bytes at SRC guarded by SEQ. -1 if the daemon
+  * kept rewriting the record. */
+ static int cache_copy(const unsigned int *seq, void *dst, const void *src, size_t size) {
+     for (int i = 0; i < AI_CLIENT_CACHE_RETRIES; i++) {
+         unsigned int before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+         if (before & 1) {
+             continue;
+         }
+         memcpy(dst, src, size);
+         __atomic_thread_fence(__ATOMIC_ACQUIRE);
+         if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) {
+             return 0;
+         }
+     }
+     return -1;
+ }
+ 
+ /* Caller holds g_cache.mutex. A status record refreshed within its TTL
+  * also shows the daemon is alive, which every lookup requires. */
+ static int cache_status_locked(const ai_os_cache_t *cache, char *out, size_t out_size) {
+     char status[AI_OS_CACHE_STATUS_SIZE];
+     time_t updated;
+     
+     if (cache_copy(&cache->status_seq, &updated, &cache->status_updated, sizeof(updated)) != 0 ||
+         updated == 0 || time(NULL) - updated > AI_OS_CACHE_STATUS_TTL) {
+         return -1;
+     }
+     if (!out) {
+         return 0;
+     }
+     if (cache_copy(&cache->status_seq, status, cache->status, sizeof(status)) != 0) {
+         return -1;
+     }
+     status[sizeof(status) - 1] = '\0';
+     if (!status[0] || strlen(status) >= out_size) {
+         return -1;
+     }
+     strcpy(out, status);
+     return 0;
+ }
+ 
+ static int cache_status(char *out, size_t out_size) {
+     pthread_mutex_lock(&g_cache.mutex);
+     const ai_os_cache_t *cache = cache_get();
+     int result = cache ? cache_status_locked(cache, out, out_size) : -1;
+     pthread_mutex_unlock(&g_cache.mutex);
+     return result;
+ }
+ 
+ /* 0 and the entry's result code in *code on a hit, -1 on a miss */
+ static int cache_lookup(unsigned int kind, const char *key, char *value, size_t value_size, int *code) {
+     ai_os_cache_entry_t copy;
+     int result = -1;
+     
+     if (!key || strlen(key) >= AI_OS_CACHE_KEY_SIZE) {
+         return -1;
+     }
+     unsigned int hash = ai_os_cache_hash(kind, key);
+     
+     pthread_mutex_lock(&g_cache.mutex);
+     const ai_os_cache_t *cache = cache_get();
+     if (cache && cache_status_locked(cache, NULL, 0) == 0) {
+         time_t now = time(NULL);
+         for (int i = 0; i < AI_OS_CACHE_PROBE; i++) {
+             const ai_os_cache_entry_t *e = &cache->entries[(hash + i) & (AI_OS_CACHE_ENTRIES - 1)];
+             if (cache_copy(&e->seq, &copy, e, sizeof(copy)) != 0 || copy.kind != kind || copy.hash != hash) {
+                 continue;
+             }
+             copy.key[sizeof(copy.key) - 1] = '\0';
+             copy.value[sizeof(copy.value) - 1] = '\0';
+             if (copy.expires <= now || strcmp(copy.key, key) != 0 || strlen(copy.value) >= value_size) {
+                 continue;
+             }
+             strcpy(value, copy.value);
+             *code = copy.result_code;
+             result = 0;
+             break;
+         }
+     }
+     pthread_mutex_unlock(&g_cache.mutex);
+     return result;
+ }
+ 
+ /* Process-wide handle behind the classic API */
+ static ai_handle_t *g_default = NULL;
+ static pthread_mutex_t g_default_mutex = PTHREAD_MUTEX_INITIALIZER;
+ 
+ static ai_handle_t *default_handle(void) {
+     pthread_mutex_lock(&g_default_mutex);
+     if (!g_default) {
+         g_default = ai_handle_open(NULL);
+     }
+     pthread_mutex_unlock(&g_default_mutex);
+     return g_default;
+ }
+ 
+ /* Connect to AI daemon */
+ int ai_client_connect(void) {
+     ai_handle_t *h = default_handle();
+     return h ? ai_handle_connect(h) : -1;
+ }
+ 
+ /* Disconnect from AI daemon; the next request reconnects */
+ void ai_client_disconnect(void) {
+     pthread_mutex_lock(&g_default_mutex);
+     ai_handle_t *h = g_default;
+     pthread_mutex_unlock(&g_default_mutex);
+     ai_handle_disconnect(h);
+ }
+ 
+ /* Trace the classic API's requests (see ai_handle_set_trace) */
+ void ai_client_set_trace(int enabled) {
+     g_trace = enabled != 0;
+     ai_handle_set_trace(default_handle(), enabled);
+ }
+ 
+ int ai_client_last_trace_id(char *trace_id, size_t size) {
+     return ai_handle_last_trace_id(default_handle(), trace_id, size);
+ }
+ 
+ /* Send request and receive response */
+ static int send_request(const char *action, const char *text, char *response, size_t response_size) {
+     ai_handle_t *h = default_handle();
+     if (!h) {
+         return -1;
+     }
+     return ai_handle_call(h, action, text, response, response_size, -1);
+ }
+ 
+ /* Interpret natural language command */
+ int ai_interpret_command(const char *natural_command, char *shell_command, size_t command_size) {
+     int code;
+     if (shell_command && command_size > 0 &&
+         cache_lookup(AI_OS_CACHE_INTERPRET, natural_command, shell_command, command_size, &code) == 0) {
+         return code;
+     }
      
-     const char *request_str = json_object_to_json_string(request);
+     ai_handle_t *h = default_handle();
+     if (!h) {
+         return -1;
+     }
+     return ai_handle_interpret(h, natural_command, shell_command, command_size, -1);
+ }
+ 
+ /* Execute command through daemon */
+ int ai_execute_command(const char *command, char *output, size_t output_size) {
+     if (!command || !output || output_size == 0) {
+         return -1;
+     }
      
      /* Send request */
      char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
-     
-     json_object_put(request);
+     int result = send_request("execute", command, response, sizeof(response));
      
      if (result != 0) {
          return -1;
@@ -235,19 +973,13 @@ static ai_client_state_t g_client = {-1, 0};
          return -1;
      }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("status");
-     
-     json_object_object_add(request, "action", action);
-     
-     const char *request_str = json_object_to_json_string(request);
+     if (cache_status(status_info, info_size) == 0) {
+         return 0;
+     }
      
      /* Send request */
      char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
-     
-     json_object_put(request);
+     int result = send_request("status", NULL, response, sizeof(response));
      
      if (result != 0) {
          return -1;
@@ -266,21 +998,9 @@ static ai_client_state_t g_client = {-1, 0};
          return -1;
      }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("set_model");
-     json_object *model = json_object_new_string(model_name);
-     
-     json_object_object_add(request, "action", action);
-     json_object_object_add(request, "model", model);
-     
-     const char *request_str = json_object_to_json_string(request);
-     
      /* Send request */
      char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
-     
-     json_object_put(request);
+     int result = send_request("set_model", model_name, response, sizeof(response));
      
      if (result != 0) {
          return -1;
@@ -310,19 +1030,9 @@ static ai_client_state_t g_client = {-1, 0};
          return -1;
      }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("get_context");
-     
-     json_object_object_add(request, "action", action);
-     
-     const char *request_str = json_object_to_json_string(request);
-     
      /* Send request */
      char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
-     
-     json_object_put(request);
+     int result = send_request("get_context", NULL, response, sizeof(response));
      
      if (result != 0) {
          return -1;
@@ -358,27 +1068,69 @@ static ai_client_state_t g_client = {-1, 0};
      return -1;
  }
  
+ /* Daemon metrics in the Prometheus text exposition format */
+ int ai_get_metrics(char *metrics_text, size_t text_size) {
+     if (!metrics_text || text_size == 0) {
+         return -1;
+     }
+     
+     ai_handle_t *h = default_handle();
+     char *response = malloc(AI_CLIENT_MAX_LINE);
+     if (!h || !response) {
+         free(response);
+         return -1;
+     }
+     
+     int result = -1;
+     if (ai_handle_call(h, "metrics", NULL, response, AI_CLIENT_MAX_LINE, -1) == 0) {
+         json_object *response_obj = json_tokener_parse(response);
+         json_object *metrics_obj;
+         if (response_obj && json_object_object_get_ex(response_obj, "metrics", &metrics_obj)) {
+             snprintf(metrics_text, text_size, "%s", json_object_get_string(metrics_obj));
+             result = 0;
+         }
+         if (response_obj) json_object_put(response_obj);
+     }
+     free(response);
+     return result;
+ }
+ 
+ /* Have the daemon write its buffered trace spans to a file in FORMAT
+  * ("chrome" or "otlp"); PATH receives the file name */
+ int ai_trace_export(const char *format, char *path, size_t path_size) {
+     char response[MAX_RESPONSE_SIZE];
+     int result = -1;
+     
+     if (!path || path_size == 0 || send_request("trace_export", format, response, sizeof(response)) != 0) {
+         return -1;
+     }
+     
+     json_object *response_obj = json_tokener_parse(response);
+     json_object *path_obj, *spans_obj;
+     if (response_obj && json_object_object_get_ex(response_obj, "path", &path_obj)) {
+         snprintf(path, path_size, "%s", json_object_get_string(path_obj));
+         result = json_object_object_get_ex(response_obj, "spans", &spans_obj) ? json_object_get_int(spans_obj) : 0;
+     } else if (response_obj && json_object_object_get_ex(response_obj, "message", &path_obj)) {
+         snprintf(path, path_size, "%s", json_object_get_string(path_obj));
+     }
+     if (response_obj) json_object_put(response_obj);
+     return result;
+ }
+ 
  /* Classify input as command or chat */
  int ai_classify_input(const char *input, char *classification, size_t classification_size) {
      if (!input || !classification || classification_size == 0) {
          return -1;
      }
      
-     /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *action = json_object_new_string("classify");
-     json_object *command = json_object_new_string(input);
-     
-     json_object_object_add(request, "action", action);
-     json_object_object_add(request, "command", command);
-     
-     const char *request_str = json_object_to_json_string(request);
+     int code;
+     if (cache_lookup(AI_OS_CACHE_CLASSIFY, input, classification, classification_size, &code) == 0) {
+         return 0;
+     }
      
      /* Send request */
      char response[MAX_RESPONSE_SIZE];
-     int result = send_request(request_str, response, sizeof(response));
-     
-     json_object_put(request);
+     int result = send_request("classify", input, response, sizeof(response));
      
      if (result != 0) {
          return -1;
@@ -410,4 +1162,37 @@ static ai_client_state_t g_client = {-1, 0};
      
      json_object_put(response_obj);
      return -1;
- }
\ No newline at end of file
+ } 
+ /* Queue a speculative interpretation of a line that is still being typed.
+  * Returns at once; a later ai_interpret_command() for the same text on this
+  * connection is answered from the daemon's speculation slot. Empty input
+  * cancels the pending speculation. */
+ int ai_speculate_command(const char *natural_command) {
+     if (!natural_command) {
+         return -1;
+     }
+     
+     /* Send request */
+     char response[MAX_RESPONSE_SIZE];
+     int result = send_request("speculate", natural_command, response, sizeof(response));
+     
+     if (result != 0) {
+         return -1;
+     }
+     
+     json_object *response_obj = json_tokener_parse(response);
+     if (!response_obj) {
+         ai_client_log("AI-Client: Invalid JSON response\n");
+         return -1;
+     }
+     
+     json_object *status_obj;
+     const char *status = "error";
+     if (json_object_object_get_ex(response_obj, "status", &status_obj)) {
+         status = json_object_get_string(status_obj);
+     }
+     result = strcmp(status, "error") == 0 ? -1 : 0;
+     
+     json_object_put(response_obj);
+     return result;
+ }
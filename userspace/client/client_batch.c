@@ -0,0 +1,239 @@
+/*
+ * AI-OS Batch Mode (ai-client --batch)
+ * File: userspace/client/client_batch.c
+ *
+ * Reads one input per line (or per NUL with -0) and pipelines them to the
+ * daemon over a single connection, keeping at most max_inflight requests
+ * outstanding. The daemon answers a connection's requests in order, so
+ * results are written in input order as they arrive: one record per input,
+ * delimited like the input, or one NDJSON object per input carrying its
+ * 1-based input number as "id". A 10,000-line runbook then costs one
+ * process and one connection instead of 10,000 of each. Requests go as
+ * batch priority, so the daemon runs them only when no shell is waiting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <json-c/json.h>
+#include "../ai_os_common.h"
+
+#define BATCH_MAX_INFLIGHT 1024
+#define BATCH_POLL_SLICE_MS 100
+
+typedef struct {
+    unsigned long id;           /* input number, from 1 */
+    char *input;
+    char *output;
+    int code;                   /* CLI exit code convention */
+    int done;
+} batch_item_t;
+
+static struct {
+    const char *action;
+    int delimiter;
+    int json;
+    batch_item_t *window;       /* ring indexed by id % size */
+    int size;
+    unsigned long next_id;      /* next input to read */
+    unsigned long flushed;      /* inputs written so far */
+    int failures;
+} batch;
+
+static batch_item_t *batch_slot(unsigned long id) {
+    return &batch.window[id % (unsigned long)batch.size];
+}
+
+/* Reply JSON -> (code, output) for the batchable actions */
+static void parse_reply(batch_item_t *item, const char *response) {
+    json_object *obj = json_tokener_parse(response);
+    json_object *field;
+    const char *status = "error";
+    const char *text = "";
+
+    item->code = 1;
+    if (!obj) {
+        item->output = strdup("invalid reply from daemon");
+        return;
+    }
+    if (json_object_object_get_ex(obj, "status", &field)) {
+        status = json_object_get_string(field);
+    }
+
+    if (strcmp(batch.action, "interpret") == 0) {
+        if (strcmp(status, "success") == 0 && json_object_object_get_ex(obj, "interpreted_command", &field)) {
+            item->code = 0;
+            text = json_object_get_string(field);
+        } else if (strcmp(status, "unsafe") == 0) {
+            item->code = 2;
+        } else if (strcmp(status, "unclear") == 0) {
+            item->code = 3;
+        }
+    } else if (strcmp(batch.action, "classify") == 0) {
+        if (strcmp(status, "success") == 0 && json_object_object_get_ex(obj, "classification", &field)) {
+            item->code = 0;
+            text = json_object_get_string(field);
+        }
+    } else if (strcmp(batch.action, "chat") == 0) {
+        if (strcmp(status, "success") == 0 && json_object_object_get_ex(obj, "chat_response", &field)) {
+            item->code = 0;
+            text = json_object_get_string(field);
+        }
+    } else if (strcmp(batch.action, "execute") == 0) {
+        if (json_object_object_get_ex(obj, "exit_code", &field)) {
+            item->code = json_object_get_int(field);
+        }
+        if (json_object_object_get_ex(obj, "execution_result", &field)) {
+            text = json_object_get_string(field);
+        }
+    }
+
+    if (item->code != 0 && !*text && json_object_object_get_ex(obj, "message", &field)) {
+        text = json_object_get_string(field);
+    }
+    item->output = strdup(text ? text : "");
+    json_object_put(obj);
+}
+
+static void on_reply(ai_handle_t *handle, int error, const char *response, void *user_data) {
+    batch_item_t *item = user_data;
+    (void)handle;
+
+    if (error || !response) {
+        item->code = 1;
+        item->output = strdup(strerror(error ? error : EIO));
+    } else {
+        parse_reply(item, response);
+    }
+    item->done = 1;
+}
+
+static void write_item(const batch_item_t *item) {
+    const char *output = item->output ? item->output : "";
+
+    if (item->code != 0) {
+        batch.failures++;
+    }
+
+    if (batch.json) {
+        json_object *obj = json_object_new_object();
+        json_object_object_add(obj, "id", json_object_new_int64((int64_t)item->id));
+        json_object_object_add(obj, "input", json_object_new_string(item->input));
+        json_object_object_add(obj, "code", json_object_new_int(item->code));
+        json_object_object_add(obj, "output", json_object_new_string(output));
+        printf("%s\n", json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+        json_object_put(obj);
+        return;
+    }
+
+    /* Keep one record per input; failures leave an empty record and say
+     * why on stderr */
+    if (item->code == 0 || strcmp(batch.action, "execute") == 0) {
+        fputs(output, stdout);
+    } else {
+        fprintf(stderr, "ai-client: input %lu: %s\n", item->id, *output ? output : "failed");
+    }
+    fputc(batch.delimiter, stdout);
+}
+
+/* Write every finished item at the head of the window */
+static void flush_done(void) {
+    while (batch.flushed < batch.next_id) {
+        batch_item_t *item = batch_slot(batch.flushed + 1);
+        if (!item->done) {
+            break;
+        }
+        write_item(item);
+        free(item->input);
+        free(item->output);
+        memset(item, 0, sizeof(*item));
+        batch.flushed++;
+    }
+    fflush(stdout);
+}
+
+/* Pipeline ACTION for every record of IN. Returns 0 when every input
+ * succeeded, 1 otherwise. */
+int batch_mode(const char *action, FILE *in, int delimiter, int max_inflight, int json_output) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    int eof = 0;
+
+    if (strcmp(action, "interpret") != 0 && strcmp(action, "classify") != 0 &&
+        strcmp(action, "chat") != 0 && strcmp(action, "execute") != 0) {
+        fprintf(stderr, "ai-client: --batch supports interpret, classify, chat and execute\n");
+        return 1;
+    }
+    if (max_inflight < 1 || max_inflight > BATCH_MAX_INFLIGHT) {
+        fprintf(stderr, "ai-client: in-flight limit must be 1..%d\n", BATCH_MAX_INFLIGHT);
+        return 1;
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.action = action;
+    batch.delimiter = delimiter;
+    batch.json = json_output;
+    batch.size = max_inflight;
+    batch.window = calloc((size_t)max_inflight, sizeof(batch_item_t));
+    if (!batch.window) {
+        return 1;
+    }
+
+    ai_handle_t *handle = ai_handle_open(NULL);
+    if (!handle || ai_handle_connect(handle) != 0) {
+        fprintf(stderr, "ai-client: cannot connect to the daemon: %s\n", strerror(errno));
+        ai_handle_close(handle);
+        free(batch.window);
+        return 1;
+    }
+    ai_handle_set_batch(handle, 1);
+
+    while (!eof || batch.flushed < batch.next_id) {
+        /* Fill the window */
+        while (!eof && batch.next_id - batch.flushed < (unsigned long)batch.size) {
+            ssize_t len = getdelim(&line, &line_cap, delimiter, in);
+            if (len == -1) {
+                eof = 1;
+                break;
+            }
+            if (len > 0 && line[len - 1] == delimiter) line[--len] = '\0';
+            if (delimiter == '\n' && len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+
+            batch_item_t *item = batch_slot(++batch.next_id);
+            item->id = batch.next_id;
+            item->input = strdup(line);
+            if (!item->input || len == 0) {
+                /* Blank input: keep its place, nothing to ask */
+                if (!item->input) item->input = strdup("");
+                item->code = len == 0 ? 0 : 1;
+                item->done = 1;
+                continue;
+            }
+            if (ai_handle_submit(handle, action, item->input, -1, on_reply, item) != 0) {
+                on_reply(handle, errno ? errno : EIO, NULL, item);
+            }
+        }
+
+        flush_done();
+        if (eof && batch.flushed == batch.next_id) {
+            break;
+        }
+
+        struct pollfd pfd = {
+            .fd = ai_handle_fd(handle),
+            .events = ai_handle_events(handle),
+        };
+        int wait_ms = ai_handle_timeout(handle);
+        if (wait_ms < 0 || wait_ms > BATCH_POLL_SLICE_MS) wait_ms = BATCH_POLL_SLICE_MS;
+        poll(&pfd, 1, wait_ms);
+        ai_handle_process(handle);
+    }
+
+    free(line);
+    ai_handle_close(handle);
+    free(batch.window);
+    return batch.failures ? 1 : 0;
+}
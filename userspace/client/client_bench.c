@@ -0,0 +1,440 @@
+/*
+ * AI-OS Daemon Load Generator (ai-client bench)
+ * File: userspace/client/client_bench.c
+ *
+ * Drives the daemon over N handles from one poll loop using the async
+ * client API. Closed loop keeps a fixed number of requests outstanding per
+ * connection; open loop (-r) issues requests on a fixed schedule and
+ * measures latency from the scheduled time, so a stalled daemon shows up
+ * as queueing delay instead of silently lowering the offered load.
+ *
+ * Latencies go into log-linear (HDR-style) histograms: exact below 128us,
+ * then 64 sub-buckets per power of two, i.e. under 1.6% relative error.
+ * Reports list actions in a fixed order with fixed precision so results
+ * from two builds can be diffed directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include "../ai_os_common.h"
+
+#define BENCH_MAX_CONNECTIONS 64         /* daemon's MAX_CLIENTS */
+#define BENCH_HIST_SUB 64
+#define BENCH_HIST_LINEAR (2 * BENCH_HIST_SUB)
+#define BENCH_HIST_SHIFTS 40
+#define BENCH_HIST_BUCKETS (BENCH_HIST_LINEAR + BENCH_HIST_SHIFTS * BENCH_HIST_SUB)
+
+enum bench_action {
+    BENCH_CLASSIFY,
+    BENCH_INTERPRET,
+    BENCH_STATUS,
+    BENCH_GET_CONTEXT,
+    BENCH_EXECUTE,
+    BENCH_ACTIONS
+};
+
+static const char *bench_action_names[BENCH_ACTIONS] = {
+    "classify", "interpret", "status", "get_context", "execute"
+};
+
+typedef struct {
+    uint64_t counts[BENCH_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min_us;
+    uint64_t max_us;
+    double sum_us;
+} bench_hist_t;
+
+typedef struct {
+    bench_hist_t hist;
+    uint64_t sent;
+    uint64_t errors;
+    uint64_t timeouts;
+} bench_stats_t;
+
+/* One request in flight */
+typedef struct {
+    int conn;
+    enum bench_action action;
+    long long start_us;
+} bench_req_t;
+
+static struct {
+    int connections;
+    int concurrency;                 /* closed loop: outstanding per connection */
+    double rate;                     /* open loop: requests/s overall, 0 = closed */
+    double duration;
+    long requests;                   /* stop after this many, 0 = use duration */
+    int timeout_ms;
+    int weights[BENCH_ACTIONS];
+    int weight_total;
+    const char *text;
+    const char *exec_text;
+    const char *socket_path;
+    int json;
+
+    ai_handle_t *handles[BENCH_MAX_CONNECTIONS];
+    int outstanding[BENCH_MAX_CONNECTIONS];
+    bench_stats_t stats[BENCH_ACTIONS];
+    long issued;
+    long completed;
+    unsigned int rng;
+} bench;
+
+static long long bench_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int hist_index(uint64_t us) {
+    if (us < BENCH_HIST_LINEAR) {
+        return (int)us;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    int shift = msb - 6;                          /* leaves 64..127 */
+    if (shift > BENCH_HIST_SHIFTS) {
+        return BENCH_HIST_BUCKETS - 1;
+    }
+    return BENCH_HIST_LINEAR + (shift - 1) * BENCH_HIST_SUB + (int)((us >> shift) - BENCH_HIST_SUB);
+}
+
+/* Highest value that lands in bucket INDEX */
+static uint64_t hist_value(int index) {
+    if (index < BENCH_HIST_LINEAR) {
+        return (uint64_t)index;
+    }
+    int shift = (index - BENCH_HIST_LINEAR) / BENCH_HIST_SUB + 1;
+    uint64_t sub = (uint64_t)((index - BENCH_HIST_LINEAR) % BENCH_HIST_SUB + BENCH_HIST_SUB);
+    return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(bench_hist_t *h, uint64_t us) {
+    h->counts[hist_index(us)]++;
+    if (h->total == 0 || us < h->min_us) h->min_us = us;
+    if (us > h->max_us) h->max_us = us;
+    h->total++;
+    h->sum_us += (double)us;
+}
+
+static uint64_t hist_percentile(const bench_hist_t *h, double percentile) {
+    if (h->total == 0) return 0;
+    uint64_t target = (uint64_t)(percentile / 100.0 * (double)h->total + 0.999999);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t value = hist_value(i);
+            return value < h->max_us ? value : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+/* "classify=70,interpret=10,status=20" */
+static int parse_mix(const char *spec) {
+    char *copy = strdup(spec);
+    char *save = NULL;
+
+    if (!copy) return -1;
+    memset(bench.weights, 0, sizeof(bench.weights));
+    bench.weight_total = 0;
+
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        int weight = 1;
+        if (eq) {
+            *eq = '\0';
+            weight = atoi(eq + 1);
+        }
+        int found = 0;
+        for (int a = 0; a < BENCH_ACTIONS; a++) {
+            if (strcmp(item, bench_action_names[a]) == 0) {
+                bench.weights[a] += weight;
+                found = 1;
+            }
+        }
+        if (!found || weight < 0) {
+            fprintf(stderr, "bench: bad mix entry '%s'\n", item);
+            free(copy);
+            return -1;
+        }
+        bench.weight_total += weight;
+    }
+    free(copy);
+    return bench.weight_total > 0 ? 0 : -1;
+}
+
+static enum bench_action pick_action(void) {
+    int roll = (int)(rand_r(&bench.rng) % (unsigned int)bench.weight_total);
+    for (int a = 0; a < BENCH_ACTIONS; a++) {
+        if (roll < bench.weights[a]) return (enum bench_action)a;
+        roll -= bench.weights[a];
+    }
+    return BENCH_STATUS;
+}
+
+static int bench_done_issuing(long long now_us, long long end_us) {
+    if (bench.requests > 0) return bench.issued >= bench.requests;
+    return now_us >= end_us;
+}
+
+static void issue(int conn, long long scheduled_us);
+
+static void on_complete(ai_handle_t *handle, int error, const char *response, void *user_data) {
+    bench_req_t *req = user_data;
+    bench_stats_t *stats = &bench.stats[req->action];
+    (void)handle;
+
+    hist_record(&stats->hist, (uint64_t)(bench_now_us() - req->start_us));
+    if (error == ETIMEDOUT) {
+        stats->timeouts++;
+        stats->errors++;
+    } else if (error || !response || strstr(response, "\"status\": \"error\"") ||
+               strncmp(response, "{ \"error\"", 9) == 0 || strncmp(response, "{\"error\"", 8) == 0) {
+        stats->errors++;
+    }
+    bench.outstanding[req->conn]--;
+    bench.completed++;
+    free(req);
+}
+
+static void issue(int conn, long long scheduled_us) {
+    bench_req_t *req = malloc(sizeof(*req));
+    if (!req) return;
+
+    req->conn = conn;
+    req->action = pick_action();
+    req->start_us = scheduled_us;
+
+    const char *text = NULL;
+    switch (req->action) {
+        case BENCH_CLASSIFY:
+        case BENCH_INTERPRET:
+            text = bench.text;
+            break;
+        case BENCH_EXECUTE:
+            text = bench.exec_text;
+            break;
+        default:
+            break;
+    }
+
+    bench.stats[req->action].sent++;
+    bench.outstanding[conn]++;
+    bench.issued++;
+    if (ai_handle_submit(bench.handles[conn], bench_action_names[req->action], text,
+                         bench.timeout_ms, on_complete, req) != 0) {
+        on_complete(bench.handles[conn], errno ? errno : EIO, NULL, req);
+    }
+}
+
+static void print_text(double elapsed) {
+    uint64_t total = 0, errors = 0;
+
+    printf("ai-client bench: %d connections, %s, %.1fs, mix",
+           bench.connections, bench.rate > 0 ? "open loop" : "closed loop", elapsed);
+    for (int a = 0; a < BENCH_ACTIONS; a++) {
+        if (bench.weights[a]) printf(" %s=%d", bench_action_names[a], bench.weights[a]);
+    }
+    if (bench.rate > 0) {
+        printf(", target %.1f req/s\n", bench.rate);
+    } else {
+        printf(", %d outstanding/connection\n", bench.concurrency);
+    }
+    printf("%-12s %8s %7s %9s %10s %10s %10s %10s %10s %10s\n",
+           "action", "count", "err%", "req/s", "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)", "p99.9(ms)", "max(ms)");
+
+    for (int a = 0; a < BENCH_ACTIONS; a++) {
+        const bench_stats_t *s = &bench.stats[a];
+        if (!bench.weights[a]) continue;
+        total += s->hist.total;
+        errors += s->errors;
+        printf("%-12s %8llu %7.2f %9.1f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+               bench_action_names[a], (unsigned long long)s->hist.total,
+               s->hist.total ? 100.0 * (double)s->errors / (double)s->hist.total : 0.0,
+               (double)s->hist.total / elapsed,
+               s->hist.total ? s->hist.sum_us / (double)s->hist.total / 1000.0 : 0.0,
+               hist_percentile(&s->hist, 50.0) / 1000.0,
+               hist_percentile(&s->hist, 90.0) / 1000.0,
+               hist_percentile(&s->hist, 99.0) / 1000.0,
+               hist_percentile(&s->hist, 99.9) / 1000.0,
+               s->hist.max_us / 1000.0);
+    }
+    printf("%-12s %8llu %7.2f %9.1f\n", "total", (unsigned long long)total,
+           total ? 100.0 * (double)errors / (double)total : 0.0, (double)total / elapsed);
+}
+
+/* One key per line, fixed order and precision: diff-friendly */
+static void print_json(double elapsed) {
+    printf("{\n");
+    printf("  \"connections\": %d,\n", bench.connections);
+    printf("  \"mode\": \"%s\",\n", bench.rate > 0 ? "open" : "closed");
+    printf("  \"rate\": %.1f,\n", bench.rate);
+    printf("  \"concurrency\": %d,\n", bench.concurrency);
+    printf("  \"elapsed_s\": %.3f,\n", elapsed);
+    printf("  \"actions\": {\n");
+
+    int first = 1;
+    for (int a = 0; a < BENCH_ACTIONS; a++) {
+        const bench_stats_t *s = &bench.stats[a];
+        if (!bench.weights[a]) continue;
+        printf("%s    \"%s\": {\n", first ? "" : ",\n", bench_action_names[a]);
+        first = 0;
+        printf("      \"weight\": %d,\n", bench.weights[a]);
+        printf("      \"count\": %llu,\n", (unsigned long long)s->hist.total);
+        printf("      \"errors\": %llu,\n", (unsigned long long)s->errors);
+        printf("      \"timeouts\": %llu,\n", (unsigned long long)s->timeouts);
+        printf("      \"throughput\": %.1f,\n", (double)s->hist.total / elapsed);
+        printf("      \"latency_us\": {\n");
+        printf("        \"min\": %llu,\n", (unsigned long long)s->hist.min_us);
+        printf("        \"mean\": %.0f,\n", s->hist.total ? s->hist.sum_us / (double)s->hist.total : 0.0);
+        printf("        \"p50\": %llu,\n", (unsigned long long)hist_percentile(&s->hist, 50.0));
+        printf("        \"p90\": %llu,\n", (unsigned long long)hist_percentile(&s->hist, 90.0));
+        printf("        \"p99\": %llu,\n", (unsigned long long)hist_percentile(&s->hist, 99.0));
+        printf("        \"p99.9\": %llu,\n", (unsigned long long)hist_percentile(&s->hist, 99.9));
+        printf("        \"max\": %llu\n", (unsigned long long)s->hist.max_us);
+        printf("      }\n");
+        printf("    }");
+    }
+    printf("\n  }\n}\n");
+}
+
+static void bench_usage(void) {
+    printf("Usage: ai-client bench [OPTIONS]\n\n");
+    printf("  -c N        connections (default 4, max %d)\n", BENCH_MAX_CONNECTIONS);
+    printf("  -C N        closed loop: requests outstanding per connection (default 1)\n");
+    printf("  -r RATE     open loop: total requests/s on a fixed schedule\n");
+    printf("  -d SECONDS  run time (default 10)\n");
+    printf("  -n COUNT    stop after COUNT requests instead\n");
+    printf("  -m MIX      action weights, e.g. classify=70,interpret=10,status=20\n");
+    printf("              actions: classify interpret status get_context execute\n");
+    printf("              (default classify=60,status=20,get_context=20)\n");
+    printf("  -t TEXT     text for classify/interpret (default \"list files\")\n");
+    printf("  -x COMMAND  command for execute (default \"true\")\n");
+    printf("  -T MS       per-request timeout (default 30000)\n");
+    printf("  -s PATH     daemon socket\n");
+    printf("  -j          JSON report\n");
+}
+
+int bench_main(int argc, char **argv) {
+    int opt;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.connections = 4;
+    bench.concurrency = 1;
+    bench.duration = 10.0;
+    bench.timeout_ms = 30000;
+    bench.text = "list files";
+    bench.exec_text = "true";
+    bench.rng = (unsigned int)getpid();
+    parse_mix("classify=60,status=20,get_context=20");
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:C:r:d:n:m:t:x:T:s:jh")) != -1) {
+        switch (opt) {
+            case 'c': bench.connections = atoi(optarg); break;
+            case 'C': bench.concurrency = atoi(optarg); break;
+            case 'r': bench.rate = atof(optarg); break;
+            case 'd': bench.duration = atof(optarg); break;
+            case 'n': bench.requests = atol(optarg); break;
+            case 'm':
+                if (parse_mix(optarg) != 0) return 1;
+                break;
+            case 't': bench.text = optarg; break;
+            case 'x': bench.exec_text = optarg; break;
+            case 'T': bench.timeout_ms = atoi(optarg); break;
+            case 's': bench.socket_path = optarg; break;
+            case 'j': bench.json = 1; break;
+            case 'h':
+                bench_usage();
+                return 0;
+            default:
+                bench_usage();
+                return 1;
+        }
+    }
+    if (bench.connections < 1 || bench.connections > BENCH_MAX_CONNECTIONS ||
+        bench.concurrency < 1 || bench.duration <= 0 || bench.rate < 0) {
+        bench_usage();
+        return 1;
+    }
+
+    for (int i = 0; i < bench.connections; i++) {
+        bench.handles[i] = ai_handle_open(bench.socket_path);
+        if (!bench.handles[i] || ai_handle_connect(bench.handles[i]) != 0) {
+            fprintf(stderr, "bench: cannot connect to the daemon: %s\n", strerror(errno));
+            for (int j = 0; j <= i; j++) ai_handle_close(bench.handles[j]);
+            return 1;
+        }
+    }
+
+    long long start_us = bench_now_us();
+    long long end_us = start_us + (long long)(bench.duration * 1e6);
+    long long interval_us = bench.rate > 0 ? (long long)(1e6 / bench.rate) : 0;
+    long long next_us = start_us;
+    int next_conn = 0;
+
+    for (;;) {
+        long long now_us = bench_now_us();
+        int issuing = !bench_done_issuing(now_us, end_us);
+
+        if (issuing && bench.rate > 0) {
+            /* Catch up on every slot that is due, stamped with its slot time */
+            while (next_us <= now_us && !bench_done_issuing(next_us, end_us)) {
+                issue(next_conn, next_us);
+                next_conn = (next_conn + 1) % bench.connections;
+                next_us += interval_us;
+            }
+        } else if (issuing) {
+            for (int i = 0; i < bench.connections; i++) {
+                while (bench.outstanding[i] < bench.concurrency && !bench_done_issuing(now_us, end_us)) {
+                    issue(i, bench_now_us());
+                }
+            }
+        }
+
+        if (!issuing && bench.completed >= bench.issued) {
+            break;
+        }
+
+        struct pollfd fds[BENCH_MAX_CONNECTIONS];
+        int wait_ms = 100;
+        for (int i = 0; i < bench.connections; i++) {
+            fds[i].fd = ai_handle_fd(bench.handles[i]);
+            fds[i].events = ai_handle_events(bench.handles[i]);
+            fds[i].revents = 0;
+            int t = ai_handle_timeout(bench.handles[i]);
+            if (t >= 0 && t < wait_ms) wait_ms = t;
+        }
+        if (issuing && bench.rate > 0) {
+            long long until_next = (next_us - bench_now_us()) / 1000;
+            if (until_next < wait_ms) wait_ms = until_next > 0 ? (int)until_next : 0;
+        }
+
+        poll(fds, (nfds_t)bench.connections, wait_ms);
+        for (int i = 0; i < bench.connections; i++) {
+            ai_handle_process(bench.handles[i]);
+        }
+    }
+
+    double elapsed = (double)(bench_now_us() - start_us) / 1e6;
+    if (bench.json) {
+        print_json(elapsed);
+    } else {
+        print_text(elapsed);
+    }
+
+    for (int i = 0; i < bench.connections; i++) {
+        ai_handle_close(bench.handles[i]);
+    }
+    return 0;
+}
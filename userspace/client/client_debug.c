@@ -0,0 +1,231 @@
+/*
+ * AI-OS Debug Dumps (ai-client debug)
+ * File: userspace/client/client_debug.c
+ *
+ * `ai-client debug flight-recorder` prints the daemon's flight recorder
+ * (ai_os_flight.h): the last requests it served, oldest first, with the
+ * time each spent per stage. It reads the shared-memory segment directly,
+ * so it works while the daemon is hung and after it has crashed; -p reads
+ * the segment a restarted daemon set aside.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../ai_os_common.h"
+#include "../ai_os_flight.h"
+
+#define DEBUG_COPY_RETRIES 8
+
+/* enum metrics_stage order */
+static const char *stage_columns[AI_OS_FLIGHT_STAGES] = {
+    "context", "spec", "queue", "prompt", "wait", "http", "parse", "exec", "serial"
+};
+static const char *stage_names[AI_OS_FLIGHT_STAGES] = {
+    "context", "speculation", "queue", "prompt", "mutex_wait", "http", "parse", "execute", "serialize"
+};
+
+static long long clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Seqlock read of one record; -1 if it kept changing under us */
+static int copy_record(const ai_os_flight_record_t *src, ai_os_flight_record_t *dst) {
+    for (int i = 0; i < DEBUG_COPY_RETRIES; i++) {
+        unsigned int before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(dst, src, sizeof(*dst));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == before) {
+            dst->action[sizeof(dst->action) - 1] = '\0';
+            dst->status[sizeof(dst->status) - 1] = '\0';
+            dst->model[sizeof(dst->model) - 1] = '\0';
+            dst->trace_id[sizeof(dst->trace_id) - 1] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void format_time(long long unix_ns, char *buf, size_t size) {
+    time_t secs = (time_t)(unix_ns / 1000000000LL);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    size_t len = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + len, size - len, ".%03lld", unix_ns / 1000000 % 1000);
+}
+
+static int compare_records(const void *a, const void *b) {
+    const ai_os_flight_record_t *x = a, *y = b;
+    return x->request_no < y->request_no ? -1 : x->request_no > y->request_no;
+}
+
+static void print_text(const ai_os_flight_record_t *r, long long now_unix_ns) {
+    char when[40];
+    /* An unfinished request has been running since it arrived */
+    double total_ms = r->state == AI_OS_FLIGHT_DONE ? r->total_ns / 1e6 : (now_unix_ns - r->start_unix_ns) / 1e6;
+
+    format_time(r->start_unix_ns, when, sizeof(when));
+    printf("%6llu %s %-11s %-9s %10.1f %5u %6u %6u %8u %4u %7d",
+           r->request_no, when, r->action,
+           r->state == AI_OS_FLIGHT_DONE ? r->status : "ACTIVE",
+           total_ms, r->queue_depth, r->request_bytes, r->response_bytes, r->arena_bytes, r->heap_allocs,
+           (int)r->client_pid);
+    for (int s = 0; s < AI_OS_FLIGHT_STAGES; s++) {
+        printf(" %8.1f", r->stage_ns[s] / 1e6);
+    }
+    printf("  %s%s%s\n", r->model, r->trace_id[0] ? " trace=" : "", r->trace_id);
+}
+
+static void json_safe(char *dst, const char *src, size_t size) {
+    size_t n = 0;
+    for (const char *p = src; *p && n < size - 1; p++) {
+        if (*p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\') {
+            dst[n++] = *p;
+        }
+    }
+    dst[n] = '\0';
+}
+
+static void print_json(const ai_os_flight_record_t *r, long long now_unix_ns) {
+    double total_ms = r->state == AI_OS_FLIGHT_DONE ? r->total_ns / 1e6 : (now_unix_ns - r->start_unix_ns) / 1e6;
+    char action[sizeof(r->action)], model[sizeof(r->model)];
+
+    /* The action is whatever the client sent and the model comes from the
+     * config: keep both printable and quote-free */
+    json_safe(action, r->action, sizeof(action));
+    json_safe(model, r->model, sizeof(model));
+
+    printf("{\"request\":%llu,\"start_unix_ms\":%lld,\"action\":\"%s\",\"status\":\"%s\",\"active\":%s,"
+           "\"total_ms\":%.3f,\"queue_depth\":%u,\"request_bytes\":%u,\"response_bytes\":%u,"
+           "\"arena_bytes\":%u,\"heap_allocs\":%u,\"client_pid\":%d,"
+           "\"model\":\"%s\",\"trace_id\":\"%s\",\"stages_ms\":{",
+           r->request_no, r->start_unix_ns / 1000000, action, r->status,
+           r->state == AI_OS_FLIGHT_DONE ? "false" : "true", total_ms, r->queue_depth,
+           r->request_bytes, r->response_bytes, r->arena_bytes, r->heap_allocs, (int)r->client_pid,
+           model, r->trace_id);
+    for (int s = 0; s < AI_OS_FLIGHT_STAGES; s++) {
+        printf("%s\"%s\":%.3f", s ? "," : "", stage_names[s], r->stage_ns[s] / 1e6);
+    }
+    printf("}}\n");
+}
+
+static int dump_flight_recorder(const char *path, int json, int limit) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ai-client: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ai_os_flight_t)) {
+        fprintf(stderr, "ai-client: %s: not a flight recorder segment\n", path);
+        close(fd);
+        return 1;
+    }
+    const ai_os_flight_t *map = mmap(NULL, sizeof(ai_os_flight_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ai-client: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (map->magic != AI_OS_FLIGHT_MAGIC || map->version != AI_OS_FLIGHT_VERSION ||
+        map->record_count != AI_OS_FLIGHT_RECORDS || map->record_size != sizeof(ai_os_flight_record_t)) {
+        fprintf(stderr, "ai-client: %s: unknown flight recorder layout\n", path);
+        munmap((void *)map, sizeof(ai_os_flight_t));
+        return 1;
+    }
+
+    ai_os_flight_record_t *records = malloc(sizeof(ai_os_flight_record_t) * AI_OS_FLIGHT_RECORDS);
+    if (!records) {
+        munmap((void *)map, sizeof(ai_os_flight_t));
+        return 1;
+    }
+    int count = 0, torn = 0;
+    for (int i = 0; i < AI_OS_FLIGHT_RECORDS; i++) {
+        if (copy_record(&map->records[i], &records[count]) != 0) {
+            torn++;
+        } else if (records[count].state != AI_OS_FLIGHT_EMPTY) {
+            count++;
+        }
+    }
+    qsort(records, (size_t)count, sizeof(*records), compare_records);
+
+    long long now_unix_ns = clock_ns(CLOCK_REALTIME);
+    pid_t pid = map->daemon_pid;
+    int alive = pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+    int first = limit > 0 && count > limit ? count - limit : 0;
+
+    if (!json) {
+        char started[40];
+        format_time(map->started_unix_ns, started, sizeof(started));
+        printf("%s: daemon pid %d (%s), started %s, %llu requests, last %d kept%s\n", path, (int)pid,
+               alive ? "running" : "not running", started, map->next_request, count,
+               torn ? " (some records were being written)" : "");
+        printf("%6s %-23s %-11s %-9s %10s %5s %6s %6s %8s %4s %7s", "req", "arrived", "action", "status",
+               "total(ms)", "queue", "in(B)", "out(B)", "arena(B)", "heap", "pid");
+        for (int s = 0; s < AI_OS_FLIGHT_STAGES; s++) {
+            printf(" %8s", stage_columns[s]);
+        }
+        printf("  model\n");
+    }
+    for (int i = first; i < count; i++) {
+        if (json) {
+            print_json(&records[i], now_unix_ns);
+        } else {
+            print_text(&records[i], now_unix_ns);
+        }
+    }
+
+    free(records);
+    munmap((void *)map, sizeof(ai_os_flight_t));
+    return 0;
+}
+
+static void debug_usage(void) {
+    printf("Usage: ai-client debug flight-recorder [OPTIONS]\n\n");
+    printf("  -p          the previous daemon's recorder (%s)\n", AI_OS_FLIGHT_PREV_PATH);
+    printf("  -f PATH     read PATH instead of %s\n", AI_OS_FLIGHT_PATH);
+    printf("  -n COUNT    only the last COUNT requests\n");
+    printf("  -j          one JSON object per request\n");
+}
+
+int debug_main(int argc, char **argv) {
+    const char *path = AI_OS_FLIGHT_PATH;
+    int json = 0;
+    int limit = 0;
+    int opt;
+
+    if (argc < 2 || strcmp(argv[1], "flight-recorder") != 0) {
+        debug_usage();
+        return argc < 2 || strcmp(argv[1], "-h") != 0;
+    }
+
+    optind = 1;
+    while ((opt = getopt(argc - 1, argv + 1, "pf:n:jh")) != -1) {
+        switch (opt) {
+            case 'p': path = AI_OS_FLIGHT_PREV_PATH; break;
+            case 'f': path = optarg; break;
+            case 'n': limit = atoi(optarg); break;
+            case 'j': json = 1; break;
+            case 'h':
+                debug_usage();
+                return 0;
+            default:
+                debug_usage();
+                return 1;
+        }
+    }
+    return dump_flight_recorder(path, json, limit);
+}
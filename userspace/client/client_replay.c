@@ -0,0 +1,353 @@
+/*
+ * AI-OS Traffic Replay (ai-client replay)
+ * File: userspace/client/client_replay.c
+ *
+ * Re-drives the requests of a daemon traffic capture (daemon/capture.c)
+ * against a daemon, on the recorded connections and at the recorded
+ * arrival times, optionally sped up. Requests are issued on schedule
+ * whether or not earlier ones have been answered, and latency is measured
+ * from the scheduled time, as in bench's open loop. The report sets each
+ * action's replayed latencies beside the recorded ones.
+ *
+ * Point it at a daemon whose "replay_backend" is the same capture so
+ * generate calls are answered as they were in production; recorded
+ * "execute" requests are skipped unless -x is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <json-c/json.h>
+#include "../ai_os_common.h"
+
+#define REPLAY_MAX_CONNECTIONS 64        /* daemon's MAX_CLIENTS */
+#define REPLAY_MAX_ACTIONS 16
+
+/* One recorded request */
+typedef struct {
+    long long t_us;                      /* arrival, from the start of the capture */
+    long long recorded_us;               /* the daemon's service time then */
+    long long conn;
+    int action;
+    char *text;
+} replay_req_t;
+
+typedef struct {
+    char name[32];
+    long long *replayed_us;
+    long long *recorded_us;
+    size_t count;
+    size_t cap;
+    unsigned long errors;
+    unsigned long skipped;
+} replay_stats_t;
+
+/* One request in flight */
+typedef struct {
+    int action;
+    long long scheduled_us;
+    long long recorded_us;
+} replay_pending_t;
+
+static struct {
+    replay_req_t *reqs;
+    size_t count;
+    replay_stats_t stats[REPLAY_MAX_ACTIONS];
+    int actions;
+    long long conn_ids[REPLAY_MAX_CONNECTIONS];
+    int conns;
+    ai_handle_t *handles[REPLAY_MAX_CONNECTIONS];
+    long completed;
+    long issued;
+    long long max_lag_us;
+} replay;
+
+static long long replay_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int action_index(const char *name) {
+    for (int a = 0; a < replay.actions; a++) {
+        if (strcmp(replay.stats[a].name, name) == 0) return a;
+    }
+    if (replay.actions == REPLAY_MAX_ACTIONS) return -1;
+    snprintf(replay.stats[replay.actions].name, sizeof(replay.stats[0].name), "%s", name);
+    return replay.actions++;
+}
+
+/* Connection slot for a recorded connection; beyond the daemon's client
+ * limit recorded connections share slots */
+static int conn_index(long long conn) {
+    for (int i = 0; i < replay.conns; i++) {
+        if (replay.conn_ids[i] == conn) return i;
+    }
+    if (replay.conns < REPLAY_MAX_CONNECTIONS) {
+        replay.conn_ids[replay.conns] = conn;
+        return replay.conns++;
+    }
+    return (int)(conn % REPLAY_MAX_CONNECTIONS);
+}
+
+static int compare_reqs(const void *a, const void *b) {
+    const replay_req_t *x = a, *y = b;
+    return x->t_us < y->t_us ? -1 : x->t_us > y->t_us;
+}
+
+static int compare_us(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* The request lines of the capture at PATH, in arrival order */
+static int load_capture(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "replay: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0, cap = 0;
+    while (getline(&line, &line_cap, fp) > 0) {
+        json_object *obj = json_tokener_parse(line);
+        json_object *t, *conn, *action, *text, *us;
+        if (obj && json_object_object_get_ex(obj, "t_us", &t) &&
+            json_object_object_get_ex(obj, "conn", &conn) &&
+            json_object_object_get_ex(obj, "action", &action)) {
+            int a = action_index(json_object_get_string(action));
+            if (a >= 0 && replay.count == cap) {
+                cap = cap ? cap * 2 : 1024;
+                replay_req_t *grown = realloc(replay.reqs, cap * sizeof(*grown));
+                if (!grown) {
+                    json_object_put(obj);
+                    break;
+                }
+                replay.reqs = grown;
+            }
+            if (a >= 0) {
+                replay_req_t *r = &replay.reqs[replay.count++];
+                r->t_us = json_object_get_int64(t);
+                r->conn = json_object_get_int64(conn);
+                r->action = a;
+                r->recorded_us = json_object_object_get_ex(obj, "us", &us) ? json_object_get_int64(us) : 0;
+                r->text = json_object_object_get_ex(obj, "text", &text) ? strdup(json_object_get_string(text)) : NULL;
+            }
+        }
+        if (obj) json_object_put(obj);
+    }
+    free(line);
+    fclose(fp);
+
+    qsort(replay.reqs, replay.count, sizeof(*replay.reqs), compare_reqs);
+    return 0;
+}
+
+static void record_latency(replay_stats_t *s, long long replayed_us, long long recorded_us) {
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 256;
+        long long *replayed = realloc(s->replayed_us, cap * sizeof(long long));
+        if (!replayed) return;
+        s->replayed_us = replayed;
+        long long *recorded = realloc(s->recorded_us, cap * sizeof(long long));
+        if (!recorded) return;
+        s->recorded_us = recorded;
+        s->cap = cap;
+    }
+    s->replayed_us[s->count] = replayed_us;
+    s->recorded_us[s->count] = recorded_us;
+    s->count++;
+}
+
+static void on_complete(ai_handle_t *handle, int error, const char *response, void *user_data) {
+    replay_pending_t *p = user_data;
+    replay_stats_t *s = &replay.stats[p->action];
+    (void)handle;
+
+    record_latency(s, replay_now_us() - p->scheduled_us, p->recorded_us);
+    if (error || !response || strstr(response, "\"status\": \"error\"") ||
+        strncmp(response, "{ \"error\"", 9) == 0 || strncmp(response, "{\"error\"", 8) == 0) {
+        s->errors++;
+    }
+    replay.completed++;
+    free(p);
+}
+
+static void issue(const replay_req_t *r, long long scheduled_us, int timeout_ms) {
+    replay_pending_t *p = malloc(sizeof(*p));
+    if (!p) return;
+    p->action = r->action;
+    p->scheduled_us = scheduled_us;
+    p->recorded_us = r->recorded_us;
+
+    int conn = conn_index(r->conn);
+    replay.issued++;
+    if (ai_handle_submit(replay.handles[conn], replay.stats[r->action].name, r->text,
+                         timeout_ms, on_complete, p) != 0) {
+        on_complete(replay.handles[conn], errno ? errno : EIO, NULL, p);
+    }
+}
+
+static long long percentile(const long long *sorted, size_t count, double pct) {
+    if (count == 0) return 0;
+    size_t index = (size_t)(pct / 100.0 * (double)count + 0.999999);
+    if (index == 0) index = 1;
+    return sorted[(index > count ? count : index) - 1];
+}
+
+static void print_report(double elapsed, double speed, int json) {
+    if (json) {
+        printf("{\n  \"requests\": %ld,\n  \"speed\": %.2f,\n  \"elapsed_s\": %.3f,\n  \"max_lag_us\": %lld,\n"
+               "  \"actions\": {", replay.issued, speed, elapsed, replay.max_lag_us);
+    } else {
+        printf("ai-client replay: %ld requests on %d connections, speed %s%.2g, %.1fs, issued up to %.1fms late\n",
+               replay.issued, replay.conns, speed > 0 ? "x" : "unpaced ", speed, elapsed, replay.max_lag_us / 1000.0);
+        printf("%-12s %8s %8s %7s %12s %12s %12s %12s\n", "action", "count", "skipped", "err%",
+               "p50(ms)", "rec p50", "p99(ms)", "rec p99");
+    }
+
+    int first = 1;
+    for (int a = 0; a < replay.actions; a++) {
+        replay_stats_t *s = &replay.stats[a];
+        if (s->count == 0 && s->skipped == 0) continue;
+        qsort(s->replayed_us, s->count, sizeof(long long), compare_us);
+        qsort(s->recorded_us, s->count, sizeof(long long), compare_us);
+        long long p50 = percentile(s->replayed_us, s->count, 50.0);
+        long long p99 = percentile(s->replayed_us, s->count, 99.0);
+        long long rec50 = percentile(s->recorded_us, s->count, 50.0);
+        long long rec99 = percentile(s->recorded_us, s->count, 99.0);
+        if (json) {
+            printf("%s\n    \"%s\": { \"count\": %zu, \"skipped\": %lu, \"errors\": %lu, "
+                   "\"p50_us\": %lld, \"p99_us\": %lld, \"recorded_p50_us\": %lld, \"recorded_p99_us\": %lld }",
+                   first ? "" : ",", s->name, s->count, s->skipped, s->errors, p50, p99, rec50, rec99);
+            first = 0;
+        } else {
+            printf("%-12s %8zu %8lu %7.2f %12.3f %12.3f %12.3f %12.3f\n", s->name, s->count, s->skipped,
+                   s->count ? 100.0 * (double)s->errors / (double)s->count : 0.0,
+                   p50 / 1000.0, rec50 / 1000.0, p99 / 1000.0, rec99 / 1000.0);
+        }
+    }
+    if (json) {
+        printf("\n  }\n}\n");
+    }
+}
+
+static void replay_usage(void) {
+    printf("Usage: ai-client replay [OPTIONS] CAPTURE\n\n");
+    printf("  -S SPEED    replay SPEED times faster than recorded (default 1, 0 = unpaced)\n");
+    printf("  -x          also replay execute requests (runs the recorded commands)\n");
+    printf("  -T MS       per-request timeout (default 30000)\n");
+    printf("  -s PATH     daemon socket\n");
+    printf("  -j          JSON report\n");
+}
+
+int replay_main(int argc, char **argv) {
+    double speed = 1.0;
+    int allow_execute = 0;
+    int timeout_ms = 30000;
+    const char *socket_path = NULL;
+    int json = 0;
+    int opt;
+
+    memset(&replay, 0, sizeof(replay));
+    optind = 1;
+    while ((opt = getopt(argc, argv, "S:xT:s:jh")) != -1) {
+        switch (opt) {
+            case 'S': speed = atof(optarg); break;
+            case 'x': allow_execute = 1; break;
+            case 'T': timeout_ms = atoi(optarg); break;
+            case 's': socket_path = optarg; break;
+            case 'j': json = 1; break;
+            case 'h':
+                replay_usage();
+                return 0;
+            default:
+                replay_usage();
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || speed < 0) {
+        replay_usage();
+        return 1;
+    }
+    if (load_capture(argv[optind]) != 0) {
+        return 1;
+    }
+
+    /* Every recorded connection gets one, opened before the clock starts */
+    for (size_t i = 0; i < replay.count; i++) {
+        conn_index(replay.reqs[i].conn);
+    }
+    for (int i = 0; i < replay.conns; i++) {
+        replay.handles[i] = ai_handle_open(socket_path);
+        if (!replay.handles[i] || ai_handle_connect(replay.handles[i]) != 0) {
+            fprintf(stderr, "replay: cannot connect to the daemon: %s\n", strerror(errno));
+            for (int j = 0; j <= i; j++) ai_handle_close(replay.handles[j]);
+            return 1;
+        }
+    }
+
+    long long base_t_us = replay.count ? replay.reqs[0].t_us : 0;
+    long long start_us = replay_now_us();
+    size_t next = 0;
+
+    for (;;) {
+        long long now_us = replay_now_us();
+        long long wait_us = 100000;
+
+        while (next < replay.count) {
+            const replay_req_t *r = &replay.reqs[next];
+            long long due_us = start_us + (speed > 0 ? (long long)((r->t_us - base_t_us) / speed) : 0);
+            if (due_us > now_us) {
+                wait_us = due_us - now_us;
+                break;
+            }
+            if (strcmp(replay.stats[r->action].name, "execute") == 0 && !allow_execute) {
+                replay.stats[r->action].skipped++;
+            } else {
+                if (now_us - due_us > replay.max_lag_us) replay.max_lag_us = now_us - due_us;
+                issue(r, due_us, timeout_ms);
+            }
+            next++;
+        }
+
+        if (next == replay.count && replay.completed >= replay.issued) {
+            break;
+        }
+
+        struct pollfd fds[REPLAY_MAX_CONNECTIONS];
+        int wait_ms = (int)((wait_us + 999) / 1000);
+        for (int i = 0; i < replay.conns; i++) {
+            fds[i].fd = ai_handle_fd(replay.handles[i]);
+            fds[i].events = ai_handle_events(replay.handles[i]);
+            fds[i].revents = 0;
+            int t = ai_handle_timeout(replay.handles[i]);
+            if (t >= 0 && t < wait_ms) wait_ms = t;
+        }
+        poll(fds, (nfds_t)replay.conns, wait_ms);
+        for (int i = 0; i < replay.conns; i++) {
+            ai_handle_process(replay.handles[i]);
+        }
+    }
+
+    print_report((double)(replay_now_us() - start_us) / 1e6, speed, json);
+
+    for (int i = 0; i < replay.conns; i++) {
+        ai_handle_close(replay.handles[i]);
+    }
+    for (size_t i = 0; i < replay.count; i++) {
+        free(replay.reqs[i].text);
+    }
+    free(replay.reqs);
+    for (int a = 0; a < replay.actions; a++) {
+        free(replay.stats[a].replayed_us);
+        free(replay.stats[a].recorded_us);
+    }
+    return 0;
+}
@@ -13,13 +13,13 @@
  #include <locale.h>
  #include <langinfo.h>
  #include <sys/utsname.h>
- #include <sys/stat.h>
  #include <stdarg.h>
  #include <time.h>
  #include "../ai_os_common.h"
+ #include "../ai_os_log.h"
+ #include "../ai_os_json.h"
  
  #define OLLAMA_CLIENT_LOG_FILE "/var/log/ai-os/ollama_client.log"
- #define OLLAMA_CLIENT_LOG_MAX_SIZE (1024 * 1024) // 1MB
 
  // Function to get Linux distribution and config
 static void get_linux_distribution(char *distro, size_t size, char *config, size_t config_size) {
@@ -57,12 +57,16 @@ static void get_linux_distribution(char *distro, size_t size, char *config, size
  #define OLLAMA_API_URL "http://localhost:11434/api"
  #define MAX_RESPONSE_SIZE 8192
  #define MAX_PROMPT_SIZE 4096
+ #define MAX_BODY_SIZE (64 * 1024)
+ #define OLLAMA_MUTEX_WAIT_NS 5000000000LL /* longest wait for the client without a deadline */
+ #define OLLAMA_IDLE_HANDLES 16     /* generate handles kept for reuse (and their connections) */
  
  /* Response structure for HTTP requests */
  struct ollama_response {
      char *data;
      size_t size;
      size_t capacity;
+     int in_arena;               /* data is from the request's arena, not malloc */
  };
  
  /* Ollama client configuration */
@@ -72,60 +76,31 @@ static void get_linux_distribution(char *distro, size_t size, char *config, size
      int timeout;
      int max_tokens;
      float temperature;
-     pthread_mutex_t mutex;
-     CURL *curl_handle;
+     pthread_rwlock_t lock;      /* shared by generate calls, held alone to change settings */
+     CURL *curl_handle;          /* status and model list, under the lock held alone */
+     struct curl_slist *json_headers;
+     pthread_mutex_t handles_mutex;
+     CURL *idle_handles[OLLAMA_IDLE_HANDLES]; /* one per concurrent generate call */
+     int idle_count;
  } ollama_client_t;
  
  /* Global client instance */
  static ollama_client_t g_client = {0};
  
- // Add global variables for distro info
-static char g_distro_id[64] = "";
-static char g_distro_version[64] = "";
-static char g_distro_name[128] = "";
-
-// Function to load distro info from config.json
-static void load_distro_info() {
-    FILE *f = fopen("/etc/ai-os/config.json", "r");
-    if (!f) return;
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char *buf = malloc(len + 1);
-    if (!buf) { fclose(f); return; }
-    fread(buf, 1, len, f);
-    buf[len] = '\0';
-    fclose(f);
-    struct json_object *root = json_tokener_parse(buf);
-    free(buf);
-    if (!root) return;
-    struct json_object *id, *ver, *name;
-    if (json_object_object_get_ex(root, "distro_id", &id)) {
-        strncpy(g_distro_id, json_object_get_string(id), sizeof(g_distro_id)-1);
-        g_distro_id[sizeof(g_distro_id)-1] = '\0';
-    }
-    if (json_object_object_get_ex(root, "distro_version", &ver)) {
-        strncpy(g_distro_version, json_object_get_string(ver), sizeof(g_distro_version)-1);
-        g_distro_version[sizeof(g_distro_version)-1] = '\0';
-    }
-    if (json_object_object_get_ex(root, "distro_name", &name)) {
-        strncpy(g_distro_name, json_object_get_string(name), sizeof(g_distro_name)-1);
-        g_distro_name[sizeof(g_distro_name)-1] = '\0';
-    }
-    json_object_put(root);
-}
- 
  /* Callback function to write HTTP response data */
  static size_t write_callback(void *contents, size_t size, size_t nmemb, struct ollama_response *response) {
      size_t real_size = size * nmemb;
      
      /* Ensure we have enough capacity */
      if (response->size + real_size >= response->capacity) {
-         response->capacity = (response->size + real_size) * 2;
-         response->data = realloc(response->data, response->capacity);
-         if (!response->data) {
+         size_t capacity = (response->size + real_size) * 2;
+         char *data = response->in_arena ? arena_resize(response->data, response->capacity, capacity)
+                                         : realloc(response->data, capacity);
+         if (!data) {
              return 0; /* Out of memory */
          }
+         response->data = data;
+         response->capacity = capacity;
      }
      
      memcpy(response->data + response->size, contents, real_size);
@@ -135,38 +110,18 @@ static void load_distro_info() {
      return real_size;
  }
  
- static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* Log rotation utility */
-static void ollama_client_rotate_log() {
-    struct stat st;
-    if (stat(OLLAMA_CLIENT_LOG_FILE, &st) == 0 && st.st_size > OLLAMA_CLIENT_LOG_MAX_SIZE) {
-        char rotated[512];
-        snprintf(rotated, sizeof(rotated), "%s.old", OLLAMA_CLIENT_LOG_FILE);
-        rename(OLLAMA_CLIENT_LOG_FILE, rotated);
-    }
-}
-
-/* Logging utility with mutex and rotation */
-static FILE *log_file = NULL;
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK(OLLAMA_CLIENT_LOG_FILE, 0);
 static void ollama_client_log(const char *fmt, ...) {
-    pthread_mutex_lock(&log_mutex);
-    ollama_client_rotate_log();
-    if (!log_file) {
-        log_file = fopen(OLLAMA_CLIENT_LOG_FILE, "a");
-        if (!log_file) log_file = stderr;
-    }
     va_list args;
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
-    fflush(log_file);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
     va_end(args);
-    pthread_mutex_unlock(&log_mutex);
 }
 
  /* Initialize Ollama client */
  int ollama_client_init(const char *model_name, const char *api_url) {
-     if (pthread_mutex_init(&g_client.mutex, NULL) != 0) {
+     if (pthread_rwlock_init(&g_client.lock, NULL) != 0 || pthread_mutex_init(&g_client.handles_mutex, NULL) != 0) {
          ollama_client_log("Ollama Client: Failed to initialize mutex\n");
          return -1;
      }
@@ -187,7 +142,9 @@ static void ollama_client_log(const char *fmt, ...) {
          return -1;
      }
      
-     /* Set basic CURL options */
+     /* Set basic CURL options; the generate header list is built once */
+     g_client.json_headers = curl_slist_append(NULL, "Content-Type: application/json");
+     curl_easy_setopt(g_client.curl_handle, CURLOPT_NOSIGNAL, 1L);
      curl_easy_setopt(g_client.curl_handle, CURLOPT_TIMEOUT, g_client.timeout);
      curl_easy_setopt(g_client.curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
      
@@ -204,12 +161,11 @@ static const char *detect_language(const char *text) {
     return "English";
 }
  
- /* Create system prompt for command interpretation */
- static char *create_system_prompt(const char *context, const char *language) {
-     static char system_prompt[4096];
-     // Ensure distro info is loaded
-     if (g_distro_id[0] == '\0') load_distro_info();
-     snprintf(system_prompt, sizeof(system_prompt),
+ /* Create system prompt for command interpretation in SYSTEM_PROMPT, which
+  * the caller owns: generate calls build theirs concurrently */
+ static char *create_system_prompt(char *system_prompt, size_t size, const char *context, const char *language) {
+     const ai_os_settings_t *config = config_get();
+     snprintf(system_prompt, size,
          "You are an AI assistant that translates natural language commands into Linux shell commands.\n"
          "Input language: %s\n"
          "Linux distribution: %s (%s, version %s)\n"
@@ -225,95 +181,241 @@ static const char *detect_language(const char *text) {
          "Input: 'instala el paquete python numpy'\n"
          "Output: pip install numpy\n\n",
          language ? language : "English",
-         g_distro_name[0] ? g_distro_name : "Unknown Linux",
-         g_distro_id[0] ? g_distro_id : "unknown",
-         g_distro_version[0] ? g_distro_version : "unknown",
+         config->distro_name[0] ? config->distro_name : "Unknown Linux",
+         config->distro_id[0] ? config->distro_id : "unknown",
+         config->distro_version[0] ? config->distro_version : "unknown",
          context ? context : "Current directory, standard user permissions");
      return system_prompt;
  }
  
+ /* Progress callback: abort the transfer once the caller's cancel check fires */
+ struct ollama_cancel {
+     int (*cancelled)(void *arg);
+     void *arg;
+ };
+ 
+ static int xferinfo_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                              curl_off_t ultotal, curl_off_t ulnow) {
+     struct ollama_cancel *cancel = clientp;
+     (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+     return cancel->cancelled(cancel->arg) ? 1 : 0;
+ }
+ 
+ /* Ollama's generate reply in one pass: the answer is unescaped straight
+  * into RESPONSE and the timing fields (nanoseconds or token counts, 0 if
+  * absent) into TIMINGS. 0 if there was an answer, 1 if not, -1 if the
+  * reply is not JSON. */
+ static int parse_generate_reply(const char *reply, size_t len, char *response, size_t response_size,
+                                 struct ollama_timings *timings) {
+     ai_os_json_reader_t r;
+     int answered = 0;
+     int token;
+ 
+     memset(timings, 0, sizeof(*timings));
+     ai_os_json_reader_init(&r, reply, len);
+     if (ai_os_json_next(&r) != AI_OS_JSON_OBJECT_BEGIN) {
+         return -1;
+     }
+     while ((token = ai_os_json_next(&r)) == AI_OS_JSON_KEY) {
+         int is_response = ai_os_json_key_is(&r, "response");
+         long long *timing = NULL;
+         if (ai_os_json_key_is(&r, "total_duration")) timing = &timings->total_ns;
+         else if (ai_os_json_key_is(&r, "load_duration")) timing = &timings->load_ns;
+         else if (ai_os_json_key_is(&r, "prompt_eval_count")) timing = &timings->prompt_eval_count;
+         else if (ai_os_json_key_is(&r, "prompt_eval_duration")) timing = &timings->prompt_eval_ns;
+         else if (ai_os_json_key_is(&r, "eval_count")) timing = &timings->eval_count;
+         else if (ai_os_json_key_is(&r, "eval_duration")) timing = &timings->eval_ns;
+ 
+         token = ai_os_json_next(&r);
+         if (is_response && token == AI_OS_JSON_STRING) {
+             ai_os_json_get_string(&r, response, response_size);
+             answered = 1;
+         } else if (timing && token == AI_OS_JSON_NUMBER) {
+             long long n = ai_os_json_get_int64(&r);
+             *timing = n > 0 ? n : 0;
+         } else if (ai_os_json_skip(&r, token) <= 0) {
+             return -1;
+         }
+     }
+     if (token != AI_OS_JSON_OBJECT_END) {
+         return -1;
+     }
+     return answered ? 0 : 1;
+ }
+ 
+ /* The /api/generate body for PROMPT into BUF: system prompt (built in
+  * SYSTEM), options, no streaming. Its length, or -1 if it does not fit. */
+ AI_OS_BENCH_VISIBLE int build_generate_body(char *buf, size_t size, char *system, size_t system_size,
+                                             const char *prompt, const char *context) {
+     ai_os_json_writer_t w;
+     const char *language = detect_language(prompt);
+ 
+     ai_os_json_writer_init(&w, buf, size);
+     ai_os_json_begin_object(&w);
+     ai_os_json_field_string(&w, "model", g_client.model_name);
+     ai_os_json_field_string(&w, "system", create_system_prompt(system, system_size, context, language));
+     ai_os_json_field_string(&w, "prompt", prompt);
+     ai_os_json_field_bool(&w, "stream", 0);
+     ai_os_json_key(&w, "options");
+     ai_os_json_begin_object(&w);
+     ai_os_json_field_double(&w, "temperature", g_client.temperature);
+     ai_os_json_field_int(&w, "num_predict", g_client.max_tokens);
+     ai_os_json_end_object(&w);
+     ai_os_json_end_object(&w);
+     return ai_os_json_writer_finish(&w);
+ }
+ 
+ /* A CURL handle for one generate call: generate calls run concurrently, as
+  * many as the fair queue lets in, each on its own handle */
+ static CURL *take_handle(void) {
+     CURL *curl = NULL;
+     pthread_mutex_lock(&g_client.handles_mutex);
+     if (g_client.idle_count > 0) {
+         curl = g_client.idle_handles[--g_client.idle_count];
+     }
+     pthread_mutex_unlock(&g_client.handles_mutex);
+     
+     if (!curl && (curl = curl_easy_init())) {
+         /* Timeouts by signal are process-wide, and calls run in many threads */
+         curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, g_client.json_headers);
+     }
+     return curl;
+ }
+ 
+ /* CURL back for the next call, keeping its connection to Ollama open */
+ static void give_handle(CURL *curl) {
+     pthread_mutex_lock(&g_client.handles_mutex);
+     if (g_client.idle_count < OLLAMA_IDLE_HANDLES) {
+         g_client.idle_handles[g_client.idle_count++] = curl;
+         curl = NULL;
+     }
+     pthread_mutex_unlock(&g_client.handles_mutex);
+     if (curl) {
+         curl_easy_cleanup(curl);
+     }
+ }
+ 
  /* Send request to Ollama API */
- static int send_ollama_request(const char *prompt, const char *context, char *response, size_t response_size) {
+ static int send_ollama_http(const char *prompt, const char *context, char *response, size_t response_size,
+                             int max_attempts, struct ollama_cancel *cancel) {
+     long long start_ns = metrics_now_ns();
+     long long stage_ns;
      struct ollama_response http_response = {0};
-     http_response.data = malloc(MAX_RESPONSE_SIZE);
+     http_response.data = arena_alloc(MAX_RESPONSE_SIZE);
      http_response.capacity = MAX_RESPONSE_SIZE;
+     http_response.in_arena = 1;
      
      if (!http_response.data) {
          return -1;
      }
      
      /* Create JSON request */
-     json_object *request = json_object_new_object();
-     json_object *model = json_object_new_string(g_client.model_name);
-     const char *language = detect_language(prompt);
-     json_object *system_prompt = json_object_new_string(create_system_prompt(context, language));
-     json_object *user_prompt = json_object_new_string(prompt);
-     json_object *stream = json_object_new_boolean(0);
-     json_object *options = json_object_new_object();
-     json_object *temperature = json_object_new_double(g_client.temperature);
-     json_object *num_predict = json_object_new_int(g_client.max_tokens);
-     
-     json_object_object_add(options, "temperature", temperature);
-     json_object_object_add(options, "num_predict", num_predict);
-     
-     json_object_object_add(request, "model", model);
-     json_object_object_add(request, "system", system_prompt);
-     json_object_object_add(request, "prompt", user_prompt);
-     json_object_object_add(request, "stream", stream);
-     json_object_object_add(request, "options", options);
-     
-     const char *json_string = json_object_to_json_string(request);
+     char *body = arena_alloc(MAX_BODY_SIZE);
+     char *system = arena_alloc(MAX_PROMPT_SIZE);
+     if (!body || !system) {
+         return -1;
+     }
+     if (build_generate_body(body, MAX_BODY_SIZE, system, MAX_PROMPT_SIZE, prompt, context) < 0) {
+         ollama_client_log("Ollama Client: Request body over %d bytes\n", MAX_BODY_SIZE);
+         metrics_observe_backend(g_client.model_name, -1, metrics_now_ns() - start_ns);
+         return -1;
+     }
+     stage_ns = metrics_now_ns();
+     metrics_observe_stage(METRICS_STAGE_PROMPT, stage_ns - start_ns);
      
      /* Setup CURL for POST request */
      char url[512];
      snprintf(url, sizeof(url), "%s/generate", g_client.api_url);
      
-     struct curl_slist *headers = NULL;
-     headers = curl_slist_append(headers, "Content-Type: application/json");
-     
-     curl_easy_setopt(g_client.curl_handle, CURLOPT_URL, url);
-     curl_easy_setopt(g_client.curl_handle, CURLOPT_POSTFIELDS, json_string);
-     curl_easy_setopt(g_client.curl_handle, CURLOPT_HTTPHEADER, headers);
-     curl_easy_setopt(g_client.curl_handle, CURLOPT_WRITEDATA, &http_response);
-     curl_easy_setopt(g_client.curl_handle, CURLOPT_TIMEOUT, 15L); // HTTP timeout
-     int max_attempts = 5;
+     CURL *curl = take_handle();
+     if (!curl) {
+         ollama_client_log("Ollama Client: Failed to initialize CURL\n");
+         metrics_observe_backend(g_client.model_name, -1, metrics_now_ns() - start_ns);
+         return -1;
+     }
+     curl_easy_setopt(curl, CURLOPT_URL, url);
+     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &http_response);
+     if (cancel) {
+         curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_callback);
+         curl_easy_setopt(curl, CURLOPT_XFERINFODATA, cancel);
+         curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+     }
      int attempt = 0;
      int backoff = 1;
+     long long attempt_ns = stage_ns;
      CURLcode res = CURLE_OK;
+     int out_of_time = 0;
      while (attempt < max_attempts) {
-         res = curl_easy_perform(g_client.curl_handle);
-         if (res == CURLE_OK) break;
+         /* Each attempt gets the configured timeout or what is left of the
+          * request's deadline */
+         long long budget_ns = deadline_budget_ns((long long)g_client.timeout * 1000000000LL);
+         if (budget_ns <= 0) {
+             out_of_time = 1;
+             break;
+         }
+         curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)((budget_ns + 999999) / 1000000));
+         attempt_ns = metrics_now_ns();
+         res = curl_easy_perform(curl);
+         if (res == CURLE_OK || res == CURLE_ABORTED_BY_CALLBACK) break;
          ollama_client_log("Ollama Client: CURL error (attempt %d): %s\n", attempt + 1, curl_easy_strerror(res));
+         if (attempt + 1 >= max_attempts) {
+             attempt++;
+             break;
+         }
+         /* No retry that could not finish in time */
+         if (deadline_budget_ns((long long)backoff * 1000000000LL) < (long long)backoff * 1000000000LL) {
+             out_of_time = 1;
+             break;
+         }
          sleep(backoff);
          backoff *= 2;
          if (backoff > 16) backoff = 16;
          attempt++;
      }
+     long long http_end_ns = metrics_now_ns();
+     long long served_ns = http_end_ns - attempt_ns;     /* the attempt that answered */
+     metrics_observe_stage(METRICS_STAGE_HTTP, http_end_ns - stage_ns);
+     
+     /* Cleanup: the body is in the arena, and the next call on the
+      * handle may not be cancellable */
+     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+     if (cancel) {
+         curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+         curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, NULL);
+         curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
+     }
+     give_handle(curl);
      
-     /* Cleanup */
-     curl_slist_free_all(headers);
-     json_object_put(request);
-     
+     if (res == CURLE_ABORTED_BY_CALLBACK) {
+         metrics_observe_backend(g_client.model_name, -4, metrics_now_ns() - start_ns);
+         return -4;
+     }
+     if (out_of_time || (res == CURLE_OPERATION_TIMEDOUT && deadline_check(METRICS_STAGE_HTTP))) {
+         ollama_client_log("Ollama Client: Out of time after %d attempts\n", attempt + 1);
+         deadline_exceeded(METRICS_STAGE_HTTP);
+         metrics_observe_backend(g_client.model_name, -7, metrics_now_ns() - start_ns);
+         return -7;
+     }
      if (res != CURLE_OK) {
          ollama_client_log("Ollama Client: CURL error after %d attempts: %s\n", attempt, curl_easy_strerror(res));
-         free(http_response.data);
+         metrics_observe_backend(g_client.model_name, -1, metrics_now_ns() - start_ns);
          return -1;
      }
      
      /* Parse response */
-     json_object *response_obj = json_tokener_parse(http_response.data);
-     if (!response_obj) {
+     stage_ns = metrics_now_ns();
+     struct ollama_timings timings;
+     int parsed = parse_generate_reply(http_response.data, http_response.size, response, response_size, &timings);
+     if (parsed < 0) {
          ollama_client_log("Ollama Client: Failed to parse JSON response\n");
-         free(http_response.data);
+         metrics_observe_backend(g_client.model_name, -1, metrics_now_ns() - start_ns);
          return -1;
      }
      
-     json_object *response_text;
-     if (json_object_object_get_ex(response_obj, "response", &response_text)) {
-         const char *text = json_object_get_string(response_text);
-         strncpy(response, text, response_size - 1);
-         response[response_size - 1] = '\0';
-         
+     if (parsed == 0) {
          /* Remove trailing newlines */
          size_t len = strlen(response);
          while (len > 0 && (response[len-1] == '\n' || response[len-1] == '\r')) {
@@ -323,51 +425,228 @@ static const char *detect_language(const char *text) {
          strncpy(response, "ERROR: No response from model", response_size - 1);
      }
      
-     json_object_put(response_obj);
-     free(http_response.data);
+     /* The concurrency limiter's sample: the answering attempt without the
+      * model load, so neither a cold start nor earlier failed attempts read
+      * as load, and without prompt evaluation, whose cost per token is far
+      * below a generated token's, so a long prompt does not read as a fast
+      * backend. Ollama's eval duration alone would miss time spent queued
+      * inside Ollama, which is what the limiter must see. */
+     long long generating_ns = served_ns - timings.load_ns - timings.prompt_eval_ns;
+     if (parsed == 0 && timings.eval_count > 0 && generating_ns > 0) {
+         fair_queue_observe(generating_ns, timings.eval_count);
+     }
      
+     long long end_ns = metrics_now_ns();
+     metrics_observe_stage(METRICS_STAGE_PARSE, end_ns - stage_ns);
+     metrics_observe_backend(g_client.model_name, 0, end_ns - start_ns);
+     metrics_observe_ollama(g_client.model_name, &timings);
+     trace_ollama(g_client.model_name, &timings, http_end_ns);
      return 0;
  }
  
- /* Main interpretation function */
- int ollama_interpret_command(const char *natural_command, const char *context, 
-                             char *shell_command, size_t command_size) {
+ /* Generate call answered from a traffic capture instead of Ollama */
+ static int send_replay_request(const char *prompt, char *response, size_t response_size,
+                                struct ollama_cancel *cancel) {
+     long long start_ns = metrics_now_ns();
+     int result = replay_backend_answer(g_client.model_name, prompt, response, response_size,
+                                        cancel ? cancel->cancelled : NULL, cancel ? cancel->arg : NULL);
+     long long end_ns = metrics_now_ns();
+     metrics_observe_stage(METRICS_STAGE_HTTP, end_ns - start_ns);
+     metrics_observe_backend(g_client.model_name, result, end_ns - start_ns);
+     return result;
+ }
+ 
+ /* One generate call, recorded when traffic capture is on */
+ static int send_ollama_request(const char *prompt, const char *context, char *response, size_t response_size,
+                                int max_attempts, struct ollama_cancel *cancel) {
+     if (replay_backend_active()) {
+         return send_replay_request(prompt, response, response_size, cancel);
+     }
+     
+     long long start_ns = metrics_now_ns();
+     int result = send_ollama_http(prompt, context, response, response_size, max_attempts, cancel);
+     capture_backend(g_client.model_name, prompt, result, result == 0 ? response : NULL,
+                     metrics_now_ns() - start_ns);
+     return result;
+ }
+ 
+ /* Map the model's safety markers onto the interpret return codes */
+ static int check_safety_markers(const char *shell_command) {
+     if (strstr(shell_command, "UNSAFE_COMMAND")) {
+         return -2; /* Unsafe command */
+     }
+     if (strstr(shell_command, "UNCLEAR_COMMAND")) {
+         return -3; /* Unclear command */
+     }
+     return 0;
+ }
+ 
+ /* Second try for a reply with no command in it that parses */
+ #define REASK_PROMPT "%s\n\nYour previous reply was not a valid shell command (%s). " \
+     "Reply with exactly one shell command and nothing else: no markdown, no explanation."
+ 
+ /*
+  * Cut the model's reply in SHELL_COMMAND down to a command that parses;
+  * with REASK (the client lock held) a reply with none in it is asked for
+  * once more with a stricter prompt. Returns the interpret result code: -3
+  * when nothing usable came back, or -1 without REASK so a speculation
+  * counts as a miss and the interactive request asks again itself.
+  */
+ static int settle_reply(const char *natural_command, const char *context,
+                         char *shell_command, size_t command_size, int reask) {
+     char reason[96];
+     int result = check_safety_markers(shell_command);
+     if (result != 0) {
+         return result;
+     }
+     
+     int outcome = shell_output_clean(shell_command, reason, sizeof(reason));
+     if (outcome == SHELL_OUTPUT_REJECTED && reask) {
+         ollama_client_log("AI-OS: Reply is not a shell command (%s), asking again\n", reason);
+         size_t prompt_size = strlen(natural_command) + sizeof(reason) + sizeof(REASK_PROMPT);
+         char *prompt = arena_alloc(prompt_size);
+         if (prompt) {
+             snprintf(prompt, prompt_size, REASK_PROMPT, natural_command, reason);
+             int sent = send_ollama_request(prompt, context, shell_command, command_size, 1, NULL);
+             if (sent == -7) {
+                 return -7;
+             }
+             if (sent == 0) {
+                 result = check_safety_markers(shell_command);
+                 if (result != 0) {
+                     return result;
+                 }
+                 if (shell_output_clean(shell_command, reason, sizeof(reason)) != SHELL_OUTPUT_REJECTED) {
+                     outcome = SHELL_OUTPUT_REASKED;
+                 }
+             }
+         }
+     }
+     metrics_observe_output(outcome);
+     
+     if (outcome == SHELL_OUTPUT_REJECTED) {
+         ollama_client_log("AI-OS: No shell command in the reply (%s)\n", reason);
+         return reask ? -3 : -1;
+     }
+     if (outcome == SHELL_OUTPUT_REPAIRED) {
+         ollama_client_log("AI-OS: Reply cut down to '%s'\n", shell_command);
+     }
+     return 0;
+ }
+ 
+ /* Interpret under the client lock; the first generate call is abandoned
+  * with -4 once CANCEL (if any) fires, and any wait with -7 once the
+  * request's deadline (deadline.c) has run out. A CHAT reply is prose and
+  * skips the shell syntax check */
+ static int interpret_locked(const char *natural_command, const char *context,
+                             char *shell_command, size_t command_size, struct ollama_cancel *cancel, int chat) {
      if (!natural_command || !shell_command || command_size == 0) {
          return -1;
      }
      
      struct timespec mutex_timeout;
-     clock_gettime(CLOCK_REALTIME, &mutex_timeout);
-     mutex_timeout.tv_sec += 5; // 5 second timeout for mutex
-     if (pthread_mutex_timedlock(&g_client.mutex, &mutex_timeout) != 0) {
+     long long wait_ns = metrics_now_ns();
+     deadline_timespec(&mutex_timeout, deadline_budget_ns(OLLAMA_MUTEX_WAIT_NS));
+     int locked = pthread_rwlock_timedrdlock(&g_client.lock, &mutex_timeout);
+     metrics_observe_stage(METRICS_STAGE_MUTEX_WAIT, metrics_now_ns() - wait_ns);
+     if (locked != 0) {
          ollama_client_log("Ollama Client: Timed out waiting for mutex in interpret_command\n");
-         return -1;
+         return deadline_check(METRICS_STAGE_MUTEX_WAIT) ? -7 : -1;
      }
      
      ollama_client_log("AI-OS: Interpreting '%s' with context '%s'\n", 
             natural_command, context ? context : "none");
      
-     int result = send_ollama_request(natural_command, context, shell_command, command_size);
+     int result = send_ollama_request(natural_command, context, shell_command, command_size, 5, cancel);
+     if (result == 0 && chat) {
+         result = check_safety_markers(shell_command);
+     } else if (result == 0) {
+         ollama_client_log("AI-OS: Interpreted as '%s'\n", shell_command);
+         result = settle_reply(natural_command, context, shell_command, command_size, 1);
+     }
      
-     pthread_mutex_unlock(&g_client.mutex);
+     pthread_rwlock_unlock(&g_client.lock);
+     
+     return result;
+ }
+ 
+ /* Main interpretation function */
+ int ollama_interpret_command(const char *natural_command, const char *context, 
+                             char *shell_command, size_t command_size) {
+     return interpret_locked(natural_command, context, shell_command, command_size, NULL, 0);
+ }
+ 
+ /*
+  * Interpretation that a more urgent request may take the backend from:
+  * returns -4 as soon as cancelled() reports so, for the caller to queue
+  * again. A NULL cancelled() makes it ollama_interpret_command().
+  */
+ int ollama_interpret_preemptible(const char *natural_command, const char *context,
+                                  char *shell_command, size_t command_size,
+                                  int (*cancelled)(void *arg), void *arg) {
+     struct ollama_cancel cancel = { cancelled, arg };
+     return interpret_locked(natural_command, context, shell_command, command_size, cancelled ? &cancel : NULL, 0);
+ }
+ 
+ /* ollama_interpret_preemptible() for a chat reply, which is handed back
+  * as the model wrote it */
+ int ollama_chat_preemptible(const char *message, const char *context, char *reply, size_t reply_size,
+                             int (*cancelled)(void *arg), void *arg) {
+     struct ollama_cancel cancel = { cancelled, arg };
+     return interpret_locked(message, context, reply, reply_size, cancelled ? &cancel : NULL, 1);
+ }
+ 
+ /*
+  * Low-priority interpretation for speculative requests (the caller has its
+  * background turn from the fair queue). Never waits for the client:
+  * returns -4 straight away if its settings are being changed, and also -4
+  * as soon as cancelled() reports the request is stale. Makes a
+  * single attempt since a newer keystroke will usually resubmit anyway.
+  */
+ int ollama_interpret_speculative(const char *natural_command, const char *context,
+                                  char *shell_command, size_t command_size,
+                                  int (*cancelled)(void *arg), void *arg) {
+     if (!natural_command || !shell_command || command_size == 0 || !cancelled) {
+         return -1;
+     }
+     
+     if (pthread_rwlock_tryrdlock(&g_client.lock) != 0) {
+         return -4;
+     }
+     
+     struct ollama_cancel cancel = { cancelled, arg };
+     int result = send_ollama_request(natural_command, context, shell_command, command_size, 1, &cancel);
+     
+     pthread_rwlock_unlock(&g_client.lock);
      
      if (result == 0) {
-         ollama_client_log("AI-OS: Interpreted as '%s'\n", shell_command);
-         
-         /* Check for safety markers */
-         if (strstr(shell_command, "UNSAFE_COMMAND")) {
-             return -2; /* Unsafe command */
-         }
-         if (strstr(shell_command, "UNCLEAR_COMMAND")) {
-             return -3; /* Unclear command */
-         }
+         ollama_client_log("AI-OS: Speculatively interpreted '%s' as '%s'\n", natural_command, shell_command);
+         result = settle_reply(natural_command, context, shell_command, command_size, 0);
      }
      
      return result;
  }
  
+ /* Take the client lock alone: no generate call may see settings change */
+ static int lock_client(const char *caller) {
+     struct timespec mutex_timeout;
+     long long wait_ns = metrics_now_ns();
+     deadline_timespec(&mutex_timeout, deadline_budget_ns(OLLAMA_MUTEX_WAIT_NS));
+     int locked = pthread_rwlock_timedwrlock(&g_client.lock, &mutex_timeout);
+     metrics_observe_stage(METRICS_STAGE_MUTEX_WAIT, metrics_now_ns() - wait_ns);
+     if (locked != 0) {
+         ollama_client_log("Ollama Client: Timed out waiting for mutex in %s\n", caller);
+         return -1;
+     }
+     return 0;
+ }
+ 
  /* Check if Ollama is running */
  int ollama_check_status(void) {
+     if (replay_backend_active()) {
+         return 0;
+     }
+     
      struct ollama_response response = {0};
      response.data = malloc(1024);
      response.capacity = 1024;
@@ -376,6 +655,11 @@ static const char *detect_language(const char *text) {
          return -1;
      }
      
+     if (lock_client("check_status") != 0) {
+         free(response.data);
+         return -1;
+     }
+     
      char url[512];
      snprintf(url, sizeof(url), "%s/tags", g_client.api_url);
      
@@ -384,16 +668,15 @@ static const char *detect_language(const char *text) {
      curl_easy_setopt(g_client.curl_handle, CURLOPT_WRITEDATA, &response);
      
      CURLcode res = curl_easy_perform(g_client.curl_handle);
-     
-     free(response.data);
-     
+     long response_code = 0;
      if (res == CURLE_OK) {
-         long response_code;
          curl_easy_getinfo(g_client.curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
-         return (response_code == 200) ? 0 : -1;
      }
      
-     return -1;
+     pthread_rwlock_unlock(&g_client.lock);
+     free(response.data);
+     
+     return (res == CURLE_OK && response_code == 200) ? 0 : -1;
  }
  
  /* Get available models */
@@ -406,6 +689,11 @@ static const char *detect_language(const char *text) {
          return -1;
      }
      
+     if (lock_client("list_models") != 0) {
+         free(response.data);
+         return -1;
+     }
+     
      char url[512];
      snprintf(url, sizeof(url), "%s/tags", g_client.api_url);
      
@@ -414,6 +702,7 @@ static const char *detect_language(const char *text) {
      curl_easy_setopt(g_client.curl_handle, CURLOPT_WRITEDATA, &response);
      
      CURLcode res = curl_easy_perform(g_client.curl_handle);
+     pthread_rwlock_unlock(&g_client.lock);
      
      if (res != CURLE_OK) {
          free(response.data);
@@ -450,16 +739,12 @@ static const char *detect_language(const char *text) {
  int ollama_set_model(const char *model_name) {
      if (!model_name) return -1;
      
-     struct timespec mutex_timeout;
-     clock_gettime(CLOCK_REALTIME, &mutex_timeout);
-     mutex_timeout.tv_sec += 5;
-     if (pthread_mutex_timedlock(&g_client.mutex, &mutex_timeout) != 0) {
-         ollama_client_log("Ollama Client: Timed out waiting for mutex in set_model\n");
+     if (lock_client("set_model") != 0) {
          return -1;
      }
      
      strncpy(g_client.model_name, model_name, sizeof(g_client.model_name) - 1);
-     pthread_mutex_unlock(&g_client.mutex);
+     pthread_rwlock_unlock(&g_client.lock);
      
      ollama_client_log("AI-OS: Switched to model '%s'\n", model_name);
      return 0;
@@ -470,11 +755,13 @@ static const char *detect_language(const char *text) {
      if (g_client.curl_handle) {
          curl_easy_cleanup(g_client.curl_handle);
      }
+     while (g_client.idle_count > 0) {
+         curl_easy_cleanup(g_client.idle_handles[--g_client.idle_count]);
+     }
+     curl_slist_free_all(g_client.json_headers);
      curl_global_cleanup();
-     pthread_mutex_destroy(&g_client.mutex);
+     pthread_rwlock_destroy(&g_client.lock);
+     pthread_mutex_destroy(&g_client.handles_mutex);
      ollama_client_log("AI-OS: Ollama client cleaned up\n");
-     pthread_mutex_lock(&log_mutex);
-     if (log_file && log_file != stderr) fclose(log_file);
-     log_file = NULL;
-     pthread_mutex_unlock(&log_mutex);
+     ai_os_log_flush();
  }
\ No newline at end of file
@@ -14,12 +14,16 @@
  #include <sys/wait.h>
  #include <pthread.h>
  #include <errno.h>
- #include <json-c/json.h>
+ #include <limits.h>
  #include <syslog.h>
  #include <stdarg.h>
  
  /* Include our custom headers */
  #include "../ai_os_common.h"
+ #include "../ai_os_cache.h"
+ #include "../ai_os_log.h"
+ #include "../ai_os_probes.h"
+ #include "../ai_os_json.h"
  extern int ollama_client_init(const char *model_name, const char *api_url);
  extern int ollama_interpret_command(const char *natural_command, const char *context, 
                                     char *shell_command, size_t command_size);
@@ -37,10 +41,11 @@
  extern void ai_context_free(ai_context_t *ctx);
  
  #define AI_SOCKET_PATH "/var/run/ai-os.sock"
- #define AI_CONFIG_FILE "/etc/ai-os/config.json"
  #define AI_LOG_FILE "/var/log/ai-os.log"
  #define MAX_CLIENTS 64
  #define MAX_COMMAND_LEN 4096
+ #define MAX_RESPONSE_LEN (64 * 1024)
+ #define METRICS_TEXT_SIZE (32 * 1024)
  
  /* Global daemon state */
  typedef struct {
@@ -48,102 +53,62 @@
      ai_client_t clients[MAX_CLIENTS];
      pthread_mutex_t clients_mutex;
      int running;
-     char current_model[64];
-     int safety_mode;
-     int confirmation_required;
-     FILE *log_file;
+     char current_model[64];    /* config "model" until set_model changes it */
+     unsigned long next_session_id;
+     unsigned long long next_request;   /* numbers requests for probes and the flight recorder */
  } ai_daemon_t;
  
  static ai_daemon_t g_daemon = {0};
  
- /* Logging function */
+ /* Number of the request this thread is serving */
+ static __thread unsigned long long current_request;
+ 
+ /* Logging function; the log writer thread puts the line in the log file
+  * and syslog, never the caller */
+ static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK(AI_LOG_FILE, AI_OS_LOG_TIMESTAMP | AI_OS_LOG_SYSLOG);
  static void ai_log(const char *level, const char *format, ...) {
      va_list args;
-     time_t now;
-     char timestamp[64];
-     
-     time(&now);
-     strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
-     
-     if (g_daemon.log_file) {
-         fprintf(g_daemon.log_file, "[%s] %s: ", timestamp, level);
-         va_start(args, format);
-         vfprintf(g_daemon.log_file, format, args);
-         va_end(args);
-         fprintf(g_daemon.log_file, "\n");
-         fflush(g_daemon.log_file);
-     }
+     int log_level = AI_OS_LOG_INFO;
      
-     /* Also log to syslog */
-     int priority = LOG_INFO;
-     if (strcmp(level, "ERROR") == 0) priority = LOG_ERR;
-     else if (strcmp(level, "WARN") == 0) priority = LOG_WARNING;
+     if (level[0] == 'E') log_level = AI_OS_LOG_ERROR;
+     else if (level[0] == 'W') log_level = AI_OS_LOG_WARN;
+     else if (level[0] == 'D') log_level = AI_OS_LOG_DEBUG;
      
      va_start(args, format);
-     vsyslog(priority, format, args);
+     ai_os_logv(&log_sink, log_level, format, args);
      va_end(args);
  }
  
- /* Safety check for commands */
- static int is_safe_command(const char *command) {
-     /* Safety checks disabled - all commands are considered safe */
-     return 1;
-     
-     /* Original safety logic (commented out):
-     if (!command || strlen(command) == 0) return 0;
-     
-     // List of dangerous command patterns
-     const char *dangerous_patterns[] = {
-         "rm -rf /",
-         "rm -rf /*",
-         "dd if=",
-         "mkfs",
-         "format",
-         "fdisk",
-         "parted",
-         "shutdown",
-         "reboot",
-         "halt",
-         "poweroff",
-         "kill -9 1",
-         "chmod 777 /",
-         "chown root:root /",
-         "> /dev/sda",
-         "> /dev/sdb",
-         "wget http://", // Block direct downloads without review
-         "curl http://",
-         ":(){ :|:& };:", // Fork bomb
-         NULL
-     };
-     
-     for (int i = 0; dangerous_patterns[i]; i++) {
-         if (strstr(command, dangerous_patterns[i])) {
-             ai_log("WARN", "Blocked dangerous command pattern: %s", dangerous_patterns[i]);
-             return 0;
-         }
+ /* Auto-execute is off while answering from a capture: never run what the
+  * recorded replies say */
+ static int confirmation_required(void) {
+     return replay_backend_active() || config_get()->confirmation_required;
+ }
+ 
+ /* COMMAND under timeout(1) when BUDGET_NS is finite: asked to stop when
+  * the request's deadline comes, killed a second later. NULL if the quoted
+  * command does not fit in the arena. */
+ static const char *bounded_command(const char *command, long long budget_ns) {
+     if (budget_ns == LLONG_MAX) {
+         return command;
      }
-     
-     // Additional checks for sudo commands
-     if (strstr(command, "sudo ")) {
-         const char *sudo_dangerous[] = {
-             "sudo rm -rf",
-             "sudo dd",
-             "sudo mkfs",
-             "sudo fdisk",
-             "sudo parted",
-             NULL
-         };
-         
-         for (int i = 0; sudo_dangerous[i]; i++) {
-             if (strstr(command, sudo_dangerous[i])) {
-                 ai_log("WARN", "Blocked dangerous sudo command: %s", sudo_dangerous[i]);
-                 return 0;
-             }
+     size_t size = strlen(command) * 4 + 64;
+     char *bounded = arena_alloc(size);
+     if (!bounded) {
+         return NULL;
+     }
+     size_t len = (size_t)snprintf(bounded, size, "timeout -k 1 %lld.%03lld sh -c '",
+                                   budget_ns / 1000000000LL, budget_ns / 1000000 % 1000);
+     for (const char *p = command; *p; p++) {
+         if (*p == '\'') {
+             memcpy(bounded + len, "'\\''", 4);
+             len += 4;
+         } else {
+             bounded[len++] = *p;
          }
      }
-     
-     return 1;
-     */
+     memcpy(bounded + len, "'", 2);
+     return bounded;
  }
  
  /* Execute command with safety checks */
@@ -154,13 +119,42 @@
      ai_context_add_command(&client->context, command);
      
      /* If in confirmation mode, don't execute automatically */
-     if (g_daemon.confirmation_required) {
+     if (confirmation_required()) {
          snprintf(output, output_size, "CONFIRM_REQUIRED: %s", command);
          return 1; /* Needs confirmation */
      }
      
-     /* Execute the command */
-     FILE *fp = popen(command, "r");
+     /* Safety mode: the policy has the last word on what runs unattended */
+     if (config_get()->safety_mode) {
+         char reason[128];
+         int verdict = safety_policy_check(command, reason, sizeof(reason));
+         if (verdict == SAFETY_BLOCK) {
+             ai_log("WARN", "Blocked by safety policy for PID %d: %s", client->client_pid, reason);
+             snprintf(output, output_size, "BLOCKED: %s", reason);
+             return -1;
+         }
+         if (verdict == SAFETY_CONFIRM) {
+             snprintf(output, output_size, "CONFIRM_REQUIRED: %s", command);
+             return 1;
+         }
+     }
+     
+     /* Execute the command, in what is left of the request's deadline */
+     long long budget_ns = deadline_budget_ns(LLONG_MAX);
+     if (budget_ns <= 0) {
+         deadline_exceeded(METRICS_STAGE_EXECUTE);
+         snprintf(output, output_size, "ERROR: Deadline exceeded before execution");
+         return -1;
+     }
+     const char *run = bounded_command(command, budget_ns);
+     if (!run) {
+         snprintf(output, output_size, "ERROR: Failed to execute command");
+         return -1;
+     }
+     
+     long long start_ns = metrics_now_ns();
+     AI_OS_PROBE2(exec_start, current_request, command);
+     FILE *fp = popen(run, "r");
      if (!fp) {
          snprintf(output, output_size, "ERROR: Failed to execute command");
          return -1;
@@ -181,6 +175,11 @@
      }
      
      int exit_code = pclose(fp);
+     metrics_observe_stage(METRICS_STAGE_EXECUTE, metrics_now_ns() - start_ns);
+     if (run != command && deadline_check(METRICS_STAGE_EXECUTE)) {
+         ai_log("WARN", "Command for PID %d stopped at its deadline: %s", client->client_pid, command);
+     }
+     AI_OS_PROBE3(exec_done, current_request, WEXITSTATUS(exit_code), total_read);
      
      if (total_read == 0) {
          snprintf(output, output_size, "Command executed successfully (exit code: %d)", 
@@ -190,171 +189,476 @@
      return WEXITSTATUS(exit_code);
  }
  
- /* Handle client request */
- static int handle_client_request(ai_client_t *client, const char *request, char *response, size_t response_size) {
-     json_object *req_obj = json_tokener_parse(request);
-     if (!req_obj) {
-         snprintf(response, response_size, "{\"error\": \"Invalid JSON request\"}");
+ /* Fields of a protocol request, read in one pass into fixed buffers; "id"
+  * is kept as raw JSON and echoed back verbatim */
+ typedef struct {
+     char action[64];
+     char command[MAX_COMMAND_LEN];
+     char model[128];
+     char trace_id[64];
+     char session[128];
+     char priority[16];
+     char deadline[24];
+     const char *id;
+     size_t id_len;
+     int has_model;
+     int has_trace_id;
+     int has_session;
+     int has_priority;
+     int has_deadline;
+ } daemon_request_t;
+ 
+ /* Parse REQUEST into REQ; -1 unless it is a JSON object */
+ static int parse_request(const char *request, size_t len, daemon_request_t *req) {
+     ai_os_json_reader_t r;
+     int token;
+     
+     strcpy(req->action, "interpret");
+     req->command[0] = '\0';
+     req->id = NULL;
+     req->has_model = req->has_trace_id = req->has_session = req->has_priority = req->has_deadline = 0;
+     
+     ai_os_json_reader_init(&r, request, len);
+     if (ai_os_json_next(&r) != AI_OS_JSON_OBJECT_BEGIN) {
          return -1;
      }
+     while ((token = ai_os_json_next(&r)) == AI_OS_JSON_KEY) {
+         char *field = NULL;
+         size_t field_size = 0;
+         int *seen = NULL;
+         
+         if (ai_os_json_key_is(&r, "action")) {
+             field = req->action; field_size = sizeof(req->action);
+         } else if (ai_os_json_key_is(&r, "command")) {
+             field = req->command; field_size = sizeof(req->command);
+         } else if (ai_os_json_key_is(&r, "model")) {
+             field = req->model; field_size = sizeof(req->model); seen = &req->has_model;
+         } else if (ai_os_json_key_is(&r, "trace_id")) {
+             field = req->trace_id; field_size = sizeof(req->trace_id); seen = &req->has_trace_id;
+         } else if (ai_os_json_key_is(&r, "session")) {
+             field = req->session; field_size = sizeof(req->session); seen = &req->has_session;
+         } else if (ai_os_json_key_is(&r, "priority")) {
+             field = req->priority; field_size = sizeof(req->priority); seen = &req->has_priority;
+         } else if (ai_os_json_key_is(&r, "deadline")) {
+             field = req->deadline; field_size = sizeof(req->deadline); seen = &req->has_deadline;
+         } else if (ai_os_json_key_is(&r, "id")) {
+             if (ai_os_json_raw_value(&r, ai_os_json_next(&r), &req->id, &req->id_len) != 0) {
+                 return -1;
+             }
+             continue;
+         }
+         
+         token = ai_os_json_next(&r);
+         if (field) {
+             int result = ai_os_json_get_text(&r, token, field, field_size);
+             if (result < 0) {
+                 return -1;
+             }
+             if (seen && result == 0) {
+                 *seen = 1;
+             }
+         } else if (ai_os_json_skip(&r, token) <= 0) {
+             return -1;
+         }
+     }
+     return token == AI_OS_JSON_OBJECT_END ? 0 : -1;
+ }
+ 
+ /* Speculation session key: explicit "session" field (REQ, if any), else
+  * the connection; scoped by the peer UID so users cannot reach each
+  * other's slots */
+ static void client_session_key(const ai_client_t *client, const daemon_request_t *req, char *key, size_t key_size) {
+     if (req && req->has_session) {
+         snprintf(key, key_size, "%u:s:%s", (unsigned)client->client_uid, req->session);
+     } else {
+         snprintf(key, key_size, "%u:conn:%lu", (unsigned)client->client_uid, client->session_id);
+     }
+ }
+ 
+ /* Fair queue lane for a model request normally in LANE: "priority":
+  * "batch" puts it behind everything a user is waiting on */
+ static int request_lane(const daemon_request_t *req, int lane) {
+     return req->has_priority && strcmp(req->priority, "batch") == 0 ? FAIR_QUEUE_BACKGROUND : lane;
+ }
+ 
+ /* When REQ, which arrived at START_NS, must be answered by: the client's
+  * "deadline" (wall-clock milliseconds since the epoch), else the
+  * configured default for the action; 0 for no deadline */
+ static long long request_deadline(const daemon_request_t *req, long long start_ns) {
+     if (req->has_deadline) {
+         char *end;
+         long long epoch_ms = strtoll(req->deadline, &end, 10);
+         if (end != req->deadline && !*end && epoch_ms > 0) {
+             return deadline_from_epoch_ms(epoch_ms);
+         }
+     }
+     const ai_os_settings_t *config = config_get();
+     int budget_ms = strcmp(req->action, "interpret") == 0 ? config->interpret_deadline_ms :
+                     strcmp(req->action, "chat") == 0 ? config->chat_deadline_ms :
+                     strcmp(req->action, "execute") == 0 ? config->execute_deadline_ms : 0;
+     return budget_ms > 0 ? start_ns + budget_ms * 1000000LL : 0;
+ }
+ 
+ /* Fields of the status reply, shared with the published cache */
+ static void add_status_fields(ai_os_json_writer_t *w) {
+     char models_list[1024];
+     int ollama_status = ollama_check_status();
+     ollama_list_models(models_list, sizeof(models_list));
      
-     json_object *action_obj, *command_obj, *model_obj;
-     const char *action = "interpret";
-     const char *command = "";
-     const char *model = NULL;
+     ai_os_json_field_string(w, "daemon_status", "running");
+     ai_os_json_field_string(w, "ollama_status", ollama_status == 0 ? "running" : "not available");
+     ai_os_json_field_string(w, "current_model", g_daemon.current_model);
+     ai_os_json_field_string(w, "available_models", models_list);
+     ai_os_json_field_bool(w, "safety_mode", config_get()->safety_mode);
+     ai_os_json_field_bool(w, "confirmation_required", confirmation_required());
+     ai_os_json_field_int(w, "config_generation", (long long)config_get()->generation);
+ }
+ 
+ /* Status reply without a request id, for the shared cache refresher */
+ static int status_snapshot(char *buf, size_t size) {
+     ai_os_json_writer_t w;
+     ai_os_json_writer_init(&w, buf, size);
+     ai_os_json_begin_object(&w);
+     add_status_fields(&w);
+     ai_os_json_end_object(&w);
+     return ai_os_json_writer_finish(&w) < 0 ? -1 : 0;
+ }
+ 
+ /* The reply's "status", also what metrics, traces and the flight record see */
+ static const char *reply_status(ai_os_json_writer_t *w, const char *status) {
+     ai_os_json_field_string(w, "status", status);
+     return status;
+ }
+ 
+ /* Ask the model about COMMAND once CLIENT's user has their turn at the
+  * backend in LANE, with probes around the call; a CHAT reply is taken as
+  * prose, anything else must be a shell command. -5 if the user is over
+  * their rate (*RETRY_MS says when to come back), -6 if the turn did not
+  * come in time, -7 if the request's deadline ran out first. Below the
+  * interactive lane the call gives way to more urgent requests and is
+  * queued again. */
+ static int run_inference(const ai_client_t *client, int lane, int chat, const char *command, const char *context,
+                          char *reply, size_t reply_size, long *retry_ms) {
+     fair_queue_ticket_t ticket;
+     long long start_ns = metrics_now_ns();
+     int admitted = fair_queue_acquire(client->client_uid, lane, &ticket, retry_ms);
+     metrics_observe_stage(METRICS_STAGE_QUEUE, metrics_now_ns() - start_ns);
+     metrics_observe_admission(lane, admitted);
+     if (admitted == FAIR_QUEUE_TIMEOUT && deadline_check(METRICS_STAGE_QUEUE)) {
+         return -7;
+     }
+     if (admitted != FAIR_QUEUE_GRANTED) {
+         ai_log("WARN", "%s for UID %d", admitted == FAIR_QUEUE_RATE_LIMITED ? "Rate limited" : "Queue timeout",
+                client->client_uid);
+         return admitted == FAIR_QUEUE_RATE_LIMITED ? -5 : -6;
+     }
      
-     if (json_object_object_get_ex(req_obj, "action", &action_obj)) {
-         action = json_object_get_string(action_obj);
+     int result;
+     for (;;) {
+         start_ns = metrics_now_ns();
+         AI_OS_PROBE3(inference_start, current_request, g_daemon.current_model, strlen(command));
+         int (*cancelled)(void *) = lane == FAIR_QUEUE_INTERACTIVE ? NULL : fair_queue_preempted;
+         result = chat ? ollama_chat_preemptible(command, context, reply, reply_size, cancelled, &ticket)
+                       : ollama_interpret_preemptible(command, context, reply, reply_size, cancelled, &ticket);
+         AI_OS_PROBE5(inference_done, current_request, g_daemon.current_model, result,
+                      metrics_now_ns() - start_ns, result == 0 ? strlen(reply) : 0);
+         if (result != -4 || lane == FAIR_QUEUE_INTERACTIVE) {
+             break;
+         }
+         
+         ai_log("INFO", "Preempted request from PID %d after %lld ms, requeued", client->client_pid,
+                (metrics_now_ns() - start_ns) / 1000000);
+         start_ns = metrics_now_ns();
+         admitted = fair_queue_requeue(&ticket);
+         metrics_observe_stage(METRICS_STAGE_QUEUE, metrics_now_ns() - start_ns);
+         if (admitted != FAIR_QUEUE_GRANTED) {
+             metrics_observe_admission(lane, admitted);
+             if (deadline_check(METRICS_STAGE_QUEUE)) {
+                 return -7;
+             }
+             ai_log("WARN", "Queue timeout for UID %d", client->client_uid);
+             return -6;
+         }
      }
+     fair_queue_release(&ticket);
+     return result;
+ }
+ 
+ /* The reply for a request the fair queue turned away (run_inference's
+  * -5 and -6) */
+ static const char *admission_reply(ai_os_json_writer_t *w, int result, long retry_ms) {
+     if (result == -5) {
+         ai_os_json_field_string(w, "message", "Request rate limit reached, try again later");
+         ai_os_json_field_int(w, "retry_after_ms", (int)retry_ms);
+         return reply_status(w, "rate_limited");
+     }
+     ai_os_json_field_string(w, "message", "Inference backend busy, try again later");
+     return reply_status(w, "busy");
+ }
+ 
+ /* The reply for a request that ran out of its deadline: where it did */
+ static const char *deadline_reply(ai_os_json_writer_t *w) {
+     const char *stage = deadline_expired_stage();
+     char message[96];
+     snprintf(message, sizeof(message), "Deadline exceeded in %s", stage ? stage : "request");
+     ai_os_json_field_string(w, "message", message);
+     if (stage) {
+         ai_os_json_field_string(w, "stage", stage);
+     }
+     return reply_status(w, "deadline_exceeded");
+ }
+ 
+ /* Rule-based command/chat classification for the classify action */
+ AI_OS_BENCH_VISIBLE const char *classify_input(const char *command) {
+     /* Enhanced classification logic */
+     const char *classification = "chat"; /* default */
+     
+     /* Command action words - high priority */
+     const char *command_actions[] = {
+         "add", "commit", "push", "pull", "clone", "init", "status", "log", "branch", "checkout",
+         "merge", "rebase", "stash", "reset", "revert", "tag", "fetch", "remote", "config",
+         "list", "show", "find", "search", "grep", "cat", "head", "tail", "less", "more",
+         "create", "delete", "remove", "rm", "mkdir", "touch", "cp", "copy", "mv", "move",
+         "install", "uninstall", "update", "upgrade", "download", "wget", "curl", "scp", "rsync",
+         "run", "start", "stop", "restart", "kill", "pkill", "killall", "ps", "top", "htop",
+         "check", "test", "verify", "validate", "get", "set", "export", "import", "source",
+         "open", "close", "edit", "view", "read", "write", "save", "load", "backup", "restore",
+         "build", "compile", "make", "cmake", "configure", "install", "uninstall", "package",
+         "mount", "umount", "format", "partition", "fsck", "dd", "tar", "zip", "unzip",
+         "chmod", "chown", "chgrp", "umask", "sudo", "su", "whoami", "id", "groups",
+         "ping", "traceroute", "netstat", "ss", "iptables", "firewall", "ufw",
+         "docker", "podman", "kubectl", "helm", "terraform", "ansible",
+         "python", "pip", "node", "npm", "yarn", "cargo", "go", "java", "maven", "gradle",
+         NULL
+     };
      
-     if (json_object_object_get_ex(req_obj, "command", &command_obj)) {
-         command = json_object_get_string(command_obj);
+     /* Chat/question words - lower priority */
+     const char *chat_words[] = {
+         "hello", "hi", "hey", "good morning", "good afternoon", "good evening",
+         "how are you", "how do you", "what is", "what are", "who is", "who are",
+         "when is", "when will", "where is", "where are", "why is", "why are",
+         "tell me", "explain", "describe", "define", "what does", "how does",
+         "joke", "funny", "humor", "weather", "time", "date", "temperature",
+         "thanks", "thank you", "appreciate", "help", "please", "could you",
+         "would you", "can you", "should I", "do you think", "what do you think",
+         NULL
+     };
+     
+     /* Check for command action words first (higher priority) */
+     for (int i = 0; command_actions[i] != NULL; i++) {
+         if (strstr(command, command_actions[i])) {
+             classification = "command";
+             break;
+         }
      }
      
-     if (json_object_object_get_ex(req_obj, "model", &model_obj)) {
-         model = json_object_get_string(model_obj);
+     /* Only check for chat words if no command action was found */
+     if (strcmp(classification, "command") != 0) {
+         for (int i = 0; chat_words[i] != NULL; i++) {
+             if (strstr(command, chat_words[i])) {
+                 classification = "chat";
+                 break;
+             }
+         }
      }
      
-     /* Update client context */
-     if (ai_context_needs_refresh(&client->context)) {
+     return classification;
+ }
+ 
+ /* Handle client request */
+ AI_OS_BENCH_VISIBLE int handle_client_request(ai_client_t *client, const char *request, char *response, size_t response_size) {
+     long long start_ns = metrics_now_ns();
+     long long stage_ns;
+     size_t request_bytes = strlen(request);
+     daemon_request_t req;
+     if (parse_request(request, request_bytes, &req) != 0) {
+         snprintf(response, response_size, "{\"error\": \"Invalid JSON request\"}");
+         metrics_observe_request(NULL, "error", metrics_now_ns() - start_ns);
+         return -1;
+     }
+     
+     const char *action = req.action;
+     const char *command = req.command;
+     const char *model = req.has_model ? req.model : NULL;
+     
+     const char *trace_id = NULL;
+     if (req.has_trace_id) {
+         trace_id = req.trace_id;
+         trace_begin(trace_id);
+     }
+     
+     AI_OS_PROBE3(request_parse, current_request, action, request_bytes);
+     deadline_begin(request_deadline(&req, start_ns));
+     
+     /* Only interpret and chat reach the model */
+     int uses_model = strcmp(action, "interpret") == 0 || strcmp(action, "chat") == 0;
+     flight_begin(current_request, action, uses_model ? g_daemon.current_model : NULL, client->client_pid,
+                  request_bytes, trace_id);
+     
+     /* Update client context, unless there is no time left to use it */
+     if (ai_context_needs_refresh(&client->context) && !deadline_check(METRICS_STAGE_CONTEXT)) {
+         stage_ns = metrics_now_ns();
+         AI_OS_PROBE1(context_refresh_start, current_request);
          ai_context_update(&client->context);
+         long long context_ns = metrics_now_ns() - stage_ns;
+         AI_OS_PROBE2(context_refresh_done, current_request, context_ns);
+         metrics_observe_stage(METRICS_STAGE_CONTEXT, context_ns);
      }
      
-     json_object *response_obj = json_object_new_object();
+     /* The reply is written straight into RESPONSE */
+     ai_os_json_writer_t reply;
+     const char *status = NULL;
+     ai_os_json_writer_init(&reply, response, response_size);
+     ai_os_json_begin_object(&reply);
+     
+     /* Echo the request id first so pipelining clients can match replies */
+     if (req.id) {
+         ai_os_json_field_raw(&reply, "id", req.id, req.id_len);
+     }
      
      if (strcmp(action, "interpret") == 0) {
          char shell_command[MAX_COMMAND_LEN];
          char *context_summary = ai_context_to_summary(&client->context);
          
+         char session[64];
+         int result;
+         int speculative = 0;
+         long retry_ms = 0;
+         
          ai_log("INFO", "Interpreting command from PID %d: %s", client->client_pid, command);
          
-         int result = ollama_interpret_command(command, context_summary, shell_command, sizeof(shell_command));
+         client_session_key(client, &req, session, sizeof(session));
+         stage_ns = metrics_now_ns();
+         int taken = speculation_take(session, command, context_summary, shell_command, sizeof(shell_command), &result);
+         metrics_observe_stage(METRICS_STAGE_SPECULATION, metrics_now_ns() - stage_ns);
+         AI_OS_PROBE3(cache_lookup, current_request, command, taken == 0);
+         if (taken == 0) {
+             speculative = 1;
+             ai_log("INFO", "Answered from speculation for PID %d", client->client_pid);
+         } else {
+             result = run_inference(client, request_lane(&req, FAIR_QUEUE_INTERACTIVE), 0, command, context_summary,
+                                    shell_command, sizeof(shell_command), &retry_ms);
+         }
+         
+         /* Safety mode: a blocked command is reported as unsafe, and cached
+          * that way, before anyone sees it */
+         int verdict = SAFETY_ALLOW;
+         char policy_reason[128] = "";
+         if (result == 0 && config_get()->safety_mode) {
+             verdict = safety_policy_check(shell_command, policy_reason, sizeof(policy_reason));
+             if (verdict == SAFETY_BLOCK) {
+                 ai_log("WARN", "Blocked by safety policy for PID %d: %s", client->client_pid, policy_reason);
+                 result = -2;
+             }
+         }
+         
+         /* The context is the daemon's own, so the answer holds for every
+          * client; not while interpret also executes, which a cache hit
+          * would skip */
+         if (confirmation_required() && (result == 0 || result == -2 || result == -3)) {
+             shared_cache_put(AI_OS_CACHE_INTERPRET, command, result == 0 ? shell_command : "", result);
+         }
          
          if (result == 0) {
-             json_object_object_add(response_obj, "interpreted_command", json_object_new_string(shell_command));
-             json_object_object_add(response_obj, "status", json_object_new_string("success"));
+             ai_os_json_field_string(&reply, "interpreted_command", shell_command);
+             status = reply_status(&reply, "success");
+             if (speculative) {
+                 ai_os_json_field_bool(&reply, "speculative", 1);
+             }
              
-             /* Auto-execute is enabled - execute all commands */
-             if (!g_daemon.confirmation_required) {
+             /* Auto-execute is enabled - execute all commands the policy
+              * lets run unattended */
+             if (!confirmation_required() && verdict == SAFETY_CONFIRM) {
+                 ai_os_json_field_bool(&reply, "confirmation_required", 1);
+                 ai_os_json_field_string(&reply, "message", policy_reason);
+             } else if (!confirmation_required()) {
                  char exec_output[4096];
                  int exec_result = execute_command_safely(client, shell_command, exec_output, sizeof(exec_output));
                  
-                 json_object_object_add(response_obj, "execution_result", json_object_new_string(exec_output));
-                 json_object_object_add(response_obj, "exit_code", json_object_new_int(exec_result));
+                 ai_os_json_field_string(&reply, "execution_result", exec_output);
+                 ai_os_json_field_int(&reply, "exit_code", exec_result);
              }
          } else if (result == -2) {
-             json_object_object_add(response_obj, "status", json_object_new_string("unsafe"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Command marked as unsafe by AI"));
+             status = reply_status(&reply, "unsafe");
+             if (policy_reason[0]) {
+                 char message[160];
+                 snprintf(message, sizeof(message), "Blocked by safety policy: %s", policy_reason);
+                 ai_os_json_field_string(&reply, "message", message);
+             } else {
+                 ai_os_json_field_string(&reply, "message", "Command marked as unsafe by AI");
+             }
          } else if (result == -3) {
-             json_object_object_add(response_obj, "status", json_object_new_string("unclear"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Command unclear, please rephrase"));
+             status = reply_status(&reply, "unclear");
+             ai_os_json_field_string(&reply, "message", "Command unclear, please rephrase");
+         } else if (result == -5 || result == -6) {
+             status = admission_reply(&reply, result, retry_ms);
+         } else if (result == -7) {
+             status = deadline_reply(&reply);
          } else {
-             json_object_object_add(response_obj, "status", json_object_new_string("error"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Failed to interpret command"));
+             status = reply_status(&reply, "error");
+             ai_os_json_field_string(&reply, "message", "Failed to interpret command");
          }
          
+     } else if (strcmp(action, "speculate") == 0) {
+         /* Low-priority interpretation of a line still being typed; replies
+          * at once, the result is picked up by a later interpret */
+         char session[64];
+         client_session_key(client, &req, session, sizeof(session));
+         
+         int queued = speculation_submit(client->client_uid, session, command,
+                                         ai_context_to_summary(&client->context));
+         status = reply_status(&reply, queued == 0 ? "queued" : queued == 1 ? "duplicate" : "error");
+         
      } else if (strcmp(action, "execute") == 0) {
          /* Direct execution request */
          char exec_output[4096];
          int exec_result = execute_command_safely(client, command, exec_output, sizeof(exec_output));
          
-         json_object_object_add(response_obj, "execution_result", json_object_new_string(exec_output));
-         json_object_object_add(response_obj, "exit_code", json_object_new_int(exec_result));
-         json_object_object_add(response_obj, "status", json_object_new_string(exec_result == 0 ? "success" : "error"));
+         ai_os_json_field_string(&reply, "execution_result", exec_output);
+         ai_os_json_field_int(&reply, "exit_code", exec_result);
+         if (deadline_expired_stage()) {
+             status = deadline_reply(&reply);
+         } else {
+             status = reply_status(&reply, exec_result == 0 ? "success" : "error");
+         }
          
      } else if (strcmp(action, "status") == 0) {
          /* Return daemon and Ollama status */
-         char models_list[1024];
-         int ollama_status = ollama_check_status();
-         ollama_list_models(models_list, sizeof(models_list));
-         
-         json_object_object_add(response_obj, "daemon_status", json_object_new_string("running"));
-         json_object_object_add(response_obj, "ollama_status", json_object_new_string(ollama_status == 0 ? "running" : "not available"));
-         json_object_object_add(response_obj, "current_model", json_object_new_string(g_daemon.current_model));
-         json_object_object_add(response_obj, "available_models", json_object_new_string(models_list));
-         json_object_object_add(response_obj, "safety_mode", json_object_new_boolean(g_daemon.safety_mode));
-         json_object_object_add(response_obj, "confirmation_required", json_object_new_boolean(g_daemon.confirmation_required));
+         add_status_fields(&reply);
          
      } else if (strcmp(action, "set_model") == 0 && model) {
          /* Change AI model */
          if (ollama_set_model(model) == 0) {
              strncpy(g_daemon.current_model, model, sizeof(g_daemon.current_model) - 1);
-             json_object_object_add(response_obj, "status", json_object_new_string("success"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Model changed successfully"));
+             shared_cache_invalidate(AI_OS_CACHE_INTERPRET);
+             shared_cache_refresh_status();
+             status = reply_status(&reply, "success");
+             ai_os_json_field_string(&reply, "message", "Model changed successfully");
              ai_log("INFO", "Model changed to: %s", model);
          } else {
-             json_object_object_add(response_obj, "status", json_object_new_string("error"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Failed to change model"));
+             status = reply_status(&reply, "error");
+             ai_os_json_field_string(&reply, "message", "Failed to change model");
          }
          
      } else if (strcmp(action, "get_context") == 0) {
-         /* Return current context */
+         /* Return current context; the document is in the request's arena */
          char *context_json = ai_context_to_json(&client->context);
          if (context_json) {
-             json_object *context_obj = json_tokener_parse(context_json);
-             json_object_object_add(response_obj, "context", context_obj);
-             free(context_json);
+             ai_os_json_field_raw(&reply, "context", context_json, strlen(context_json));
          }
-         json_object_object_add(response_obj, "status", json_object_new_string("success"));
+         status = reply_status(&reply, "success");
          
      } else if (strcmp(action, "classify") == 0) {
          /* Classify input as command or chat */
          ai_log("INFO", "Classifying input from PID %d: %s", client->client_pid, command);
          
-         /* Enhanced classification logic */
-         const char *classification = "chat"; /* default */
-         
-         /* Command action words - high priority */
-         const char *command_actions[] = {
-             "add", "commit", "push", "pull", "clone", "init", "status", "log", "branch", "checkout",
-             "merge", "rebase", "stash", "reset", "revert", "tag", "fetch", "remote", "config",
-             "list", "show", "find", "search", "grep", "cat", "head", "tail", "less", "more",
-             "create", "delete", "remove", "rm", "mkdir", "touch", "cp", "copy", "mv", "move",
-             "install", "uninstall", "update", "upgrade", "download", "wget", "curl", "scp", "rsync",
-             "run", "start", "stop", "restart", "kill", "pkill", "killall", "ps", "top", "htop",
-             "check", "test", "verify", "validate", "get", "set", "export", "import", "source",
-             "open", "close", "edit", "view", "read", "write", "save", "load", "backup", "restore",
-             "build", "compile", "make", "cmake", "configure", "install", "uninstall", "package",
-             "mount", "umount", "format", "partition", "fsck", "dd", "tar", "zip", "unzip",
-             "chmod", "chown", "chgrp", "umask", "sudo", "su", "whoami", "id", "groups",
-             "ping", "traceroute", "netstat", "ss", "iptables", "firewall", "ufw",
-             "docker", "podman", "kubectl", "helm", "terraform", "ansible",
-             "python", "pip", "node", "npm", "yarn", "cargo", "go", "java", "maven", "gradle",
-             NULL
-         };
-         
-         /* Chat/question words - lower priority */
-         const char *chat_words[] = {
-             "hello", "hi", "hey", "good morning", "good afternoon", "good evening",
-             "how are you", "how do you", "what is", "what are", "who is", "who are",
-             "when is", "when will", "where is", "where are", "why is", "why are",
-             "tell me", "explain", "describe", "define", "what does", "how does",
-             "joke", "funny", "humor", "weather", "time", "date", "temperature",
-             "thanks", "thank you", "appreciate", "help", "please", "could you",
-             "would you", "can you", "should I", "do you think", "what do you think",
-             NULL
-         };
-         
-         /* Check for command action words first (higher priority) */
-         for (int i = 0; command_actions[i] != NULL; i++) {
-             if (strstr(command, command_actions[i])) {
-                 classification = "command";
-                 break;
-             }
-         }
+         const char *classification = classify_input(command);
          
-         /* Only check for chat words if no command action was found */
-         if (strcmp(classification, "command") != 0) {
-             for (int i = 0; chat_words[i] != NULL; i++) {
-                 if (strstr(command, chat_words[i])) {
-                     classification = "chat";
-                     break;
-                 }
-             }
-         }
+         /* Pure rules, so the answer holds for every client */
+         shared_cache_put(AI_OS_CACHE_CLASSIFY, command, classification, 0);
          
-         json_object_object_add(response_obj, "classification", json_object_new_string(classification));
-         json_object_object_add(response_obj, "status", json_object_new_string("success"));
+         ai_os_json_field_string(&reply, "classification", classification);
+         status = reply_status(&reply, "success");
          
      } else if (strcmp(action, "chat") == 0) {
          /* Handle chat requests */
@@ -364,36 +668,114 @@
          
          /* Use Ollama for chat response */
          char chat_response[1024];
-         int result = ollama_interpret_command(command, context_summary, chat_response, sizeof(chat_response));
+         long retry_ms = 0;
+         int result = run_inference(client, request_lane(&req, FAIR_QUEUE_CHAT), 1, command, context_summary,
+                                    chat_response, sizeof(chat_response), &retry_ms);
          
          if (result == 0) {
-             json_object_object_add(response_obj, "chat_response", json_object_new_string(chat_response));
-             json_object_object_add(response_obj, "status", json_object_new_string("success"));
+             ai_os_json_field_string(&reply, "chat_response", chat_response);
+             status = reply_status(&reply, "success");
+         } else if (result == -5 || result == -6) {
+             status = admission_reply(&reply, result, retry_ms);
+         } else if (result == -7) {
+             status = deadline_reply(&reply);
+         } else {
+             status = reply_status(&reply, "error");
+             ai_os_json_field_string(&reply, "message", "Failed to get chat response");
+         }
+         
+     } else if (strcmp(action, "trace_export") == 0) {
+         /* Buffered spans to a file; "command" picks chrome (default) or otlp */
+         char path[256];
+         int spans = trace_export(command, path, sizeof(path));
+         int export_errno = errno;
+         if (spans >= 0) {
+             ai_os_json_field_string(&reply, "path", path);
+             ai_os_json_field_int(&reply, "spans", spans);
+             status = reply_status(&reply, "success");
+             ai_log("INFO", "Exported %d trace spans to %s", spans, path);
+         } else {
+             status = reply_status(&reply, "error");
+             ai_os_json_field_string(&reply, "message",
+                 export_errno == EINVAL ? "Unknown trace format (chrome, otlp)" : "Failed to export trace");
+         }
+         
+     } else if (strcmp(action, "metrics") == 0) {
+         /* Prometheus text exposition of metrics.c */
+         char *text = arena_alloc(METRICS_TEXT_SIZE);
+         if (text && metrics_render(text, METRICS_TEXT_SIZE) >= 0) {
+             ai_os_json_field_string(&reply, "metrics", text);
+             status = reply_status(&reply, "success");
          } else {
-             json_object_object_add(response_obj, "status", json_object_new_string("error"));
-             json_object_object_add(response_obj, "message", json_object_new_string("Failed to get chat response"));
+             status = reply_status(&reply, "error");
+             ai_os_json_field_string(&reply, "message", "Failed to render metrics");
          }
          
      } else {
-         json_object_object_add(response_obj, "status", json_object_new_string("error"));
-         json_object_object_add(response_obj, "message", json_object_new_string("Unknown action"));
+         status = reply_status(&reply, "error");
+         ai_os_json_field_string(&reply, "message", "Unknown action");
      }
      
-     const char *response_str = json_object_to_json_string(response_obj);
-     strncpy(response, response_str, response_size - 1);
-     response[response_size - 1] = '\0';
+     stage_ns = metrics_now_ns();
+     ai_os_json_end_object(&reply);
+     if (ai_os_json_writer_finish(&reply) < 0) {
+         /* Say so rather than send a cut-off document */
+         ai_os_json_writer_init(&reply, response, response_size);
+         ai_os_json_begin_object(&reply);
+         if (req.id) {
+             ai_os_json_field_raw(&reply, "id", req.id, req.id_len);
+         }
+         status = reply_status(&reply, "error");
+         ai_os_json_field_string(&reply, "message", "Response too large");
+         ai_os_json_end_object(&reply);
+         if (ai_os_json_writer_finish(&reply) < 0) {
+             snprintf(response, response_size, "{\"error\": \"Response too large\"}");
+         }
+     }
+     metrics_observe_stage(METRICS_STAGE_SERIALIZE, metrics_now_ns() - stage_ns);
+     
+     size_t response_bytes = strlen(response);
+     metrics_observe_request(action, status, metrics_now_ns() - start_ns);
+     trace_end(action, status, start_ns);
+     capture_request(client->session_id, start_ns, action, strcmp(action, "set_model") == 0 ? model : command,
+                     status, metrics_now_ns() - start_ns);
      
-     json_object_put(req_obj);
-     json_object_put(response_obj);
+     /* The reply is out of the arena, so the request's scratch memory goes */
+     struct arena_stats memory;
+     arena_reset(&memory);
+     metrics_observe_memory(&memory);
+     flight_end(status, response_bytes, &memory);
+     AI_OS_PROBE4(request_done, current_request, action, status ? status : "none", response_bytes);
+     deadline_end();
      
      return 0;
  }
  
- /* Client thread function */
+ /* Answer one request; replies are newline-terminated JSON */
+ static void serve_request(ai_client_t *client, const char *request) {
+     char response[MAX_RESPONSE_LEN];
+     
+     current_request = __atomic_add_fetch(&g_daemon.next_request, 1, __ATOMIC_RELAXED);
+     AI_OS_PROBE3(request_start, current_request, client->session_id, strlen(request));
+     metrics_request_started();
+     if (handle_client_request(client, request, response, sizeof(response) - 1) != 0 &&
+         strncmp(response, "{\"error\"", 9) != 0) {
+         strcpy(response, "{\"error\": \"Failed to process request\"}");
+     }
+     strcat(response, "\n");
+     ssize_t sent = send(client->socket_fd, response, strlen(response), MSG_NOSIGNAL);
+     AI_OS_PROBE2(response_send, current_request, sent);
+     metrics_request_finished();
+ }
+ 
+ /* Client thread function. Requests are one JSON object per line, so a
+  * client may pipeline several; a single unterminated object per recv, as
+  * older clients send, is still accepted. */
  static void *client_thread(void *arg) {
      ai_client_t *client = (ai_client_t *)arg;
      char buffer[MAX_COMMAND_LEN];
-     char response[MAX_COMMAND_LEN * 2];
+     size_t buffered = 0;
+     int overlong = 0;
      ssize_t bytes_received;
      
      ai_log("INFO", "Client connected: PID %d, UID %d", client->client_pid, client->client_uid);
@@ -402,25 +784,52 @@
      ai_context_create(&client->context, client->client_pid);
      
      while (client->active && g_daemon.running) {
-         bytes_received = recv(client->socket_fd, buffer, sizeof(buffer) - 1, 0);
+         bytes_received = recv(client->socket_fd, buffer + buffered, sizeof(buffer) - 1 - buffered, 0);
          
          if (bytes_received <= 0) {
              break; /* Client disconnected */
          }
          
-         buffer[bytes_received] = '\0';
+         buffered += (size_t)bytes_received;
+         buffer[buffered] = '\0';
          client->last_activity = time(NULL);
          
-         /* Handle the request */
-         if (handle_client_request(client, buffer, response, sizeof(response)) == 0) {
-             send(client->socket_fd, response, strlen(response), 0);
-         } else {
-             const char *error_response = "{\"error\": \"Failed to process request\"}";
-             send(client->socket_fd, error_response, strlen(error_response), 0);
+         /* Handle each complete line */
+         char *line = buffer, *newline;
+         while ((newline = memchr(line, '\n', buffered - (size_t)(line - buffer)))) {
+             *newline = '\0';
+             if (overlong) {
+                 overlong = 0; /* tail of a request already rejected */
+             } else if (*line) {
+                 serve_request(client, line);
+             }
+             line = newline + 1;
+         }
+         buffered -= (size_t)(line - buffer);
+         memmove(buffer, line, buffered + 1);
+         
+         if (buffered == 0) {
+             continue;
+         }
+         
+         /* Unframed request from an older client */
+         if (!overlong && ai_os_json_complete(buffer, buffered) == 1) {
+             serve_request(client, buffer);
+             buffered = 0;
+         } else if (buffered == sizeof(buffer) - 1) {
+             if (!overlong) {
+                 const char *error_response = "{\"error\": \"Request too large\"}\n";
+                 send(client->socket_fd, error_response, strlen(error_response), MSG_NOSIGNAL);
+             }
+             overlong = 1;
+             buffered = 0;
          }
      }
      
      ai_log("INFO", "Client disconnected: PID %d", client->client_pid);
+     char session[64];
+     client_session_key(client, NULL, session, sizeof(session));
+     speculation_end_session(session);
      close(client->socket_fd);
      ai_context_free(&client->context);
      client->active = 0;
@@ -452,10 +861,20 @@
      for (int i = 0; i < MAX_CLIENTS; i++) {
          if (!g_daemon.clients[i].active) {
              g_daemon.clients[i].socket_fd = client_socket;
-             g_daemon.clients[i].client_pid = 0; /* Will be set by client */
-             g_daemon.clients[i].client_uid = getuid(); /* Default to current user */
+             /* Who is on the other end, as the kernel saw them connect */
+             struct ucred peer;
+             socklen_t peer_len = sizeof(peer);
+             if (getsockopt(client_socket, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == 0) {
+                 g_daemon.clients[i].client_pid = peer.pid;
+                 g_daemon.clients[i].client_uid = peer.uid;
+             } else {
+                 g_daemon.clients[i].client_pid = 0; /* Will be set by client */
+                 g_daemon.clients[i].client_uid = getuid(); /* Default to current user */
+             }
              g_daemon.clients[i].active = 1;
              g_daemon.clients[i].last_activity = time(NULL);
+             g_daemon.clients[i].session_id = ++g_daemon.next_session_id;
+             AI_OS_PROBE2(client_accept, g_daemon.clients[i].session_id, client_socket);
              
              if (pthread_create(&g_daemon.clients[i].thread_id, NULL, client_thread, &g_daemon.clients[i]) != 0) {
                  ai_log("ERROR", "Failed to create client thread: %s", strerror(errno));
@@ -483,54 +902,47 @@
      return -1;
  }
  
- /* Load configuration */
- static int load_config(void) {
-     FILE *fp = fopen(AI_CONFIG_FILE, "r");
-     if (!fp) {
-         ai_log("WARN", "No config file found, using defaults");
-         strcpy(g_daemon.current_model, "codellama:7b-instruct");
-         g_daemon.safety_mode = 1;
-         g_daemon.confirmation_required = 1;
-         return 0;
-     }
-     
-     char buffer[4096];
-     size_t bytes_read = fread(buffer, 1, sizeof(buffer) - 1, fp);
-     fclose(fp);
+ /* Reload hook: settings that take effect between requests */
+ static void apply_config(const ai_os_settings_t *prev, const ai_os_settings_t *next) {
+     int invalidate = 0;
      
-     if (bytes_read == 0) {
-         ai_log("ERROR", "Failed to read config file");
-         return -1;
+     /* A new config model replaces the running one, set_model included;
+      * an unrelated edit leaves set_model's choice alone */
+     if (strcmp(prev->model, next->model) != 0 && strcmp(g_daemon.current_model, next->model) != 0) {
+         if (ollama_set_model(next->model) == 0) {
+             snprintf(g_daemon.current_model, sizeof(g_daemon.current_model), "%s", next->model);
+             invalidate = 1;
+             ai_log("INFO", "Model changed to: %s (config)", next->model);
+         } else {
+             ai_log("ERROR", "Failed to change model to %s", next->model);
+         }
      }
      
-     buffer[bytes_read] = '\0';
-     
-     json_object *config = json_tokener_parse(buffer);
-     if (!config) {
-         ai_log("ERROR", "Invalid JSON in config file");
-         return -1;
+     /* Cached interpretations were stored under the old rules */
+     if (prev->confirmation_required != next->confirmation_required || prev->safety_mode != next->safety_mode ||
+         prev->policy_count != next->policy_count ||
+         memcmp(prev->policy, next->policy, sizeof(prev->policy)) != 0) {
+         invalidate = 1;
      }
      
-     json_object *model_obj, *safety_obj, *confirm_obj;
-     
-     if (json_object_object_get_ex(config, "model", &model_obj)) {
-         strncpy(g_daemon.current_model, json_object_get_string(model_obj), sizeof(g_daemon.current_model) - 1);
+     /* AI_OS_LOG_LEVEL in the environment wins over the config file */
+     if (!getenv("AI_OS_LOG_LEVEL") && next->log_level >= 0 && next->log_level != prev->log_level) {
+         ai_os_log_set_level(next->log_level);
      }
      
-     if (json_object_object_get_ex(config, "safety_mode", &safety_obj)) {
-         g_daemon.safety_mode = json_object_get_boolean(safety_obj);
+     if (prev->generation && (strcmp(prev->metrics_socket, next->metrics_socket) != 0 ||
+                              strcmp(prev->capture_file, next->capture_file) != 0 ||
+                              strcmp(prev->replay_backend, next->replay_backend) != 0 ||
+                              prev->replay_speed != next->replay_speed)) {
+         ai_log("WARN", "metrics_socket, capture_file and replay_* take effect on restart");
      }
      
-     if (json_object_object_get_ex(config, "confirmation_required", &confirm_obj)) {
-         g_daemon.confirmation_required = json_object_get_boolean(confirm_obj);
+     if (invalidate && prev->generation) {
+         shared_cache_invalidate(AI_OS_CACHE_INTERPRET);
+         shared_cache_refresh_status();
      }
-     
-     json_object_put(config);
-     
-     ai_log("INFO", "Configuration loaded: model=%s, safety=%d, confirm=%d", 
-            g_daemon.current_model, g_daemon.safety_mode, g_daemon.confirmation_required);
-     
-     return 0;
+     ai_log("INFO", "Configuration generation %lu: model=%s, safety=%d, confirm=%d",
+            next->generation, g_daemon.current_model, next->safety_mode, next->confirmation_required);
  }
  
  /* Signal handler */
@@ -539,35 +951,78 @@
      g_daemon.running = 0;
  }
  
+ /* SIGHUP: reread the configuration on the config watcher thread */
+ static void reload_handler(int sig) {
+     (void)sig;
+     config_request_reload();
+ }
+ 
  /* Initialize daemon */
  static int init_daemon(void) {
      struct sockaddr_un addr;
 
-     g_daemon.log_file = fopen(AI_LOG_FILE, "a");
-     if (!g_daemon.log_file) {
-         ai_log("WARN", "Could not open log file %s", AI_LOG_FILE);
-     }
-
      /* Initialize syslog */
      openlog("ai-os-daemon", LOG_PID, LOG_DAEMON);
 
      ai_log("INFO", "Starting AI-OS Daemon");
 
-     if (load_config() != 0) {
+     if (config_init() != 0) {
          ai_log("ERROR", "Failed to load config");
          // Continue with defaults
      }
 
+     /* Startup-only settings; the rest is read per request or applied by
+      * apply_config() on reload */
+     const ai_os_settings_t *config = config_get();
+     snprintf(g_daemon.current_model, sizeof(g_daemon.current_model), "%s", config->model);
+     if (!getenv("AI_OS_LOG_LEVEL") && config->log_level >= 0) {
+         ai_os_log_set_level(config->log_level);
+     }
+     config_on_reload(apply_config);
+     ai_log("INFO", "Configuration loaded: model=%s, safety=%d, confirm=%d",
+            config->model, config->safety_mode, config->confirmation_required);
+
      if (ollama_client_init(g_daemon.current_model, NULL) != 0) {
          ai_log("ERROR", "Failed to initialize Ollama client");
          // Continue, but warn
      }
 
+     /* Answering from a capture is for performance tests: never run what
+      * the recorded replies say */
+     if (config->replay_backend[0]) {
+         if (replay_backend_init(config->replay_backend, config->replay_speed) == 0) {
+             ai_log("WARN", "Answering from recorded traffic in %s, not Ollama; auto-execute off",
+                    config->replay_backend);
+         } else {
+             ai_log("ERROR", "Failed to load replay backend %s", config->replay_backend);
+         }
+     }
+
      if (ollama_check_status() != 0) {
          ai_log("WARN", "Ollama is not running, some features may not work");
          // Do not fail
      }
 
+     if (capture_init(config->capture_file, g_daemon.current_model) != 0) {
+         ai_log("WARN", "Traffic capture to %s disabled", config->capture_file);
+     }
+
+     if (speculation_init() != 0) {
+         ai_log("WARN", "Speculative interpretation disabled");
+     }
+
+     if (shared_cache_init(status_snapshot) != 0) {
+         ai_log("WARN", "Shared client cache disabled");
+     }
+
+     if (metrics_init(config->metrics_socket) != 0) {
+         ai_log("WARN", "Metrics socket %s disabled", config->metrics_socket);
+     }
+
+     if (flight_init() != 0) {
+         ai_log("WARN", "Flight recorder disabled");
+     }
+
      g_daemon.server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
      if (g_daemon.server_socket < 0) {
          ai_log("ERROR", "Failed to create server socket: %s", strerror(errno));
@@ -633,15 +1088,19 @@
      if (unlink(AI_SOCKET_PATH) != 0) {
          ai_log("WARN", "Failed to unlink socket file: %s", strerror(errno));
      }
+     config_cleanup();
+     speculation_cleanup();
+     shared_cache_cleanup();
+     metrics_cleanup();
+     flight_cleanup();
+     capture_cleanup();
      ollama_client_cleanup();
      if (pthread_mutex_destroy(&g_daemon.clients_mutex) != 0) {
          ai_log("ERROR", "Failed to destroy clients mutex: %s", strerror(errno));
      }
-     if (g_daemon.log_file) {
-         fclose(g_daemon.log_file);
-     }
-     closelog();
      ai_log("INFO", "AI-OS Daemon cleanup complete");
+     ai_os_log_flush();
+     closelog();
  }
  
  /* Main daemon loop */
@@ -667,6 +1126,7 @@
      /* Setup signal handlers */
      signal(SIGINT, signal_handler);
      signal(SIGTERM, signal_handler);
+     signal(SIGHUP, reload_handler);
      signal(SIGPIPE, SIG_IGN); /* Ignore broken pipe */
      
      /* Initialize daemon */
@@ -0,0 +1,159 @@
+/*
+ * Per-Request Arena for AI-OS
+ * File: userspace/daemon/arena.c
+ *
+ * Scratch memory that lives exactly as long as one request: the Ollama
+ * reply buffer, the get_context document, the metrics text, capture lines.
+ * Every thread that serves requests (connection threads, speculation
+ * workers, the kernel bridge) bump-allocates it from its own block and
+ * drops all of it with arena_reset() when the request is done, so nothing
+ * is freed piecemeal and no lock is taken.
+ *
+ * A thread's block is allocated on first use and kept until the thread
+ * exits. A request that outgrows it spills into malloc'd blocks, which the
+ * reset frees before regrowing the block to that request's high-water mark
+ * (at most ARENA_MAX_BLOCK), so a steady workload stops reaching the heap
+ * after its first few requests. arena_reset() hands back what the request
+ * used, for metrics.c and the flight recorder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../ai_os_common.h"
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_MAX_BLOCK (4 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+/* Memory a request needed beyond the block; freed by the next reset */
+typedef struct arena_spill {
+    struct arena_spill *next;
+    size_t size;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_spill_t;
+
+static struct {
+    pthread_key_t key;
+    pthread_once_t once;
+} arena_state = {
+    .once = PTHREAD_ONCE_INIT,
+};
+
+/* This thread's arena */
+static __thread struct {
+    char *block;
+    size_t size;
+    size_t used;
+    char *last;                 /* latest allocation in the block, resizes in place */
+    arena_spill_t *spills;
+    size_t spilled;             /* bytes in spills */
+    struct arena_stats stats;
+} arena;
+
+static void block_release(void *block) {
+    free(block);
+}
+
+static void arena_once(void) {
+    pthread_key_create(&arena_state.key, block_release);
+}
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* (Re)allocate the block; the thread key frees it at thread exit */
+static void block_setup(size_t size) {
+    pthread_once(&arena_state.once, arena_once);
+    free(arena.block);
+    arena.block = malloc(size);
+    arena.size = arena.block ? size : 0;
+    arena.used = 0;
+    arena.last = NULL;
+    pthread_setspecific(arena_state.key, arena.block);
+}
+
+static void *spill_alloc(size_t size) {
+    arena_spill_t *spill = malloc(sizeof(*spill) + size);
+    if (!spill) {
+        return NULL;
+    }
+    spill->size = size;
+    spill->next = arena.spills;
+    arena.spills = spill;
+    arena.spilled += size;
+    arena.stats.heap_allocs++;
+    arena.stats.heap_bytes += size;
+    return spill->data;
+}
+
+/* SIZE bytes, 16-byte aligned, valid until this thread's next reset */
+void *arena_alloc(size_t size) {
+    size_t need = align_up(size ? size : 1);
+
+    if (!arena.block) {
+        block_setup(ARENA_BLOCK_SIZE);
+    }
+    arena.stats.allocs++;
+    arena.stats.bytes += size;
+
+    if (need <= arena.size - arena.used) {
+        char *p = arena.block + arena.used;
+        arena.used += need;
+        arena.last = p;
+        return p;
+    }
+    arena.last = NULL;
+    return spill_alloc(need);
+}
+
+/* PTR (OLD_SIZE bytes from arena_alloc) resized to NEW_SIZE: in place when
+ * it is the latest allocation and the block has room, otherwise copied */
+void *arena_resize(void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) {
+        return arena_alloc(new_size);
+    }
+
+    char *p = ptr;
+    if (p == arena.last && align_up(new_size) <= arena.size - (size_t)(p - arena.block)) {
+        arena.used = (size_t)(p - arena.block) + align_up(new_size);
+        arena.stats.bytes = arena.stats.bytes + new_size - old_size;
+        return ptr;
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    void *resized = arena_alloc(new_size);
+    if (resized) {
+        memcpy(resized, ptr, old_size);
+    }
+    return resized;
+}
+
+/* Drop everything this thread allocated since the last reset; STATS, if
+ * given, receives what the request used */
+void arena_reset(struct arena_stats *stats) {
+    size_t high_water = arena.used + arena.spilled;
+
+    if (stats) {
+        *stats = arena.stats;
+    }
+    memset(&arena.stats, 0, sizeof(arena.stats));
+
+    if (arena.spills) {
+        while (arena.spills) {
+            arena_spill_t *next = arena.spills->next;
+            free(arena.spills);
+            arena.spills = next;
+        }
+        arena.spilled = 0;
+        if (high_water <= ARENA_MAX_BLOCK) {
+            block_setup(align_up(high_water));
+        }
+    }
+    arena.used = 0;
+    arena.last = NULL;
+}
@@ -0,0 +1,319 @@
+/*
+ * Traffic Capture and Replay Backend for AI-OS
+ * File: userspace/daemon/capture.c
+ *
+ * With "capture_file" set in the config the daemon appends one JSON line
+ * per served request (arrival offset, connection, action, text, status,
+ * service time) and per Ollama generate call (model, prompt, result, reply,
+ * call time) to that file. Only what a replay needs is kept: client ids,
+ * trace ids and the daemon's context summary (user names, paths, history)
+ * are left out, and the file is created mode 0600.
+ *
+ * `ai-client replay` re-drives the request lines against a daemon at the
+ * recorded pace or faster. Given the same file as "replay_backend", that
+ * daemon answers generate calls from the recorded backend lines instead of
+ * Ollama, taking the recorded call time (scaled by "replay_speed"), so
+ * cache, routing and scheduling changes see the production workload shape
+ * with a backend that behaves like the one that served it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <json-c/json.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+#include "../ai_os_json.h"
+
+#define CAPTURE_FLUSH_NS 1000000000LL    /* a crash loses at most this much */
+#define CAPTURE_FIELDS_SIZE 256         /* a record's keys and numbers */
+#define REPLAY_BUCKETS 1024
+#define REPLAY_SLEEP_STEP_NS 10000000L   /* cancellation check while "generating" */
+
+/* One recorded generate call */
+typedef struct replay_call {
+    unsigned int hash;
+    char *model;
+    char *prompt;
+    char *reply;
+    int result;
+    long long elapsed_ns;
+    int used;
+    struct replay_call *next;
+} replay_call_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    FILE *fp;
+    long long start_ns;
+    long long last_flush_ns;
+    unsigned long records;
+} capture = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct {
+    pthread_mutex_t mutex;          /* claims of recordings, the counters */
+    replay_call_t *buckets[REPLAY_BUCKETS];
+    double speed;
+    unsigned long calls;
+    unsigned long misses;
+    int active;
+} replay = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/capture.log", 0);
+static void capture_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+/* FNV-1a over model and prompt */
+static unsigned int call_hash(const char *model, const char *prompt) {
+    unsigned int h = 2166136261u;
+    for (const char *p = model; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+    h = (h ^ 0xff) * 16777619u;
+    for (const char *p = prompt; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+    return h;
+}
+
+/* Append LINE (LEN bytes, no newline) */
+static void write_record(const char *line, int len) {
+    if (len < 0) {
+        capture_log("Capture: record too large, dropped\n");
+        return;
+    }
+    pthread_mutex_lock(&capture.mutex);
+    if (capture.fp) {
+        long long now = metrics_now_ns();
+        fwrite(line, 1, (size_t)len, capture.fp);
+        fputc('\n', capture.fp);
+        capture.records++;
+        if (now - capture.last_flush_ns >= CAPTURE_FLUSH_NS) {
+            fflush(capture.fp);
+            capture.last_flush_ns = now;
+        }
+    }
+    pthread_mutex_unlock(&capture.mutex);
+}
+
+/* A line buffer in the request's arena with room for TEXT_BYTES of string
+ * values, each byte escaped at worst */
+static char *record_buffer(ai_os_json_writer_t *w, size_t text_bytes) {
+    size_t size = 6 * text_bytes + CAPTURE_FIELDS_SIZE;
+    char *buf = arena_alloc(size);
+    if (buf) {
+        ai_os_json_writer_init(w, buf, size);
+    }
+    return buf;
+}
+
+/* Start appending to PATH; NULL or "" leaves capture off */
+int capture_init(const char *path, const char *model) {
+    if (!path || !*path) {
+        return 0;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    FILE *fp = fd >= 0 ? fdopen(fd, "a") : NULL;
+    if (!fp) {
+        capture_log("Capture: cannot open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    capture.start_ns = capture.last_flush_ns = metrics_now_ns();
+
+    char header[512];
+    ai_os_json_writer_t w;
+    ai_os_json_writer_init(&w, header, sizeof(header));
+    ai_os_json_begin_object(&w);
+    ai_os_json_field_int(&w, "capture", 1);
+    ai_os_json_field_int(&w, "started_unix_ms", (long long)real.tv_sec * 1000 + real.tv_nsec / 1000000);
+    ai_os_json_field_string(&w, "model", model ? model : "");
+    ai_os_json_end_object(&w);
+
+    pthread_mutex_lock(&capture.mutex);
+    __atomic_store_n(&capture.fp, fp, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&capture.mutex);
+    write_record(header, ai_os_json_writer_finish(&w));
+
+    capture_log("Capture: recording traffic to %s\n", path);
+    return 0;
+}
+
+int capture_active(void) {
+    return __atomic_load_n(&capture.fp, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/* A request on connection CONN that arrived at ARRIVAL_NS has been served */
+void capture_request(unsigned long conn, long long arrival_ns, const char *action, const char *text,
+                     const char *status, long long elapsed_ns) {
+    if (!capture_active()) {
+        return;
+    }
+    ai_os_json_writer_t w;
+    if (!record_buffer(&w, strlen(action) + (text ? strlen(text) : 0))) {
+        return;
+    }
+    ai_os_json_begin_object(&w);
+    ai_os_json_field_int(&w, "t_us", (arrival_ns - capture.start_ns) / 1000);
+    ai_os_json_field_int(&w, "conn", (long long)conn);
+    ai_os_json_field_string(&w, "action", action);
+    if (text && *text) {
+        ai_os_json_field_string(&w, "text", text);
+    }
+    ai_os_json_field_string(&w, "status", status ? status : "none");
+    ai_os_json_field_int(&w, "us", elapsed_ns / 1000);
+    ai_os_json_end_object(&w);
+    write_record(w.buf, ai_os_json_writer_finish(&w));
+}
+
+/* A generate call finished; REPLY is Ollama's text, before safety checks */
+void capture_backend(const char *model, const char *prompt, int result, const char *reply, long long elapsed_ns) {
+    if (!capture_active()) {
+        return;
+    }
+    model = model ? model : "";
+    reply = result == 0 ? reply : NULL;
+    ai_os_json_writer_t w;
+    if (!record_buffer(&w, strlen(model) + strlen(prompt) + (reply ? strlen(reply) : 0))) {
+        return;
+    }
+    ai_os_json_begin_object(&w);
+    ai_os_json_field_int(&w, "t_us", (metrics_now_ns() - elapsed_ns - capture.start_ns) / 1000);
+    ai_os_json_field_string(&w, "backend", model);
+    ai_os_json_field_string(&w, "prompt", prompt);
+    ai_os_json_field_int(&w, "result", result);
+    if (reply) {
+        ai_os_json_field_string(&w, "reply", reply);
+    }
+    ai_os_json_field_int(&w, "us", elapsed_ns / 1000);
+    ai_os_json_end_object(&w);
+    write_record(w.buf, ai_os_json_writer_finish(&w));
+}
+
+void capture_cleanup(void) {
+    pthread_mutex_lock(&capture.mutex);
+    if (capture.fp) {
+        fclose(capture.fp);
+        __atomic_store_n(&capture.fp, NULL, __ATOMIC_RELEASE);
+        capture_log("Capture: %lu records written\n", capture.records);
+    }
+    pthread_mutex_unlock(&capture.mutex);
+}
+
+/* ---- replay backend ---- */
+
+/* Load the backend lines of the capture at PATH; generate calls are then
+ * answered from them, SPEED times faster than recorded */
+int replay_backend_init(const char *path, double speed) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        capture_log("Replay: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned long loaded = 0;
+    while (getline(&line, &cap, fp) > 0) {
+        json_object *obj = json_tokener_parse(line);
+        json_object *model, *prompt, *result, *reply, *us;
+        if (obj && json_object_object_get_ex(obj, "backend", &model) &&
+            json_object_object_get_ex(obj, "prompt", &prompt) &&
+            json_object_object_get_ex(obj, "result", &result) &&
+            json_object_object_get_ex(obj, "us", &us)) {
+            replay_call_t *call = calloc(1, sizeof(*call));
+            if (call) {
+                call->model = strdup(json_object_get_string(model));
+                call->prompt = strdup(json_object_get_string(prompt));
+                call->reply = strdup(json_object_object_get_ex(obj, "reply", &reply) ? json_object_get_string(reply) : "");
+                call->result = json_object_get_int(result);
+                call->elapsed_ns = json_object_get_int64(us) * 1000;
+                call->hash = call_hash(call->model, call->prompt);
+                if (!call->model || !call->prompt || !call->reply) {
+                    free(call->model);
+                    free(call->prompt);
+                    free(call->reply);
+                    free(call);
+                } else {
+                    /* Append, so repeats of a prompt replay in recorded order */
+                    replay_call_t **tail = &replay.buckets[call->hash % REPLAY_BUCKETS];
+                    while (*tail) tail = &(*tail)->next;
+                    *tail = call;
+                    loaded++;
+                }
+            }
+        }
+        if (obj) json_object_put(obj);
+    }
+    free(line);
+    fclose(fp);
+
+    replay.speed = speed > 0 ? speed : 1.0;
+    replay.active = 1;
+    capture_log("Replay: %lu backend calls loaded from %s, speed %.2f\n", loaded, path, replay.speed);
+    return 0;
+}
+
+int replay_backend_active(void) {
+    return replay.active;
+}
+
+/* Answer a generate call from the capture: the first unused recording of
+ * MODEL and PROMPT, else the last one, after its recorded call time. -1 if
+ * there is none, -4 if CANCELLED fires first. Generate calls run
+ * concurrently, so a recording is claimed under the table's own mutex and
+ * two identical prompts take two recordings. */
+int replay_backend_answer(const char *model, const char *prompt, char *reply, size_t reply_size,
+                          int (*cancelled)(void *arg), void *arg) {
+    unsigned int hash = call_hash(model, prompt);
+    replay_call_t *match = NULL;
+    unsigned long calls, misses;
+
+    pthread_mutex_lock(&replay.mutex);
+    for (replay_call_t *c = replay.buckets[hash % REPLAY_BUCKETS]; c; c = c->next) {
+        if (c->hash == hash && strcmp(c->model, model) == 0 && strcmp(c->prompt, prompt) == 0) {
+            match = c;
+            if (!c->used) break;
+        }
+    }
+    calls = ++replay.calls;
+    misses = match ? replay.misses : ++replay.misses;
+    if (match) {
+        match->used = 1;
+    }
+    pthread_mutex_unlock(&replay.mutex);
+
+    if (!match) {
+        capture_log("Replay: no recorded call for '%s' on %s (%lu of %lu missed)\n",
+                    prompt, model, misses, calls);
+        return -1;
+    }
+
+    long long remaining = (long long)(match->elapsed_ns / replay.speed);
+    while (remaining > 0) {
+        if (cancelled && cancelled(arg)) {
+            return -4;
+        }
+        struct timespec step = { 0, remaining < REPLAY_SLEEP_STEP_NS ? remaining : REPLAY_SLEEP_STEP_NS };
+        nanosleep(&step, NULL);
+        remaining -= step.tv_nsec;
+    }
+
+    snprintf(reply, reply_size, "%s", match->reply);
+    return match->result;
+}
@@ -0,0 +1,568 @@
+/*
+ * Configuration for AI-OS
+ * File: userspace/daemon/config.c
+ *
+ * Parses config.json and models.json into one immutable snapshot. Readers
+ * call config_get() and use what it returns for the work at hand: it is a
+ * single acquire load, with no lock and no reference to drop. A reload
+ * builds a complete new snapshot and publishes it with one atomic pointer
+ * swap, so a request in flight keeps the snapshot it started with and the
+ * next one sees the new settings. A file that fails to parse leaves the
+ * current snapshot in place.
+ *
+ * Reloads happen on SIGHUP and whenever a file in AI_OS_CONFIG_DIR is
+ * written or replaced (inotify), always on the watcher thread, which then
+ * runs the registered reload hooks with the old and new snapshots.
+ * A replaced snapshot is freed once it has been out of use for
+ * CONFIG_GRACE_SEC, far longer than any reader holds one (readers look up
+ * a setting and let go; none keeps the pointer across requests), so a
+ * tool that rewrites the files often costs a bounded amount of memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <json-c/json.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+
+#define CONFIG_MAX_FILE_SIZE (1024 * 1024)
+#define CONFIG_MAX_HOOKS 8
+#define CONFIG_SETTLE_MS 100        /* editors write a file in several steps */
+#define CONFIG_GRACE_SEC 60         /* a replaced snapshot may still be in use */
+
+/* Used until config_init() has loaded the files */
+static ai_os_settings_t default_config = {
+    .model = "codellama:7b-instruct",
+    .safety_mode = 1,
+    .confirmation_required = 1,
+    .log_level = -1,
+    .user_default = { .weight = 1 },
+    .queue_timeout_ms = 30000,
+    .max_concurrency = 8,
+    .interpret_deadline_ms = 30000,
+    .chat_deadline_ms = 30000,
+};
+
+typedef struct config_snapshot {
+    ai_os_settings_t config;          /* first, so a config pointer is its snapshot */
+    struct config_snapshot *retired;  /* the one published before */
+    long long replaced_ns;            /* metrics_now_ns() it stopped being current; 0 while it is */
+} config_snapshot_t;
+
+static struct {
+    ai_os_settings_t *current;
+    config_snapshot_t *snapshots;   /* current first, then those in their grace period */
+    pthread_mutex_t reload_mutex;   /* one reload at a time */
+    void (*hooks[CONFIG_MAX_HOOKS])(const ai_os_settings_t *prev, const ai_os_settings_t *next);
+    int hook_count;
+    unsigned long generation;
+    int wake_pipe[2];               /* SIGHUP and shutdown wake the watcher */
+    int inotify_fd;
+    pthread_t watcher;
+    int watching;
+} config_state = {
+    .current = &default_config,
+    .reload_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake_pipe = { -1, -1 },
+    .inotify_fd = -1,
+};
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/config.log", 0);
+static void config_log(int level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, level, fmt, args);
+    va_end(args);
+}
+
+const ai_os_settings_t *config_get(void) {
+    return __atomic_load_n(&config_state.current, __ATOMIC_ACQUIRE);
+}
+
+/* PATH parsed as JSON; NULL with *MISSING set if it does not exist */
+static json_object *read_json_file(const char *path, int *missing) {
+    *missing = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *missing = errno == ENOENT;
+        if (!*missing) {
+            config_log(AI_OS_LOG_ERROR, "Config: cannot open %s: %s\n", path, strerror(errno));
+        }
+        return NULL;
+    }
+
+    struct stat st;
+    char *text = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size <= CONFIG_MAX_FILE_SIZE) {
+        text = malloc((size_t)st.st_size + 1);
+    }
+    ssize_t got = text ? read(fd, text, (size_t)st.st_size) : -1;
+    close(fd);
+    if (got < 0) {
+        config_log(AI_OS_LOG_ERROR, "Config: cannot read %s\n", path);
+        free(text);
+        return NULL;
+    }
+    text[got] = '\0';
+
+    json_object *root = json_tokener_parse(text);
+    free(text);
+    if (!root || !json_object_is_type(root, json_type_object)) {
+        config_log(AI_OS_LOG_ERROR, "Config: %s is not a JSON object\n", path);
+        if (root) json_object_put(root);
+        return NULL;
+    }
+    return root;
+}
+
+static void copy_string(json_object *root, const char *key, char *dst, size_t size) {
+    json_object *value;
+    if (json_object_object_get_ex(root, key, &value)) {
+        snprintf(dst, size, "%s", json_object_get_string(value));
+    }
+}
+
+static void copy_bool(json_object *root, const char *key, int *dst) {
+    json_object *value;
+    if (json_object_object_get_ex(root, key, &value)) {
+        *dst = json_object_get_boolean(value);
+    }
+}
+
+/* Strings of a JSON array into fixed slots; the count copied */
+static int copy_strings(json_object *array, char *slots, size_t slot_size, int max) {
+    if (!json_object_is_type(array, json_type_array)) {
+        return 0;
+    }
+    int count = json_object_array_length(array);
+    if (count > max) {
+        count = max;
+    }
+    for (int i = 0; i < count; i++) {
+        snprintf(slots + (size_t)i * slot_size, slot_size, "%s",
+                 json_object_get_string(json_object_array_get_idx(array, i)));
+    }
+    return count;
+}
+
+/* "safety_policy": [{"command", "flags", "args" or "redirects",
+ * "piped_from", "privileged", "action", "reason"}, ...] */
+static void parse_policy(json_object *rules, ai_os_settings_t *cfg) {
+    int count = json_object_array_length(rules);
+    for (int i = 0; i < count && cfg->policy_count < AI_OS_POLICY_MAX_RULES; i++) {
+        json_object *entry = json_object_array_get_idx(rules, i);
+        ai_os_policy_rule_t *rule = &cfg->policy[cfg->policy_count];
+        json_object *value;
+
+        memset(rule, 0, sizeof(*rule));
+        copy_string(entry, "command", rule->command, sizeof(rule->command));
+        copy_string(entry, "piped_from", rule->piped_from, sizeof(rule->piped_from));
+        copy_string(entry, "reason", rule->reason, sizeof(rule->reason));
+        copy_bool(entry, "privileged", &rule->privileged);
+        if (json_object_object_get_ex(entry, "flags", &value)) {
+            copy_strings(value, rule->flags[0], sizeof(rule->flags[0]), AI_OS_POLICY_MAX_FLAGS);
+        }
+        if (json_object_object_get_ex(entry, "redirects", &value)) {
+            rule->redirects = copy_strings(value, rule->args[0], sizeof(rule->args[0]), AI_OS_POLICY_MAX_ARGS) > 0;
+        } else if (json_object_object_get_ex(entry, "args", &value)) {
+            copy_strings(value, rule->args[0], sizeof(rule->args[0]), AI_OS_POLICY_MAX_ARGS);
+        }
+        rule->action = SAFETY_BLOCK;
+        if (json_object_object_get_ex(entry, "action", &value) &&
+            strcmp(json_object_get_string(value), "confirm") == 0) {
+            rule->action = SAFETY_CONFIRM;
+        }
+
+        if (!rule->command[0] && !rule->redirects) {
+            config_log(AI_OS_LOG_WARN, "Config: safety_policy rule %d has no command or redirects, ignored\n", i);
+            continue;
+        }
+        cfg->policy_count++;
+    }
+}
+
+/* "weight", "rate" and "burst" of OBJ over SHARE; bad values are skipped */
+static void copy_share(json_object *obj, int index, ai_os_user_setting_t *share) {
+    static const char *const keys[] = {"weight", "rate", "burst"};
+    double *fields[] = {&share->weight, &share->rate, &share->burst};
+    json_object *value;
+
+    for (int k = 0; k < 3; k++) {
+        if (!json_object_object_get_ex(obj, keys[k], &value)) continue;
+        double v = json_object_get_double(value);
+        if (v < 0 || (k == 0 && v == 0)) {
+            config_log(AI_OS_LOG_WARN, "Config: fair_queue entry %d has a bad %s, ignored\n", index, keys[k]);
+            continue;
+        }
+        *fields[k] = v;
+    }
+}
+
+/* A "user" value: a uid or a user name; -1 if there is no such user */
+static int lookup_uid(json_object *user, uid_t *uid) {
+    const char *name = json_object_get_string(user);
+    struct passwd pw, *found = NULL;
+    char buf[1024];
+
+    if (json_object_is_type(user, json_type_int)) {
+        *uid = (uid_t)json_object_get_int64(user);
+        return 0;
+    }
+    if (isdigit((unsigned char)name[0])) {
+        *uid = (uid_t)strtoul(name, NULL, 10);
+        return 0;
+    }
+    if (getpwnam_r(name, &pw, buf, sizeof(buf), &found) != 0 || !found) {
+        return -1;
+    }
+    *uid = found->pw_uid;
+    return 0;
+}
+
+/* "fair_queue": {"weight", "rate", "burst", "max_wait_ms", "max_concurrency",
+ * "users": [{"user": name or uid, "weight", "rate", "burst"}, ...]}; a
+ * listed user starts from the defaults around the list */
+static void parse_fair_queue(json_object *root, ai_os_settings_t *cfg) {
+    json_object *value, *users;
+
+    copy_share(root, -1, &cfg->user_default);
+    if (json_object_object_get_ex(root, "max_wait_ms", &value) && json_object_get_int(value) > 0) {
+        cfg->queue_timeout_ms = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(root, "max_concurrency", &value) && json_object_get_int(value) > 0) {
+        cfg->max_concurrency = json_object_get_int(value);
+    }
+    if (!json_object_object_get_ex(root, "users", &users) || !json_object_is_type(users, json_type_array)) {
+        return;
+    }
+
+    int count = json_object_array_length(users);
+    for (int i = 0; i < count && cfg->user_count < AI_OS_CONFIG_MAX_USERS; i++) {
+        json_object *entry = json_object_array_get_idx(users, i);
+        ai_os_user_setting_t *user = &cfg->users[cfg->user_count];
+
+        memcpy(user, &cfg->user_default, sizeof(*user));
+        if (!json_object_object_get_ex(entry, "user", &value) || lookup_uid(value, &user->uid) != 0) {
+            config_log(AI_OS_LOG_WARN, "Config: fair_queue user %d is missing or unknown, ignored\n", i);
+            continue;
+        }
+        copy_share(entry, i, user);
+        cfg->user_count++;
+    }
+}
+
+/* "deadlines": {"interpret", "chat", "execute"}: milliseconds a request
+ * without its own deadline is given, 0 for no limit */
+static void parse_deadlines(json_object *root, ai_os_settings_t *cfg) {
+    static const char *actions[] = { "interpret", "chat", "execute" };
+    int *fields[] = { &cfg->interpret_deadline_ms, &cfg->chat_deadline_ms, &cfg->execute_deadline_ms };
+    json_object *value;
+
+    for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+        if (!json_object_object_get_ex(root, actions[i], &value)) continue;
+        if (json_object_get_int(value) < 0) {
+            config_log(AI_OS_LOG_WARN, "Config: negative %s deadline, ignored\n", actions[i]);
+            continue;
+        }
+        *fields[i] = json_object_get_int(value);
+    }
+}
+
+static int parse_config(json_object *root, ai_os_settings_t *cfg) {
+    json_object *value;
+
+    copy_string(root, "model", cfg->model, sizeof(cfg->model));
+    copy_bool(root, "safety_mode", &cfg->safety_mode);
+    copy_bool(root, "confirmation_required", &cfg->confirmation_required);
+    copy_string(root, "metrics_socket", cfg->metrics_socket, sizeof(cfg->metrics_socket));
+    copy_string(root, "capture_file", cfg->capture_file, sizeof(cfg->capture_file));
+    copy_string(root, "replay_backend", cfg->replay_backend, sizeof(cfg->replay_backend));
+    if (json_object_object_get_ex(root, "replay_speed", &value)) {
+        cfg->replay_speed = json_object_get_double(value);
+    }
+    if (json_object_object_get_ex(root, "log_level", &value)) {
+        cfg->log_level = ai_os_log_level_from_name(json_object_get_string(value));
+        if (cfg->log_level < 0) {
+            config_log(AI_OS_LOG_WARN, "Config: unknown log_level '%s'\n", json_object_get_string(value));
+        }
+    }
+    copy_string(root, "distro_id", cfg->distro_id, sizeof(cfg->distro_id));
+    copy_string(root, "distro_version", cfg->distro_version, sizeof(cfg->distro_version));
+    copy_string(root, "distro_name", cfg->distro_name, sizeof(cfg->distro_name));
+    if (json_object_object_get_ex(root, "safety_policy", &value) && json_object_is_type(value, json_type_array)) {
+        parse_policy(value, cfg);
+    }
+    if (json_object_object_get_ex(root, "fair_queue", &value) && json_object_is_type(value, json_type_object)) {
+        parse_fair_queue(value, cfg);
+    }
+    if (json_object_object_get_ex(root, "deadlines", &value) && json_object_is_type(value, json_type_object)) {
+        parse_deadlines(value, cfg);
+    }
+
+    if (!cfg->model[0]) {
+        snprintf(cfg->model, sizeof(cfg->model), "%s", default_config.model);
+    }
+    return 0;
+}
+
+/* models.json: {"models": [{"name", "enabled", "priority"}, ...]} */
+static int parse_models(json_object *root, ai_os_settings_t *cfg) {
+    json_object *models;
+    if (!json_object_object_get_ex(root, "models", &models) || !json_object_is_type(models, json_type_array)) {
+        return 0;
+    }
+
+    int count = json_object_array_length(models);
+    for (int i = 0; i < count && cfg->model_count < AI_OS_CONFIG_MAX_MODELS; i++) {
+        json_object *entry = json_object_array_get_idx(models, i);
+        json_object *name, *enabled, *priority;
+        if (!json_object_object_get_ex(entry, "name", &name) ||
+            !json_object_object_get_ex(entry, "enabled", &enabled)) {
+            continue;
+        }
+        ai_os_model_setting_t *m = &cfg->models[cfg->model_count++];
+        snprintf(m->name, sizeof(m->name), "%s", json_object_get_string(name));
+        m->enabled = json_object_get_boolean(enabled);
+        m->priority = json_object_object_get_ex(entry, "priority", &priority) ? json_object_get_int(priority) : -1;
+    }
+    return 0;
+}
+
+/* Both files into CFG; -1 if either exists but cannot be used */
+static int load_files(ai_os_settings_t *cfg) {
+    int missing;
+    json_object *root;
+
+    memcpy(cfg, &default_config, sizeof(*cfg));
+
+    root = read_json_file(AI_OS_CONFIG_FILE, &missing);
+    if (root) {
+        parse_config(root, cfg);
+        json_object_put(root);
+    } else if (!missing) {
+        return -1;
+    }
+
+    root = read_json_file(AI_OS_MODELS_FILE, &missing);
+    if (root) {
+        parse_models(root, cfg);
+        json_object_put(root);
+    } else if (!missing) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Free the snapshots replaced more than CONFIG_GRACE_SEC ago; the list is
+ * newest first, so they are its tail. Called with the reload mutex held. */
+static void free_retired(long long now_ns) {
+    config_snapshot_t **link = &config_state.snapshots;
+    while (*link && (!(*link)->replaced_ns || now_ns - (*link)->replaced_ns < CONFIG_GRACE_SEC * 1000000000LL)) {
+        link = &(*link)->retired;
+    }
+    while (*link) {
+        config_snapshot_t *old = *link;
+        *link = old->retired;
+        free(old);
+    }
+}
+
+/* Read the files again and publish the result if it differs from the
+ * current snapshot. 1 if a new snapshot went in, 0 if nothing changed,
+ * -1 if a file was unusable (the current snapshot stays). */
+int config_reload(void) {
+    ai_os_settings_t next;
+
+    pthread_mutex_lock(&config_state.reload_mutex);
+    if (load_files(&next) != 0) {
+        pthread_mutex_unlock(&config_state.reload_mutex);
+        config_log(AI_OS_LOG_ERROR, "Config: reload failed, keeping generation %lu\n", config_state.generation);
+        return -1;
+    }
+
+    const ai_os_settings_t *prev = config_get();
+    next.generation = prev->generation;
+    if (prev->generation && memcmp(&next, prev, sizeof(next)) == 0) {
+        pthread_mutex_unlock(&config_state.reload_mutex);
+        return 0;
+    }
+
+    config_snapshot_t *snapshot = malloc(sizeof(*snapshot));
+    if (!snapshot) {
+        pthread_mutex_unlock(&config_state.reload_mutex);
+        return -1;
+    }
+    snapshot->config = next;
+    snapshot->config.generation = ++config_state.generation;
+    snapshot->replaced_ns = 0;
+    snapshot->retired = config_state.snapshots;
+    config_state.snapshots = snapshot;
+    __atomic_store_n(&config_state.current, &snapshot->config, __ATOMIC_RELEASE);
+    long long now_ns = metrics_now_ns();
+    if (snapshot->retired) {
+        snapshot->retired->replaced_ns = now_ns;
+    }
+    free_retired(now_ns);
+
+    for (int i = 0; i < config_state.hook_count; i++) {
+        config_state.hooks[i](prev, &snapshot->config);
+    }
+    pthread_mutex_unlock(&config_state.reload_mutex);
+
+    config_log(AI_OS_LOG_INFO, "Config: generation %lu loaded: model=%s, safety=%d, confirm=%d, "
+               "%d model settings, %d policy rules, %d fair queue users\n",
+               snapshot->config.generation, snapshot->config.model, snapshot->config.safety_mode,
+               snapshot->config.confirmation_required, snapshot->config.model_count, snapshot->config.policy_count,
+               snapshot->config.user_count);
+    return 1;
+}
+
+/* FN runs after every new snapshot, on the reloading thread; PREV is the
+ * built-in defaults (generation 0) until the files have loaded once */
+void config_on_reload(void (*fn)(const ai_os_settings_t *prev, const ai_os_settings_t *next)) {
+    pthread_mutex_lock(&config_state.reload_mutex);
+    if (config_state.hook_count < CONFIG_MAX_HOOKS) {
+        config_state.hooks[config_state.hook_count++] = fn;
+    }
+    pthread_mutex_unlock(&config_state.reload_mutex);
+}
+
+/* Async-signal-safe: for the SIGHUP handler */
+void config_request_reload(void) {
+    int saved_errno = errno;
+    if (config_state.wake_pipe[1] >= 0) {
+        ssize_t ignored = write(config_state.wake_pipe[1], "r", 1);
+        (void)ignored;
+    }
+    errno = saved_errno;
+}
+
+/* Is an inotify event about one of our files? */
+static int watched_event(const char *buf, ssize_t len) {
+    for (const char *p = buf; p < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *)p;
+        if (event->mask & IN_IGNORED) {
+            return -1;          /* the directory went away */
+        }
+        if (event->len && (strcmp(event->name, "config.json") == 0 || strcmp(event->name, "models.json") == 0)) {
+            return 1;
+        }
+        p += sizeof(*event) + event->len;
+    }
+    return 0;
+}
+
+static void *watcher_thread(void *arg) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    (void)arg;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = config_state.wake_pipe[0], .events = POLLIN },
+            { .fd = config_state.inotify_fd, .events = POLLIN },
+        };
+        if (poll(fds, config_state.inotify_fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        int reload = 0;
+        if (fds[0].revents & POLLIN) {
+            char cmd[16];
+            ssize_t n = read(config_state.wake_pipe[0], cmd, sizeof(cmd));
+            if (n > 0 && memchr(cmd, 'q', (size_t)n)) {
+                break;
+            }
+            reload = 1;
+        }
+        if (config_state.inotify_fd >= 0 && (fds[1].revents & POLLIN)) {
+            /* Let the writer finish, then take every event that piled up */
+            poll(NULL, 0, CONFIG_SETTLE_MS);
+            ssize_t n;
+            while ((n = read(config_state.inotify_fd, buf, sizeof(buf))) > 0) {
+                int watched = watched_event(buf, n);
+                if (watched < 0) {
+                    config_log(AI_OS_LOG_WARN, "Config: %s removed; reload with SIGHUP only\n", AI_OS_CONFIG_DIR);
+                    close(config_state.inotify_fd);
+                    config_state.inotify_fd = -1;
+                    break;
+                }
+                reload |= watched;
+            }
+        }
+        if (reload) {
+            config_reload();
+        }
+    }
+    return NULL;
+}
+
+/* First load, then watch for changes */
+int config_init(void) {
+    int result = config_reload();
+    if (result < 0) {
+        config_log(AI_OS_LOG_ERROR, "Config: using defaults\n");
+    }
+
+    if (pipe2(config_state.wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        config_log(AI_OS_LOG_WARN, "Config: no reload pipe: %s\n", strerror(errno));
+        config_state.wake_pipe[0] = config_state.wake_pipe[1] = -1;
+        return result < 0 ? -1 : 0;
+    }
+
+    config_state.inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (config_state.inotify_fd >= 0 &&
+        inotify_add_watch(config_state.inotify_fd, AI_OS_CONFIG_DIR,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+        config_log(AI_OS_LOG_INFO, "Config: not watching %s (%s); reload with SIGHUP\n",
+                   AI_OS_CONFIG_DIR, strerror(errno));
+        close(config_state.inotify_fd);
+        config_state.inotify_fd = -1;
+    }
+
+    if (pthread_create(&config_state.watcher, NULL, watcher_thread, NULL) != 0) {
+        config_log(AI_OS_LOG_WARN, "Config: no watcher thread; changes need a restart\n");
+    } else {
+        config_state.watching = 1;
+    }
+    return result < 0 ? -1 : 0;
+}
+
+void config_cleanup(void) {
+    if (config_state.watching) {
+        ssize_t ignored = write(config_state.wake_pipe[1], "q", 1);
+        (void)ignored;
+        pthread_join(config_state.watcher, NULL);
+        config_state.watching = 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (config_state.wake_pipe[i] >= 0) {
+            close(config_state.wake_pipe[i]);
+            config_state.wake_pipe[i] = -1;
+        }
+    }
+    if (config_state.inotify_fd >= 0) {
+        close(config_state.inotify_fd);
+        config_state.inotify_fd = -1;
+    }
+
+    /* No reader is left: every snapshot can go */
+    __atomic_store_n(&config_state.current, &default_config, __ATOMIC_RELEASE);
+    while (config_state.snapshots) {
+        config_snapshot_t *next = config_state.snapshots->retired;
+        free(config_state.snapshots);
+        config_state.snapshots = next;
+    }
+}
@@ -7,41 +7,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
-#include <sys/stat.h>
 #include <time.h>
-#include <json-c/json.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include "../ai_os_common.h"
+#include "../ai_os_log.h"
+#include "../ai_os_json.h"
 
 #define MAX_PATH_SIZE 1024
 #define MAX_HISTORY_ENTRIES 50
 #define CONTEXT_MANAGER_LOG_FILE "/var/log/ai-os/context_manager.log"
-#define CONTEXT_MANAGER_LOG_MAX_SIZE (1024 * 1024) // 1MB
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-static FILE *log_file = NULL;
-static void context_manager_rotate_log() {
-    struct stat st;
-    if (stat(CONTEXT_MANAGER_LOG_FILE, &st) == 0 && st.st_size > CONTEXT_MANAGER_LOG_MAX_SIZE) {
-        char rotated[512];
-        snprintf(rotated, sizeof(rotated), "%s.old", CONTEXT_MANAGER_LOG_FILE);
-        rename(CONTEXT_MANAGER_LOG_FILE, rotated);
-    }
-}
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK(CONTEXT_MANAGER_LOG_FILE, 0);
 static void context_manager_log(const char *fmt, ...) {
-    pthread_mutex_lock(&log_mutex);
-    context_manager_rotate_log();
-    if (!log_file) {
-        log_file = fopen(CONTEXT_MANAGER_LOG_FILE, "a");
-        if (!log_file) log_file = stderr;
-    }
     va_list args;
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
-    fflush(log_file);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
     va_end(args);
-    pthread_mutex_unlock(&log_mutex);
 }
 
 /* Get current working directory */
@@ -200,34 +182,45 @@ int ai_context_needs_refresh(ai_context_t *ctx) {
     return (now - ctx->last_update) > 5;
 }
 
-// Convert context to JSON string (caller must free)
+// Convert context to a JSON string in the request's arena (not freed by the caller)
 char *ai_context_to_json(const ai_context_t *ctx) {
     if (!ctx) return NULL;
-    json_object *obj = json_object_new_object();
-    json_object_object_add(obj, "current_directory", json_object_new_string(ctx->current_directory));
-    json_object_object_add(obj, "username", json_object_new_string(ctx->username));
-    json_object_object_add(obj, "shell", json_object_new_string(ctx->shell));
-    json_object_object_add(obj, "hostname", json_object_new_string(ctx->hostname));
-    json_object_object_add(obj, "git_branch", json_object_new_string(ctx->git_branch));
-    json_object_object_add(obj, "git_status", json_object_new_string(ctx->git_status));
-    json_object_object_add(obj, "file_listing", json_object_new_string(ctx->file_listing));
-    json_object_object_add(obj, "system_info", json_object_new_string(ctx->system_info));
-    json_object_object_add(obj, "process_id", json_object_new_int(ctx->process_id));
-    json_object_object_add(obj, "user_id", json_object_new_int(ctx->user_id));
-    json_object_object_add(obj, "last_update", json_object_new_int((int)ctx->last_update));
+    // Room for every byte escaped as \u00XX, plus the keys
+    size_t size = 6 * sizeof(*ctx) + 1024;
+    char *buf = arena_alloc(size);
+    if (!buf) return NULL;
+
+    ai_os_json_writer_t w;
+    ai_os_json_writer_init(&w, buf, size);
+    ai_os_json_begin_object(&w);
+    ai_os_json_field_string(&w, "current_directory", ctx->current_directory);
+    ai_os_json_field_string(&w, "username", ctx->username);
+    ai_os_json_field_string(&w, "shell", ctx->shell);
+    ai_os_json_field_string(&w, "hostname", ctx->hostname);
+    ai_os_json_field_string(&w, "git_branch", ctx->git_branch);
+    ai_os_json_field_string(&w, "git_status", ctx->git_status);
+    ai_os_json_field_string(&w, "file_listing", ctx->file_listing);
+    ai_os_json_field_string(&w, "system_info", ctx->system_info);
+    ai_os_json_field_int(&w, "process_id", ctx->process_id);
+    ai_os_json_field_int(&w, "user_id", ctx->user_id);
+    ai_os_json_field_int(&w, "last_update", (int)ctx->last_update);
     // Add recent commands as array
-    json_object *cmds = json_object_new_array();
+    ai_os_json_key(&w, "recent_commands");
+    ai_os_json_begin_array(&w);
     for (int i = 0; i < ctx->command_count; ++i) {
-        json_object_array_add(cmds, json_object_new_string(ctx->recent_commands[i]));
+        ai_os_json_string(&w, ctx->recent_commands[i]);
     }
-    json_object_object_add(obj, "recent_commands", cmds);
-    json_object_object_add(obj, "env_vars", json_object_new_string(ctx->env_vars));
-    json_object_object_add(obj, "running_processes", json_object_new_string(ctx->running_processes));
-    json_object_object_add(obj, "open_ports", json_object_new_string(ctx->open_ports));
-    json_object_object_add(obj, "disk_usage", json_object_new_string(ctx->disk_usage));
-    char *json_str = strdup(json_object_to_json_string(obj));
-    json_object_put(obj);
-    return json_str;
+    ai_os_json_end_array(&w);
+    ai_os_json_field_string(&w, "env_vars", ctx->env_vars);
+    ai_os_json_field_string(&w, "running_processes", ctx->running_processes);
+    ai_os_json_field_string(&w, "open_ports", ctx->open_ports);
+    ai_os_json_field_string(&w, "disk_usage", ctx->disk_usage);
+    ai_os_json_end_object(&w);
+
+    int len = ai_os_json_writer_finish(&w);
+    if (len < 0) return NULL;
+    // Hand the unused tail back to the arena
+    return arena_resize(buf, size, (size_t)len + 1);
 }
 
 // Free any dynamically allocated fields (none currently, stub for future)
@@ -237,8 +230,5 @@ void ai_context_free(ai_context_t *ctx) {
 }
 
 void context_manager_log_cleanup(void) {
-    pthread_mutex_lock(&log_mutex);
-    if (log_file && log_file != stderr) fclose(log_file);
-    log_file = NULL;
-    pthread_mutex_unlock(&log_mutex);
+    ai_os_log_flush();
 }
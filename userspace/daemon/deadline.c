@@ -0,0 +1,94 @@
+/*
+ * Request Deadlines for AI-OS
+ * File: userspace/daemon/deadline.c
+ *
+ * Every request is answered by an absolute deadline: the one its client
+ * sent ("deadline", wall-clock milliseconds, so time spent queued on the
+ * connection counts), or else the configured default for its action. It
+ * is kept per thread for the request being handled, and each blocking
+ * stage (the fair queue, the Ollama client mutex, the HTTP call and its
+ * retries, command execution) waits at most the budget that is left
+ * rather than a fixed timeout of its own. A stage that finds the budget
+ * gone gives up at once and notes itself as the reason, which the reply
+ * reports; threads with no deadline (speculation, the kernel bridge) keep
+ * each stage's own default.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "../ai_os_common.h"
+
+/* Farther than any stage waits; keeps the conversion to ns from overflowing */
+#define DEADLINE_MAX_MS (24LL * 3600 * 1000)
+
+static __thread long long request_deadline_ns;  /* CLOCK_MONOTONIC; 0 for none */
+static __thread int expired_stage;              /* enum metrics_stage, or -1 */
+
+/* The current request must be answered by DEADLINE_NS (metrics_now_ns()
+ * time), or has no deadline if 0 */
+void deadline_begin(long long deadline_ns) {
+    request_deadline_ns = deadline_ns;
+    expired_stage = -1;
+}
+
+void deadline_end(void) {
+    request_deadline_ns = 0;
+    expired_stage = -1;
+}
+
+/* A wall-clock deadline in milliseconds since the epoch, on the
+ * metrics_now_ns() clock; at most a day either side of now */
+long long deadline_from_epoch_ms(long long epoch_ms) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long now_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    long long left_ms = epoch_ms - now_ms;
+    if (left_ms > DEADLINE_MAX_MS) {
+        left_ms = DEADLINE_MAX_MS;
+    } else if (left_ms < -DEADLINE_MAX_MS) {
+        left_ms = -DEADLINE_MAX_MS;
+    }
+    return metrics_now_ns() + left_ms * 1000000LL;
+}
+
+/* What a stage that would wait DEFAULT_NS may wait: the budget left if
+ * that is shorter (<= 0 once it is gone) */
+long long deadline_budget_ns(long long default_ns) {
+    if (!request_deadline_ns) {
+        return default_ns;
+    }
+    long long left = request_deadline_ns - metrics_now_ns();
+    return left < default_ns ? left : default_ns;
+}
+
+/* STAGE (enum metrics_stage) gives up for lack of time; it is the reason
+ * reported unless an earlier stage already ran out */
+void deadline_exceeded(int stage) {
+    if (expired_stage < 0) {
+        expired_stage = stage;
+        metrics_observe_deadline(stage);
+    }
+}
+
+/* 1 if the deadline has passed, charged to STAGE */
+int deadline_check(int stage) {
+    if (!request_deadline_ns || metrics_now_ns() < request_deadline_ns) {
+        return 0;
+    }
+    deadline_exceeded(stage);
+    return 1;
+}
+
+/* The stage that ran out of budget, for the reply; NULL if none did */
+const char *deadline_expired_stage(void) {
+    return expired_stage < 0 ? NULL : metrics_stage_name(expired_stage);
+}
+
+/* A CLOCK_REALTIME timeout BUDGET_NS from now, for the timed waits */
+void deadline_timespec(struct timespec *ts, long long budget_ns) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    if (budget_ns < 0) budget_ns = 0;
+    long long nsec = ts->tv_nsec + budget_ns;
+    ts->tv_sec += (time_t)(nsec / 1000000000LL);
+    ts->tv_nsec = (long)(nsec % 1000000000LL);
+}
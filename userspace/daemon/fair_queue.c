@@ -0,0 +1,470 @@
+/*
+ * Fair Queueing for AI-OS
+ * File: userspace/daemon/fair_queue.c
+ *
+ * Admission to the inference backend, shared fairly between users. Every
+ * request that needs the model asks here first, under the UID its client
+ * connected with (SO_PEERCRED) and in one of three lanes: interactive
+ * (interpret, a shell is waiting), chat, and background (batch jobs and
+ * speculation). Lanes are served strictly in that order, so a shell never
+ * waits behind a queue of chats, and background work only ever gets
+ * capacity nobody else wants.
+ *
+ * Within a lane, whenever the backend has room the next request comes from
+ * the user who has used the least of it so far, by weight: weighted fair
+ * queueing over virtual time, where a request is charged the backend time
+ * it actually took divided by its user's weight. A long chat therefore
+ * costs its user as much as many short interprets, and one user's batch
+ * loop only ever takes its share. A user coming back from idle starts at
+ * the current virtual time, so idleness banks no credit.
+ *
+ * A request waiting in a higher lane preempts the lowest-priority request
+ * running: its ticket is marked, the generation is cancelled at the next
+ * transfer progress callback, and the request goes back to the head of its
+ * queue (fair_queue_requeue()) with the time it used charged. After
+ * FQ_MAX_REQUEUES a request is left to finish, so chats cannot starve
+ * under a steady stream of interprets.
+ *
+ * How many requests hold the backend at once is not fixed: the right
+ * number depends on the Ollama host and the model. Every generate call
+ * reports its latency per token (fair_queue_observe()); calls made alone
+ * set the no-load baseline, and the limit follows the gradient between
+ * the two. While recent latency stays within FQ_TOLERANCE of the baseline
+ * and the limit is all in use, it grows by one every limit-many calls;
+ * once latency inflates beyond that, it shrinks in proportion, down to
+ * one. It so settles near the knee where more concurrency stops buying
+ * throughput, never above "max_concurrency".
+ *
+ * Users can also be held to a token bucket (a request rate with a burst
+ * allowance); a request beyond it is refused at once with the time until
+ * the next token rather than queued. Weights, rates and the longest wait
+ * come from config.json's "fair_queue" and apply from the next request; a
+ * request with less of its deadline left waits only that long.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "../ai_os_common.h"
+
+#define FQ_MAX_FLOWS 64             /* users with recent or queued requests */
+#define FQ_INITIAL_COST_NS 1000000000LL /* charged up front until a user has history */
+#define FQ_MAX_REQUEUES 3           /* preemptions before a request runs to the end */
+#define FQ_TOLERANCE 1.5            /* latency over the baseline taken for noise */
+#define FQ_SMOOTHING 0.2            /* share of the gradient one sample applies */
+#define FQ_LATENCY_WEIGHT 0.3       /* of a sample in the recent latency */
+#define FQ_BASELINE_DRIFT 0.05      /* how fast the baseline follows slower solo calls */
+
+typedef struct fq_waiter {
+    struct fq_waiter *next;
+    fair_queue_ticket_t *ticket;
+    int granted;
+} fq_waiter_t;
+
+typedef struct {
+    uid_t uid;
+    int used;
+    double vtime;                   /* weighted backend nanoseconds so far */
+    double cost_ns;                 /* moving average of this user's requests */
+    double tokens;
+    long long refilled_ns;
+    long long last_active_ns;
+    fq_waiter_t *head[FAIR_QUEUE_LANES];
+    fq_waiter_t *tail[FAIR_QUEUE_LANES];
+    int waiting;
+    int running;
+} fq_flow_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t granted_cond;
+    fq_flow_t flows[FQ_MAX_FLOWS];
+    fair_queue_ticket_t *holders;   /* requests holding the backend */
+    int running;
+    int capacity;                   /* the limit, whole */
+    int waiting;
+    int lane_waiting[FAIR_QUEUE_LANES];
+    double vclock;                  /* virtual time of the latest start */
+    double limit;
+    double baseline_ns;             /* per token, alone on the backend */
+    double latency_ns;              /* per token, moving average */
+    double gradient;
+} fq = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .granted_cond = PTHREAD_COND_INITIALIZER,
+    .capacity = 1,
+    .limit = 1,
+    .gradient = 1,
+};
+
+static const ai_os_user_setting_t *user_setting(const ai_os_settings_t *config, uid_t uid) {
+    for (int i = 0; i < config->user_count; i++) {
+        if (config->users[i].uid == uid) {
+            return &config->users[i];
+        }
+    }
+    return &config->user_default;
+}
+
+/* UID's flow, taking over the longest idle one if the table is full;
+ * NULL only if every flow has requests queued or running */
+static fq_flow_t *find_flow(uid_t uid, long long now_ns) {
+    fq_flow_t *spare = NULL;
+
+    for (int i = 0; i < FQ_MAX_FLOWS; i++) {
+        fq_flow_t *flow = &fq.flows[i];
+        if (!flow->used) {
+            if (!spare || spare->used) spare = flow;
+        } else if (flow->uid == uid) {
+            return flow;
+        } else if (!flow->waiting && !flow->running &&
+                   (!spare || (spare->used && flow->last_active_ns < spare->last_active_ns))) {
+            spare = flow;
+        }
+    }
+    if (spare) {
+        memset(spare, 0, sizeof(*spare));
+        spare->used = 1;
+        spare->uid = uid;
+        spare->cost_ns = FQ_INITIAL_COST_NS;
+        spare->tokens = -1;         /* filled on first use */
+        spare->refilled_ns = now_ns;
+    }
+    return spare;
+}
+
+/* Take a token from FLOW's bucket; otherwise 0 with *RETRY_MS set */
+static int take_token(fq_flow_t *flow, const ai_os_user_setting_t *share, long long now_ns, long *retry_ms) {
+    if (share->rate <= 0) {
+        return 1;
+    }
+    double capacity = share->burst > 0 ? share->burst : share->rate < 1 ? 1 : share->rate;
+    if (flow->tokens < 0) {
+        flow->tokens = capacity;
+    } else {
+        flow->tokens += (double)(now_ns - flow->refilled_ns) / 1e9 * share->rate;
+        if (flow->tokens > capacity) flow->tokens = capacity;
+    }
+    flow->refilled_ns = now_ns;
+
+    if (flow->tokens < 1) {
+        *retry_ms = (long)((1 - flow->tokens) / share->rate * 1000) + 1;
+        return 0;
+    }
+    flow->tokens -= 1;
+    return 1;
+}
+
+/* Give TICKET's request the backend: charge its expected cost up front so
+ * that, with room for more than one, the same user is not picked again for
+ * free; the release settles the difference */
+static void start(fq_flow_t *flow, fair_queue_ticket_t *ticket) {
+    if (flow->vtime < fq.vclock) {
+        flow->vtime = fq.vclock;    /* back from idle: no banked credit */
+    }
+    fq.vclock = flow->vtime;
+    ticket->charged = flow->cost_ns / ticket->weight;
+    ticket->start_ns = metrics_now_ns();
+    __atomic_store_n(&ticket->preempted, 0, __ATOMIC_RELAXED);
+    flow->vtime += ticket->charged;
+    flow->running++;
+    fq.running++;
+    ticket->next = fq.holders;
+    fq.holders = ticket;
+}
+
+/* Take TICKET off the holders and settle what its request really used */
+static void stop(fq_flow_t *flow, fair_queue_ticket_t *ticket, long long elapsed_ns) {
+    fair_queue_ticket_t **link = &fq.holders;
+    while (*link && *link != ticket) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = ticket->next;
+    }
+    flow->vtime += (double)elapsed_ns / ticket->weight - ticket->charged;
+    flow->last_active_ns = metrics_now_ns();
+    flow->running--;
+    fq.running--;
+}
+
+/* Highest-priority lane with requests waiting, or -1 */
+static int waiting_lane(void) {
+    for (int lane = 0; lane < FAIR_QUEUE_LANES; lane++) {
+        if (fq.lane_waiting[lane]) return lane;
+    }
+    return -1;
+}
+
+/* With the backend full and LANE waiting, ask the lowest-priority holder
+ * below it to make room, unless one is already on its way out */
+static void preempt_for(int lane) {
+    fair_queue_ticket_t *victim = NULL;
+
+    for (fair_queue_ticket_t *t = fq.holders; t; t = t->next) {
+        if (t->lane <= lane) continue;
+        if (__atomic_load_n(&t->preempted, __ATOMIC_RELAXED)) {
+            return;
+        }
+        if (t->requeues < FQ_MAX_REQUEUES && (!victim || t->lane > victim->lane)) {
+            victim = t;
+        }
+    }
+    if (victim) {
+        __atomic_store_n(&victim->preempted, 1, __ATOMIC_RELAXED);
+        metrics_observe_preemption(victim->lane);
+    }
+}
+
+/* Hand free capacity to the heads of the least-served queues of the
+ * highest lane waiting; with none free, make room for that lane */
+static void dispatch(void) {
+    int woke = 0;
+    int lane;
+    while ((lane = waiting_lane()) >= 0 && fq.running < fq.capacity) {
+        fq_flow_t *next = NULL;
+        for (int i = 0; i < FQ_MAX_FLOWS; i++) {
+            fq_flow_t *flow = &fq.flows[i];
+            if (flow->head[lane] && (!next || flow->vtime < next->vtime)) {
+                next = flow;
+            }
+        }
+        fq_waiter_t *waiter = next->head[lane];
+        next->head[lane] = waiter->next;
+        if (!next->head[lane]) next->tail[lane] = NULL;
+        next->waiting--;
+        fq.waiting--;
+        fq.lane_waiting[lane]--;
+        start(next, waiter->ticket);
+        waiter->granted = 1;
+        woke = 1;
+    }
+    if (woke) {
+        pthread_cond_broadcast(&fq.granted_cond);
+    }
+    if (lane >= 0) {
+        preempt_for(lane);
+    }
+}
+
+static void unlink_waiter(fq_flow_t *flow, int lane, fq_waiter_t *waiter) {
+    fq_waiter_t **link = &flow->head[lane];
+    fq_waiter_t *prev = NULL;
+    while (*link && *link != waiter) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = waiter->next;
+        if (flow->tail[lane] == waiter) flow->tail[lane] = prev;
+        flow->waiting--;
+        fq.waiting--;
+        fq.lane_waiting[lane]--;
+    }
+}
+
+/* Queue TICKET's request on FLOW (at the head if it was preempted) and
+ * wait for dispatch() to start it, at most the longest wait or what is
+ * left of the request's deadline; called and returns with the mutex held */
+static int wait_turn(fq_flow_t *flow, fair_queue_ticket_t *ticket, int at_head, int timeout_ms) {
+    fq_waiter_t waiter = { NULL, ticket, 0 };
+    int lane = ticket->lane;
+    long long budget_ns = deadline_budget_ns((long long)timeout_ms * 1000000LL);
+
+    if (budget_ns <= 0) {
+        return FAIR_QUEUE_TIMEOUT;
+    }
+
+    if (at_head) {
+        waiter.next = flow->head[lane];
+        flow->head[lane] = &waiter;
+        if (!flow->tail[lane]) flow->tail[lane] = &waiter;
+    } else {
+        if (flow->tail[lane]) {
+            flow->tail[lane]->next = &waiter;
+        } else {
+            flow->head[lane] = &waiter;
+        }
+        flow->tail[lane] = &waiter;
+    }
+    flow->waiting++;
+    fq.waiting++;
+    fq.lane_waiting[lane]++;
+    dispatch();
+
+    struct timespec deadline;
+    deadline_timespec(&deadline, budget_ns);
+    while (!waiter.granted) {
+        if (pthread_cond_timedwait(&fq.granted_cond, &fq.mutex, &deadline) == ETIMEDOUT && !waiter.granted) {
+            unlink_waiter(flow, lane, &waiter);
+            return FAIR_QUEUE_TIMEOUT;
+        }
+    }
+    return FAIR_QUEUE_GRANTED;
+}
+
+/*
+ * Wait for UID's turn at the backend in LANE. FAIR_QUEUE_GRANTED with
+ * TICKET filled in, to be handed back to fair_queue_release() when done
+ * (TICKET must stay put until then); FAIR_QUEUE_RATE_LIMITED with
+ * *RETRY_MS set if the user is over their rate; FAIR_QUEUE_TIMEOUT after
+ * the configured longest wait.
+ */
+int fair_queue_acquire(uid_t uid, int lane, fair_queue_ticket_t *ticket, long *retry_ms) {
+    const ai_os_settings_t *config = config_get();
+    const ai_os_user_setting_t *share = user_setting(config, uid);
+    long long now_ns = metrics_now_ns();
+    int result = FAIR_QUEUE_GRANTED;
+
+    memset(ticket, 0, sizeof(*ticket));
+    ticket->lane = lane;
+    ticket->weight = share->weight;
+    *retry_ms = 0;
+
+    pthread_mutex_lock(&fq.mutex);
+    fq_flow_t *flow = find_flow(uid, now_ns);
+    if (!flow) {
+        /* As many users as flows, all of them busy */
+        pthread_mutex_unlock(&fq.mutex);
+        return FAIR_QUEUE_TIMEOUT;
+    }
+    flow->last_active_ns = now_ns;
+    if (!take_token(flow, share, now_ns, retry_ms)) {
+        pthread_mutex_unlock(&fq.mutex);
+        return FAIR_QUEUE_RATE_LIMITED;
+    }
+    ticket->flow = (int)(flow - fq.flows);
+
+    if (fq.running < fq.capacity && !fq.waiting) {
+        start(flow, ticket);
+    } else {
+        if (!flow->waiting && !flow->running && flow->vtime < fq.vclock) {
+            flow->vtime = fq.vclock;
+        }
+        result = wait_turn(flow, ticket, 0, config->queue_timeout_ms);
+    }
+    pthread_mutex_unlock(&fq.mutex);
+    return result;
+}
+
+/* The backend for UID in LANE only if it is idle right now; never waits
+ * (speculation, which retries on its own). With CHARGE set the grant takes
+ * one of the user's tokens, FAIR_QUEUE_RATE_LIMITED if none is left */
+int fair_queue_try_acquire(uid_t uid, int lane, int charge, fair_queue_ticket_t *ticket) {
+    const ai_os_user_setting_t *share = user_setting(config_get(), uid);
+    long long now_ns = metrics_now_ns();
+    long retry_ms;
+    int result = FAIR_QUEUE_TIMEOUT;
+
+    memset(ticket, 0, sizeof(*ticket));
+    ticket->lane = lane;
+    ticket->weight = share->weight;
+
+    pthread_mutex_lock(&fq.mutex);
+    if (fq.running < fq.capacity && !fq.waiting) {
+        fq_flow_t *flow = find_flow(uid, now_ns);
+        if (flow && charge && !take_token(flow, share, now_ns, &retry_ms)) {
+            result = FAIR_QUEUE_RATE_LIMITED;
+        } else if (flow) {
+            flow->last_active_ns = now_ns;
+            ticket->flow = (int)(flow - fq.flows);
+            start(flow, ticket);
+            result = FAIR_QUEUE_GRANTED;
+        }
+    }
+    pthread_mutex_unlock(&fq.mutex);
+    return result;
+}
+
+/* The request behind TICKET gave way to a higher lane: charge what it used
+ * and wait at the head of its queue for another turn */
+int fair_queue_requeue(fair_queue_ticket_t *ticket) {
+    long long elapsed_ns = metrics_now_ns() - ticket->start_ns;
+    int timeout_ms = config_get()->queue_timeout_ms;
+
+    pthread_mutex_lock(&fq.mutex);
+    fq_flow_t *flow = &fq.flows[ticket->flow];
+    stop(flow, ticket, elapsed_ns);
+    ticket->requeues++;
+    int result = wait_turn(flow, ticket, 1, timeout_ms);
+    pthread_mutex_unlock(&fq.mutex);
+    return result;
+}
+
+/* Cancel check for the generation behind TICKET (a fair_queue_ticket_t) */
+int fair_queue_preempted(void *ticket) {
+    return __atomic_load_n(&((fair_queue_ticket_t *)ticket)->preempted, __ATOMIC_RELAXED);
+}
+
+/* The request behind TICKET is done with the backend: its user is charged
+ * what it really took and the next request is let in */
+void fair_queue_release(fair_queue_ticket_t *ticket) {
+    long long elapsed_ns = metrics_now_ns() - ticket->start_ns;
+
+    pthread_mutex_lock(&fq.mutex);
+    fq_flow_t *flow = &fq.flows[ticket->flow];
+    stop(flow, ticket, elapsed_ns);
+    flow->cost_ns = flow->cost_ns * 0.75 + (double)elapsed_ns * 0.25;
+    dispatch();
+    pthread_mutex_unlock(&fq.mutex);
+}
+
+/*
+ * A generate call took ELAPSED_NS to generate TOKENS: move the concurrency
+ * limit by how its latency per generated token compares with the no-load
+ * baseline.
+ */
+void fair_queue_observe(long long elapsed_ns, long long tokens) {
+    double sample = (double)elapsed_ns / (double)(tokens > 0 ? tokens : 1);
+    int max = config_get()->max_concurrency;
+
+    pthread_mutex_lock(&fq.mutex);
+    if (fq.running <= 1) {
+        if (!fq.baseline_ns || sample < fq.baseline_ns) {
+            fq.baseline_ns = sample;
+        } else {
+            fq.baseline_ns += (sample - fq.baseline_ns) * FQ_BASELINE_DRIFT;
+        }
+    }
+    fq.latency_ns = fq.latency_ns ? fq.latency_ns + (sample - fq.latency_ns) * FQ_LATENCY_WEIGHT : sample;
+    if (fq.baseline_ns) {
+        fq.gradient = fq.baseline_ns * FQ_TOLERANCE / fq.latency_ns;
+        if (fq.gradient > 1) fq.gradient = 1;
+        if (fq.gradient < 0.5) fq.gradient = 0.5;
+    }
+
+    int capacity = fq.capacity;
+    if (fq.gradient < 1) {
+        fq.limit *= 1 - FQ_SMOOTHING * (1 - fq.gradient);
+    } else if (fq.running >= fq.capacity) {
+        fq.limit += 1 / fq.limit;   /* all in use without slowing down: probe further */
+    }
+    if (fq.limit > max) fq.limit = max;
+    if (fq.limit < 1) fq.limit = 1;
+    fq.capacity = (int)fq.limit;
+    if (fq.capacity > capacity) {
+        dispatch();
+    }
+    pthread_mutex_unlock(&fq.mutex);
+}
+
+/* The concurrency limit and what it was set from, for metrics */
+void fair_queue_limiter(fair_queue_limiter_t *stats) {
+    pthread_mutex_lock(&fq.mutex);
+    stats->limit = fq.limit;
+    stats->inflight = fq.running;
+    stats->baseline_ns = fq.baseline_ns;
+    stats->latency_ns = fq.latency_ns;
+    stats->gradient = fq.gradient;
+    pthread_mutex_unlock(&fq.mutex);
+}
+
+/* Requests waiting in LANE right now */
+int fair_queue_waiting(int lane) {
+    pthread_mutex_lock(&fq.mutex);
+    int waiting = fq.lane_waiting[lane];
+    pthread_mutex_unlock(&fq.mutex);
+    return waiting;
+}
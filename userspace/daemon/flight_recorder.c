@@ -0,0 +1,206 @@
+/*
+ * Flight Recorder for AI-OS
+ * File: userspace/daemon/flight_recorder.c
+ *
+ * Keeps the last AI_OS_FLIGHT_RECORDS requests in a shared-memory ring
+ * (layout in ai_os_flight.h) so a hang or crash can be examined after the
+ * fact with `ai-client debug flight-recorder`. A request's number (the
+ * daemon's, also carried by its probes) picks its slot, and from then on
+ * only its own thread writes that slot, bracketing each update with the
+ * slot's sequence counter; no lock is taken. Stage times arrive through
+ * metrics.c, like trace spans.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../ai_os_common.h"
+#include "../ai_os_flight.h"
+#include "../ai_os_log.h"
+
+_Static_assert(AI_OS_FLIGHT_STAGES == METRICS_STAGES, "flight record stages follow enum metrics_stage");
+
+static ai_os_flight_t *flight_map;
+
+/* Slot of the request this thread is serving */
+static __thread struct {
+    ai_os_flight_record_t *record;
+    unsigned long long request_no;
+    long long start_ns;
+} current;
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/flight_recorder.log", 0);
+static void flight_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+static void seq_begin(unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* The current request's record, unless the ring has lapped it */
+static ai_os_flight_record_t *owned_record(void) {
+    ai_os_flight_record_t *r = current.record;
+    if (!r || r->request_no != current.request_no) {
+        return NULL;
+    }
+    return r;
+}
+
+/* Request N has arrived on this thread */
+void flight_begin(unsigned long long n, const char *action, const char *model,
+                  pid_t client_pid, size_t request_bytes, const char *trace_id) {
+    struct timespec now;
+
+    current.record = NULL;
+    if (!flight_map) {
+        return;
+    }
+
+    unsigned long long last = __atomic_load_n(&flight_map->next_request, __ATOMIC_RELAXED);
+    while (last < n && !__atomic_compare_exchange_n(&flight_map->next_request, &last, n, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    ai_os_flight_record_t *r = &flight_map->records[n & (AI_OS_FLIGHT_RECORDS - 1)];
+    long long in_flight = metrics_in_flight();
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    current.start_ns = metrics_now_ns();
+
+    seq_begin(&r->seq);
+    r->state = AI_OS_FLIGHT_ACTIVE;
+    r->request_no = n;
+    r->start_unix_ns = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    r->updated_ns = current.start_ns;
+    r->total_ns = 0;
+    memset(r->stage_ns, 0, sizeof(r->stage_ns));
+    r->client_pid = client_pid;
+    r->queue_depth = in_flight > 1 ? (unsigned int)(in_flight - 1) : 0;
+    r->request_bytes = (unsigned int)request_bytes;
+    r->response_bytes = 0;
+    r->arena_bytes = 0;
+    r->heap_allocs = 0;
+    snprintf(r->action, sizeof(r->action), "%s", action ? action : "");
+    r->status[0] = '\0';
+    snprintf(r->model, sizeof(r->model), "%s", model ? model : "");
+    snprintf(r->trace_id, sizeof(r->trace_id), "%s", trace_id && trace_valid_id(trace_id) ? trace_id : "");
+    seq_end(&r->seq);
+
+    current.record = r;
+    current.request_no = n;
+}
+
+/* A stage of the current request took ELAPSED_NS; repeats add up */
+void flight_stage(enum metrics_stage stage, long long elapsed_ns) {
+    ai_os_flight_record_t *r = owned_record();
+    if (!r || (int)stage < 0 || stage >= METRICS_STAGES) {
+        return;
+    }
+    seq_begin(&r->seq);
+    r->stage_ns[stage] += elapsed_ns;
+    r->updated_ns = metrics_now_ns();
+    seq_end(&r->seq);
+}
+
+/* The current request has its reply */
+void flight_end(const char *status, size_t response_bytes, const struct arena_stats *memory) {
+    ai_os_flight_record_t *r = owned_record();
+    if (r) {
+        long long now = metrics_now_ns();
+        seq_begin(&r->seq);
+        r->state = AI_OS_FLIGHT_DONE;
+        r->total_ns = now - current.start_ns;
+        r->updated_ns = now;
+        r->response_bytes = (unsigned int)response_bytes;
+        if (memory) {
+            r->arena_bytes = memory->bytes > 0xffffffffULL ? 0xffffffffu : (unsigned int)memory->bytes;
+            r->heap_allocs = (unsigned int)memory->heap_allocs;
+        }
+        snprintf(r->status, sizeof(r->status), "%s", status ? status : "none");
+        seq_end(&r->seq);
+    }
+    current.record = NULL;
+}
+
+/* Map a fresh segment, keeping the last daemon's as AI_OS_FLIGHT_PREV_PATH
+ * so its final requests can still be dumped */
+int flight_init(void) {
+    char tmp_path[128];
+    struct timespec real;
+
+    if (access(AI_OS_FLIGHT_PATH, F_OK) == 0 && rename(AI_OS_FLIGHT_PATH, AI_OS_FLIGHT_PREV_PATH) != 0) {
+        flight_log("Flight recorder: cannot keep previous segment: %s\n", strerror(errno));
+    }
+
+    /* /dev/shm is world-writable: a fixed name could be planted as a
+     * symlink, so the segment is built under a fresh name mkostemp creates
+     * with O_EXCL. rename() replaces whatever sits at the final path
+     * without following it. */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", AI_OS_FLIGHT_PATH);
+    int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd < 0) {
+        flight_log("Flight recorder: cannot create %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    if (fchmod(fd, 0644) != 0 || ftruncate(fd, sizeof(ai_os_flight_t)) != 0) {
+        flight_log("Flight recorder: cannot size %s: %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    ai_os_flight_t *map = mmap(NULL, sizeof(ai_os_flight_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        flight_log("Flight recorder: mmap failed: %s\n", strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* ftruncate zero-filled the records */
+    clock_gettime(CLOCK_REALTIME, &real);
+    map->magic = AI_OS_FLIGHT_MAGIC;
+    map->version = AI_OS_FLIGHT_VERSION;
+    map->record_count = AI_OS_FLIGHT_RECORDS;
+    map->record_size = sizeof(ai_os_flight_record_t);
+    map->daemon_pid = getpid();
+    map->monotonic_base_ns = metrics_now_ns();
+    map->started_unix_ns = (long long)real.tv_sec * 1000000000LL + real.tv_nsec;
+
+    if (rename(tmp_path, AI_OS_FLIGHT_PATH) != 0) {
+        flight_log("Flight recorder: cannot publish %s: %s\n", AI_OS_FLIGHT_PATH, strerror(errno));
+        munmap(map, sizeof(ai_os_flight_t));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    flight_map = map;
+    flight_log("Flight recorder: recording to %s (%zu bytes)\n", AI_OS_FLIGHT_PATH, sizeof(ai_os_flight_t));
+    return 0;
+}
+
+/* Stop recording new requests. The segment stays for postmortems and
+ * stays mapped: a request thread may still be finishing its record. */
+void flight_cleanup(void) {
+    ai_os_flight_t *map = flight_map;
+    flight_map = NULL;
+    if (map) {
+        msync(map, sizeof(ai_os_flight_t), MS_ASYNC);
+    }
+}
@@ -19,6 +19,7 @@
  #include <sys/stat.h>
  #include <stdarg.h>
  #include "../ai_os_common.h"
+ #include "../ai_os_log.h"
  
  /* IOCTL definitions for kernel communication */
  #define AI_OS_MAGIC 'A'
@@ -43,16 +44,11 @@
                                     char *shell_command, size_t command_size);
  
  /* Logging utility */
-static FILE *log_file = NULL;
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/kernel_bridge.log", 0);
 static void kernel_bridge_log(const char *fmt, ...) {
     va_list args;
-    if (!log_file) {
-        log_file = fopen("/var/log/ai-os/kernel_bridge.log", "a");
-        if (!log_file) log_file = stderr;
-    }
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
-    fflush(log_file);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
     va_end(args);
 }
  
@@ -70,7 +66,7 @@ static void kernel_bridge_log(const char *fmt, ...) {
  }
  
  /* Get status from kernel module */
- int kernel_bridge_get_status(struct ai_os_status *status) {
+ int kernel_bridge_get_status(ai_os_status_t *status) {
      if (bridge_state.kernel_fd < 0) {
          return -1;
      }
@@ -158,8 +154,8 @@ static void kernel_bridge_log(const char *fmt, ...) {
  }
  
  /* Process kernel interpretation request */
- static int process_kernel_request(const struct ai_os_request *request, 
-                                  struct ai_os_response *response) {
+ static int process_kernel_request(const ai_os_request_t *request, 
+                                  ai_os_response_t *response) {
      char interpreted_command[1024];
      int result;
      
@@ -175,6 +171,7 @@ static void kernel_bridge_log(const char *fmt, ...) {
      /* Use Ollama to interpret the command */
      result = ollama_interpret_command(request->command, request->context, 
                                      interpreted_command, sizeof(interpreted_command));
+     arena_reset(NULL);
      
      if (result == 0) {
          response->result_code = 0;
@@ -203,12 +200,11 @@ static void kernel_bridge_log(const char *fmt, ...) {
  
  /* Bridge thread function */
  static void *bridge_thread_func(void *arg) {
-     struct ai_os_request request;
-     struct ai_os_response response;
      fd_set readfds;
      struct timeval timeout;
      int result;
      
+     (void)arg;
      kernel_bridge_log("Kernel Bridge: Bridge thread started\n");
      
      while (bridge_state.running) {
@@ -300,9 +296,8 @@ static void kernel_bridge_log(const char *fmt, ...) {
          }
          bridge_state.kernel_fd = -1;
      }
-     if (log_file && log_file != stderr) fclose(log_file);
-     log_file = NULL;
      kernel_bridge_log("Kernel Bridge: Cleaned up\n");
+     ai_os_log_flush();
  }
  
  /* Get pending request count */
@@ -315,22 +310,10 @@ static void kernel_bridge_log(const char *fmt, ...) {
  }
  
  /* Advanced kernel communication using netlink sockets */
- #include <linux/netlink.h>
  #include <sys/socket.h>
  
- #define NETLINK_AI_OS 31
- #define AI_OS_MSG_INTERPRET 1
- #define AI_OS_MSG_RESPONSE 2
- 
- struct ai_netlink_msg {
-     struct nlmsghdr nlh;
-     int msg_type;
-     int request_id;
-     pid_t pid;
-     char data[1024];
- };
- 
  static int netlink_fd = -1;
+ static int netlink_attached = 0; /* fd supplied by caller (e.g. kernel emulator) */
  
  /* Initialize netlink communication */
  int kernel_bridge_init_netlink(void) {
@@ -381,7 +364,12 @@ static void kernel_bridge_log(const char *fmt, ...) {
      msg.msg_type = AI_OS_MSG_RESPONSE;
      msg.request_id = request_id;
      
-     if (interpreted_cmd) {
+     /* The kernel module marks requests failed by the data prefix */
+     if (result_code == -2) {
+         snprintf(msg.data, sizeof(msg.data), "UNSAFE: %s", interpreted_cmd ? interpreted_cmd : "");
+     } else if (result_code != 0) {
+         snprintf(msg.data, sizeof(msg.data), "ERROR: %s", interpreted_cmd ? interpreted_cmd : "");
+     } else if (interpreted_cmd) {
          strncpy(msg.data, interpreted_cmd, sizeof(msg.data) - 1);
      }
      
@@ -395,8 +383,9 @@ static void kernel_bridge_log(const char *fmt, ...) {
      iov.iov_base = &msg;
      iov.iov_len = msg.nlh.nlmsg_len;
      
-     msgh.msg_name = &dest_addr;
-     msgh.msg_namelen = sizeof(dest_addr);
+     /* Connected sockets (emulator socketpair) must not carry an address */
+     msgh.msg_name = netlink_attached ? NULL : &dest_addr;
+     msgh.msg_namelen = netlink_attached ? 0 : sizeof(dest_addr);
      msgh.msg_iov = &iov;
      msgh.msg_iovlen = 1;
      msgh.msg_control = NULL;
@@ -413,7 +402,7 @@ static void kernel_bridge_log(const char *fmt, ...) {
  }
  
  /* Receive request via netlink */
- int kernel_bridge_receive_netlink_request(struct ai_os_request *request) {
+ int kernel_bridge_receive_netlink_request(ai_os_request_t *request) {
      struct ai_netlink_msg msg;
      struct sockaddr_nl src_addr;
      struct iovec iov;
@@ -463,13 +452,14 @@ static void kernel_bridge_log(const char *fmt, ...) {
  
  /* Enhanced bridge thread with netlink support */
  static void *enhanced_bridge_thread_func(void *arg) {
-     struct ai_os_request request;
-     struct ai_os_response response;
+     ai_os_request_t request;
+     ai_os_response_t response;
      fd_set readfds;
      struct timeval timeout;
      int result;
      int max_fd;
      
+     (void)arg;
      kernel_bridge_log("Kernel Bridge: Enhanced bridge thread started\n");
      
      while (bridge_state.running) {
@@ -507,7 +497,9 @@ static void kernel_bridge_log(const char *fmt, ...) {
                  /* Process the request */
                  if (process_kernel_request(&request, &response) == 0) {
                      kernel_bridge_send_netlink_response(request.request_id, 
-                                                       response.interpreted_command, 
+                                                       response.result_code == 0 ?
+                                                       response.interpreted_command :
+                                                       response.error_message, 
                                                        response.result_code);
                  }
              }
@@ -553,6 +545,32 @@ static void kernel_bridge_log(const char *fmt, ...) {
      return 0;
  }
  
+ /* Start the bridge on an already connected message socket.
+  * The peer must speak the ai_netlink_msg protocol (SOCK_SEQPACKET socketpair
+  * from the kernel emulator); ownership of the fd passes to the bridge. */
+ int kernel_bridge_start_attached(int fd) {
+     if (fd < 0) {
+         kernel_bridge_log("Kernel Bridge: start_attached called with invalid fd\n");
+         return -1;
+     }
+     
+     netlink_fd = fd;
+     netlink_attached = 1;
+     bridge_state.running = 1;
+     
+     if (pthread_create(&bridge_state.bridge_thread, NULL, enhanced_bridge_thread_func, NULL) != 0) {
+         kernel_bridge_log("Kernel Bridge: Failed to create attached bridge thread: %s\n", 
+                 strerror(errno));
+         bridge_state.running = 0;
+         netlink_fd = -1;
+         netlink_attached = 0;
+         return -1;
+     }
+     
+     kernel_bridge_log("Kernel Bridge: Attached bridge started on fd %d\n", fd);
+     return 0;
+ }
+ 
  /* Cleanup enhanced bridge */
  void kernel_bridge_cleanup_enhanced(void) {
      kernel_bridge_cleanup();
@@ -562,6 +580,7 @@ static void kernel_bridge_log(const char *fmt, ...) {
              kernel_bridge_log("Kernel Bridge: Failed to close netlink fd: %s\n", strerror(errno));
          }
          netlink_fd = -1;
+         netlink_attached = 0;
      }
  }
 
@@ -29,20 +29,28 @@ typedef struct {
 static feedback_entry_t feedback_db[MAX_FEEDBACK_ENTRIES];
 static int feedback_count = 0;
 static pthread_mutex_t feedback_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char feedback_file[256] = FEEDBACK_FILE;
+
+/* Keep feedback in PATH instead of FEEDBACK_FILE; call before init */
+void learning_system_set_file(const char *path) {
+    pthread_mutex_lock(&feedback_mutex);
+    snprintf(feedback_file, sizeof(feedback_file), "%s", path);
+    pthread_mutex_unlock(&feedback_mutex);
+}
 
 /* Load feedback from file */
 void learning_system_load_feedback() {
     pthread_mutex_lock(&feedback_mutex);
     feedback_count = 0;
-    FILE *file = fopen(FEEDBACK_FILE, "r");
+    FILE *file = fopen(feedback_file, "r");
     if (!file) {
-        fprintf(stderr, "[AI-OS Learning] Could not open feedback file %s for reading\n", FEEDBACK_FILE);
+        fprintf(stderr, "[AI-OS Learning] Could not open feedback file %s for reading\n", feedback_file);
         pthread_mutex_unlock(&feedback_mutex);
         return;
     }
-    json_object *root = json_object_from_file(FEEDBACK_FILE);
+    json_object *root = json_object_from_file(feedback_file);
     if (!root) {
-        fprintf(stderr, "[AI-OS Learning] Failed to parse feedback JSON from %s\n", FEEDBACK_FILE);
+        fprintf(stderr, "[AI-OS Learning] Failed to parse feedback JSON from %s\n", feedback_file);
         fclose(file);
         pthread_mutex_unlock(&feedback_mutex);
         return;
@@ -76,7 +84,7 @@ void learning_system_load_feedback() {
 void learning_system_save_feedback() {
     pthread_mutex_lock(&feedback_mutex);
     // Ensure feedback directory exists
-    char *dir = strdup(FEEDBACK_FILE);
+    char *dir = strdup(feedback_file);
     char *slash = strrchr(dir, '/');
     if (slash) {
         *slash = '\0';
@@ -99,8 +107,8 @@ void learning_system_save_feedback() {
         json_object_object_add(entry, "timestamp", json_object_new_int64(fb->timestamp));
         json_object_array_add(root, entry);
     }
-    if (json_object_to_file(FEEDBACK_FILE, root) != 0) {
-        fprintf(stderr, "[AI-OS Learning] Failed to save feedback to %s\n", FEEDBACK_FILE);
+    if (json_object_to_file(feedback_file, root) != 0) {
+        fprintf(stderr, "[AI-OS Learning] Failed to save feedback to %s\n", feedback_file);
     }
     json_object_put(root);
     pthread_mutex_unlock(&feedback_mutex);
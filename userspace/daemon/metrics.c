@@ -0,0 +1,566 @@
+/*
+ * Metrics for AI-OS
+ * File: userspace/daemon/metrics.c
+ *
+ * Counters and fixed-bucket latency histograms for every request, broken
+ * down by action and reply status, for every Ollama call by model (with
+ * Ollama's own split into model load, prompt evaluation and generation), and for
+ * each stage a request passes through (context refresh, speculation,
+ * prompt building, waiting for the CURL handle, HTTP, reply parsing,
+ * command execution, reply serialisation), plus the scratch memory requests
+ * took from their arena and how much of it spilled to the heap, and whether
+ * interpret replies parsed as they came, needed repair or a second
+ * generation. Recording is a handful of relaxed atomic adds, so the hot
+ * paths never take a lock; only the first sighting of a new model name does.
+ *
+ * The data is rendered in the Prometheus text exposition format, returned
+ * by the `metrics` action and, when a metrics socket is configured, written
+ * to every connection on that Unix socket, e.g. for node_exporter's
+ * textfile collector:
+ *
+ *     socat - UNIX-CONNECT:/var/run/ai-os-metrics.sock > ai_os.prom
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+
+#define METRICS_MAX_MODELS 8
+#define METRICS_RENDER_SIZE (48 * 1024)
+
+/* Upper bounds in seconds; the last bucket is +Inf */
+static const double bucket_bounds[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+#define METRICS_BUCKETS ((int)(sizeof(bucket_bounds) / sizeof(bucket_bounds[0])) + 1)
+
+static const char *stage_names[METRICS_STAGES] = {
+    "context", "speculation", "queue", "prompt", "mutex_wait", "http", "parse", "execute", "serialize"
+};
+
+/* Last entry catches anything not listed */
+static const char *action_names[] = {
+    "interpret", "speculate", "execute", "status", "set_model", "get_context",
+    "classify", "chat", "metrics", "trace_export", "other"
+};
+#define METRICS_ACTIONS ((int)(sizeof(action_names) / sizeof(action_names[0])))
+
+static const char *status_names[] = {
+    "success", "error", "unsafe", "unclear", "queued", "duplicate", "rate_limited", "busy", "deadline_exceeded", "none", "other"
+};
+#define METRICS_STATUSES ((int)(sizeof(status_names) / sizeof(status_names[0])))
+
+static const char *backend_result_names[] = { "ok", "error", "cancelled" };
+#define METRICS_BACKEND_RESULTS 3
+
+/* By enum shell_output */
+static const char *output_names[SHELL_OUTPUTS] = { "valid", "repaired", "reasked", "rejected" };
+
+/* By enum fair_queue_result and enum fair_queue_lane */
+static const char *admission_names[FAIR_QUEUE_RESULTS] = { "granted", "rate_limited", "timeout" };
+static const char *lane_names[FAIR_QUEUE_LANES] = { "interactive", "chat", "background" };
+
+typedef struct {
+    unsigned long long buckets[METRICS_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum_ns;
+} metrics_hist_t;
+
+static struct {
+    metrics_hist_t stages[METRICS_STAGES];
+    metrics_hist_t requests[METRICS_ACTIONS];
+    unsigned long long request_counts[METRICS_ACTIONS][METRICS_STATUSES];
+    long long in_flight;
+    unsigned long long arena_allocs;
+    unsigned long long arena_bytes;
+    unsigned long long heap_allocs;
+    unsigned long long heap_bytes;
+    unsigned long long outputs[SHELL_OUTPUTS];
+    unsigned long long admissions[FAIR_QUEUE_LANES][FAIR_QUEUE_RESULTS];
+    unsigned long long preemptions[FAIR_QUEUE_LANES];
+    unsigned long long deadlines[METRICS_STAGES];
+
+    /* Slot METRICS_MAX_MODELS collects models beyond the table */
+    char model_names[METRICS_MAX_MODELS][64];
+    char model_labels[METRICS_MAX_MODELS][128];    /* escaped for the exposition */
+    int model_count;
+    metrics_hist_t backend[METRICS_MAX_MODELS + 1];
+    unsigned long long backend_counts[METRICS_MAX_MODELS + 1][METRICS_BACKEND_RESULTS];
+    metrics_hist_t load[METRICS_MAX_MODELS + 1];
+    unsigned long long prompt_tokens[METRICS_MAX_MODELS + 1];
+    unsigned long long prompt_eval_ns[METRICS_MAX_MODELS + 1];
+    unsigned long long eval_tokens[METRICS_MAX_MODELS + 1];
+    unsigned long long eval_ns[METRICS_MAX_MODELS + 1];
+    pthread_mutex_t model_mutex;
+
+    int listen_fd;
+    char socket_path[108];
+    pthread_t listener;
+    int listening;
+} metrics = {
+    .model_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .listen_fd = -1,
+};
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/metrics.log", 0);
+static void metrics_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+long long metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void hist_observe(metrics_hist_t *hist, long long elapsed_ns) {
+    if (elapsed_ns < 0) elapsed_ns = 0;
+    double seconds = (double)elapsed_ns / 1e9;
+    int b = 0;
+    while (b < METRICS_BUCKETS - 1 && seconds > bucket_bounds[b]) b++;
+
+    __atomic_fetch_add(&hist->buckets[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum_ns, (unsigned long long)elapsed_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+}
+
+static int name_index(const char *const *names, int count, const char *name) {
+    if (name) {
+        for (int i = 0; i < count - 1; i++) {
+            if (strcmp(names[i], name) == 0) return i;
+        }
+    }
+    return count - 1;
+}
+
+/* VALUE as a label value: backslash, double quote and newline escaped, as
+ * the text format requires (model names come from clients) */
+static void escape_label(char *out, size_t size, const char *value) {
+    size_t len = 0;
+    for (; *value && len + 2 < size; value++) {
+        char c = *value;
+        if (c == '\\' || c == '"' || c == '\n') {
+            out[len++] = '\\';
+            c = c == '\n' ? 'n' : c;
+        }
+        out[len++] = c;
+    }
+    out[len] = '\0';
+}
+
+/* Index of MODEL in the model table, adding it on first sight */
+static int model_index(const char *model) {
+    int count = __atomic_load_n(&metrics.model_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(metrics.model_names[i], model) == 0) return i;
+    }
+
+    pthread_mutex_lock(&metrics.model_mutex);
+    count = metrics.model_count;
+    int index = METRICS_MAX_MODELS;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(metrics.model_names[i], model) == 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index == METRICS_MAX_MODELS && count < METRICS_MAX_MODELS) {
+        snprintf(metrics.model_names[count], sizeof(metrics.model_names[count]), "%s", model);
+        escape_label(metrics.model_labels[count], sizeof(metrics.model_labels[count]), metrics.model_names[count]);
+        __atomic_store_n(&metrics.model_count, count + 1, __ATOMIC_RELEASE);
+        index = count;
+    }
+    pthread_mutex_unlock(&metrics.model_mutex);
+    return index;
+}
+
+void metrics_observe_stage(enum metrics_stage stage, long long elapsed_ns) {
+    if ((int)stage < 0 || stage >= METRICS_STAGES) return;
+    hist_observe(&metrics.stages[stage], elapsed_ns);
+    trace_stage(stage_names[stage], elapsed_ns);
+    flight_stage(stage, elapsed_ns);
+}
+
+/* One request served; STATUS is the reply's "status" field, or NULL */
+void metrics_observe_request(const char *action, const char *status, long long elapsed_ns) {
+    int a = name_index(action_names, METRICS_ACTIONS, action);
+    int s = name_index(status_names, METRICS_STATUSES, status ? status : "none");
+
+    hist_observe(&metrics.requests[a], elapsed_ns);
+    __atomic_fetch_add(&metrics.request_counts[a][s], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_request_started(void) {
+    __atomic_fetch_add(&metrics.in_flight, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_request_finished(void) {
+    __atomic_fetch_sub(&metrics.in_flight, 1, __ATOMIC_RELAXED);
+}
+
+long long metrics_in_flight(void) {
+    return __atomic_load_n(&metrics.in_flight, __ATOMIC_RELAXED);
+}
+
+/* One Ollama generate call; RESULT is 0 ok, -4 cancelled, else error */
+void metrics_observe_backend(const char *model, int result, long long elapsed_ns) {
+    int m = model_index(model ? model : "unknown");
+    int r = result == 0 ? 0 : result == -4 ? 2 : 1;
+
+    hist_observe(&metrics.backend[m], elapsed_ns);
+    __atomic_fetch_add(&metrics.backend_counts[m][r], 1, __ATOMIC_RELAXED);
+}
+
+/* Ollama's timings for one successful generate call with MODEL */
+void metrics_observe_ollama(const char *model, const struct ollama_timings *timings) {
+    int m = model_index(model ? model : "unknown");
+
+    hist_observe(&metrics.load[m], timings->load_ns);
+    __atomic_fetch_add(&metrics.prompt_tokens[m], (unsigned long long)timings->prompt_eval_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics.prompt_eval_ns[m], (unsigned long long)timings->prompt_eval_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics.eval_tokens[m], (unsigned long long)timings->eval_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics.eval_ns[m], (unsigned long long)timings->eval_ns, __ATOMIC_RELAXED);
+}
+
+/* The arena use of one request (arena_reset) */
+void metrics_observe_memory(const struct arena_stats *stats) {
+    __atomic_fetch_add(&metrics.arena_allocs, stats->allocs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics.arena_bytes, stats->bytes, __ATOMIC_RELAXED);
+    if (stats->heap_allocs) {
+        __atomic_fetch_add(&metrics.heap_allocs, stats->heap_allocs, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&metrics.heap_bytes, stats->heap_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/* What the syntax check made of one interpret reply (enum shell_output) */
+void metrics_observe_output(int outcome) {
+    if (outcome >= 0 && outcome < SHELL_OUTPUTS) {
+        __atomic_fetch_add(&metrics.outputs[outcome], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* What the fair queue said to one model request in LANE (enum
+ * fair_queue_result) */
+void metrics_observe_admission(int lane, int result) {
+    if (lane >= 0 && lane < FAIR_QUEUE_LANES && result >= 0 && result < FAIR_QUEUE_RESULTS) {
+        __atomic_fetch_add(&metrics.admissions[lane][result], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* A request in LANE was asked to give the backend up */
+void metrics_observe_preemption(int lane) {
+    if (lane >= 0 && lane < FAIR_QUEUE_LANES) {
+        __atomic_fetch_add(&metrics.preemptions[lane], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* A request ran out of time in STAGE (enum metrics_stage) */
+void metrics_observe_deadline(int stage) {
+    if (stage >= 0 && stage < METRICS_STAGES) {
+        __atomic_fetch_add(&metrics.deadlines[stage], 1, __ATOMIC_RELAXED);
+    }
+}
+
+const char *metrics_stage_name(int stage) {
+    return stage >= 0 && stage < METRICS_STAGES ? stage_names[stage] : "other";
+}
+
+/* Bounded appender for the renderer */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    int truncated;
+} metrics_out_t;
+
+static void out_printf(metrics_out_t *out, const char *fmt, ...) {
+    va_list args;
+    if (out->truncated) return;
+    va_start(args, fmt);
+    int n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= out->size - out->len) {
+        out->truncated = 1;
+        out->buf[out->len] = '\0';
+        return;
+    }
+    out->len += (size_t)n;
+}
+
+static void render_header(metrics_out_t *out, const char *name, const char *type, const char *help) {
+    out_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* LABELS is `key="value"` */
+static void render_hist(metrics_out_t *out, const char *name, const char *labels, const metrics_hist_t *hist) {
+    unsigned long long cumulative = 0;
+
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        cumulative += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+        if (b < METRICS_BUCKETS - 1) {
+            out_printf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels, bucket_bounds[b], cumulative);
+        } else {
+            out_printf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, cumulative);
+        }
+    }
+    out_printf(out, "%s_sum{%s} %.9f\n", name, labels,
+               (double)__atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED) / 1e9);
+    out_printf(out, "%s_count{%s} %llu\n", name, labels, cumulative);
+}
+
+static const char *model_label(int m) {
+    return m < METRICS_MAX_MODELS ? metrics.model_labels[m] : "other";
+}
+
+/* A per-model counter; SCALE turns nanoseconds into seconds */
+static void render_model_counter(metrics_out_t *out, int models, const char *name, const char *help,
+                                 const unsigned long long *values, double scale) {
+    render_header(out, name, "counter", help);
+    for (int m = 0; m <= METRICS_MAX_MODELS; m++) {
+        if (m >= models && m < METRICS_MAX_MODELS) continue;
+        unsigned long long n = __atomic_load_n(&values[m], __ATOMIC_RELAXED);
+        if (!n) continue;
+        if (scale != 1) {
+            out_printf(out, "%s{model=\"%s\"} %.9f\n", name, model_label(m), (double)n * scale);
+        } else {
+            out_printf(out, "%s{model=\"%s\"} %llu\n", name, model_label(m), n);
+        }
+    }
+}
+
+/* Render everything in the text exposition format. Returns the length,
+ * or -1 if SIZE was too small. */
+int metrics_render(char *buf, size_t size) {
+    metrics_out_t out = { buf, size, 0, 0 };
+    char labels[160];
+
+    if (!buf || size == 0) return -1;
+    buf[0] = '\0';
+
+    render_header(&out, "ai_os_requests_total", "counter", "Requests served, by action and reply status.");
+    for (int a = 0; a < METRICS_ACTIONS; a++) {
+        for (int s = 0; s < METRICS_STATUSES; s++) {
+            unsigned long long n = __atomic_load_n(&metrics.request_counts[a][s], __ATOMIC_RELAXED);
+            if (n) {
+                out_printf(&out, "ai_os_requests_total{action=\"%s\",status=\"%s\"} %llu\n",
+                           action_names[a], status_names[s], n);
+            }
+        }
+    }
+
+    render_header(&out, "ai_os_requests_in_flight", "gauge", "Requests being served right now.");
+    out_printf(&out, "ai_os_requests_in_flight %lld\n", __atomic_load_n(&metrics.in_flight, __ATOMIC_RELAXED));
+
+    render_header(&out, "ai_os_request_arena_allocations_total", "counter",
+                  "Scratch allocations requests made from their per-thread arena.");
+    out_printf(&out, "ai_os_request_arena_allocations_total %llu\n",
+               __atomic_load_n(&metrics.arena_allocs, __ATOMIC_RELAXED));
+    render_header(&out, "ai_os_request_arena_bytes_total", "counter", "Bytes requests took from their arena.");
+    out_printf(&out, "ai_os_request_arena_bytes_total %llu\n", __atomic_load_n(&metrics.arena_bytes, __ATOMIC_RELAXED));
+    render_header(&out, "ai_os_request_heap_allocations_total", "counter",
+                  "Arena allocations that did not fit the arena and went to malloc.");
+    out_printf(&out, "ai_os_request_heap_allocations_total %llu\n",
+               __atomic_load_n(&metrics.heap_allocs, __ATOMIC_RELAXED));
+    render_header(&out, "ai_os_request_heap_bytes_total", "counter", "Bytes of those heap allocations.");
+    out_printf(&out, "ai_os_request_heap_bytes_total %llu\n", __atomic_load_n(&metrics.heap_bytes, __ATOMIC_RELAXED));
+
+    render_header(&out, "ai_os_request_duration_seconds", "histogram", "Time to serve a request, by action.");
+    for (int a = 0; a < METRICS_ACTIONS; a++) {
+        if (__atomic_load_n(&metrics.requests[a].count, __ATOMIC_RELAXED) == 0) continue;
+        snprintf(labels, sizeof(labels), "action=\"%s\"", action_names[a]);
+        render_hist(&out, "ai_os_request_duration_seconds", labels, &metrics.requests[a]);
+    }
+
+    render_header(&out, "ai_os_stage_duration_seconds", "histogram", "Time spent in each stage of a request.");
+    for (int s = 0; s < METRICS_STAGES; s++) {
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stage_names[s]);
+        render_hist(&out, "ai_os_stage_duration_seconds", labels, &metrics.stages[s]);
+    }
+
+    render_header(&out, "ai_os_model_output_total", "counter",
+                  "Interpret replies by what the shell syntax check made of them.");
+    for (int o = 0; o < SHELL_OUTPUTS; o++) {
+        unsigned long long n = __atomic_load_n(&metrics.outputs[o], __ATOMIC_RELAXED);
+        if (n) {
+            out_printf(&out, "ai_os_model_output_total{outcome=\"%s\"} %llu\n", output_names[o], n);
+        }
+    }
+
+    render_header(&out, "ai_os_deadline_exceeded_total", "counter",
+                  "Requests that ran out of their deadline, by the stage they were in.");
+    for (int s = 0; s < METRICS_STAGES; s++) {
+        unsigned long long n = __atomic_load_n(&metrics.deadlines[s], __ATOMIC_RELAXED);
+        if (n) {
+            out_printf(&out, "ai_os_deadline_exceeded_total{stage=\"%s\"} %llu\n", stage_names[s], n);
+        }
+    }
+    render_header(&out, "ai_os_fair_queue_admissions_total", "counter",
+                  "Model requests by lane and what the per-user fair queue made of them.");
+    for (int l = 0; l < FAIR_QUEUE_LANES; l++) {
+        for (int r = 0; r < FAIR_QUEUE_RESULTS; r++) {
+            unsigned long long n = __atomic_load_n(&metrics.admissions[l][r], __ATOMIC_RELAXED);
+            if (n) {
+                out_printf(&out, "ai_os_fair_queue_admissions_total{lane=\"%s\",result=\"%s\"} %llu\n",
+                           lane_names[l], admission_names[r], n);
+            }
+        }
+    }
+    render_header(&out, "ai_os_fair_queue_preemptions_total", "counter",
+                  "Model requests asked to give way to a higher lane, by their lane.");
+    for (int l = 0; l < FAIR_QUEUE_LANES; l++) {
+        out_printf(&out, "ai_os_fair_queue_preemptions_total{lane=\"%s\"} %llu\n", lane_names[l],
+                   __atomic_load_n(&metrics.preemptions[l], __ATOMIC_RELAXED));
+    }
+    render_header(&out, "ai_os_fair_queue_waiting", "gauge", "Model requests waiting for their turn, by lane.");
+    for (int l = 0; l < FAIR_QUEUE_LANES; l++) {
+        out_printf(&out, "ai_os_fair_queue_waiting{lane=\"%s\"} %d\n", lane_names[l], fair_queue_waiting(l));
+    }
+
+    fair_queue_limiter_t limiter;
+    fair_queue_limiter(&limiter);
+    render_header(&out, "ai_os_concurrency_limit", "gauge", "Adaptive limit on concurrent generate calls.");
+    out_printf(&out, "ai_os_concurrency_limit %.3f\n", limiter.limit);
+    render_header(&out, "ai_os_concurrency_inflight", "gauge", "Generate calls holding the backend.");
+    out_printf(&out, "ai_os_concurrency_inflight %d\n", limiter.inflight);
+    render_header(&out, "ai_os_concurrency_baseline_seconds_per_token", "gauge",
+                  "No-load latency per generated token the limit is measured against.");
+    out_printf(&out, "ai_os_concurrency_baseline_seconds_per_token %.9f\n", limiter.baseline_ns / 1e9);
+    render_header(&out, "ai_os_concurrency_latency_seconds_per_token", "gauge",
+                  "Recent latency per generated token (moving average).");
+    out_printf(&out, "ai_os_concurrency_latency_seconds_per_token %.9f\n", limiter.latency_ns / 1e9);
+    render_header(&out, "ai_os_concurrency_gradient", "gauge",
+                  "Baseline allowance over recent latency; below 1 the limit shrinks.");
+    out_printf(&out, "ai_os_concurrency_gradient %.3f\n", limiter.gradient);
+
+    int models = __atomic_load_n(&metrics.model_count, __ATOMIC_ACQUIRE);
+    render_header(&out, "ai_os_backend_requests_total", "counter", "Ollama generate calls, by model and result.");
+    for (int m = 0; m <= METRICS_MAX_MODELS; m++) {
+        if (m >= models && m < METRICS_MAX_MODELS) continue;
+        for (int r = 0; r < METRICS_BACKEND_RESULTS; r++) {
+            unsigned long long n = __atomic_load_n(&metrics.backend_counts[m][r], __ATOMIC_RELAXED);
+            if (n) {
+                out_printf(&out, "ai_os_backend_requests_total{model=\"%s\",result=\"%s\"} %llu\n",
+                           model_label(m), backend_result_names[r], n);
+            }
+        }
+    }
+
+    render_header(&out, "ai_os_backend_duration_seconds", "histogram", "Ollama generate call time, by model.");
+    for (int m = 0; m <= METRICS_MAX_MODELS; m++) {
+        if (m >= models && m < METRICS_MAX_MODELS) continue;
+        if (__atomic_load_n(&metrics.backend[m].count, __ATOMIC_RELAXED) == 0) continue;
+        snprintf(labels, sizeof(labels), "model=\"%s\"", model_label(m));
+        render_hist(&out, "ai_os_backend_duration_seconds", labels, &metrics.backend[m]);
+    }
+
+    render_header(&out, "ai_os_backend_load_duration_seconds", "histogram",
+                  "Time Ollama spent loading the model for a call, by model.");
+    for (int m = 0; m <= METRICS_MAX_MODELS; m++) {
+        if (m >= models && m < METRICS_MAX_MODELS) continue;
+        if (__atomic_load_n(&metrics.load[m].count, __ATOMIC_RELAXED) == 0) continue;
+        snprintf(labels, sizeof(labels), "model=\"%s\"", model_label(m));
+        render_hist(&out, "ai_os_backend_load_duration_seconds", labels, &metrics.load[m]);
+    }
+    render_model_counter(&out, models, "ai_os_backend_prompt_tokens_total",
+                         "Prompt tokens Ollama evaluated, by model.", metrics.prompt_tokens, 1);
+    render_model_counter(&out, models, "ai_os_backend_prompt_eval_seconds_total",
+                         "Time Ollama spent evaluating prompts, by model.", metrics.prompt_eval_ns, 1e-9);
+    render_model_counter(&out, models, "ai_os_backend_eval_tokens_total",
+                         "Tokens Ollama generated, by model.", metrics.eval_tokens, 1);
+    render_model_counter(&out, models, "ai_os_backend_eval_seconds_total",
+                         "Time Ollama spent generating, by model.", metrics.eval_ns, 1e-9);
+
+    return out.truncated ? -1 : (int)out.len;
+}
+
+/* Each connection gets one rendering and is closed */
+static void *listener_thread(void *arg) {
+    char *text = malloc(METRICS_RENDER_SIZE);
+    (void)arg;
+
+    if (!text) return NULL;
+    while (__atomic_load_n(&metrics.listening, __ATOMIC_ACQUIRE)) {
+        int fd = accept(metrics.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int len = metrics_render(text, METRICS_RENDER_SIZE);
+        if (len > 0) {
+            send(fd, text, (size_t)len, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    free(text);
+    return NULL;
+}
+
+/* Start serving the exposition text on SOCKET_PATH; NULL or "" leaves
+ * the socket off and metrics available through the action only */
+int metrics_init(const char *socket_path) {
+    struct sockaddr_un addr;
+
+    if (!socket_path || !*socket_path) {
+        return 0;
+    }
+
+    metrics.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metrics.listen_fd < 0) {
+        metrics_log("Metrics: socket failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(metrics.socket_path, sizeof(metrics.socket_path), "%s", socket_path);
+    strncpy(addr.sun_path, metrics.socket_path, sizeof(addr.sun_path) - 1);
+    unlink(metrics.socket_path);
+
+    if (bind(metrics.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(metrics.listen_fd, 8) < 0) {
+        metrics_log("Metrics: cannot listen on %s: %s\n", metrics.socket_path, strerror(errno));
+        close(metrics.listen_fd);
+        metrics.listen_fd = -1;
+        return -1;
+    }
+    chmod(metrics.socket_path, 0666);
+
+    metrics.listening = 1;
+    if (pthread_create(&metrics.listener, NULL, listener_thread, NULL) != 0) {
+        metrics_log("Metrics: cannot start listener\n");
+        metrics.listening = 0;
+        close(metrics.listen_fd);
+        metrics.listen_fd = -1;
+        unlink(metrics.socket_path);
+        return -1;
+    }
+
+    metrics_log("Metrics: serving %s\n", metrics.socket_path);
+    return 0;
+}
+
+void metrics_cleanup(void) {
+    if (metrics.listen_fd < 0) {
+        return;
+    }
+    __atomic_store_n(&metrics.listening, 0, __ATOMIC_RELEASE);
+    shutdown(metrics.listen_fd, SHUT_RDWR);   /* wakes accept() */
+    pthread_join(metrics.listener, NULL);
+    close(metrics.listen_fd);
+    metrics.listen_fd = -1;
+    unlink(metrics.socket_path);
+}
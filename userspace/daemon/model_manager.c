@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <json-c/json.h>
@@ -17,23 +18,20 @@
 #include <curl/curl.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
 
 /* Logging utility */
-static FILE *log_file = NULL;
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/model_manager.log", 0);
 static void model_manager_log(const char *fmt, ...) {
     va_list args;
-    if (!log_file) {
-        log_file = fopen("/var/log/ai-os/model_manager.log", "a");
-        if (!log_file) log_file = stderr;
-    }
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
-    fflush(log_file);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
     va_end(args);
 }
 
 /* Model configuration structure */
-typedef struct {
+typedef struct ai_model_config {
     char name[64];
     char description[256];
     char api_url[256];
@@ -45,10 +43,19 @@ typedef struct {
     int success_count;
     int failure_count;
     double avg_response_time;
+    /* Ollama's own timings, summed over successful calls */
+    int timed_count;
+    double load_time;
+    long long prompt_tokens;
+    double prompt_eval_time;
+    long long eval_tokens;
+    double eval_time;
     int priority;
     int enabled;
 } ai_model_config_t;
 
+#define MAX_COMMAND_LEN 4096    /* as in ai_daemon.c */
+
 /* Task type definitions */
 #define TASK_TYPE_FILE_OPS     "file_ops"
 #define TASK_TYPE_PROCESS_OPS  "process_ops"
@@ -139,6 +146,9 @@ typedef struct {
 
 static model_manager_t g_model_manager = {0};
 
+int model_manager_load_config(void);
+static void model_manager_reload(const ai_os_settings_t *prev, const ai_os_settings_t *next);
+
 /* Task classification patterns */
 static const char *task_patterns[][2] = {
     /* File operations */
@@ -198,24 +208,26 @@ int model_manager_init(const char *config_file) {
     /* Set default model */
     g_model_manager.current_model = &model_registry[0];
     
-    /* Load configuration */
+    /* Settings come from the config snapshot (config.c), which also
+     * reloads them; config_file is where model_manager_save_config() writes */
     model_manager_load_config();
+    config_on_reload(model_manager_reload);
     
     model_manager_log("Model Manager: Initialized with %zu models\n", MAX_MODELS);
     return 0;
 }
 
 /* Classify task type based on command */
-static const char *classify_task_type(const char *command) {
+AI_OS_BENCH_VISIBLE const char *classify_task_type(const char *command) {
     if (!command) return TASK_TYPE_GENERAL;
     
-    char *lower_command = strdup(command);
-    if (!lower_command) return TASK_TYPE_GENERAL;
-    
-    /* Convert to lowercase */
-    for (int i = 0; lower_command[i]; i++) {
-        lower_command[i] = tolower(lower_command[i]);
+    /* Lowercase copy on the stack; patterns only need the first MAX_COMMAND_LEN bytes */
+    char lower_command[MAX_COMMAND_LEN];
+    size_t len = 0;
+    for (; command[len] && len < sizeof(lower_command) - 1; len++) {
+        lower_command[len] = tolower((unsigned char)command[len]);
     }
+    lower_command[len] = '\0';
     
     /* Count matches for each task type */
     int task_scores[8] = {0}; /* Assuming 8 task types */
@@ -252,38 +264,34 @@ static const char *classify_task_type(const char *command) {
         }
     }
     
-    free(lower_command);
     return task_types[best_task];
 }
 
-/* Check if model supports task type */
+/* Check if model supports task type: TASK_TYPE is one of the model's
+ * comma-separated task types, spaces around them ignored */
 static int model_supports_task(ai_model_config_t *model, const char *task_type) {
-    if (!model || !task_type) return 0;
+    if (!model || !task_type || !*task_type) return 0;
     
-    char *task_types = strdup(model->task_types);
-    if (!task_types) return 0;
-    
-    char *token = strtok(task_types, ",");
-    while (token) {
-        /* Remove leading/trailing spaces */
+    size_t want = strlen(task_type);
+    const char *token = model->task_types;
+    while (*token) {
+        /* Trim leading/trailing spaces without copying the list */
         while (*token == ' ') token++;
-        char *end = token + strlen(token) - 1;
-        while (end > token && *end == ' ') end--;
-        *(end + 1) = '\0';
+        const char *end = token + strcspn(token, ",");
+        const char *last = end;
+        while (last > token && last[-1] == ' ') last--;
         
-        if (strcmp(token, task_type) == 0) {
-            free(task_types);
+        if ((size_t)(last - token) == want && strncmp(token, task_type, want) == 0) {
             return 1;
         }
-        token = strtok(NULL, ",");
+        token = *end ? end + 1 : end;
     }
     
-    free(task_types);
     return 0;
 }
 
 /* Select best model for task */
-static ai_model_config_t *select_best_model(const char *task_type) {
+AI_OS_BENCH_VISIBLE ai_model_config_t *select_best_model(const char *task_type) {
     ai_model_config_t *best_model = NULL;
     float best_score = -1.0;
     
@@ -396,6 +404,37 @@ void model_manager_update_stats(const char *model_name, int success, double resp
     pthread_mutex_unlock(&g_model_manager.stats_mutex);
 }
 
+/* Add Ollama's timings for one successful call, separating model load
+ * time from prompt cost and generation speed */
+void model_manager_update_timings(const char *model_name, const struct ollama_timings *timings) {
+    pthread_mutex_lock(&g_model_manager.stats_mutex);
+    
+    for (size_t i = 0; i < MAX_MODELS; i++) {
+        if (strcmp(model_registry[i].name, model_name) == 0) {
+            ai_model_config_t *model = &model_registry[i];
+            model->timed_count++;
+            model->load_time += timings->load_ns / 1e9;
+            model->prompt_tokens += timings->prompt_eval_count;
+            model->prompt_eval_time += timings->prompt_eval_ns / 1e9;
+            model->eval_tokens += timings->eval_count;
+            model->eval_time += timings->eval_ns / 1e9;
+            break;
+        }
+    }
+    
+    pthread_mutex_unlock(&g_model_manager.stats_mutex);
+}
+
+/* Timing summary of MODEL for the stats JSON */
+static void add_timing_stats(json_object *obj, const ai_model_config_t *model) {
+    json_object_object_add(obj, "avg_load_time", json_object_new_double(
+        model->timed_count > 0 ? model->load_time / model->timed_count : 0.0));
+    json_object_object_add(obj, "prompt_tokens_per_second", json_object_new_double(
+        model->prompt_eval_time > 0 ? model->prompt_tokens / model->prompt_eval_time : 0.0));
+    json_object_object_add(obj, "eval_tokens_per_second", json_object_new_double(
+        model->eval_time > 0 ? model->eval_tokens / model->eval_time : 0.0));
+}
+
 /* List available models */
 int model_manager_list_models(char *output, size_t output_size) {
     json_object *root = json_object_new_array();
@@ -413,6 +452,7 @@ int model_manager_list_models(char *output, size_t output_size) {
         json_object_object_add(model_obj, "avg_response_time", json_object_new_double(model->avg_response_time));
         json_object_object_add(model_obj, "priority", json_object_new_int(model->priority));
         json_object_object_add(model_obj, "task_types", json_object_new_string(model->task_types));
+        add_timing_stats(model_obj, model);
         
         json_object_array_add(root, model_obj);
     }
@@ -462,53 +502,35 @@ void model_manager_set_learning(int enabled) {
 
 /* Load configuration from file */
 int model_manager_load_config(void) {
-    FILE *file = fopen(g_model_manager.config_file, "r");
-    if (!file) {
-        model_manager_log("Model Manager: No config file found, using defaults\n");
-        return 0;
-    }
-    
-    json_object *root = json_object_from_file(g_model_manager.config_file);
-    if (!root) {
-        fclose(file);
-        model_manager_log("Model Manager: Failed to parse config file\n");
-        return -1;
-    }
+    const ai_os_settings_t *config = config_get();
     
-    /* Parse configuration */
-    json_object *models_array;
-    if (json_object_object_get_ex(root, "models", &models_array)) {
-        int array_len = json_object_array_length(models_array);
+    pthread_mutex_lock(&g_model_manager.model_mutex);
+    for (int i = 0; i < config->model_count; i++) {
+        const ai_os_model_setting_t *setting = &config->models[i];
         
-        for (int i = 0; i < array_len && i < MAX_MODELS; i++) {
-            json_object *model_obj = json_object_array_get_idx(models_array, i);
-            
-            json_object *name_obj, *enabled_obj, *priority_obj;
-            if (json_object_object_get_ex(model_obj, "name", &name_obj) &&
-                json_object_object_get_ex(model_obj, "enabled", &enabled_obj)) {
-                
-                const char *name = json_object_get_string(name_obj);
-                
-                /* Find matching model in registry */
-                for (size_t j = 0; j < MAX_MODELS; j++) {
-                    if (strcmp(model_registry[j].name, name) == 0) {
-                        model_registry[j].enabled = json_object_get_boolean(enabled_obj);
-                        
-                        if (json_object_object_get_ex(model_obj, "priority", &priority_obj)) {
-                            model_registry[j].priority = json_object_get_int(priority_obj);
-                        }
-                        break;
-                    }
+        /* Find matching model in registry */
+        for (size_t j = 0; j < MAX_MODELS; j++) {
+            if (strcmp(model_registry[j].name, setting->name) == 0) {
+                model_registry[j].enabled = setting->enabled;
+                if (setting->priority >= 0) {
+                    model_registry[j].priority = setting->priority;
                 }
+                break;
             }
         }
     }
-    
-    json_object_put(root);
-    fclose(file);
+    pthread_mutex_unlock(&g_model_manager.model_mutex);
     return 0;
 }
 
+/* models.json changed: the registry follows the new snapshot */
+static void model_manager_reload(const ai_os_settings_t *prev, const ai_os_settings_t *next) {
+    (void)prev;
+    (void)next;
+    model_manager_load_config();
+    model_manager_log("Model Manager: Model settings reloaded\n");
+}
+
 /* Save configuration to file */
 int model_manager_save_config(void) {
     json_object *root = json_object_new_object();
@@ -596,6 +618,7 @@ int model_manager_get_stats(char *stats_json, size_t stats_size) {
             (model_registry[i].success_count + model_registry[i].failure_count) > 0 ?
             (double)model_registry[i].success_count / (model_registry[i].success_count + model_registry[i].failure_count) : 0.0
         ));
+        add_timing_stats(summary, &model_registry[i]);
         
         json_object_array_add(models_summary, summary);
     }
@@ -614,7 +637,6 @@ void model_manager_cleanup(void) {
     model_manager_save_config();
     pthread_mutex_destroy(&g_model_manager.model_mutex);
     pthread_mutex_destroy(&g_model_manager.stats_mutex);
-    if (log_file && log_file != stderr) fclose(log_file);
-    log_file = NULL;
     model_manager_log("Model Manager: Cleaned up\n");
+    ai_os_log_flush();
 } 
\ No newline at end of file
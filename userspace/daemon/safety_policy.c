@@ -0,0 +1,1203 @@
+/*
+ * Safety Policy for AI-OS
+ * File: userspace/daemon/safety_policy.c
+ *
+ * Decides whether a shell command may run, should only run after the user
+ * confirms it, or is blocked. The command is read the way the shell reads
+ * it: quotes and escapes removed, split into simple commands at pipes,
+ * lists and subshells, redirections taken apart from arguments, wrappers
+ * such as sudo, env or nice looked through, and the bodies of `sh -c`,
+ * `eval`, `find -exec` (with "{}" standing for find's starting paths) and
+ * command substitutions checked as commands of their own. Each simple
+ * command is then matched against the rules for its program name only, so
+ * `r""m -rf '/'` and `sudo -u root /bin/rm -fr //` meet the same rule as
+ * `rm -rf /`.
+ *
+ * Rules are the built-in set below plus config.json's "safety_policy".
+ * Each thread indexes them by program name once per config snapshot, so
+ * a check is a single pass over the command and a hash probe per simple
+ * command: a few microseconds, cheap enough to leave safety mode on.
+ * Anything it cannot check fully asks for confirmation rather than
+ * passing: a command too long or too deeply nested, a program named by an
+ * expansion (`$(echo rm) -rf /`), or a command a rule could match through
+ * operands it reads from input under xargs or gets from the shell
+ * (`rm -rf "$dir"`, `rm -rf /opt/*`).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "../ai_os_common.h"
+
+#define POLICY_MAX_WORDS 64
+#define POLICY_MAX_REDIRECTS 8
+#define POLICY_WORD_BYTES 4096
+#define POLICY_MAX_DEPTH 4          /* sh -c, eval, $(...) inside each other */
+#define POLICY_MAX_FUNCTIONS 8
+#define POLICY_MAX_NAMES 256
+#define POLICY_MAX_GLOBS 32
+#define POLICY_BUCKETS 128
+
+/* Shipped rules; config rules are checked alongside, never instead */
+static const ai_os_policy_rule_t builtin_rules[] = {
+    { .command = "rm", .flags = {"-r|-R|--recursive"},
+      .args = {"/", "/*", "~", "~/*", "$HOME", "${HOME}", "/home/*", "/usr/*", "/var/lib", "/etc/*", "/boot/*"},
+      .reason = "recursive delete of a system or home directory", .action = SAFETY_BLOCK },
+    { .command = "rm", .flags = {"-r|-R|--recursive"}, .args = {"\\*", ".", ".."},
+      .reason = "recursive delete of the whole working directory", .action = SAFETY_CONFIRM },
+    { .command = "rm", .flags = {"--no-preserve-root"},
+      .reason = "rm --no-preserve-root", .action = SAFETY_BLOCK },
+    { .command = "rm", .flags = {"-r|-R|--recursive", "-f|--force"}, .privileged = 1,
+      .reason = "forced recursive delete as root", .action = SAFETY_BLOCK },
+    { .command = "dd",
+      .args = {"of=/dev/sd*", "of=/dev/nvme*", "of=/dev/hd*", "of=/dev/vd*", "of=/dev/xvd*",
+               "of=/dev/mmcblk*", "of=/dev/disk/*", "of=/dev/mapper/*"},
+      .reason = "dd onto a block device", .action = SAFETY_BLOCK },
+    { .command = "dd", .privileged = 1,
+      .reason = "dd as root", .action = SAFETY_BLOCK },
+    { .command = "mkfs|mkfs.*|mke2fs|mkswap|wipefs|fdisk|sfdisk|cfdisk|gdisk|sgdisk|parted|blkdiscard",
+      .reason = "formats or repartitions a disk", .action = SAFETY_BLOCK },
+    { .command = "shutdown|reboot|halt|poweroff",
+      .reason = "shuts the machine down", .action = SAFETY_BLOCK },
+    { .command = "init|telinit", .args = {"0", "6"},
+      .reason = "shuts the machine down", .action = SAFETY_BLOCK },
+    { .command = "systemctl", .args = {"poweroff", "reboot", "halt", "kexec", "emergency", "rescue"},
+      .reason = "shuts the machine down", .action = SAFETY_BLOCK },
+    { .command = "kill", .args = {"1"},
+      .reason = "signals init", .action = SAFETY_BLOCK },
+    { .command = "kill", .flags = {"-1"},
+      .reason = "signals every process", .action = SAFETY_BLOCK },
+    { .command = "kill", .args = {"-1"},
+      .reason = "signals every process", .action = SAFETY_BLOCK },
+    { .command = "chmod|chown|chgrp", .args = {"/"},
+      .reason = "changes the root directory's ownership or mode", .action = SAFETY_BLOCK },
+    { .command = "chmod|chown|chgrp", .flags = {"-R|--recursive"},
+      .args = {"/*", "~", "$HOME", "${HOME}", "/usr/*", "/etc/*"},
+      .reason = "recursive ownership or mode change of a system directory", .action = SAFETY_BLOCK },
+    { .command = "find", .flags = {"-delete"}, .args = {"/", "/*", "~", "$HOME", "${HOME}"},
+      .reason = "find -delete over a system or home directory", .action = SAFETY_BLOCK },
+    { .redirects = 1,
+      .args = {"/dev/sd*", "/dev/nvme*", "/dev/hd*", "/dev/vd*", "/dev/xvd*", "/dev/mmcblk*",
+               "/etc/passwd", "/etc/shadow", "/etc/group", "/etc/sudoers", "/boot/*"},
+      .reason = "overwrites a disk or system file", .action = SAFETY_BLOCK },
+    { .command = "tee",
+      .args = {"/dev/sd*", "/dev/nvme*", "/dev/hd*", "/dev/vd*", "/dev/xvd*", "/dev/mmcblk*",
+               "/etc/passwd", "/etc/shadow", "/etc/group", "/etc/sudoers", "/boot/*"},
+      .reason = "overwrites a disk or system file", .action = SAFETY_BLOCK },
+    { .command = "sh|bash|dash|zsh|ksh|python|python3|perl", .piped_from = "curl|wget",
+      .reason = "runs a downloaded script", .action = SAFETY_CONFIRM },
+    { .command = "curl|wget", .args = {"http://*"},
+      .reason = "plain-HTTP download", .action = SAFETY_CONFIRM },
+    { .command = "crontab", .flags = {"-r"},
+      .reason = "removes the crontab", .action = SAFETY_CONFIRM },
+};
+
+#define BUILTIN_RULES ((int)(sizeof(builtin_rules) / sizeof(builtin_rules[0])))
+#define POLICY_MAX_RULES (BUILTIN_RULES + AI_OS_POLICY_MAX_RULES)
+
+/* Programs that run the rest of their arguments as a command */
+static const struct {
+    const char *name;
+    const char *short_args;         /* options that take a value */
+    const char *long_args;          /* the same, spelled long */
+    int operands;                   /* operands before the command */
+    int privileged;
+    int input_operands;             /* the command gets more operands from input */
+} wrappers[] = {
+    {"sudo", "CDghpRrtTUu", "|user|group|chdir|chroot|close-from|host|other-user|prompt|role|type|command-timeout|", 0, 1, 0},
+    {"doas", "Cu", "", 0, 1, 0},
+    {"pkexec", "", "|user|", 0, 1, 0},
+    {"env", "CSu", "|chdir|split-string|unset|", 0, 0, 0},
+    {"nice", "n", "|adjustment|", 0, 0, 0},
+    {"ionice", "cnp", "|class|classdata|pid|", 0, 0, 0},
+    {"nohup", "", "", 0, 0, 0},
+    {"time", "fo", "|format|output|", 0, 0, 0},
+    {"timeout", "ks", "|kill-after|signal|", 1, 0, 0},
+    {"exec", "a", "", 0, 0, 0},
+    {"command", "", "", 0, 0, 0},
+    {"builtin", "", "", 0, 0, 0},
+    {"stdbuf", "eio", "|input|output|error|", 0, 0, 0},
+    {"setsid", "", "", 0, 0, 0},
+    {"xargs", "adEILnPs", "|arg-file|delimiter|max-args|max-procs|max-chars|process-slot-var|", 0, 0, 1},
+    {"watch", "dn", "|interval|", 0, 0, 0},
+    {"busybox", "", "", 0, 0, 0},
+};
+
+/* Programs that run a command line given as an argument */
+static const char *const shells[] = {"sh", "bash", "dash", "zsh", "ksh", "mksh", "fish", "su", NULL};
+
+/* What a name in the hash index stands for */
+enum policy_kind {
+    POLICY_RULE,                    /* value: rule index */
+    POLICY_WRAPPER,                 /* value: wrappers[] index */
+    POLICY_SHELL,                   /* sh -c, su -c */
+    POLICY_EVAL,
+    POLICY_FIND                     /* find -exec */
+};
+
+/* A program name known to the index */
+typedef struct {
+    const char *name;
+    unsigned short len;
+    unsigned char kind;
+    unsigned short value;
+    unsigned short next;            /* index + 1 of the next name in the bucket */
+} policy_name_t;
+
+/* The rules of one config snapshot, indexed by program name. Per thread:
+ * rebuilt when the thread first sees a new snapshot, never shared */
+static __thread struct {
+    const ai_os_settings_t *config;
+    unsigned long generation;       /* a freed snapshot's address can come back */
+    const ai_os_policy_rule_t *rules[POLICY_MAX_RULES];
+    int rule_count;
+    policy_name_t names[POLICY_MAX_NAMES];
+    int name_count;
+    unsigned short heads[POLICY_BUCKETS];
+    struct {
+        char pattern[96];
+        unsigned short rule;
+    } globs[POLICY_MAX_GLOBS];      /* program names with wildcards */
+    int glob_count;
+    unsigned short any[POLICY_MAX_RULES];      /* rules for every program (redirections) */
+    int any_count;
+    int overflow;                   /* too many names to index: scan every rule */
+} policy;
+
+/* A redirection target, and whether its operator opens it for writing */
+typedef struct {
+    const char *target;
+    int writes;                     /* >, >>, >|, &>, &>>, <>; not <, <& */
+} policy_redirect_t;
+
+/* One simple command as the shell would run it */
+typedef struct {
+    const char *argv[POLICY_MAX_WORDS];
+    int argc;
+    policy_redirect_t redirects[POLICY_MAX_REDIRECTS];
+    int redirect_count;
+    char words[POLICY_WORD_BYTES];
+    size_t used;
+} simple_command_t;
+
+/* The command after wrappers, as the rules see it */
+typedef struct {
+    const char *name;               /* program, without its directory */
+    const char *const *argv;        /* argv[0] is the program */
+    int argc;
+    const policy_redirect_t *redirects;
+    int redirect_count;
+    const char *piped_from;
+    int privileged;
+    int input_operands;             /* under xargs: operands we never see */
+} command_view_t;
+
+/* A shell function being defined, to catch it calling itself */
+typedef struct {
+    char name[64];
+    int depth;                      /* brace depth outside its body */
+    int closed;
+} policy_function_t;
+
+typedef struct {
+    int verdict;
+    const char *reason;
+    char subject[64];               /* program the verdict is about */
+    int depth;
+    int privileged;                 /* inside sudo sh -c '...' and the like */
+    int brace_depth;
+    policy_function_t functions[POLICY_MAX_FUNCTIONS];
+    int function_count;
+} policy_eval_t;
+
+static void evaluate(policy_eval_t *ev, const char *s, size_t len);
+
+static unsigned int hash_name(const char *name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h % POLICY_BUCKETS;
+}
+
+static int is_glob(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* fnmatch(3), after a cheap check of the pattern's literal prefix: most
+ * operands differ from most patterns in the first byte or two */
+static int glob_match(const char *pattern, const char *s, int flags) {
+    const char *p = pattern;
+    const char *q = s;
+    while (*p && *p != '*' && *p != '?' && *p != '[' && *p != '\\') {
+        if (*p++ != *q++) {
+            return 0;
+        }
+    }
+    return *p ? fnmatch(pattern, s, flags) == 0 : *q == '\0';
+}
+
+static int index_name(const char *name, size_t len, int kind, unsigned short value) {
+    if (policy.name_count == POLICY_MAX_NAMES) {
+        return -1;
+    }
+    policy_name_t *n = &policy.names[policy.name_count];
+    unsigned int bucket = hash_name(name, len);
+    n->name = name;
+    n->len = (unsigned short)len;
+    n->kind = (unsigned char)kind;
+    n->value = value;
+    n->next = policy.heads[bucket];
+    policy.heads[bucket] = (unsigned short)++policy.name_count;
+    return 0;
+}
+
+/* The first name in the index after N (0: from the start) equal to NAME */
+static const policy_name_t *lookup_name(const char *name, size_t len, const policy_name_t *n) {
+    unsigned short next = n ? n->next : policy.heads[hash_name(name, len)];
+    for (; next; next = policy.names[next - 1].next) {
+        n = &policy.names[next - 1];
+        if (n->len == len && memcmp(n->name, name, len) == 0) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+/* The first entry of KIND for NAME, or NULL */
+static const policy_name_t *lookup_kind(const char *name, int kind) {
+    size_t len = strlen(name);
+    for (const policy_name_t *n = lookup_name(name, len, NULL); n; n = lookup_name(name, len, n)) {
+        if (n->kind == kind || (kind == POLICY_SHELL && n->kind >= POLICY_SHELL)) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+static void index_rule(const ai_os_policy_rule_t *rule) {
+    unsigned short index = (unsigned short)policy.rule_count++;
+
+    policy.rules[index] = rule;
+    if (!rule->command[0]) {
+        policy.any[policy.any_count++] = index;
+    }
+    for (const char *p = rule->command; *p;) {
+        const char *bar = strchr(p, '|');
+        size_t len = bar ? (size_t)(bar - p) : strlen(p);
+        if (is_glob(p, len)) {
+            if (policy.glob_count == POLICY_MAX_GLOBS || len >= sizeof(policy.globs[0].pattern)) {
+                policy.overflow = 1;
+            } else {
+                memcpy(policy.globs[policy.glob_count].pattern, p, len);
+                policy.globs[policy.glob_count++].rule = index;
+            }
+        } else if (len && index_name(p, len, POLICY_RULE, index) != 0) {
+            policy.overflow = 1;
+        }
+        p += len + (bar != NULL);
+    }
+}
+
+/* Index the current snapshot's rules for this thread if not done yet */
+static void policy_index(const ai_os_settings_t *config) {
+    if (policy.config == config && policy.generation == config->generation) {
+        return;
+    }
+    memset(&policy, 0, sizeof(policy));
+    policy.config = config;
+    policy.generation = config->generation;
+    for (unsigned short w = 0; w < sizeof(wrappers) / sizeof(wrappers[0]); w++) {
+        index_name(wrappers[w].name, strlen(wrappers[w].name), POLICY_WRAPPER, w);
+    }
+    for (int i = 0; shells[i]; i++) {
+        index_name(shells[i], strlen(shells[i]), POLICY_SHELL, 0);
+    }
+    index_name("eval", 4, POLICY_EVAL, 0);
+    index_name("find", 4, POLICY_FIND, 0);
+    for (int i = 0; i < BUILTIN_RULES; i++) {
+        index_rule(&builtin_rules[i]);
+    }
+    for (int i = 0; i < config->policy_count; i++) {
+        index_rule(&config->policy[i]);
+    }
+}
+
+static void raise_verdict(policy_eval_t *ev, int verdict, const char *reason, const char *subject) {
+    if (verdict > ev->verdict) {
+        ev->verdict = verdict;
+        ev->reason = reason;
+        snprintf(ev->subject, sizeof(ev->subject), "%s", subject ? subject : "");
+    }
+}
+
+/* Does S match one of the '|'-separated ALTERNATIVES (globs allowed)? */
+static int alternatives_match(const char *alternatives, const char *s) {
+    char alt[96];
+    for (const char *p = alternatives; *p;) {
+        const char *bar = strchr(p, '|');
+        size_t len = bar ? (size_t)(bar - p) : strlen(p);
+        if (len < sizeof(alt)) {
+            memcpy(alt, p, len);
+            alt[len] = '\0';
+            if (glob_match(alt, s, FNM_PATHNAME)) {
+                return 1;
+            }
+        }
+        p += len + (bar != NULL);
+    }
+    return 0;
+}
+
+/* Is the option ALT ("-r", "-9", "-delete", "--force") among ARGV's options? */
+static int option_present(const command_view_t *cmd, const char *alt, size_t len) {
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *arg = cmd->argv[i];
+        if (arg[0] != '-' || !arg[1]) {
+            continue;
+        }
+        if (strcmp(arg, "--") == 0) {
+            break;
+        }
+        if (len == 2 && alt[1] != '-' && !(alt[1] >= '0' && alt[1] <= '9')) {
+            /* A short flag, alone or clustered: -r, -rf, -fr */
+            if (arg[1] != '-' && memchr(arg + 1, alt[1], strlen(arg + 1))) {
+                return 1;
+            }
+        } else if (strncmp(arg, alt, len) == 0 && (arg[len] == '\0' || (alt[1] == '-' && arg[len] == '='))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int flag_present(const command_view_t *cmd, const char *alternatives) {
+    for (const char *p = alternatives; *p;) {
+        const char *bar = strchr(p, '|');
+        size_t len = bar ? (size_t)(bar - p) : strlen(p);
+        if (len > 1 && option_present(cmd, p, len)) {
+            return 1;
+        }
+        p += len + (bar != NULL);
+    }
+    return 0;
+}
+
+/* PATH with duplicate slashes, "." and ".." resolved and no trailing
+ * slash, so "//", "/tmp/.." and "/./" all read as "/" and "~/" as "~" */
+static const char *normalize_path(const char *path, char *out, size_t size) {
+    const char *slash = strchr(path, '/');
+    if (!slash || strlen(path) >= size) {
+        return path;
+    }
+
+    size_t len = (size_t)(slash - path);     /* "of=", "~" and the like stay */
+    memcpy(out, path, len);
+    const char *p = slash;
+    while (*p) {
+        while (*p == '/') p++;
+        const char *component = p;
+        while (*p && *p != '/') p++;
+        size_t clen = (size_t)(p - component);
+        if (clen == 0 || (clen == 1 && component[0] == '.')) {
+            continue;
+        }
+        if (clen == 2 && component[0] == '.' && component[1] == '.') {
+            char *prev = memrchr(out + (slash - path), '/', len - (size_t)(slash - path));
+            if (prev) {
+                len = (size_t)(prev - out);
+            }
+            continue;
+        }
+        out[len++] = '/';
+        memcpy(out + len, component, clen);
+        len += clen;
+    }
+    if (len == 0) {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return out;
+}
+
+/* WORD is used as written, not through an expansion or a glob */
+static int literal_name(const char *word) {
+    if (strpbrk(word, "$`*?")) {
+        return 0;
+    }
+    const char *open = strchr(word, '[');
+    return !(open && strchr(open, ']'));
+}
+
+/* ARG is only known once the shell expands it: a substitution or a
+ * variable, or a glob that can reach outside the working directory */
+static int expanded_operand(const char *arg) {
+    if (strpbrk(arg, "$`")) {
+        return 1;
+    }
+    return !literal_name(arg) && (arg[0] == '/' || arg[0] == '~' || arg[0] == '.');
+}
+
+static int operand_matches(const ai_os_policy_rule_t *rule, const char *arg) {
+    char path[POLICY_WORD_BYTES];
+    int url = strstr(arg, "://") != NULL;      /* http patterns cover the whole URL */
+    if (!url) {
+        arg = normalize_path(arg, path, sizeof(path));
+    }
+    for (int i = 0; i < AI_OS_POLICY_MAX_ARGS && rule->args[i][0]; i++) {
+        if (glob_match(rule->args[i], arg, url ? 0 : FNM_PATHNAME)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 1 if RULE matches CMD; 2 if it might, through operands CMD reads from
+ * input; 3 if it might, through an operand the shell expands */
+static int rule_matches(const ai_os_policy_rule_t *rule, const command_view_t *cmd) {
+    int unknown = cmd->input_operands ? 2 : 0;
+    int unseen = 0;                 /* would need what xargs reads or the shell expands */
+
+    if (rule->privileged && !cmd->privileged) {
+        return 0;
+    }
+    if (rule->piped_from[0] && !(cmd->piped_from && alternatives_match(rule->piped_from, cmd->piped_from))) {
+        return 0;
+    }
+    for (int i = 1; i < cmd->argc && !unknown; i++) {
+        if (strpbrk(cmd->argv[i], "$`")) {
+            unknown = 3;            /* rm $opts / */
+        }
+    }
+    for (int i = 0; i < AI_OS_POLICY_MAX_FLAGS && rule->flags[i][0]; i++) {
+        if (!flag_present(cmd, rule->flags[i])) {
+            if (!unknown || rule->redirects) {
+                return 0;
+            }
+            unseen = 1;
+        }
+    }
+    if (!rule->args[0][0]) {
+        return unseen ? unknown : 1;
+    }
+
+    if (rule->redirects) {
+        int expanded = 0;
+        for (int i = 0; i < cmd->redirect_count; i++) {
+            if (!cmd->redirects[i].writes) {
+                continue;
+            }
+            if (operand_matches(rule, cmd->redirects[i].target)) {
+                return 1;
+            }
+            expanded |= expanded_operand(cmd->redirects[i].target);
+        }
+        return expanded ? 3 : 0;
+    }
+    int maybe = unknown;
+    int options = 1;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *arg = cmd->argv[i];
+        if (options && arg[0] == '-' && arg[1]) {
+            options = strcmp(arg, "--") != 0;
+            continue;
+        }
+        if (operand_matches(rule, arg)) {
+            return unseen ? unknown : 1;
+        }
+        if (!maybe && expanded_operand(arg)) {
+            maybe = 3;
+        }
+    }
+    return maybe;
+}
+
+static void check_rule(policy_eval_t *ev, const ai_os_policy_rule_t *rule, const command_view_t *cmd) {
+    if (rule->action <= ev->verdict) {
+        return;
+    }
+    int match = rule_matches(rule, cmd);
+    if (match == 1) {
+        raise_verdict(ev, rule->action, rule->reason[0] ? rule->reason : "matches the safety policy", cmd->name);
+    } else if (match == 2) {
+        raise_verdict(ev, SAFETY_CONFIRM, "operands read from input cannot be checked", cmd->name);
+    } else if (match == 3) {
+        raise_verdict(ev, SAFETY_CONFIRM, "operands the shell expands cannot be checked", cmd->name);
+    }
+}
+
+static void check_rules(policy_eval_t *ev, const command_view_t *cmd) {
+    size_t len = strlen(cmd->name);
+    for (const policy_name_t *n = lookup_name(cmd->name, len, NULL); n; n = lookup_name(cmd->name, len, n)) {
+        if (n->kind == POLICY_RULE) {
+            check_rule(ev, policy.rules[n->value], cmd);
+        }
+    }
+    for (int i = 0; i < policy.glob_count; i++) {
+        if (glob_match(policy.globs[i].pattern, cmd->name, FNM_PATHNAME)) {
+            check_rule(ev, policy.rules[policy.globs[i].rule], cmd);
+        }
+    }
+    for (int i = 0; i < policy.any_count && cmd->redirect_count; i++) {
+        check_rule(ev, policy.rules[policy.any[i]], cmd);
+    }
+    if (policy.overflow) {
+        for (int i = 0; i < policy.rule_count; i++) {
+            if (alternatives_match(policy.rules[i]->command, cmd->name)) {
+                check_rule(ev, policy.rules[i], cmd);
+            }
+        }
+    }
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* NAME=value before the program */
+static int is_assignment(const char *word) {
+    if (!(word[0] == '_' || (word[0] >= 'A' && word[0] <= 'Z') || (word[0] >= 'a' && word[0] <= 'z'))) {
+        return 0;
+    }
+    for (const char *p = word + 1; *p; p++) {
+        if (*p == '=') {
+            return 1;
+        }
+        if (!(*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9'))) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void evaluate_nested(policy_eval_t *ev, const char *text, int privileged);
+
+/* Index of the wrapped command in ARGV, past wrapper W's options from I.
+ * Options are read as getopt would, so `sudo -uroot rm` is not `sudo -u
+ * rm`; a string for env -S is itself a command line */
+static int skip_wrapper(policy_eval_t *ev, int w, const char *const *argv, int argc, int i, int privileged) {
+    int operands = wrappers[w].operands;
+    int env = strcmp(wrappers[w].name, "env") == 0;
+
+    while (i < argc) {
+        const char *arg = argv[i];
+        const char *value = NULL;
+        if (strcmp(arg, "--") == 0) {
+            return i + 1;
+        }
+        if (arg[0] == '-' && arg[1] == '-') {
+            char name[40];
+            const char *eq = strchr(arg + 2, '=');
+            size_t len = eq ? (size_t)(eq - arg - 2) : strlen(arg + 2);
+            if (len + 3 <= sizeof(name)) {
+                snprintf(name, sizeof(name), "|%.*s|", (int)len, arg + 2);
+                if (strstr(wrappers[w].long_args, name)) {
+                    value = eq ? eq + 1 : (i + 1 < argc ? argv[++i] : NULL);
+                    if (env && value && strcmp(name, "|split-string|") == 0) {
+                        evaluate_nested(ev, value, privileged);
+                    }
+                }
+            }
+            i++;
+            continue;
+        }
+        if (arg[0] == '-' && arg[1]) {
+            for (const char *c = arg + 1; *c; c++) {
+                if (strchr(wrappers[w].short_args, *c)) {
+                    value = c[1] ? c + 1 : (i + 1 < argc ? argv[++i] : NULL);
+                    if (env && value && *c == 'S') {
+                        evaluate_nested(ev, value, privileged);
+                    }
+                    break;
+                }
+            }
+            i++;
+            continue;
+        }
+        if (env && is_assignment(arg)) {
+            i++;
+            continue;
+        }
+        if (operands > 0) {
+            operands--;
+            i++;
+            continue;
+        }
+        break;
+    }
+    return i;
+}
+
+/* Evaluate TEXT as a nested command line, as sudo or not */
+static void evaluate_nested(policy_eval_t *ev, const char *text, int privileged) {
+    int saved = ev->privileged;
+    ev->privileged = privileged;
+    evaluate(ev, text, strlen(text));
+    ev->privileged = saved;
+}
+
+/* Index of the script after a -c option (sh -c, su -c), or -1 */
+static int script_argument(const command_view_t *cmd) {
+    for (int i = 1; i < cmd->argc - 1; i++) {
+        const char *arg = cmd->argv[i];
+        if (arg[0] == '-' && arg[1] != '-' && strchr(arg + 1, 'c')) {
+            return i + 1;
+        }
+        if (strcmp(arg, "--command") == 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+static void evaluate_view(policy_eval_t *ev, const char *const *argv, int argc, const policy_redirect_t *redirects,
+                          int redirect_count, const char *piped_from, char *name_out, size_t name_size);
+
+/* A find -exec command, once per starting path with "{}" replaced by it:
+ * the paths themselves are among what find hands the command */
+static void evaluate_find_exec(policy_eval_t *ev, const command_view_t *cmd, int first, int end,
+                               const char *const *paths, int path_count) {
+    const char *argv[POLICY_MAX_WORDS];
+    char words[POLICY_WORD_BYTES];
+    int argc = end - first;
+
+    for (int p = 0; p < path_count; p++) {
+        size_t used = 0;
+        int substituted = 0;
+        for (int i = 0; i < argc; i++) {
+            const char *word = cmd->argv[first + i];
+            const char *brace = strstr(word, "{}");
+            argv[i] = word;
+            if (!brace) {
+                continue;
+            }
+            int len = snprintf(words + used, sizeof(words) - used, "%.*s%s%s", (int)(brace - word), word,
+                               paths[p], brace + 2);
+            if (len < 0 || (size_t)len >= sizeof(words) - used) {
+                raise_verdict(ev, SAFETY_CONFIRM, "find -exec too long to check", cmd->name);
+                return;
+            }
+            argv[i] = words + used;
+            used += (size_t)len + 1;
+            substituted = 1;
+        }
+        evaluate_view(ev, argv, argc, NULL, 0, NULL, NULL, 0);
+        if (!substituted) {
+            return;
+        }
+    }
+}
+
+/* find [-H|-L|-P|-D opts|-Olevel] [path...] expression: the commands its
+ * -exec, -execdir, -ok and -okdir actions run */
+static void evaluate_find(policy_eval_t *ev, const command_view_t *cmd) {
+    static const char *const here[] = {"."};
+    const char *const *paths = here;
+    int path_count = 1;
+    int i = 1;
+
+    while (i < cmd->argc && (!strcmp(cmd->argv[i], "-H") || !strcmp(cmd->argv[i], "-L") ||
+                             !strcmp(cmd->argv[i], "-P") || !strcmp(cmd->argv[i], "-D") ||
+                             !strncmp(cmd->argv[i], "-O", 2))) {
+        i += strcmp(cmd->argv[i], "-D") == 0 ? 2 : 1;
+    }
+    int start = i;
+    while (i < cmd->argc && cmd->argv[i][0] != '-' && strcmp(cmd->argv[i], "(") && strcmp(cmd->argv[i], "!")) {
+        i++;
+    }
+    if (i > start) {
+        paths = cmd->argv + start;
+        path_count = i - start;
+    }
+
+    int saved = ev->privileged;
+    ev->privileged = cmd->privileged;
+    for (; i < cmd->argc; i++) {
+        const char *arg = cmd->argv[i];
+        if (strcmp(arg, "-exec") && strcmp(arg, "-execdir") && strcmp(arg, "-ok") && strcmp(arg, "-okdir")) {
+            continue;
+        }
+        int end = i + 1;
+        while (end < cmd->argc && strcmp(cmd->argv[end], ";") && strcmp(cmd->argv[end], "+")) {
+            end++;
+        }
+        if (end > i + 1) {
+            evaluate_find_exec(ev, cmd, i + 1, end, paths, path_count);
+        }
+        i = end;
+    }
+    ev->privileged = saved;
+}
+
+/* Commands that run other commands from their arguments */
+static void evaluate_inner(policy_eval_t *ev, const command_view_t *cmd) {
+    const char *name = cmd->name;
+    const policy_name_t *inner = lookup_kind(name, POLICY_SHELL);
+
+    if (!inner) {
+        return;
+    }
+    if (inner->kind == POLICY_SHELL) {
+        int script = script_argument(cmd);
+        if (script > 0) {
+            evaluate_nested(ev, cmd->argv[script], cmd->privileged || strcmp(name, "su") == 0);
+        }
+    } else if (inner->kind == POLICY_EVAL) {
+        char joined[POLICY_WORD_BYTES];
+        size_t len = 0;
+        for (int i = 1; i < cmd->argc; i++) {
+            len += (size_t)snprintf(joined + len, sizeof(joined) - len, "%s%s", i > 1 ? " " : "", cmd->argv[i]);
+            if (len >= sizeof(joined)) {
+                raise_verdict(ev, SAFETY_CONFIRM, "eval too long to check", name);
+                return;
+            }
+        }
+        evaluate_nested(ev, joined, cmd->privileged);
+    } else if (inner->kind == POLICY_FIND) {
+        evaluate_find(ev, cmd);
+    }
+}
+
+/* One simple command: look through wrappers, check it, then anything it
+ * runs; NAME_OUT receives the program for the next command in a pipe */
+static void evaluate_view(policy_eval_t *ev, const char *const *argv, int argc, const policy_redirect_t *redirects,
+                          int redirect_count, const char *piped_from, char *name_out, size_t name_size) {
+    command_view_t cmd = {
+        .name = "",
+        .redirects = redirects,
+        .redirect_count = redirect_count,
+        .piped_from = piped_from,
+        .privileged = ev->privileged,
+    };
+    const policy_name_t *wrapper;
+    int i = 0;
+
+    for (;;) {
+        while (i < argc && is_assignment(argv[i])) i++;
+        if (i >= argc || !(wrapper = lookup_kind(base_name(argv[i]), POLICY_WRAPPER))) {
+            break;
+        }
+        cmd.privileged |= wrappers[wrapper->value].privileged;
+        cmd.input_operands |= wrappers[wrapper->value].input_operands;
+        i = skip_wrapper(ev, wrapper->value, argv, argc, i + 1, cmd.privileged);
+    }
+    if (i < argc) {
+        cmd.name = base_name(argv[i]);
+        cmd.argv = argv + i;
+        cmd.argc = argc - i;
+    }
+    if (name_out) {
+        size_t len = strnlen(cmd.name, name_size - 1);
+        memcpy(name_out, cmd.name, len);
+        name_out[len] = '\0';
+    }
+
+    /* :(){ :|:& };: and friends */
+    for (int f = 0; f < ev->function_count && cmd.name[0]; f++) {
+        policy_function_t *fn = &ev->functions[f];
+        if (!fn->closed && ev->brace_depth > fn->depth && strcmp(fn->name, cmd.name) == 0) {
+            raise_verdict(ev, SAFETY_BLOCK, "shell function that calls itself (fork bomb)", cmd.name);
+        }
+    }
+
+    /* $(echo rm) -rf /: whatever runs, no rule can tell */
+    if (cmd.argc && !literal_name(cmd.argv[0])) {
+        raise_verdict(ev, SAFETY_CONFIRM, "program name is not a literal word", NULL);
+    }
+    if (cmd.argc || cmd.redirect_count) {
+        check_rules(ev, &cmd);
+    }
+    if (cmd.argc) {
+        evaluate_inner(ev, &cmd);
+    }
+}
+
+static void command_reset(simple_command_t *cmd) {
+    cmd->argc = 0;
+    cmd->redirect_count = 0;
+    cmd->used = 0;
+}
+
+static void finish_command(policy_eval_t *ev, simple_command_t *cmd, const char *piped_from,
+                           char *name_out, size_t name_size) {
+    if (name_out) {
+        name_out[0] = '\0';
+    }
+    if (cmd->argc || cmd->redirect_count) {
+        evaluate_view(ev, cmd->argv, cmd->argc, cmd->redirects, cmd->redirect_count, piped_from,
+                      name_out, name_size);
+    }
+    command_reset(cmd);
+}
+
+static int put_char(simple_command_t *cmd, char c) {
+    if (cmd->used >= sizeof(cmd->words) - 1) {
+        return -1;
+    }
+    cmd->words[cmd->used++] = c;
+    return 0;
+}
+
+/* End of the construct opened at P (just past "$(" or "`"), minding quotes */
+static const char *substitution_end(const char *p, const char *end, char close) {
+    int depth = 1;
+    while (p < end) {
+        char c = *p;
+        if (c == '\\' && p + 1 < end) {
+            p += 2;
+            continue;
+        }
+        if (close == '`') {
+            if (c == '`') return p;
+        } else if (c == '\'') {
+            const char *q = memchr(p + 1, '\'', (size_t)(end - p - 1));
+            p = q ? q : end;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+/* $(...) or `...`: checked as a command line, kept in the word as written */
+static const char *substitution(policy_eval_t *ev, simple_command_t *cmd, const char *p, const char *end) {
+    int backtick = *p == '`';
+    const char *body = p + (backtick ? 1 : 2);
+    const char *close = substitution_end(body, end, backtick ? '`' : ')');
+    const char *next = close < end ? close + 1 : end;
+
+    evaluate(ev, body, (size_t)(close - body));
+    for (const char *q = p; q < next; q++) {
+        if (put_char(cmd, *q) != 0) break;
+    }
+    return next;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* $'...' with its backslash escapes decoded; P is past the quote */
+static const char *ansi_c_string(simple_command_t *cmd, const char *p, const char *end) {
+    while (p < end && *p != '\'') {
+        char c = *p++;
+        if (c == '\\' && p < end) {
+            c = *p++;
+            switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'e': case 'E': c = 033; break;
+            case 'x': {
+                int v = 0, digits = 0, h;
+                while (digits < 2 && p < end && (h = hex_value(*p)) >= 0) {
+                    v = v * 16 + h;
+                    p++;
+                    digits++;
+                }
+                c = (char)v;
+                break;
+            }
+            default:
+                if (c >= '0' && c <= '7') {
+                    int v = c - '0', digits = 1;
+                    while (digits < 3 && p < end && *p >= '0' && *p <= '7') {
+                        v = v * 8 + (*p++ - '0');
+                        digits++;
+                    }
+                    c = (char)v;
+                }
+                break;
+            }
+        }
+        put_char(cmd, c);
+    }
+    return p < end ? p + 1 : end;
+}
+
+static int is_word_end(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' || c == '|' ||
+           c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+/* One word with quotes and escapes removed, stored in CMD; NULL if CMD is full */
+static const char *read_word(policy_eval_t *ev, simple_command_t *cmd, const char **pos, const char *end) {
+    const char *p = *pos;
+    size_t start = cmd->used;
+    int full = 0;
+
+    while (p < end && !is_word_end(*p)) {
+        char c = *p;
+        if (c == '\\') {
+            if (p + 1 < end && p[1] != '\n') {
+                full |= put_char(cmd, p[1]);
+            }
+            p += 2;
+        } else if (c == '\'') {
+            const char *q = memchr(p + 1, '\'', (size_t)(end - p - 1));
+            const char *stop = q ? q : end;
+            for (p++; p < stop; p++) full |= put_char(cmd, *p);
+            p = q ? q + 1 : end;
+        } else if (c == '"') {
+            for (p++; p < end && *p != '"';) {
+                if (*p == '\\' && p + 1 < end && strchr("$`\"\\\n", p[1])) {
+                    if (p[1] != '\n') full |= put_char(cmd, p[1]);
+                    p += 2;
+                } else if ((*p == '$' && p + 1 < end && p[1] == '(') || *p == '`') {
+                    p = substitution(ev, cmd, p, end);
+                } else {
+                    full |= put_char(cmd, *p++);
+                }
+            }
+            p = p < end ? p + 1 : end;
+        } else if (c == '$' && p + 1 < end && p[1] == '\'') {
+            p = ansi_c_string(cmd, p + 2, end);
+        } else if ((c == '$' && p + 1 < end && p[1] == '(') || c == '`') {
+            p = substitution(ev, cmd, p, end);
+        } else {
+            full |= put_char(cmd, c);
+            p++;
+        }
+    }
+    *pos = p;
+    if (full || cmd->used >= sizeof(cmd->words) - 1) {
+        return NULL;
+    }
+    cmd->words[cmd->used++] = '\0';
+    return cmd->words + start;
+}
+
+/* A redirection operator at P: [n]>, >>, >|, <, <<, <<<, <>, &>, &>>, >&, <& */
+static int redirect_length(const char *p, const char *end) {
+    const char *q = p;
+    while (q < end && *q >= '0' && *q <= '9') q++;
+    if (q == p && q < end && *q == '&' && q + 1 < end && q[1] == '>') {
+        q += 2;
+        return (int)(q - p) + (q < end && *q == '>');
+    }
+    if (q >= end || (*q != '<' && *q != '>')) {
+        return 0;
+    }
+    char op = *q++;
+    while (q < end && (*q == op || *q == '|' || *q == '&' || (op == '<' && *q == '>')) && q - p < 4) q++;
+    return (int)(q - p);
+}
+
+static void define_function(policy_eval_t *ev, const char *name) {
+    if (ev->function_count < POLICY_MAX_FUNCTIONS) {
+        policy_function_t *fn = &ev->functions[ev->function_count++];
+        snprintf(fn->name, sizeof(fn->name), "%s", name);
+        fn->depth = ev->brace_depth;
+        fn->closed = 0;
+    }
+}
+
+/* Reserved words where a program name would be; 1 if WORD was one */
+static int keyword(policy_eval_t *ev, const char *word) {
+    static const char *const skipped[] = {
+        "!", "if", "then", "else", "elif", "fi", "do", "done", "while", "until", NULL
+    };
+    if (strcmp(word, "{") == 0) {
+        ev->brace_depth++;
+        return 1;
+    }
+    if (strcmp(word, "}") == 0) {
+        ev->brace_depth--;
+        for (int f = 0; f < ev->function_count; f++) {
+            if (ev->functions[f].depth >= ev->brace_depth) {
+                ev->functions[f].closed = 1;
+            }
+        }
+        return 1;
+    }
+    for (int i = 0; skipped[i]; i++) {
+        if (strcmp(word, skipped[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Past the line that closes a here-document starting at P */
+static const char *heredoc_end(const char *p, const char *end, const char *delimiter, int tabs) {
+    size_t len = strlen(delimiter);
+    while (p < end) {
+        const char *line = p;
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+        while (tabs && line < eol && *line == '\t') line++;
+        p = nl ? nl + 1 : end;
+        if ((size_t)(eol - line) == len && memcmp(line, delimiter, len) == 0) {
+            break;
+        }
+    }
+    return p;
+}
+
+/* Check one command line, S..S+LEN, simple command by simple command */
+static void evaluate(policy_eval_t *ev, const char *s, size_t len) {
+    if (ev->depth >= POLICY_MAX_DEPTH) {
+        raise_verdict(ev, SAFETY_CONFIRM, "commands nested too deeply to check", NULL);
+        return;
+    }
+    ev->depth++;
+
+    simple_command_t cmd;
+    char piped_from[64] = "";
+    char name[64];
+    int in_pipe = 0;
+    int define_next = 0;            /* after `function` */
+    char heredoc[64] = "";          /* delimiter of a here-document whose body follows */
+    int heredoc_tabs = 0;           /* <<- strips leading tabs */
+    const char *p = s;
+    const char *end = s + len;
+
+    command_reset(&cmd);
+    while (p < end && ev->verdict != SAFETY_BLOCK) {
+        char c = *p;
+        if (c == ' ' || c == '\t' || (c == '\\' && p + 1 < end && p[1] == '\n')) {
+            p += c == '\\' ? 2 : 1;
+            continue;
+        }
+        if (c == '#') {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            p = nl ? nl : end;
+            continue;
+        }
+
+        int redirect = redirect_length(p, end);
+        if ((c == '<' || c == '>') && p + 1 < end && p[1] == '(') {
+            /* Process substitution: a command line of its own */
+            const char *close = substitution_end(p + 2, end, ')');
+            evaluate(ev, p + 2, (size_t)(close - p - 2));
+            p = close < end ? close + 1 : end;
+            continue;
+        }
+        if (redirect) {
+            const char *op = memchr(p, '<', (size_t)redirect);
+            int here = op && op + 1 < p + redirect && op[1] == '<';     /* << or <<< */
+            int here_string = here && op + 2 < p + redirect && op[2] == '<';
+            int dup = p[redirect - 1] == '&';
+            int writes = memchr(p, '>', (size_t)redirect) != NULL;
+            p += redirect;
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+            const char *target = read_word(ev, &cmd, &p, end);
+            if (!target) {
+                raise_verdict(ev, SAFETY_CONFIRM, "command too long to check", NULL);
+                break;
+            }
+            if (here && !here_string) {
+                heredoc_tabs = target[0] == '-';
+                snprintf(heredoc, sizeof(heredoc), "%s", target + heredoc_tabs);
+            } else if (!here && !dup && target[0]) {
+                if (cmd.redirect_count == POLICY_MAX_REDIRECTS) {
+                    raise_verdict(ev, SAFETY_CONFIRM, "too many redirections to check", NULL);
+                    break;
+                }
+                cmd.redirects[cmd.redirect_count].target = target;
+                cmd.redirects[cmd.redirect_count++].writes = writes;
+            }
+            continue;
+        }
+
+        if (c == '\n' || c == ';' || c == '&' || c == '|' || c == '(' || c == ')') {
+            /* name() { ...; } */
+            if (c == '(' && cmd.argc == 1 && !cmd.redirect_count) {
+                const char *q = p + 1;
+                while (q < end && (*q == ' ' || *q == '\t')) q++;
+                if (q < end && *q == ')') {
+                    define_function(ev, cmd.argv[0]);
+                    command_reset(&cmd);
+                    p = q + 1;
+                    continue;
+                }
+            }
+            int pipe = c == '|' && !(p + 1 < end && p[1] == '|');
+            finish_command(ev, &cmd, in_pipe ? piped_from : NULL, name, sizeof(name));
+            if (c == '\n' && heredoc[0]) {
+                /* The here-document is input, not commands */
+                p = heredoc_end(p + 1, end, heredoc, heredoc_tabs);
+                heredoc[0] = '\0';
+                in_pipe = 0;
+                continue;
+            }
+            if (pipe) {
+                memcpy(piped_from, name, sizeof(piped_from));
+            }
+            in_pipe = pipe;
+            p += (p + 1 < end && (p[1] == c || (c == '|' && p[1] == '&'))) ? 2 : 1;
+            continue;
+        }
+
+        const char *word = read_word(ev, &cmd, &p, end);
+        if (!word) {
+            raise_verdict(ev, SAFETY_CONFIRM, "command too long to check", NULL);
+            break;
+        }
+        if (define_next) {
+            define_function(ev, word);
+            define_next = 0;
+            command_reset(&cmd);
+            continue;
+        }
+        if (cmd.argc == 0 && !cmd.redirect_count) {
+            if (strcmp(word, "function") == 0) {
+                define_next = 1;
+                cmd.used = 0;
+                continue;
+            }
+            if (keyword(ev, word)) {
+                cmd.used = 0;
+                continue;
+            }
+        }
+        if (cmd.argc == POLICY_MAX_WORDS) {
+            raise_verdict(ev, SAFETY_CONFIRM, "too many arguments to check", NULL);
+            break;
+        }
+        cmd.argv[cmd.argc++] = word;
+    }
+    if (ev->verdict != SAFETY_BLOCK) {
+        finish_command(ev, &cmd, in_pipe ? piped_from : NULL, NULL, 0);
+    }
+    ev->depth--;
+}
+
+/* SAFETY_ALLOW, SAFETY_CONFIRM or SAFETY_BLOCK for COMMAND; REASON gets
+ * the program and the rule's reason for anything but SAFETY_ALLOW */
+int safety_policy_check(const char *command, char *reason, size_t reason_size) {
+    policy_eval_t ev;
+
+    if (reason && reason_size) {
+        reason[0] = '\0';
+    }
+    if (!command) {
+        return SAFETY_ALLOW;
+    }
+
+    policy_index(config_get());
+    memset(&ev, 0, sizeof(ev));
+    evaluate(&ev, command, strlen(command));
+
+    if (ev.verdict != SAFETY_ALLOW && reason && reason_size) {
+        if (ev.subject[0]) {
+            snprintf(reason, reason_size, "%s: %s", ev.subject, ev.reason);
+        } else {
+            snprintf(reason, reason_size, "%s", ev.reason);
+        }
+    }
+    return ev.verdict;
+}
@@ -0,0 +1,277 @@
+/*
+ * Shared Read-Only Cache for AI-OS Clients
+ * File: userspace/daemon/shared_cache.c
+ *
+ * Publishes answers that are the same for every shell on the host (daemon
+ * status, rule-based classifications, recent interpretations) into a file
+ * that clients map read-only, so the commonest queries need no IPC. The
+ * layout and the per-record seqlock protocol are in ai_os_cache.h. The
+ * file is built under a temporary name and renamed into place, so a client
+ * never maps a half-initialised cache; a restarted daemon publishes a new
+ * file and clients holding the old one notice its status going stale.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <grp.h>
+#include "../ai_os_common.h"
+#include "../ai_os_cache.h"
+#include "../ai_os_log.h"
+
+#define SHARED_CACHE_REFRESH_SEC 2
+
+static struct {
+    ai_os_cache_t *map;
+    pthread_mutex_t mutex;              /* one writer at a time */
+    pthread_cond_t stop_cond;
+    pthread_t refresher;
+    int running;
+    int (*status_fn)(char *buf, size_t size);
+} cache_state = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .stop_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/shared_cache.log", 0);
+static void shared_cache_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+/* Seqlock write side; caller holds the mutex */
+static void seq_begin(unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static void copy_field(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(src, size - 1);
+    memcpy(dst, src, len);
+    memset(dst + len, 0, size - len);
+}
+
+/* Slot holding key, else the first free or expired slot in its probe
+ * window, else the one closest to expiry */
+static ai_os_cache_entry_t *find_slot(unsigned int kind, unsigned int hash, const char *key, time_t now) {
+    ai_os_cache_entry_t *victim = NULL;
+
+    for (int i = 0; i < AI_OS_CACHE_PROBE; i++) {
+        ai_os_cache_entry_t *e = &cache_state.map->entries[(hash + i) & (AI_OS_CACHE_ENTRIES - 1)];
+        if (e->kind == kind && e->hash == hash && strcmp(e->key, key) == 0) {
+            return e;
+        }
+        if (victim && (victim->kind == AI_OS_CACHE_EMPTY || victim->expires <= now)) {
+            continue;
+        }
+        if (!victim || e->kind == AI_OS_CACHE_EMPTY || e->expires <= now || e->expires < victim->expires) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+static void publish_status_locked(const char *status_json) {
+    ai_os_cache_t *map = cache_state.map;
+
+    seq_begin(&map->status_seq);
+    copy_field(map->status, status_json, sizeof(map->status));
+    map->status_updated = status_json[0] ? time(NULL) : 0;
+    seq_end(&map->status_seq);
+}
+
+/* Replace the status record; an empty string withdraws it */
+void shared_cache_publish_status(const char *status_json) {
+    if (!cache_state.map || !status_json) {
+        return;
+    }
+    if (strlen(status_json) >= AI_OS_CACHE_STATUS_SIZE) {
+        return;
+    }
+    pthread_mutex_lock(&cache_state.mutex);
+    publish_status_locked(status_json);
+    pthread_mutex_unlock(&cache_state.mutex);
+}
+
+/* Publish an answer clients may reuse for AI_OS_CACHE_ENTRY_TTL seconds */
+void shared_cache_put(unsigned int kind, const char *key, const char *value, int result_code) {
+    if (!cache_state.map || !key || !*key || !value) {
+        return;
+    }
+    if (strlen(key) >= AI_OS_CACHE_KEY_SIZE || strlen(value) >= AI_OS_CACHE_VALUE_SIZE) {
+        return; /* clients would not find a truncated key anyway */
+    }
+
+    unsigned int hash = ai_os_cache_hash(kind, key);
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&cache_state.mutex);
+    ai_os_cache_entry_t *e = find_slot(kind, hash, key, now);
+    seq_begin(&e->seq);
+    e->kind = kind;
+    e->hash = hash;
+    e->result_code = result_code;
+    e->expires = now + AI_OS_CACHE_ENTRY_TTL;
+    copy_field(e->key, key, sizeof(e->key));
+    copy_field(e->value, value, sizeof(e->value));
+    seq_end(&e->seq);
+    pthread_mutex_unlock(&cache_state.mutex);
+}
+
+/* Drop every entry of one kind, e.g. interpretations after a model change */
+void shared_cache_invalidate(unsigned int kind) {
+    if (!cache_state.map) {
+        return;
+    }
+    pthread_mutex_lock(&cache_state.mutex);
+    for (int i = 0; i < AI_OS_CACHE_ENTRIES; i++) {
+        ai_os_cache_entry_t *e = &cache_state.map->entries[i];
+        if (e->kind == kind) {
+            seq_begin(&e->seq);
+            e->kind = AI_OS_CACHE_EMPTY;
+            e->key[0] = '\0';
+            seq_end(&e->seq);
+        }
+    }
+    pthread_mutex_unlock(&cache_state.mutex);
+}
+
+/* Rebuild the status record now rather than at the next refresh */
+void shared_cache_refresh_status(void) {
+    char status[AI_OS_CACHE_STATUS_SIZE];
+
+    if (cache_state.status_fn && cache_state.status_fn(status, sizeof(status)) == 0) {
+        shared_cache_publish_status(status);
+    }
+}
+
+static void *refresher_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&cache_state.mutex);
+    while (cache_state.running) {
+        pthread_mutex_unlock(&cache_state.mutex);
+        shared_cache_refresh_status();
+        pthread_mutex_lock(&cache_state.mutex);
+
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += SHARED_CACHE_REFRESH_SEC;
+        while (cache_state.running &&
+               pthread_cond_timedwait(&cache_state.stop_cond, &cache_state.mutex, &wake) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&cache_state.mutex);
+    return NULL;
+}
+
+/* Create the cache file and start refreshing the status record from
+ * status_fn, which fills buf with the status action's reply */
+int shared_cache_init(int (*status_fn)(char *buf, size_t size)) {
+    char tmp_path[128];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", AI_OS_CACHE_PATH, (int)getpid());
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        shared_cache_log("Shared cache: cannot create %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    /* Users' requests are in it: readable by the cache group only */
+    struct group *group = getgrnam(AI_OS_CACHE_GROUP);
+    if (group && fchown(fd, (uid_t)-1, group->gr_gid) != 0) {
+        shared_cache_log("Shared cache: cannot give %s to group %s: %s\n", tmp_path, AI_OS_CACHE_GROUP,
+                         strerror(errno));
+        group = NULL;
+    }
+    if (fchmod(fd, group ? 0640 : 0600) != 0 || ftruncate(fd, sizeof(ai_os_cache_t)) != 0) {
+        shared_cache_log("Shared cache: cannot size %s: %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    ai_os_cache_t *map = mmap(NULL, sizeof(ai_os_cache_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shared_cache_log("Shared cache: mmap failed: %s\n", strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* ftruncate zero-filled everything else */
+    map->magic = AI_OS_CACHE_MAGIC;
+    map->version = AI_OS_CACHE_VERSION;
+    map->entry_count = AI_OS_CACHE_ENTRIES;
+    map->entry_size = sizeof(ai_os_cache_entry_t);
+    map->daemon_pid = getpid();
+
+    if (rename(tmp_path, AI_OS_CACHE_PATH) != 0) {
+        shared_cache_log("Shared cache: cannot publish %s: %s\n", AI_OS_CACHE_PATH, strerror(errno));
+        munmap(map, sizeof(ai_os_cache_t));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cache_state.stop_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    cache_state.map = map;
+    cache_state.status_fn = status_fn;
+    if (status_fn) {
+        cache_state.running = 1;
+        if (pthread_create(&cache_state.refresher, NULL, refresher_thread, NULL) != 0) {
+            shared_cache_log("Shared cache: cannot start refresher, status will not be cached\n");
+            cache_state.running = 0;
+        }
+    }
+
+    shared_cache_log("Shared cache: published %s (%zu bytes)\n", AI_OS_CACHE_PATH, sizeof(ai_os_cache_t));
+    return 0;
+}
+
+/* Mark the status stale so clients fall back to the socket, then unmap.
+ * The file stays so clients never map a missing path mid-read. */
+void shared_cache_cleanup(void) {
+    if (!cache_state.map) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_state.mutex);
+    int had_thread = cache_state.running;
+    cache_state.running = 0;
+    pthread_cond_broadcast(&cache_state.stop_cond);
+    pthread_mutex_unlock(&cache_state.mutex);
+    if (had_thread) {
+        pthread_join(cache_state.refresher, NULL);
+    }
+
+    pthread_mutex_lock(&cache_state.mutex);
+    publish_status_locked("");
+    for (int i = 0; i < AI_OS_CACHE_ENTRIES; i++) {
+        ai_os_cache_entry_t *e = &cache_state.map->entries[i];
+        seq_begin(&e->seq);
+        e->kind = AI_OS_CACHE_EMPTY;
+        seq_end(&e->seq);
+    }
+    munmap(cache_state.map, sizeof(ai_os_cache_t));
+    cache_state.map = NULL;
+    pthread_mutex_unlock(&cache_state.mutex);
+}
@@ -0,0 +1,974 @@
+/*
+ * Shell Syntax Check for AI-OS
+ * File: userspace/daemon/shell_syntax.c
+ *
+ * Vets what the model returns before it is handed out as a command. A
+ * reply is first cut down to its command, deterministically: the body of
+ * a markdown fence is kept, shell prompts and "Command:" labels are
+ * dropped, and so are explanation lines before the command and anything
+ * from the first blank or explanation line after it; an explanation with the
+ * command in `inline code` gives up that code. What is left must then
+ * parse as POSIX/bash: quotes, substitutions, [[ ]] and here-documents
+ * closed, no pipe or list operator without a command on either side, and
+ * if/fi, do/done, case/esac, braces and subshells paired with non-empty
+ * bodies. Only a reply with nothing in it that parses costs a second
+ * generation, which ollama_client.c asks for with a stricter prompt.
+ *
+ * The check is a single pass over the text with a small stack of open
+ * compound commands, recursing into $(...) and backticks. Nothing is
+ * expanded or allocated.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "../ai_os_common.h"
+
+#define SYNTAX_MAX_NESTING 16
+#define SYNTAX_MAX_DEPTH 4          /* $(...) inside each other */
+#define SYNTAX_MAX_HEREDOCS 4
+
+enum frame_kind {
+    FRAME_SCRIPT,
+    FRAME_IF,
+    FRAME_LOOP,                     /* while, until */
+    FRAME_FOR,                      /* for, select */
+    FRAME_CASE,
+    FRAME_BRACE,
+    FRAME_SUBSHELL
+};
+
+enum frame_phase {
+    PHASE_BODY,
+    PHASE_COND,                     /* if, elif, while, until: up to then/do */
+    PHASE_ELSE,
+    PHASE_NAME,                     /* for NAME, case WORD */
+    PHASE_IN,                       /* for NAME [in ...], case WORD in */
+    PHASE_WORDS,                    /* for NAME in WORDS */
+    PHASE_DO,                       /* for NAME in WORDS; do */
+    PHASE_PATTERN                   /* case patterns up to ')' */
+};
+
+typedef struct {
+    unsigned char kind;
+    unsigned char phase;
+    int commands;                   /* in the current clause */
+} syntax_frame_t;
+
+typedef struct {
+    syntax_frame_t frames[SYNTAX_MAX_NESTING];
+    int top;                        /* frames[0] is the script itself */
+    int words;                      /* of the current simple command, redirections included */
+    int need_command;               /* after | && || ! and the keywords that open a clause */
+    int closed;                     /* a compound command just ended; no word may follow */
+    int patterns;                   /* case: 0 none yet, 1 after a pattern, 2 after '|' */
+    int function;                   /* 1 after `function`, 2 after its name */
+    int heredoc_count;
+    char heredocs[SYNTAX_MAX_HEREDOCS][64];
+    int heredoc_tabs[SYNTAX_MAX_HEREDOCS];
+    char last_op[4];
+    int depth;
+    char *reason;
+    size_t reason_size;
+    int failed;
+} syntax_t;
+
+static int check(const char *s, size_t len, int depth, char *reason, size_t reason_size);
+
+/* Record the first error only; always -1 */
+static int fail(syntax_t *sx, const char *what, const char *token, size_t token_len) {
+    if (!sx->failed && sx->reason && sx->reason_size) {
+        if (token) {
+            snprintf(sx->reason, sx->reason_size, "%s '%.*s'", what, (int)(token_len > 24 ? 24 : token_len), token);
+        } else {
+            snprintf(sx->reason, sx->reason_size, "%s", what);
+        }
+    }
+    sx->failed = 1;
+    return -1;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static int is_word_end(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' || c == '|' ||
+           c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+/* A redirection operator at P: [n]>, >>, >|, <, <<, <<-, <<<, <>, &>, &>>, >&, <& */
+static int redirect_length(const char *p, const char *end) {
+    const char *q = p;
+    while (q < end && *q >= '0' && *q <= '9') q++;
+    if (q == p && q < end && *q == '&' && q + 1 < end && q[1] == '>') {
+        q += 2;
+        return (int)(q - p) + (q < end && *q == '>');
+    }
+    if (q >= end || (*q != '<' && *q != '>')) {
+        return 0;
+    }
+    char op = *q++;
+    while (q < end && (*q == op || *q == '|' || *q == '&' || (op == '<' && *q == '>')) && q - p < 4) q++;
+    if (op == '<' && q - p == 2 && q < end && *q == '-') q++;
+    return (int)(q - p);
+}
+
+/* The close of the construct opened just before P, minding quotes; END if none */
+static const char *matching_close(const char *p, const char *end, char open, char close) {
+    int depth = 1;
+    while (p < end) {
+        char c = *p;
+        if (c == '\\') {
+            p += 2;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            const char *q = p + 1;
+            while (q < end && *q != c) q += (c == '"' && *q == '\\') ? 2 : 1;
+            p = q < end ? q + 1 : end;
+            continue;
+        }
+        if (c == open) {
+            depth++;
+        } else if (c == close && --depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+static const char *scan_dollar(syntax_t *sx, const char *p, const char *end);
+
+/* "..." from the opening quote at P; past the close, or NULL */
+static const char *scan_double(syntax_t *sx, const char *p, const char *end) {
+    p++;
+    while (p < end && *p != '"') {
+        if (*p == '\\') {
+            p += 2;
+        } else if ((*p == '$' && p + 1 < end && (p[1] == '(' || p[1] == '{')) || *p == '`') {
+            if (!(p = scan_dollar(sx, p, end))) return NULL;
+        } else {
+            p++;
+        }
+    }
+    if (p >= end) {
+        fail(sx, "unterminated double quote", NULL, 0);
+        return NULL;
+    }
+    return p + 1;
+}
+
+/* $..., ${...}, $(...), $((...)), $'...' or `...` at P; past it, or NULL.
+ * Command substitutions are checked as command lines of their own */
+static const char *scan_dollar(syntax_t *sx, const char *p, const char *end) {
+    const char *start = p;
+    if (*p == '`') {
+        const char *q = p + 1;
+        while (q < end && *q != '`') q += *q == '\\' ? 2 : 1;
+        if (q >= end) {
+            fail(sx, "unterminated backquote", NULL, 0);
+            return NULL;
+        }
+        if (check(p + 1, (size_t)(q - p - 1), sx->depth + 1, sx->reason, sx->reason_size) != 0) {
+            sx->failed = 1;
+            return NULL;
+        }
+        return q + 1;
+    }
+    if (p + 1 >= end) {
+        return end;
+    }
+    switch (p[1]) {
+    case '\'': {
+        const char *q = p + 2;
+        while (q < end && *q != '\'') q += *q == '\\' ? 2 : 1;
+        if (q >= end) {
+            fail(sx, "unterminated $'...' quote", NULL, 0);
+            return NULL;
+        }
+        return q + 1;
+    }
+    case '{': {
+        const char *q = matching_close(p + 2, end, '{', '}');
+        if (q >= end) {
+            fail(sx, "unterminated", start, 2);
+            return NULL;
+        }
+        return q + 1;
+    }
+    case '(': {
+        const char *q = matching_close(p + 2, end, '(', ')');
+        if (q >= end) {
+            fail(sx, "unterminated", start, p + 2 < end && p[2] == '(' ? 3 : 2);
+            return NULL;
+        }
+        if (p + 2 < end && p[2] == '(') {
+            return q + 1;   /* arithmetic */
+        }
+        if (check(p + 2, (size_t)(q - p - 2), sx->depth + 1, sx->reason, sx->reason_size) != 0) {
+            sx->failed = 1;
+            return NULL;
+        }
+        return q + 1;
+    }
+    default:
+        return p + 1;
+    }
+}
+
+/* One word from P; past it, or NULL. *PLAIN is set when it has no
+ * quoting or expansion, so it can be a reserved word */
+static const char *scan_word(syntax_t *sx, const char *p, const char *end, int *plain) {
+    const char *start = p;
+    *plain = 1;
+    while (p < end) {
+        char c = *p;
+        if (c == '(' && p > start && p[-1] == '=') {
+            /* name=(array elements) */
+            const char *q = matching_close(p + 1, end, '(', ')');
+            if (q >= end) {
+                fail(sx, "unterminated array at", start, (size_t)(p - start) + 1);
+                return NULL;
+            }
+            p = q + 1;
+            *plain = 0;
+            continue;
+        }
+        if (is_word_end(c)) {
+            break;
+        }
+        if (c == '\\') {
+            p += p + 1 < end ? 2 : 1;
+            *plain = 0;
+        } else if (c == '\'') {
+            const char *q = memchr(p + 1, '\'', (size_t)(end - p - 1));
+            if (!q) {
+                fail(sx, "unterminated single quote", NULL, 0);
+                return NULL;
+            }
+            p = q + 1;
+            *plain = 0;
+        } else if (c == '"') {
+            if (!(p = scan_double(sx, p, end))) return NULL;
+            *plain = 0;
+        } else if (c == '$' || c == '`') {
+            if (!(p = scan_dollar(sx, p, end))) return NULL;
+            *plain = 0;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+static int word_is(const char *w, size_t len, const char *keyword) {
+    return strlen(keyword) == len && memcmp(w, keyword, len) == 0;
+}
+
+static int valid_name(const char *w, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)w[0]) || w[0] == '_')) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!isalnum((unsigned char)w[i]) && w[i] != '_') return 0;
+    }
+    return 1;
+}
+
+static syntax_frame_t *frame(syntax_t *sx) {
+    return &sx->frames[sx->top];
+}
+
+/* A command starts here: the enclosing clause is no longer empty */
+static int begin_command(syntax_t *sx) {
+    frame(sx)->commands++;
+    sx->need_command = 0;
+    sx->closed = 0;
+    return 0;
+}
+
+static int push(syntax_t *sx, int kind, int phase, const char *word, size_t len) {
+    if (sx->top + 1 >= SYNTAX_MAX_NESTING) {
+        return fail(sx, "nested too deeply at", word, len);
+    }
+    begin_command(sx);
+    sx->top++;
+    frame(sx)->kind = (unsigned char)kind;
+    frame(sx)->phase = (unsigned char)phase;
+    frame(sx)->commands = 0;
+    sx->need_command = phase == PHASE_BODY || phase == PHASE_COND;
+    sx->words = 0;
+    return 0;
+}
+
+static void pop(syntax_t *sx) {
+    sx->top--;
+    sx->closed = 1;
+    sx->words = 0;
+    sx->need_command = 0;
+}
+
+/* Enter the next clause of the innermost frame */
+static void next_clause(syntax_t *sx, int phase) {
+    frame(sx)->phase = (unsigned char)phase;
+    frame(sx)->commands = 0;
+    sx->need_command = 1;
+    sx->words = 0;
+}
+
+/* A reserved word at command position; 1 if W was one, -1 on error */
+static int keyword(syntax_t *sx, const char *w, size_t len) {
+    syntax_frame_t *f = frame(sx);
+    int clause_done = f->commands > 0 && !sx->need_command;
+
+    if (word_is(w, len, "if")) return push(sx, FRAME_IF, PHASE_COND, w, len) ? -1 : 1;
+    if (word_is(w, len, "while") || word_is(w, len, "until")) {
+        return push(sx, FRAME_LOOP, PHASE_COND, w, len) ? -1 : 1;
+    }
+    if (word_is(w, len, "for") || word_is(w, len, "select")) {
+        return push(sx, FRAME_FOR, PHASE_NAME, w, len) ? -1 : 1;
+    }
+    if (word_is(w, len, "case")) return push(sx, FRAME_CASE, PHASE_NAME, w, len) ? -1 : 1;
+    if (word_is(w, len, "{")) return push(sx, FRAME_BRACE, PHASE_BODY, w, len) ? -1 : 1;
+    if (word_is(w, len, "!")) {
+        sx->need_command = 1;
+        return 1;
+    }
+    if (word_is(w, len, "function")) {
+        sx->function = 1;
+        return 1;
+    }
+
+    if (word_is(w, len, "then") && f->kind == FRAME_IF && f->phase == PHASE_COND && clause_done) {
+        next_clause(sx, PHASE_BODY);
+    } else if ((word_is(w, len, "elif") || word_is(w, len, "else")) &&
+               f->kind == FRAME_IF && f->phase == PHASE_BODY && clause_done) {
+        next_clause(sx, w[2] == 'i' ? PHASE_COND : PHASE_ELSE);
+    } else if (word_is(w, len, "fi") && f->kind == FRAME_IF &&
+               (f->phase == PHASE_BODY || f->phase == PHASE_ELSE) && clause_done) {
+        pop(sx);
+    } else if (word_is(w, len, "do") && f->kind == FRAME_LOOP && f->phase == PHASE_COND && clause_done) {
+        next_clause(sx, PHASE_BODY);
+    } else if (word_is(w, len, "done") && (f->kind == FRAME_LOOP || f->kind == FRAME_FOR) &&
+               f->phase == PHASE_BODY && clause_done) {
+        pop(sx);
+    } else if (word_is(w, len, "}") && f->kind == FRAME_BRACE && clause_done) {
+        pop(sx);
+    } else if (word_is(w, len, "esac") && f->kind == FRAME_CASE && f->phase == PHASE_BODY &&
+               !sx->need_command) {
+        pop(sx);
+    } else if (word_is(w, len, "then") || word_is(w, len, "elif") || word_is(w, len, "else") ||
+               word_is(w, len, "fi") || word_is(w, len, "do") || word_is(w, len, "done") ||
+               word_is(w, len, "}") || word_is(w, len, "esac") || word_is(w, len, "in")) {
+        return fail(sx, "unexpected", w, len);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* [[ ... ]] from just past the opening word; past the close, or NULL */
+static const char *scan_test(syntax_t *sx, const char *p, const char *end, const char *start) {
+    while (p < end) {
+        char c = *p;
+        if (is_blank(c) || c == '\n') {
+            p++;
+        } else if (c == '(' || c == ')' || c == '<' || c == '>' || c == '!') {
+            p++;
+        } else if ((c == '&' || c == '|') && p + 1 < end && p[1] == c) {
+            p += 2;
+        } else if (c == ']' && p + 1 < end && p[1] == ']' && (p + 2 == end || is_word_end(p[2]))) {
+            return p + 2;
+        } else if (c == ';' || c == '&' || c == '|') {
+            fail(sx, "unexpected", p, 1);
+            return NULL;
+        } else {
+            int plain;
+            const char *q = scan_word(sx, p, end, &plain);
+            if (!q) return NULL;
+            p = q;
+        }
+    }
+    fail(sx, "missing ']]' for", start, 2);
+    return NULL;
+}
+
+/* A word in the current state; -1 on error */
+static int word(syntax_t *sx, const char *w, size_t len, int plain) {
+    syntax_frame_t *f = frame(sx);
+
+    if (f->kind == FRAME_FOR && f->phase != PHASE_BODY) {
+        if (f->phase == PHASE_NAME) {
+            if (!valid_name(w, len)) return fail(sx, "bad loop variable", w, len);
+            f->phase = PHASE_IN;
+        } else if (f->phase == PHASE_IN && plain && word_is(w, len, "in")) {
+            f->phase = PHASE_WORDS;
+        } else if ((f->phase == PHASE_IN || f->phase == PHASE_DO) && plain && word_is(w, len, "do")) {
+            next_clause(sx, PHASE_BODY);
+        } else if (f->phase != PHASE_WORDS) {
+            return fail(sx, "expected 'do' before", w, len);
+        }
+        return 0;
+    }
+    if (f->kind == FRAME_CASE && f->phase != PHASE_BODY) {
+        if (f->phase == PHASE_NAME) {
+            f->phase = PHASE_IN;
+        } else if (f->phase == PHASE_IN) {
+            if (!plain || !word_is(w, len, "in")) return fail(sx, "expected 'in' before", w, len);
+            f->phase = PHASE_PATTERN;
+            sx->patterns = 0;
+        } else if (sx->patterns == 0 && plain && word_is(w, len, "esac")) {
+            pop(sx);
+        } else if (sx->patterns == 1) {
+            return fail(sx, "expected ')' before", w, len);
+        } else {
+            sx->patterns = 1;
+        }
+        return 0;
+    }
+    if (sx->function == 1) {
+        if (!plain) return fail(sx, "bad function name", w, len);
+        sx->function = 2;
+        return 0;
+    }
+    if (sx->function == 2) {
+        sx->function = 0;   /* function name { ...; }: the body follows */
+    }
+
+    if (sx->closed) {
+        return fail(sx, "unexpected word", w, len);
+    }
+    if (sx->words == 0 && plain) {
+        int k = keyword(sx, w, len);
+        if (k) return k < 0 ? -1 : 0;
+    }
+    if (sx->words == 0) {
+        begin_command(sx);
+    }
+    sx->words++;
+    return 0;
+}
+
+/* |, |&, && or ||: needs a command on the left, takes one on the right */
+static int binary_operator(syntax_t *sx, const char *op, size_t len) {
+    if ((sx->words == 0 && !sx->closed) || sx->need_command || frame(sx)->phase > PHASE_ELSE) {
+        return fail(sx, "unexpected", op, len);
+    }
+    snprintf(sx->last_op, sizeof(sx->last_op), "%.*s", (int)len, op);
+    sx->words = 0;
+    sx->closed = 0;
+    sx->need_command = 1;
+    return 0;
+}
+
+/* ; or & or a newline ending a command; -1 on error */
+static int end_command(syntax_t *sx, const char *op, int newline) {
+    syntax_frame_t *f = frame(sx);
+
+    if (f->kind == FRAME_FOR && f->phase != PHASE_BODY) {
+        if (*op == '&' || f->phase == PHASE_NAME) return fail(sx, "unexpected", op, 1);
+        if (f->phase == PHASE_IN || f->phase == PHASE_WORDS) f->phase = PHASE_DO;
+        return 0;
+    }
+    if (f->kind == FRAME_CASE && f->phase != PHASE_BODY) {
+        if (!newline || f->phase == PHASE_NAME) return fail(sx, "unexpected", op, 1);
+        return 0;
+    }
+    if (sx->function) {
+        if (!newline) return fail(sx, "unexpected", op, 1);
+        return 0;
+    }
+    if (sx->need_command || (sx->words == 0 && !sx->closed)) {
+        if (newline) return 0;
+        return fail(sx, "unexpected", op, 1);
+    }
+    sx->words = 0;
+    sx->closed = 0;
+    return 0;
+}
+
+/* Past the line that closes a here-document starting at P, or NULL */
+static const char *heredoc_end(const char *p, const char *end, const char *delimiter, int tabs) {
+    size_t len = strlen(delimiter);
+    while (p < end) {
+        const char *line = p;
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+        while (tabs && line < eol && *line == '\t') line++;
+        p = nl ? nl + 1 : end;
+        if ((size_t)(eol - line) == len && memcmp(line, delimiter, len) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* The here-document delimiter in W..W+LEN with its quotes removed */
+static void add_heredoc(syntax_t *sx, const char *w, size_t len, int tabs) {
+    if (sx->heredoc_count == SYNTAX_MAX_HEREDOCS) {
+        return;
+    }
+    char *out = sx->heredocs[sx->heredoc_count];
+    size_t n = 0;
+    for (size_t i = 0; i < len && n < sizeof(sx->heredocs[0]) - 1; i++) {
+        if (w[i] != '\'' && w[i] != '"' && w[i] != '\\') out[n++] = w[i];
+    }
+    out[n] = '\0';
+    sx->heredoc_tabs[sx->heredoc_count++] = tabs;
+}
+
+/* What is still open at the end of the text */
+static int check_end(syntax_t *sx) {
+    static const char *const missing[] = {
+        [FRAME_IF] = "missing 'fi'", [FRAME_LOOP] = "missing 'done'", [FRAME_FOR] = "missing 'done'",
+        [FRAME_CASE] = "missing 'esac'", [FRAME_BRACE] = "missing '}'", [FRAME_SUBSHELL] = "missing ')'"
+    };
+    syntax_frame_t *f = frame(sx);
+
+    if (sx->heredoc_count) {
+        return fail(sx, "here-document not terminated:", sx->heredocs[0], strlen(sx->heredocs[0]));
+    }
+    if (sx->top > 0) {
+        if (f->kind == FRAME_IF && f->phase == PHASE_COND) return fail(sx, "missing 'then'", NULL, 0);
+        if ((f->kind == FRAME_LOOP || f->kind == FRAME_FOR) && f->phase != PHASE_BODY) {
+            return fail(sx, "missing 'do'", NULL, 0);
+        }
+        return fail(sx, missing[f->kind], NULL, 0);
+    }
+    if (sx->function) {
+        return fail(sx, "function without a body", NULL, 0);
+    }
+    if (sx->need_command) {
+        if (sx->last_op[0]) return fail(sx, "command ends after", sx->last_op, strlen(sx->last_op));
+        return fail(sx, "command ends early", NULL, 0);
+    }
+    if (sx->depth == 0 && f->commands == 0) {
+        return fail(sx, "no command", NULL, 0);
+    }
+    return 0;
+}
+
+/* 0 if S..S+LEN parses as a command line; otherwise -1 and REASON */
+static int check(const char *s, size_t len, int depth, char *reason, size_t reason_size) {
+    syntax_t sx;
+    const char *p = s;
+    const char *end = s + len;
+
+    memset(&sx, 0, sizeof(sx));
+    sx.depth = depth;
+    sx.reason = reason;
+    sx.reason_size = reason_size;
+    if (depth > SYNTAX_MAX_DEPTH) {
+        return fail(&sx, "substitutions nested too deeply", NULL, 0);
+    }
+
+    while (p < end && !sx.failed) {
+        char c = *p;
+        if (is_blank(c) || c == '\r' || (c == '\\' && p + 1 < end && p[1] == '\n')) {
+            p += c == '\\' ? 2 : 1;
+            continue;
+        }
+        if (c == '#') {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            p = nl ? nl : end;
+            continue;
+        }
+        if (c == '\n') {
+            if (end_command(&sx, p, 1) != 0) break;
+            p++;
+            for (int h = 0; h < sx.heredoc_count; h++) {
+                const char *next = heredoc_end(p, end, sx.heredocs[h], sx.heredoc_tabs[h]);
+                if (!next) {
+                    fail(&sx, "here-document not terminated:", sx.heredocs[h], strlen(sx.heredocs[h]));
+                    break;
+                }
+                p = next;
+            }
+            sx.heredoc_count = 0;
+            continue;
+        }
+
+        if ((c == '<' || c == '>') && p + 1 < end && p[1] == '(') {
+            /* Process substitution: a word holding a command line */
+            const char *close = matching_close(p + 2, end, '(', ')');
+            if (close >= end) {
+                fail(&sx, "unterminated", p, 2);
+                break;
+            }
+            if (check(p + 2, (size_t)(close - p - 2), depth + 1, reason, reason_size) != 0) {
+                sx.failed = 1;
+                break;
+            }
+            if (word(&sx, p, (size_t)(close + 1 - p), 0) != 0) break;
+            p = close + 1;
+            continue;
+        }
+
+        int redirect = redirect_length(p, end);
+        if (redirect) {
+            const char *op = p;
+            int heredoc = memmem(op, (size_t)redirect, "<<", 2) && !memmem(op, (size_t)redirect, "<<<", 3);
+            int tabs = heredoc && op[redirect - 1] == '-';
+            int plain;
+            p += redirect;
+            while (p < end && is_blank(*p)) p++;
+            const char *target = p;
+            if (p >= end || is_word_end(*p)) {
+                fail(&sx, "missing redirection target after", op, (size_t)redirect);
+                break;
+            }
+            if (!(p = scan_word(&sx, p, end, &plain))) break;
+            if (heredoc) {
+                add_heredoc(&sx, target, (size_t)(p - target), tabs);
+            }
+            if (frame(&sx)->phase > PHASE_ELSE || sx.function) {
+                fail(&sx, "unexpected", op, (size_t)redirect);
+                break;
+            }
+            if (sx.words == 0 && !sx.closed) {
+                begin_command(&sx);
+            }
+            if (!sx.closed) sx.words++;
+            continue;
+        }
+
+        if (c == '|' || (c == '&' && p + 1 < end && p[1] == '&')) {
+            size_t n = (p + 1 < end && (p[1] == c || (c == '|' && p[1] == '&'))) ? 2 : 1;
+            syntax_frame_t *f = frame(&sx);
+            if (c == '|' && n == 1 && f->kind == FRAME_CASE && f->phase == PHASE_PATTERN) {
+                if (sx.patterns != 1) {
+                    fail(&sx, "unexpected", p, 1);
+                    break;
+                }
+                sx.patterns = 2;
+            } else if (binary_operator(&sx, p, n) != 0) {
+                break;
+            }
+            p += n;
+            continue;
+        }
+
+        if (c == ';' || c == '&') {
+            syntax_frame_t *f = frame(&sx);
+            if (c == ';' && p + 1 < end && (p[1] == ';' || p[1] == '&')) {
+                /* ;; ;& ;;& end a case item */
+                size_t n = p[1] == ';' && p + 2 < end && p[2] == '&' ? 3 : 2;
+                if (f->kind != FRAME_CASE || f->phase != PHASE_BODY || sx.need_command) {
+                    fail(&sx, "unexpected", p, n);
+                    break;
+                }
+                f->phase = PHASE_PATTERN;
+                sx.patterns = 0;
+                sx.words = 0;
+                sx.closed = 0;
+                p += n;
+                continue;
+            }
+            if (end_command(&sx, p, 0) != 0) break;
+            p++;
+            continue;
+        }
+
+        if (c == '(') {
+            syntax_frame_t *f = frame(&sx);
+            const char *q = p + 1;
+            while (q < end && is_blank(*q)) q++;
+            if (f->kind == FRAME_CASE && f->phase == PHASE_PATTERN && sx.patterns == 0) {
+                p++;
+            } else if (f->kind == FRAME_FOR && f->phase == PHASE_NAME && p + 1 < end && p[1] == '(') {
+                /* for (( init; test; step )) */
+                const char *close = matching_close(p + 1, end, '(', ')');
+                if (close >= end) {
+                    fail(&sx, "unterminated", p, 2);
+                    break;
+                }
+                f->phase = PHASE_DO;
+                p = close + 1;
+            } else if ((sx.words == 1 || sx.function == 2) && !sx.closed && q < end && *q == ')') {
+                /* name() compound-command */
+                sx.words = 0;
+                sx.function = 0;
+                sx.need_command = 1;
+                snprintf(sx.last_op, sizeof(sx.last_op), "()");
+                p = q + 1;
+            } else if (sx.words == 0 && !sx.closed && f->phase <= PHASE_ELSE && p + 1 < end && p[1] == '(') {
+                /* (( arithmetic )) */
+                const char *close = matching_close(p + 1, end, '(', ')');
+                if (close >= end) {
+                    fail(&sx, "unterminated", p, 2);
+                    break;
+                }
+                begin_command(&sx);
+                sx.closed = 1;
+                p = close + 1;
+            } else if (sx.words == 0 && !sx.closed && f->phase <= PHASE_ELSE && !sx.function) {
+                if (push(&sx, FRAME_SUBSHELL, PHASE_BODY, p, 1) != 0) break;
+                p++;
+            } else {
+                fail(&sx, "unexpected", p, 1);
+                break;
+            }
+            continue;
+        }
+
+        if (c == ')') {
+            syntax_frame_t *f = frame(&sx);
+            if (f->kind == FRAME_CASE && f->phase == PHASE_PATTERN && sx.patterns == 1) {
+                f->phase = PHASE_BODY;
+                f->commands = 0;
+                sx.words = 0;
+                sx.closed = 0;
+                sx.need_command = 0;
+            } else if (f->kind == FRAME_SUBSHELL && f->commands > 0 && !sx.need_command) {
+                pop(&sx);
+            } else {
+                fail(&sx, "unexpected", p, 1);
+                break;
+            }
+            p++;
+            continue;
+        }
+
+        int plain;
+        const char *start = p;
+        if (!(p = scan_word(&sx, p, end, &plain))) break;
+        if (plain && sx.words == 0 && !sx.closed && frame(&sx)->phase <= PHASE_ELSE && !sx.function &&
+            word_is(start, (size_t)(p - start), "[[")) {
+            begin_command(&sx);
+            if (!(p = scan_test(&sx, p, end, start))) break;
+            sx.closed = 1;
+            continue;
+        }
+        if (word(&sx, start, (size_t)(p - start), plain) != 0) break;
+    }
+
+    if (sx.failed) {
+        return -1;
+    }
+    return check_end(&sx);
+}
+
+/* 0 if COMMAND parses as a shell command line; otherwise -1 and REASON */
+int shell_syntax_check(const char *command, char *reason, size_t reason_size) {
+    if (reason && reason_size) {
+        reason[0] = '\0';
+    }
+    if (!command) {
+        return -1;
+    }
+    return check(command, strlen(command), 0, reason, reason_size);
+}
+
+/* A word of running text: lowercase letters, maybe an apostrophe and one
+ * trailing punctuation mark ("it's", "this,"), no digits, dots or dashes */
+static int is_plain_word(const char *word, size_t len) {
+    if (len > 1 && strchr(",.;!?", word[len - 1])) {
+        len--;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!islower((unsigned char)word[i]) && word[i] != '\'') {
+            return 0;
+        }
+    }
+    return len > 0;
+}
+
+/* A line of explanation rather than a command: it ends in a colon, or it
+ * opens with a capitalised word ("Here", "I", "Sure,") and either ends a
+ * sentence or goes on in mostly plain words. A program with a capital
+ * letter still reads as one: `Rscript analyze.R --input data.csv` has no
+ * plain word after it */
+static int is_prose(const char *line, size_t len) {
+    size_t i = 0;
+
+    if (len && line[len - 1] == ':') {
+        return 1;
+    }
+    if (!len || !isupper((unsigned char)line[0])) {
+        return 0;
+    }
+    for (i = 1; i < len && (islower((unsigned char)line[i]) || line[i] == '\''); i++);
+    if (i == 1 && line[0] != 'I' && line[0] != 'A') {
+        return 0;                   /* R, X: a program, not a word */
+    }
+    if (i < len && line[i] == ',') {
+        i++;
+    }
+    if (i < len && !is_blank(line[i]) && !(i == len - 1 && strchr(".!?", line[i]))) {
+        return 0;
+    }
+    if (strchr(".!?", line[len - 1])) {
+        return 1;
+    }
+    int words = 0, plain = 0;
+    while (i < len) {
+        while (i < len && is_blank(line[i])) i++;
+        size_t word = i;
+        while (i < len && !is_blank(line[i])) i++;
+        if (i > word) {
+            words++;
+            plain += is_plain_word(line + word, i - word);
+        }
+    }
+    return plain && plain * 2 >= words;
+}
+
+static void trim(const char **s, size_t *len) {
+    while (*len && isspace((unsigned char)**s)) {
+        (*s)++;
+        (*len)--;
+    }
+    while (*len && isspace((unsigned char)(*s)[*len - 1])) {
+        (*len)--;
+    }
+}
+
+/* Line LINE with a shell prompt, label or wrapping backquotes removed */
+static void strip_line(const char **line, size_t *len) {
+    static const char *const labels[] = {"command:", "output:", "answer:", "shell:", "bash:", NULL};
+
+    for (int i = 0; labels[i]; i++) {
+        size_t n = strlen(labels[i]);
+        if (*len >= n && strncasecmp(*line, labels[i], n) == 0) {
+            *line += n;
+            *len -= n;
+            break;
+        }
+    }
+    trim(line, len);
+    if (*len >= 2 && (*line)[0] == '$' && is_blank((*line)[1])) {
+        *line += 2;
+        *len -= 2;
+        trim(line, len);
+    }
+    if (*len >= 2 && (*line)[0] == '`' && (*line)[*len - 1] == '`' && !memchr(*line + 1, '`', *len - 2)) {
+        (*line)++;
+        *len -= 2;
+    }
+}
+
+/* End of the line at P (its newline or END) */
+static const char *line_end(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    return nl ? nl : end;
+}
+
+/* S..S+LEN as the command, moved to the start of TEXT: SHELL_OUTPUT_VALID
+ * if that leaves TEXT as it was, SHELL_OUTPUT_REPAIRED if not, -1 if it
+ * does not parse */
+static int accept(char *text, const char *s, size_t len) {
+    trim(&s, &len);
+    if (len == 0 || check(s, len, 0, NULL, 0) != 0) {
+        return -1;
+    }
+    if (s == text && text[len] == '\0') {
+        return SHELL_OUTPUT_VALID;
+    }
+    memmove(text, s, len);
+    text[len] = '\0';
+    return SHELL_OUTPUT_REPAIRED;
+}
+
+/* A line that ends a command paragraph: empty or explanation */
+static int ends_paragraph(const char *line, size_t len) {
+    trim(&line, &len);
+    return len == 0 || is_prose(line, len);
+}
+
+/*
+ * Cut model output in TEXT down to one shell command, in place. Returns
+ * SHELL_OUTPUT_VALID if it was one as it stood, SHELL_OUTPUT_REPAIRED if
+ * fences, prompts or prose had to go, SHELL_OUTPUT_REJECTED (REASON set,
+ * TEXT untouched) if nothing in it parses.
+ */
+int shell_output_clean(char *text, char *reason, size_t reason_size) {
+    const char *s = text;
+    size_t len = strlen(text);
+    int outcome = -1;
+
+    if (reason && reason_size) {
+        reason[0] = '\0';
+    }
+
+    /* A markdown fence: its body is the answer */
+    const char *fence = strstr(text, "```");
+    if (fence) {
+        const char *body = line_end(fence, text + len);
+        const char *close = body < text + len ? strstr(body, "```") : NULL;
+        const char *stop = close ? close : text + len;
+        s = body < stop ? body : stop;
+        len = (size_t)(stop - s);
+    }
+    trim(&s, &len);
+
+    /* Explanation lines before the command go; inline code in them is
+     * kept as a last resort */
+    const char *end = s + len;
+    const char *p = s;
+    const char *inline_code = NULL;
+    size_t inline_len = 0;
+    while (p < end) {
+        const char *eol = line_end(p, end);
+        const char *line = p;
+        size_t line_len = (size_t)(eol - p);
+        trim(&line, &line_len);
+        if (line_len && !is_prose(line, line_len)) {
+            break;
+        }
+        const char *tick = line_len ? memchr(line, '`', line_len) : NULL;
+        const char *close = tick ? memchr(tick + 1, '`', (size_t)(line + line_len - tick - 1)) : NULL;
+        if (!inline_code && close && close > tick + 1) {
+            inline_code = tick + 1;
+            inline_len = (size_t)(close - tick - 1);
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+
+    if (p < end) {
+        /* The command runs to the first blank or prose line, or failing
+         * that (a here-document with blank lines) to the last line that
+         * is not prose, or is just the first line */
+        const char *first_end = line_end(p, end);
+        const char *cmd = p;
+        size_t first_len = (size_t)(first_end - p);
+        trim(&cmd, &first_len);
+        strip_line(&cmd, &first_len);
+
+        const char *para = first_end;
+        while (para < end) {
+            const char *eol = line_end(para + 1, end);
+            if (ends_paragraph(para + 1, (size_t)(eol - para - 1))) break;
+            para = eol;
+        }
+        const char *last = end;
+        while (last > para) {
+            const char *bol = last;
+            while (bol > para && bol[-1] != '\n') bol--;
+            if (!ends_paragraph(bol, (size_t)(last - bol))) break;
+            last = bol > para ? bol - 1 : para;
+        }
+
+        outcome = accept(text, cmd, para > first_end ? (size_t)(para - cmd) : first_len);
+        if (outcome < 0 && last > para) {
+            outcome = accept(text, cmd, (size_t)(last - cmd));
+        }
+        if (outcome < 0 && para > first_end) {
+            outcome = accept(text, cmd, first_len);
+        }
+        if (outcome == SHELL_OUTPUT_VALID && (fence || cmd != p)) {
+            outcome = SHELL_OUTPUT_REPAIRED;
+        }
+    }
+    if (outcome < 0 && inline_code) {
+        outcome = accept(text, inline_code, inline_len);
+    }
+    if (outcome >= 0) {
+        return outcome;
+    }
+
+    if (reason && reason_size && check(s, len, 0, reason, reason_size) == 0) {
+        snprintf(reason, reason_size, "%s", "reply is an explanation, not a command");
+    }
+    return SHELL_OUTPUT_REJECTED;
+}
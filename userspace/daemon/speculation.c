@@ -0,0 +1,416 @@
+/*
+ * Speculative Interpretation for AI-OS
+ * File: userspace/daemon/speculation.c
+ *
+ * Shells submit the line being edited with the `speculate` action. Each
+ * session owns one slot: a newer submission supersedes (and cancels) the
+ * previous one, and a repeat of the same text is deduplicated. A single
+ * worker thread interprets a slot once it has been quiet for the debounce
+ * interval, in the fair queue's background lane: only while the backend is
+ * otherwise idle, and given up as soon as a real request is waiting for
+ * it. Sessions are keyed by the submitting UID, and the work is charged
+ * to that user's share and rate like any other request. By the time the
+ * user presses Enter the `interpret` request can usually be answered from
+ * the slot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+
+#define SPECULATION_SLOTS 64
+#define SPECULATION_DEBOUNCE_MS 150   /* quiet time before a slot is started */
+#define SPECULATION_RETRY_MS 100      /* backend busy with interactive work */
+#define SPECULATION_TTL 30            /* seconds a result stays usable */
+#define SPECULATION_WAIT_SEC 20       /* interpret waiting on an in-flight slot */
+#define SPECULATION_TEXT_SIZE 1024
+
+enum spec_state {
+    SPEC_EMPTY = 0,
+    SPEC_PENDING,
+    SPEC_RUNNING,
+    SPEC_DONE
+};
+
+typedef struct {
+    char session[64];
+    uid_t uid;                        /* submitted by, charged for the backend */
+    int charged;                      /* took the user's token for this command */
+    char command[SPECULATION_TEXT_SIZE];
+    char context[SPECULATION_TEXT_SIZE];
+    char result[SPECULATION_TEXT_SIZE];
+    int result_code;
+    enum spec_state state;
+    unsigned long generation;
+    struct timespec not_before;       /* CLOCK_MONOTONIC */
+    time_t last_used;
+    time_t finished;
+} spec_slot_t;
+
+/* Handed to the cancel callback: stale once the slot moved on, or the
+ * backend is wanted for something else */
+typedef struct {
+    spec_slot_t *slot;
+    unsigned long generation;
+    fair_queue_ticket_t turn;
+} spec_ticket_t;
+
+static struct {
+    spec_slot_t slots[SPECULATION_SLOTS];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    pthread_t worker;
+    int running;
+} spec_state = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/speculation.log", 0);
+static void speculation_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+/* Trim and collapse whitespace so "list  files " matches "list files" */
+static void normalize_command(const char *in, char *out, size_t size) {
+    size_t len = 0;
+    int space = 0;
+
+    for (; *in && len < size - 1; in++) {
+        if (isspace((unsigned char)*in)) {
+            space = len > 0;
+            continue;
+        }
+        if (space && len < size - 2) {
+            out[len++] = ' ';
+        }
+        space = 0;
+        out[len++] = *in;
+    }
+    out[len] = '\0';
+}
+
+static void deadline_after_ms(struct timespec *ts, long ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Caller holds the mutex. Drop whatever the slot was doing; the worker
+ * notices the generation change from its cancel callback. */
+static void slot_reset(spec_slot_t *slot) {
+    slot->generation++;
+    slot->state = SPEC_EMPTY;
+    slot->charged = 0;
+    slot->command[0] = '\0';
+    pthread_cond_broadcast(&spec_state.done_cond);
+}
+
+static spec_slot_t *find_slot(const char *session) {
+    for (int i = 0; i < SPECULATION_SLOTS; i++) {
+        spec_slot_t *slot = &spec_state.slots[i];
+        if (slot->session[0] && strcmp(slot->session, session) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Free slot, else the least recently used one */
+static spec_slot_t *claim_slot(const char *session) {
+    spec_slot_t *victim = &spec_state.slots[0];
+
+    for (int i = 0; i < SPECULATION_SLOTS; i++) {
+        spec_slot_t *slot = &spec_state.slots[i];
+        if (!slot->session[0]) {
+            victim = slot;
+            break;
+        }
+        if (slot->last_used < victim->last_used) {
+            victim = slot;
+        }
+    }
+
+    slot_reset(victim);
+    strncpy(victim->session, session, sizeof(victim->session) - 1);
+    victim->session[sizeof(victim->session) - 1] = '\0';
+    return victim;
+}
+
+/* Cancel callback for ollama_interpret_speculative() */
+static int ticket_stale(void *arg) {
+    spec_ticket_t *ticket = arg;
+    int stale;
+
+    pthread_mutex_lock(&spec_state.mutex);
+    stale = !spec_state.running || ticket->slot->generation != ticket->generation;
+    pthread_mutex_unlock(&spec_state.mutex);
+    return stale || fair_queue_preempted(&ticket->turn);
+}
+
+/* Earliest pending slot that is due; *next gets the nearest future deadline */
+static spec_slot_t *next_due_slot(struct timespec *next, int *have_next) {
+    struct timespec now;
+    spec_slot_t *due = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *have_next = 0;
+    for (int i = 0; i < SPECULATION_SLOTS; i++) {
+        spec_slot_t *slot = &spec_state.slots[i];
+        if (slot->state != SPEC_PENDING) continue;
+        if (!timespec_before(&now, &slot->not_before)) {
+            if (!due || timespec_before(&slot->not_before, &due->not_before)) {
+                due = slot;
+            }
+        } else if (!*have_next || timespec_before(&slot->not_before, next)) {
+            *next = slot->not_before;
+            *have_next = 1;
+        }
+    }
+    return due;
+}
+
+static void *speculation_worker(void *arg) {
+    char command[SPECULATION_TEXT_SIZE];
+    char context[SPECULATION_TEXT_SIZE];
+    char result[SPECULATION_TEXT_SIZE];
+    (void)arg;
+
+    pthread_mutex_lock(&spec_state.mutex);
+    while (spec_state.running) {
+        struct timespec next;
+        int have_next;
+        spec_slot_t *slot = next_due_slot(&next, &have_next);
+
+        if (!slot) {
+            if (have_next) {
+                pthread_cond_timedwait(&spec_state.work_cond, &spec_state.mutex, &next);
+            } else {
+                pthread_cond_wait(&spec_state.work_cond, &spec_state.mutex);
+            }
+            continue;
+        }
+
+        spec_ticket_t ticket = { slot, slot->generation, { 0 } };
+        uid_t uid = slot->uid;
+        int charge = !slot->charged;
+        strcpy(command, slot->command);
+        strcpy(context, slot->context);
+        slot->state = SPEC_RUNNING;
+        pthread_mutex_unlock(&spec_state.mutex);
+
+        /* Charged to the user who submitted it, one token per command
+         * however often it is preempted and retried */
+        int code = -4;
+        int admitted = fair_queue_try_acquire(uid, FAIR_QUEUE_BACKGROUND, charge, &ticket.turn);
+        if (admitted == FAIR_QUEUE_GRANTED) {
+            code = ollama_interpret_speculative(command, context, result, sizeof(result),
+                                                ticket_stale, &ticket);
+            fair_queue_release(&ticket.turn);
+        } else if (admitted == FAIR_QUEUE_RATE_LIMITED) {
+            code = -1;  /* a miss: the interpret is refused on its own */
+        }
+        arena_reset(NULL);
+
+        pthread_mutex_lock(&spec_state.mutex);
+        if (slot->generation != ticket.generation) {
+            continue; /* superseded or cancelled while running */
+        }
+        if (admitted == FAIR_QUEUE_GRANTED) {
+            slot->charged = 1;
+        }
+        if (code == -4) {
+            /* Backend busy with, or wanted by, a real request; try again
+             * shortly */
+            slot->state = SPEC_PENDING;
+            deadline_after_ms(&slot->not_before, SPECULATION_RETRY_MS);
+            continue;
+        }
+
+        strcpy(slot->result, code == 0 || code == -2 || code == -3 ? result : "");
+        slot->result_code = code;
+        slot->state = SPEC_DONE;
+        slot->finished = time(NULL);
+        pthread_cond_broadcast(&spec_state.done_cond);
+        speculation_log("Speculation: [%s] '%s' -> %d\n", slot->session, command, code);
+    }
+    pthread_mutex_unlock(&spec_state.mutex);
+
+    return NULL;
+}
+
+int speculation_init(void) {
+    pthread_condattr_t attr;
+
+    /* Debounce deadlines are monotonic, the worker's condvar must match */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&spec_state.work_cond);
+    pthread_cond_init(&spec_state.work_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    spec_state.running = 1;
+    if (pthread_create(&spec_state.worker, NULL, speculation_worker, NULL) != 0) {
+        speculation_log("Speculation: Failed to start worker thread\n");
+        spec_state.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void speculation_cleanup(void) {
+    pthread_mutex_lock(&spec_state.mutex);
+    if (!spec_state.running) {
+        pthread_mutex_unlock(&spec_state.mutex);
+        return;
+    }
+    spec_state.running = 0;
+    pthread_cond_broadcast(&spec_state.work_cond);
+    pthread_cond_broadcast(&spec_state.done_cond);
+    pthread_mutex_unlock(&spec_state.mutex);
+
+    pthread_join(spec_state.worker, NULL);
+}
+
+/*
+ * Queue COMMAND for speculative interpretation in SESSION, on behalf of
+ * UID (whose share of the backend it uses). Returns 0 if it
+ * was queued (superseding anything older), 1 if the session already has it
+ * queued, running or cached, and -1 if speculation is unavailable. An empty
+ * COMMAND cancels the session's speculation.
+ */
+int speculation_submit(uid_t uid, const char *session, const char *command, const char *context) {
+    char normalized[SPECULATION_TEXT_SIZE];
+    spec_slot_t *slot;
+    time_t now = time(NULL);
+    int ret = 0;
+
+    if (!session || !command) return -1;
+    normalize_command(command, normalized, sizeof(normalized));
+
+    pthread_mutex_lock(&spec_state.mutex);
+    if (!spec_state.running) {
+        pthread_mutex_unlock(&spec_state.mutex);
+        return -1;
+    }
+
+    slot = find_slot(session);
+    if (!normalized[0]) {
+        if (slot) slot_reset(slot);
+        pthread_mutex_unlock(&spec_state.mutex);
+        return 0;
+    }
+
+    if (slot && slot->state != SPEC_EMPTY && strcmp(slot->command, normalized) == 0 &&
+        strcmp(slot->context, context ? context : "") == 0 &&
+        (slot->state != SPEC_DONE || now - slot->finished < SPECULATION_TTL)) {
+        ret = 1;
+    } else {
+        if (slot) {
+            slot_reset(slot);
+        } else {
+            slot = claim_slot(session);
+        }
+        strcpy(slot->command, normalized);
+        slot->uid = uid;
+        strncpy(slot->context, context ? context : "", sizeof(slot->context) - 1);
+        slot->context[sizeof(slot->context) - 1] = '\0';
+        slot->state = SPEC_PENDING;
+        deadline_after_ms(&slot->not_before, SPECULATION_DEBOUNCE_MS);
+        pthread_cond_signal(&spec_state.work_cond);
+    }
+    slot->last_used = now;
+    pthread_mutex_unlock(&spec_state.mutex);
+
+    return ret;
+}
+
+/*
+ * Answer an interactive interpret from the session's speculation. Returns 0
+ * with the result in OUT and the interpret result code in *CODE on a hit,
+ * waiting for a matching in-flight speculation if needed. Returns -1 on a
+ * miss, after cancelling whatever the session had queued so the interactive
+ * request gets the backend to itself.
+ */
+int speculation_take(const char *session, const char *command, const char *context,
+                     char *out, size_t out_size, int *code) {
+    char normalized[SPECULATION_TEXT_SIZE];
+    spec_slot_t *slot;
+    int ret = -1;
+
+    if (!session || !command || !out || out_size == 0 || !code) return -1;
+    normalize_command(command, normalized, sizeof(normalized));
+
+    pthread_mutex_lock(&spec_state.mutex);
+    slot = find_slot(session);
+    if (!slot || slot->state == SPEC_EMPTY) {
+        pthread_mutex_unlock(&spec_state.mutex);
+        return -1;
+    }
+
+    if (strcmp(slot->command, normalized) == 0 &&
+        strcmp(slot->context, context ? context : "") == 0) {
+        if (slot->state == SPEC_RUNNING) {
+            unsigned long generation = slot->generation;
+            struct timespec deadline;
+
+            deadline_timespec(&deadline, deadline_budget_ns(SPECULATION_WAIT_SEC * 1000000000LL));
+            while (spec_state.running && slot->generation == generation &&
+                   slot->state == SPEC_RUNNING) {
+                if (pthread_cond_timedwait(&spec_state.done_cond, &spec_state.mutex, &deadline) != 0) {
+                    break;
+                }
+            }
+        }
+        if (slot->state == SPEC_DONE && time(NULL) - slot->finished < SPECULATION_TTL &&
+            slot->result_code != -1) {
+            strncpy(out, slot->result, out_size - 1);
+            out[out_size - 1] = '\0';
+            *code = slot->result_code;
+            slot->last_used = time(NULL);
+            ret = 0;
+        }
+    }
+
+    if (ret != 0 && slot->state != SPEC_DONE) {
+        slot_reset(slot);
+    }
+    pthread_mutex_unlock(&spec_state.mutex);
+
+    return ret;
+}
+
+/* Forget a session when its connection goes away */
+void speculation_end_session(const char *session) {
+    spec_slot_t *slot;
+
+    if (!session) return;
+    pthread_mutex_lock(&spec_state.mutex);
+    slot = find_slot(session);
+    if (slot) {
+        slot_reset(slot);
+        slot->session[0] = '\0';
+    }
+    pthread_mutex_unlock(&spec_state.mutex);
+}
@@ -0,0 +1,413 @@
+/*
+ * Request Tracing for AI-OS
+ * File: userspace/daemon/trace.c
+ *
+ * A client that wants a request traced sends a "trace_id" (32 lowercase
+ * hex digits) with it. handle_client_request() opens a root span for the
+ * request on its thread and every stage timed through metrics.c (context,
+ * speculation, prompt, mutex wait, HTTP, parse, execute, serialize) becomes
+ * a child span, and so do the model load, prompt evaluation and generation
+ * phases Ollama reports for its generate calls. Spans go into a fixed-size
+ * ring owned by the recording thread, so tracing costs a clock read and a
+ * copy per stage; untraced requests cost a thread-local check. The
+ * trace_export action writes every buffered span as Chrome trace JSON
+ * (chrome://tracing, Perfetto) or as an OTLP/JSON ExportTraceServiceRequest
+ * under AI_OS_TRACE_DIR.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../ai_os_common.h"
+#include "../ai_os_log.h"
+
+#define TRACE_BUFFER_SPANS 512      /* per thread; oldest overwritten */
+#define TRACE_MAX_BUFFERS 64        /* threads beyond this are not traced */
+#define TRACE_LABEL_SIZE 24
+
+typedef struct {
+    char trace_id[AI_OS_TRACE_ID_LEN + 1];
+    unsigned long long span_id;
+    unsigned long long parent_id;   /* 0 for the request's root span */
+    const char *name;               /* static; NULL for a root span */
+    char action[TRACE_LABEL_SIZE];  /* root span only */
+    char status[TRACE_LABEL_SIZE];
+    char model[TRACE_LABEL_SIZE];   /* Ollama phases only */
+    long long tokens;               /* Ollama phases only; -1 if not counted */
+    long long start_ns;             /* CLOCK_MONOTONIC */
+    long long dur_ns;
+} trace_span_t;
+
+/* Buffers live as long as the process: a thread's key destructor may
+ * release one at any time */
+typedef struct trace_buffer {
+    pthread_mutex_t mutex;          /* owner vs. exporter; never contended otherwise */
+    pid_t tid;
+    int in_use;
+    unsigned long written;          /* spans ever recorded */
+    trace_span_t spans[TRACE_BUFFER_SPANS];
+    struct trace_buffer *next;
+} trace_buffer_t;
+
+static struct {
+    pthread_mutex_t mutex;          /* buffer list */
+    pthread_key_t key;
+    pthread_once_t once;
+    trace_buffer_t *buffers;
+    int buffer_count;
+    unsigned long long next_span;
+    unsigned long long span_salt;
+    unsigned int exports;
+} trace_state = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+/* The request this thread is serving, if it is traced */
+static __thread struct {
+    int active;
+    char trace_id[AI_OS_TRACE_ID_LEN + 1];
+    unsigned long long root_id;
+    trace_buffer_t *buffer;
+} current;
+
+/* Logging utility */
+static ai_os_log_sink_t log_sink = AI_OS_LOG_SINK("/var/log/ai-os/trace.log", 0);
+static void trace_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ai_os_logv(&log_sink, AI_OS_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+static void buffer_release(void *buffer) {
+    trace_buffer_t *b = buffer;
+    pthread_mutex_lock(&trace_state.mutex);
+    b->in_use = 0;
+    pthread_mutex_unlock(&trace_state.mutex);
+}
+
+static void trace_once(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    trace_state.span_salt = ((unsigned long long)ts.tv_sec << 32) ^ (unsigned long long)ts.tv_nsec ^
+                            ((unsigned long long)getpid() << 16);
+    pthread_key_create(&trace_state.key, buffer_release);
+}
+
+/* This thread's span buffer: a released one if any (its old spans stay
+ * exportable until overwritten), else a new one */
+static trace_buffer_t *thread_buffer(void) {
+    trace_buffer_t *b;
+
+    pthread_once(&trace_state.once, trace_once);
+    b = pthread_getspecific(trace_state.key);
+    if (b) {
+        return b;
+    }
+
+    pthread_mutex_lock(&trace_state.mutex);
+    for (b = trace_state.buffers; b && b->in_use; b = b->next) {
+    }
+    if (!b && trace_state.buffer_count < TRACE_MAX_BUFFERS) {
+        b = calloc(1, sizeof(*b));
+        if (b) {
+            pthread_mutex_init(&b->mutex, NULL);
+            b->next = trace_state.buffers;
+            trace_state.buffers = b;
+            trace_state.buffer_count++;
+        }
+    }
+    if (b) {
+        b->in_use = 1;
+        b->tid = (pid_t)syscall(SYS_gettid);
+    }
+    pthread_mutex_unlock(&trace_state.mutex);
+
+    if (b) {
+        pthread_setspecific(trace_state.key, b);
+    }
+    return b;
+}
+
+static unsigned long long new_span_id(void) {
+    unsigned long long n = __atomic_add_fetch(&trace_state.next_span, 1, __ATOMIC_RELAXED);
+    /* splitmix64, so ids look random to OTLP tools and are never 0 */
+    unsigned long long z = (n + trace_state.span_salt) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+static void record(const trace_span_t *span) {
+    trace_buffer_t *b = current.buffer;
+
+    pthread_mutex_lock(&b->mutex);
+    b->spans[b->written % TRACE_BUFFER_SPANS] = *span;
+    b->written++;
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/* Copy S into a span label, keeping only characters safe to emit in JSON */
+static void copy_label(char *dst, const char *s) {
+    size_t n = 0;
+    for (; s && *s && n < TRACE_LABEL_SIZE - 1; s++) {
+        char c = *s;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' ||
+            c == '.' || c == ':' || c == '/') {
+            dst[n++] = c;
+        }
+    }
+    dst[n] = '\0';
+}
+
+int trace_valid_id(const char *trace_id) {
+    size_t n = 0;
+    int nonzero = 0;
+    if (!trace_id) return 0;
+    for (; trace_id[n]; n++) {
+        char c = trace_id[n];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return 0;
+        if (c != '0') nonzero = 1;
+    }
+    return n == AI_OS_TRACE_ID_LEN && nonzero;
+}
+
+/* Start tracing the request this thread is about to serve. Returns 0 when
+ * it is traced; an absent or malformed id leaves it untraced. */
+int trace_begin(const char *trace_id) {
+    current.active = 0;
+    if (!trace_valid_id(trace_id)) {
+        return -1;
+    }
+    current.buffer = thread_buffer();
+    if (!current.buffer) {
+        return -1;
+    }
+    memcpy(current.trace_id, trace_id, AI_OS_TRACE_ID_LEN + 1);
+    current.root_id = new_span_id();
+    current.active = 1;
+    return 0;
+}
+
+/* A stage of the current request that just took ELAPSED_NS */
+static void record_child(const char *name, long long start_ns, long long dur_ns,
+                         const char *model, long long tokens) {
+    trace_span_t span = {0};
+    memcpy(span.trace_id, current.trace_id, sizeof(span.trace_id));
+    span.span_id = new_span_id();
+    span.parent_id = current.root_id;
+    span.name = name;
+    copy_label(span.model, model);
+    span.tokens = tokens;
+    span.start_ns = start_ns;
+    span.dur_ns = dur_ns;
+    record(&span);
+}
+
+void trace_stage(const char *name, long long elapsed_ns) {
+    if (!current.active) {
+        return;
+    }
+    record_child(name, metrics_now_ns() - elapsed_ns, elapsed_ns, NULL, -1);
+}
+
+/* Ollama's phases of the generate call whose reply arrived at END_NS,
+ * laid end to end from the start of its total_duration */
+void trace_ollama(const char *model, const struct ollama_timings *timings, long long end_ns) {
+    if (!current.active || timings->total_ns <= 0) {
+        return;
+    }
+    long long start_ns = end_ns - timings->total_ns;
+    record_child("ollama_load", start_ns, timings->load_ns, model, -1);
+    start_ns += timings->load_ns;
+    record_child("ollama_prompt_eval", start_ns, timings->prompt_eval_ns, model, timings->prompt_eval_count);
+    start_ns += timings->prompt_eval_ns;
+    record_child("ollama_eval", start_ns, timings->eval_ns, model, timings->eval_count);
+}
+
+/* Close the root span of the current request, begun at START_NS */
+void trace_end(const char *action, const char *status, long long start_ns) {
+    if (!current.active) {
+        return;
+    }
+
+    trace_span_t span = {0};
+    memcpy(span.trace_id, current.trace_id, sizeof(span.trace_id));
+    span.span_id = current.root_id;
+    copy_label(span.action, action);
+    copy_label(span.status, status);
+    span.start_ns = start_ns;
+    span.dur_ns = metrics_now_ns() - start_ns;
+    record(&span);
+    current.active = 0;
+}
+
+/* ---- export ---- */
+
+typedef struct {
+    pid_t tid;
+    trace_span_t span;
+} export_span_t;
+
+/* Snapshot every buffer; *COUNT spans, oldest first per thread */
+static export_span_t *collect(size_t *count) {
+    export_span_t *out = NULL;
+    size_t n = 0, cap = 0;
+
+    pthread_mutex_lock(&trace_state.mutex);
+    for (trace_buffer_t *b = trace_state.buffers; b; b = b->next) {
+        pthread_mutex_lock(&b->mutex);
+        unsigned long kept = b->written < TRACE_BUFFER_SPANS ? b->written : TRACE_BUFFER_SPANS;
+        if (n + kept > cap) {
+            size_t new_cap = cap ? cap : TRACE_BUFFER_SPANS;
+            while (new_cap < n + kept) new_cap *= 2;
+            export_span_t *grown = realloc(out, new_cap * sizeof(*out));
+            if (!grown) {
+                pthread_mutex_unlock(&b->mutex);
+                break;
+            }
+            out = grown;
+            cap = new_cap;
+        }
+        for (unsigned long i = b->written - kept; i < b->written; i++) {
+            out[n].tid = b->tid;
+            out[n].span = b->spans[i % TRACE_BUFFER_SPANS];
+            n++;
+        }
+        pthread_mutex_unlock(&b->mutex);
+    }
+    pthread_mutex_unlock(&trace_state.mutex);
+
+    *count = n;
+    return out;
+}
+
+static const char *span_name(const trace_span_t *span) {
+    return span->name ? span->name : span->action[0] ? span->action : "request";
+}
+
+static void write_chrome(FILE *fp, const export_span_t *spans, size_t count) {
+    pid_t pid = getpid();
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"service\":\"ai-os-daemon\"},\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"ai-os-daemon\"}}",
+            (int)pid);
+    for (size_t i = 0; i < count; i++) {
+        const trace_span_t *s = &spans[i].span;
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"trace_id\":\"%s\",\"span_id\":\"%016llx\"",
+                span_name(s), s->parent_id ? "stage" : "request",
+                s->start_ns / 1000.0, s->dur_ns / 1000.0, (int)pid, (int)spans[i].tid,
+                s->trace_id, s->span_id);
+        if (s->parent_id) {
+            fprintf(fp, ",\"parent_span_id\":\"%016llx\"", s->parent_id);
+            if (s->model[0]) {
+                fprintf(fp, ",\"model\":\"%s\"", s->model);
+            }
+            if (s->tokens >= 0) {
+                fprintf(fp, ",\"tokens\":%lld", s->tokens);
+            }
+        } else {
+            fprintf(fp, ",\"action\":\"%s\",\"status\":\"%s\"", s->action, s->status);
+        }
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n]}\n");
+}
+
+static void write_otlp(FILE *fp, const export_span_t *spans, size_t count) {
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    long long offset = ((long long)real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+
+    fprintf(fp, "{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+                "{\"key\":\"service.name\",\"value\":{\"stringValue\":\"ai-os-daemon\"}},"
+                "{\"key\":\"process.pid\",\"value\":{\"intValue\":\"%d\"}}]},"
+                "\"scopeSpans\":[{\"scope\":{\"name\":\"ai-os\"},\"spans\":[", (int)getpid());
+    for (size_t i = 0; i < count; i++) {
+        const trace_span_t *s = &spans[i].span;
+        long long start = s->start_ns + offset;
+        fprintf(fp, "%s\n{\"traceId\":\"%s\",\"spanId\":\"%016llx\",", i ? "," : "", s->trace_id, s->span_id);
+        if (s->parent_id) {
+            fprintf(fp, "\"parentSpanId\":\"%016llx\",", s->parent_id);
+        }
+        fprintf(fp, "\"name\":\"%s\",\"kind\":%d,\"startTimeUnixNano\":\"%lld\",\"endTimeUnixNano\":\"%lld\","
+                    "\"attributes\":[{\"key\":\"thread.id\",\"value\":{\"intValue\":\"%d\"}}",
+                span_name(s), s->parent_id ? 1 : 2, start, start + s->dur_ns, (int)spans[i].tid);
+        if (!s->parent_id) {
+            fprintf(fp, ",{\"key\":\"ai_os.action\",\"value\":{\"stringValue\":\"%s\"}}"
+                        ",{\"key\":\"ai_os.status\",\"value\":{\"stringValue\":\"%s\"}}",
+                    s->action, s->status);
+        }
+        if (s->model[0]) {
+            fprintf(fp, ",{\"key\":\"ai_os.model\",\"value\":{\"stringValue\":\"%s\"}}", s->model);
+        }
+        if (s->parent_id && s->tokens >= 0) {
+            fprintf(fp, ",{\"key\":\"ai_os.tokens\",\"value\":{\"intValue\":\"%lld\"}}", s->tokens);
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n]}]}]}\n");
+}
+
+/* Write every buffered span to a new file under AI_OS_TRACE_DIR in FORMAT
+ * ("chrome" or "otlp"). Returns the span count with the file name in PATH,
+ * or -1. */
+int trace_export(const char *format, char *path, size_t path_size) {
+    int otlp;
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    if (!format || !*format || strcmp(format, "chrome") == 0) {
+        otlp = 0;
+    } else if (strcmp(format, "otlp") == 0) {
+        otlp = 1;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mkdir(AI_OS_TRACE_DIR, 0755) != 0 && errno != EEXIST) {
+        trace_log("Trace: cannot create %s: %s\n", AI_OS_TRACE_DIR, strerror(errno));
+        return -1;
+    }
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(path, path_size, "%s/ai-os-trace-%s-%u%s", AI_OS_TRACE_DIR, stamp,
+             __atomic_add_fetch(&trace_state.exports, 1, __ATOMIC_RELAXED), otlp ? ".otlp.json" : ".json");
+
+    size_t count;
+    export_span_t *spans = collect(&count);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        trace_log("Trace: cannot write %s: %s\n", path, strerror(errno));
+        free(spans);
+        return -1;
+    }
+    if (otlp) {
+        write_otlp(fp, spans, count);
+    } else {
+        write_chrome(fp, spans, count);
+    }
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        trace_log("Trace: writing %s failed\n", path);
+        free(spans);
+        return -1;
+    }
+    free(spans);
+
+    trace_log("Trace: exported %zu spans to %s\n", count, path);
+    return (int)count;
+}
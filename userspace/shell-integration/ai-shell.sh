@@ -77,6 +77,66 @@ check_ai_daemon() {
     return 0
 }
 
+# Loadable builtin (ai_os.so): talks to the daemon from inside the shell
+# process, zero forks per prompt. Falls back to the co-process below.
+AI_OS_BUILTIN_PATH="${AI_OS_BUILTIN_PATH:-/usr/local/lib/ai-os/ai_os.so}"
+AI_OS_BUILTIN=0
+if [ -n "$BASH_VERSION" ] && [ -f "$AI_OS_BUILTIN_PATH" ] && enable -f "$AI_OS_BUILTIN_PATH" ai 2>/dev/null; then
+    AI_OS_BUILTIN=1
+fi
+
+# Persistent ai-client co-process (bash): one daemon connection per shell,
+# no fork+exec per prompt. See serve_mode() in ai-client.c for the framing.
+AI_OS_REQUEST_SEQ=0
+AI_OS_REPLY=""
+
+ai_os_coproc_start() {
+    [ -n "$BASH_VERSION" ] || return 1
+    command -v ai-client >/dev/null 2>&1 || return 1
+    # Redirect hides the job notice interactive shells print for coproc
+    { coproc AI_OS_COPROC { exec ai-client --serve 2>/dev/null; }; } 2>/dev/null
+    [ -n "$AI_OS_COPROC_PID" ]
+}
+
+ai_os_coproc_stop() {
+    if [ -n "$AI_OS_COPROC_PID" ]; then
+        kill "$AI_OS_COPROC_PID" 2>/dev/null
+        wait "$AI_OS_COPROC_PID" 2>/dev/null
+    fi
+    unset AI_OS_COPROC_PID
+}
+
+# ai_os_request <action> <text>: result in $AI_OS_REPLY, status as ai-client's exit code
+ai_os_request() {
+    local action="$1" text="${2//$'\n'/ }" reply id
+    text="${text//$'\t'/ }"
+    if [ "$AI_OS_BUILTIN" = "1" ]; then
+        case "$action" in
+            interpret|classify|status)
+                builtin ai "$action" ${text:+"$text"}
+                return
+                ;;
+        esac
+    fi
+    if { [ -n "$AI_OS_COPROC_PID" ] && kill -0 "$AI_OS_COPROC_PID" 2>/dev/null; } || ai_os_coproc_start; then
+        AI_OS_REQUEST_SEQ=$((AI_OS_REQUEST_SEQ + 1))
+        if printf '%s\t%s\t%s\n' "$AI_OS_REQUEST_SEQ" "$action" "$text" >&"${AI_OS_COPROC[1]}" 2>/dev/null; then
+            # Skip replies left over from an interrupted request
+            while IFS= read -r -d '' reply <&"${AI_OS_COPROC[0]}"; do
+                id="${reply%%$'\t'*}"
+                reply="${reply#*$'\t'}"
+                if [ "$id" = "$AI_OS_REQUEST_SEQ" ]; then
+                    AI_OS_REPLY="${reply#*$'\t'}"
+                    return "${reply%%$'\t'*}"
+                fi
+            done
+        fi
+        log_msg "ai-client co-process died, falling back to one process per request"
+        ai_os_coproc_stop
+    fi
+    AI_OS_REPLY=$(ai-client "$action" "$text" 2>/dev/null)
+}
+
 # Function to compute Jaccard index between two strings
 jaccard_index() {
     local str1="$1"
@@ -141,8 +201,9 @@ ai() {
     echo "DEBUG: Classification result: $classification"
     echo "DEBUG: AI_OS_AUTO_EXECUTE = $AI_OS_AUTO_EXECUTE"
     if [ "$classification" = "command" ]; then
-        interpreted_command=$(ai-client interpret "$natural_command" 2>/dev/null)
+        ai_os_request interpret "$natural_command"
         local exit_code=$?
+        interpreted_command="$AI_OS_REPLY"
         echo "DEBUG: ai-client interpret exit code: $exit_code"
         echo "DEBUG: interpreted_command = '$interpreted_command'"
         case $exit_code in
@@ -188,7 +249,8 @@ ai() {
         esac
     elif [ "$classification" = "chat" ]; then
         # Use ai-client chat or fallback to echo
-        local chat_response=$(ai-client chat "$natural_command" 2>/dev/null)
+        ai_os_request chat "$natural_command"
+        local chat_response="$AI_OS_REPLY"
         if [ -z "$chat_response" ]; then
             chat_response="[AI-OS] $natural_command"
         fi
@@ -196,14 +258,16 @@ ai() {
         log_msg "Chat: $natural_command -> $chat_response"
     else
         # Stage 2: AI-based classification
-        local ai_class=$(ai-client classify "$natural_command" 2>/dev/null)
+        ai_os_request classify "$natural_command"
+        local ai_class="$AI_OS_REPLY"
         echo "DEBUG: AI classification result: $ai_class"
         if [ "$ai_class" = "command" ]; then
             # Save as command pattern
             save_command_pattern "$natural_command"
             # Interpret and execute the command directly
-            interpreted_command=$(ai-client interpret "$natural_command" 2>/dev/null)
+            ai_os_request interpret "$natural_command"
             local exit_code=$?
+            interpreted_command="$AI_OS_REPLY"
             echo "DEBUG: ai-client interpret exit code: $exit_code"
             echo "DEBUG: interpreted_command = '$interpreted_command'"
             case $exit_code in
@@ -250,7 +314,8 @@ ai() {
         elif [ "$ai_class" = "chat" ]; then
             # Save as chat pattern
             save_chat_pattern "$natural_command"
-            local chat_response=$(ai-client chat "$natural_command" 2>/dev/null)
+            ai_os_request chat "$natural_command"
+            local chat_response="$AI_OS_REPLY"
             if [ -z "$chat_response" ]; then
                 chat_response="[AI-OS] $natural_command"
             fi
@@ -318,8 +383,11 @@ preexec() {
         echo "AI-OS: Detected complex command, interpreting..."
         log_msg "Detected complex command: $command"
         # Get interpretation
-        local interpreted=$(ai-client interpret "$command" 2>/dev/null)
-        if [ $? -eq 0 ] && [ -n "$interpreted" ]; then
+        local interpreted
+        ai_os_request interpret "$command"
+        local result=$?
+        interpreted="$AI_OS_REPLY"
+        if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
             echo "AI-OS: Interpreted as: $interpreted"
             log_msg "Complex command interpreted as: $interpreted"
             if [ "$AI_OS_CONFIRMATION" = "1" ]; then
@@ -356,8 +424,11 @@ if [ -n "$BASH_VERSION" ]; then
             echo "AI-OS: Detected complex command, interpreting..."
             log_msg "Detected complex command: $command"
             # Get interpretation
-            local interpreted=$(ai-client interpret "$command" 2>/dev/null)
-            if [ $? -eq 0 ] && [ -n "$interpreted" ]; then
+            local interpreted
+            ai_os_request interpret "$command"
+            local result=$?
+            interpreted="$AI_OS_REPLY"
+            if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
                 echo "AI-OS: Interpreted as: $interpreted"
                 log_msg "Complex command interpreted as: $interpreted"
                 if [ "$AI_OS_CONFIRMATION" = "1" ]; then
@@ -412,6 +483,20 @@ ai-confirm-off() {
     echo "AI-OS: Confirmation prompts disabled"
     log_msg "Confirmation disabled"
 }
+ai-speculate-on() {
+    if [ "$AI_OS_BUILTIN" != "1" ]; then
+        echo "AI-OS: Speculative interpretation needs the ai_os.so builtin"
+        return 1
+    fi
+    builtin ai watch on
+    echo "AI-OS: Speculative interpretation enabled"
+    log_msg "Speculation enabled"
+}
+ai-speculate-off() {
+    [ "$AI_OS_BUILTIN" = "1" ] && builtin ai watch off
+    echo "AI-OS: Speculative interpretation disabled"
+    log_msg "Speculation disabled"
+}
 ai-status() {
     echo "AI-OS Status:"
     echo "  Enabled: $AI_OS_ENABLED"
@@ -433,8 +518,12 @@ AI-OS Shell Integration Commands:
   ai-auto-off          - Disable automatic execution
   ai-confirm-on        - Enable confirmation prompts
   ai-confirm-off       - Disable confirmation prompts
+  ai-speculate-on      - Interpret the line being typed once you pause
+  ai-speculate-off     - Only interpret after Enter
   ai-status            - Show AI-OS status
   ai-help              - Show this help
+  Ctrl-X Ctrl-A        - Replace the current line with its interpretation
+                         (needs the ai_os.so builtin)
 
 Examples:
   ai "git push and add all files"
@@ -445,12 +534,26 @@ EOF
 
 # Initialize
 if check_ai_daemon > /dev/null 2>&1; then
+    # Start the co-process now so command_not_found_handle's subshell inherits it
+    [ "$AI_OS_BUILTIN" = "1" ] || ai_os_coproc_start
     echo "AI-OS: Shell integration loaded. Type 'ai-help' for usage information."
 else
     echo "AI-OS: Shell integration loaded, but daemon is not running."
     echo "AI-OS: Start daemon with 'sudo systemctl start ai-os'"
 fi
 
+# Ctrl-X Ctrl-A: replace the current line with its interpretation
+if [ "$AI_OS_BUILTIN" = "1" ] && [[ $- == *i* ]]; then
+    bind -x '"\C-x\C-a": builtin ai complete' 2>/dev/null
+fi
+
+# Speculative interpretation: the builtin watches the line being edited and
+# starts interpreting it once typing pauses, so Enter usually finds the
+# answer ready. AI_OS_SPECULATE=0 turns it off.
+if [ "$AI_OS_BUILTIN" = "1" ] && [[ $- == *i* ]] && [ "${AI_OS_SPECULATE:-1}" = "1" ]; then
+    builtin ai watch on
+fi
+
 # Tab completion for ai command
 if [ -n "$BASH_VERSION" ]; then
     _ai_completion() {
@@ -16,6 +16,66 @@ log_msg() {
 AI_OS_DIRECT_MODE=1
 AI_OS_THRESHOLD=3  # Minimum words to trigger AI interpretation
 
+# Loadable builtin (ai_os.so): talks to the daemon from inside the shell
+# process, zero forks per prompt. Falls back to the co-process below.
+AI_OS_BUILTIN_PATH="${AI_OS_BUILTIN_PATH:-/usr/local/lib/ai-os/ai_os.so}"
+AI_OS_BUILTIN=0
+if [ -n "$BASH_VERSION" ] && [ -f "$AI_OS_BUILTIN_PATH" ] && enable -f "$AI_OS_BUILTIN_PATH" ai 2>/dev/null; then
+    AI_OS_BUILTIN=1
+fi
+
+# Persistent ai-client co-process (bash): one daemon connection per shell,
+# no fork+exec per prompt. See serve_mode() in ai-client.c for the framing.
+AI_OS_REQUEST_SEQ=0
+AI_OS_REPLY=""
+
+ai_os_coproc_start() {
+    [ -n "$BASH_VERSION" ] || return 1
+    command -v ai-client >/dev/null 2>&1 || return 1
+    # Redirect hides the job notice interactive shells print for coproc
+    { coproc AI_OS_COPROC { exec ai-client --serve 2>/dev/null; }; } 2>/dev/null
+    [ -n "$AI_OS_COPROC_PID" ]
+}
+
+ai_os_coproc_stop() {
+    if [ -n "$AI_OS_COPROC_PID" ]; then
+        kill "$AI_OS_COPROC_PID" 2>/dev/null
+        wait "$AI_OS_COPROC_PID" 2>/dev/null
+    fi
+    unset AI_OS_COPROC_PID
+}
+
+# ai_os_request <action> <text>: result in $AI_OS_REPLY, status as ai-client's exit code
+ai_os_request() {
+    local action="$1" text="${2//$'\n'/ }" reply id
+    text="${text//$'\t'/ }"
+    if [ "$AI_OS_BUILTIN" = "1" ]; then
+        case "$action" in
+            interpret|classify|status)
+                builtin ai "$action" ${text:+"$text"}
+                return
+                ;;
+        esac
+    fi
+    if { [ -n "$AI_OS_COPROC_PID" ] && kill -0 "$AI_OS_COPROC_PID" 2>/dev/null; } || ai_os_coproc_start; then
+        AI_OS_REQUEST_SEQ=$((AI_OS_REQUEST_SEQ + 1))
+        if printf '%s\t%s\t%s\n' "$AI_OS_REQUEST_SEQ" "$action" "$text" >&"${AI_OS_COPROC[1]}" 2>/dev/null; then
+            # Skip replies left over from an interrupted request
+            while IFS= read -r -d '' reply <&"${AI_OS_COPROC[0]}"; do
+                id="${reply%%$'\t'*}"
+                reply="${reply#*$'\t'}"
+                if [ "$id" = "$AI_OS_REQUEST_SEQ" ]; then
+                    AI_OS_REPLY="${reply#*$'\t'}"
+                    return "${reply%%$'\t'*}"
+                fi
+            done
+        fi
+        log_msg "ai-client co-process died, falling back to one process per request"
+        ai_os_coproc_stop
+    fi
+    AI_OS_REPLY=$(ai-client "$action" "$text" 2>/dev/null)
+}
+
 # Function to detect if a command looks like natural language
 is_natural_language() {
     local cmd="$1"
@@ -47,8 +107,9 @@ command_not_found_handle() {
         log_msg "Interpreting: $full_command (command_not_found_handle)"
         # Get interpretation from AI
         local interpreted
-        interpreted=$(ai-client interpret "$full_command" 2>/dev/null)
+        ai_os_request interpret "$full_command"
         local result=$?
+        interpreted="$AI_OS_REPLY"
         if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
             echo "💡 Interpreted as: $interpreted"
             log_msg "Interpreted: $full_command -> $interpreted"
@@ -96,8 +157,9 @@ command_not_found_handler() {
         echo "🤖 Interpreting: $full_command"
         log_msg "Interpreting: $full_command (command_not_found_handler)"
         local interpreted
-        interpreted=$(ai-client interpret "$full_command" 2>/dev/null)
+        ai_os_request interpret "$full_command"
         local result=$?
+        interpreted="$AI_OS_REPLY"
         if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
             echo "💡 Interpreted as: $interpreted"
             log_msg "Interpreted: $full_command -> $interpreted"
@@ -149,8 +211,9 @@ if [ -n "$BASH_VERSION" ]; then
             echo "🤖 Intercepting: $cmd"
             log_msg "Intercepting: $cmd (bash preexec)"
             local interpreted
-            interpreted=$(ai-client interpret "$cmd" 2>/dev/null)
+            ai_os_request interpret "$cmd"
             local result=$?
+            interpreted="$AI_OS_REPLY"
             if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
                 echo "💡 Interpreted as: $interpreted"
                 log_msg "Interpreted: $cmd -> $interpreted"
@@ -201,8 +264,9 @@ if [ -n "$ZSH_VERSION" ]; then
             echo "🤖 Intercepting: $cmd"
             log_msg "Intercepting: $cmd (zsh preexec)"
             local interpreted
-            interpreted=$(ai-client interpret "$cmd" 2>/dev/null)
+            ai_os_request interpret "$cmd"
             local result=$?
+            interpreted="$AI_OS_REPLY"
             if [ $result -eq 0 ] && [ -n "$interpreted" ]; then
                 echo "💡 Interpreted as: $interpreted"
                 log_msg "Interpreted: $cmd -> $interpreted"
@@ -302,6 +366,8 @@ REQUIREMENTS:
 - Commands must be 3+ words to trigger AI interpretation
 - Must contain natural language patterns (and, with, show, etc.)
 - AI-OS daemon must be running
+- With the ai_os.so builtin, lines are interpreted in the background as
+  soon as you pause typing (set AI_OS_SPECULATE=0 to disable)
 
 SAFETY:
 - Dangerous commands are blocked by AI safety filters
@@ -313,12 +379,19 @@ EOF
 
 # Initialize
 if command -v ai-client >/dev/null 2>&1; then
+    # Start the co-process now so command_not_found_handle's subshell inherits it
+    [ "$AI_OS_BUILTIN" = "1" ] || ai_os_coproc_start
     echo "🤖 Direct AI mode loaded!"
     echo "💬 Type 'direct-ai-help' for usage instructions"
     
     # Enable by default
     direct-ai-enable
     direct-ai-auto-off  # Safe mode by default
+    
+    # Start interpreting a line once typing pauses (AI_OS_SPECULATE=0 disables)
+    if [ "$AI_OS_BUILTIN" = "1" ] && [[ $- == *i* ]] && [ "${AI_OS_SPECULATE:-1}" = "1" ]; then
+        builtin ai watch on
+    fi
 else
     echo "⚠️  AI-OS client not found. Install AI-OS first."
 fi
\ No newline at end of file